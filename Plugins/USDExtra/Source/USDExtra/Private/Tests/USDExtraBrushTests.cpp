@@ -0,0 +1,387 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraUtils.h"
+
+#include "Engine/Polys.h"
+#include "HAL/PlatformTime.h"
+#include "Materials/Material.h"
+#include "MeshDescription.h"
+#include "Misc/AutomationTest.h"
+#include "Math/RandomStream.h"
+#include "Model.h"
+#include "StaticMeshAttributes.h"
+#include "UObject/Package.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace USDExtraBrushTestsImpl
+{
+	/** Brush model with a grid of NumQuadsX by NumQuadsY quads of Spacing units, whose corners are shared by up to four polys */
+	UModel* CreateGridBrush(int32 NumQuadsX, int32 NumQuadsY, float Spacing, const FVector3f& Offset)
+	{
+		UModel* Model = NewObject<UModel>(GetTransientPackage());
+		Model->Initialize(nullptr, true);
+
+		Model->Polys->Element.Reserve(NumQuadsX * NumQuadsY);
+		for (int32 X = 0; X < NumQuadsX; ++X)
+		{
+			for (int32 Y = 0; Y < NumQuadsY; ++Y)
+			{
+				FPoly Poly;
+				Poly.Init();
+				Poly.Vertices.Add(Offset + FVector3f(X * Spacing, Y * Spacing, 0.0f));
+				Poly.Vertices.Add(Offset + FVector3f(X * Spacing, (Y + 1) * Spacing, 0.0f));
+				Poly.Vertices.Add(Offset + FVector3f((X + 1) * Spacing, (Y + 1) * Spacing, 0.0f));
+				Poly.Vertices.Add(Offset + FVector3f((X + 1) * Spacing, Y * Spacing, 0.0f));
+				Poly.Normal = FVector3f(0.0f, 0.0f, 1.0f);
+				Poly.Base = Poly.Vertices[0];
+				Poly.TextureU = FVector3f(1.0f, 0.0f, 0.0f);
+				Poly.TextureV = FVector3f(0.0f, 1.0f, 0.0f);
+				Model->Polys->Element.Add(Poly);
+			}
+		}
+
+		return Model;
+	}
+
+	/** Converts Model to a mesh description, returning the number of welded vertices and the time it took in seconds */
+	int32 WeldBrush(const UModel* Model, double& OutSeconds)
+	{
+		FMeshDescription MeshDescription;
+		FStaticMeshAttributes(MeshDescription).Register();
+		TArray<FStaticMaterial> Materials;
+
+		const double StartTime = FPlatformTime::Seconds();
+		UUSDExtraUtils::GetMeshDescriptionFromBrush(nullptr, Model, MeshDescription, Materials);
+		OutSeconds = FPlatformTime::Seconds() - StartTime;
+
+		return MeshDescription.Vertices().Num();
+	}
+
+	/**
+	 * Brush model of NumQuads by NumQuads quads split in triangles, on a terrain of flat terraces, slopes and noise,
+	 * so that polys link in groups of every size. Bands of quads alternate between two materials.
+	 */
+	UModel* CreateTriangulatedBrush(int32 NumQuads)
+	{
+		UModel* Model = NewObject<UModel>(GetTransientPackage());
+		Model->Initialize(nullptr, true);
+
+		UMaterialInterface* Materials[] = { nullptr, UMaterial::GetDefaultMaterial(MD_Surface) };
+		FRandomStream Random(NumQuads);
+
+		TArray<float> Heights;
+		Heights.SetNum((NumQuads + 1) * (NumQuads + 1));
+		for (int32 X = 0; X <= NumQuads; ++X)
+		{
+			for (int32 Y = 0; Y <= NumQuads; ++Y)
+			{
+				float& Height = Heights[X * (NumQuads + 1) + Y];
+				switch ((X / 8) % 3)
+				{
+				case 0:
+					Height = (X / 8) * 32.0f;
+					break;
+				case 1:
+					Height = X * 4.0f + Y * 2.0f;
+					break;
+				default:
+					Height = Random.FRandRange(0.0f, 64.0f);
+					break;
+				}
+			}
+		}
+
+		const auto GetCorner = [&Heights, NumQuads](int32 X, int32 Y)
+		{
+			return FVector3f(X * 16.0f, Y * 16.0f, Heights[X * (NumQuads + 1) + Y]);
+		};
+
+		Model->Polys->Element.Reserve(NumQuads * NumQuads * 2);
+		for (int32 X = 0; X < NumQuads; ++X)
+		{
+			for (int32 Y = 0; Y < NumQuads; ++Y)
+			{
+				const FVector3f Triangles[2][3] = {
+					{ GetCorner(X, Y), GetCorner(X, Y + 1), GetCorner(X + 1, Y + 1) },
+					{ GetCorner(X, Y), GetCorner(X + 1, Y + 1), GetCorner(X + 1, Y) } };
+
+				for (const FVector3f (&Triangle)[3] : Triangles)
+				{
+					FPoly Poly;
+					Poly.Init();
+					Poly.Vertices.Append(Triangle, 3);
+					Poly.Material = Materials[(Y / 16) % 2];
+					Poly.TextureU = FVector3f(1.0f, 0.0f, 0.0f);
+					Poly.TextureV = FVector3f(0.0f, 1.0f, 0.0f);
+					Poly.Base = Poly.Vertices[0];
+					if (Poly.CalcNormal(true) == 0)
+					{
+						Model->Polys->Element.Add(Poly);
+					}
+				}
+			}
+		}
+
+		return Model;
+	}
+
+	/** The pairwise linking BSPValidateBrush did before bucketing its polys */
+	TArray<int32> LinkPolysPairwise(const UModel* Model)
+	{
+		const TArray<FPoly>& Polys = Model->Polys->Element;
+
+		TArray<int32> Links;
+		Links.SetNum(Polys.Num());
+		for (int32 i = 0; i < Polys.Num(); i++)
+		{
+			Links[i] = i;
+		}
+
+		for (int32 i = 0; i < Polys.Num(); i++)
+		{
+			const FPoly& EdPoly = Polys[i];
+			if (Links[i] != i)
+			{
+				continue;
+			}
+
+			for (int32 j = i + 1; j < Polys.Num(); j++)
+			{
+				const FPoly& OtherPoly = Polys[j];
+				if
+				(	Links[j] == j
+				&&	OtherPoly.Material == EdPoly.Material
+				&&	OtherPoly.TextureU == EdPoly.TextureU
+				&&	OtherPoly.TextureV == EdPoly.TextureV
+				&&	OtherPoly.PolyFlags == EdPoly.PolyFlags
+				&&	(OtherPoly.Normal | EdPoly.Normal) > 0.9999 )
+				{
+					const float Dist = FVector::PointPlaneDist(FVector3d(OtherPoly.Vertices[0]), FVector3d(EdPoly.Vertices[0]), FVector3d(EdPoly.Normal));
+					if (Dist > -0.001 && Dist < 0.001)
+					{
+						Links[j] = i;
+					}
+				}
+			}
+		}
+
+		return Links;
+	}
+
+	/** Runs BSPValidateBrush on Model, returning the iLink of each poly */
+	TArray<int32> LinkPolys(UModel* Model)
+	{
+		UUSDExtraUtils::BSPValidateBrush(Model, true, false);
+
+		TArray<int32> Links;
+		Links.Reserve(Model->Polys->Element.Num());
+		for (const FPoly& Poly : Model->Polys->Element)
+		{
+			Links.Add(Poly.iLink);
+		}
+		return Links;
+	}
+
+	/** Fields of a poly of CreateLinkCaseBrush, each of which can keep it from linking to polys that only differ by it */
+	struct FLinkCase
+	{
+		UMaterialInterface* Material = nullptr;
+		uint32 PolyFlags = 0;
+		FVector3f TextureU = FVector3f(1.0f, 0.0f, 0.0f);
+		float PlaneOffset = 0.0f;
+		float TiltDegrees = 0.0f;
+		FVector2f Location = FVector2f::ZeroVector;
+	};
+
+	/** Triangle at Location in the plane through (0, 0, PlaneOffset) tilted by TiltDegrees around the X axis */
+	FPoly MakeLinkCasePoly(const FLinkCase& Case)
+	{
+		const FQuat4f Tilt(FVector3f(1.0f, 0.0f, 0.0f), FMath::DegreesToRadians(Case.TiltDegrees));
+		const FVector3f Corners[] = { FVector3f(0.0f, 0.0f, 0.0f), FVector3f(0.0f, 8.0f, 0.0f), FVector3f(8.0f, 8.0f, 0.0f) };
+
+		FPoly Poly;
+		Poly.Init();
+		for (const FVector3f& Corner : Corners)
+		{
+			Poly.Vertices.Add(Tilt.RotateVector(Corner + FVector3f(Case.Location, 0.0f)) + FVector3f(0.0f, 0.0f, Case.PlaneOffset));
+		}
+		Poly.Material = Case.Material;
+		Poly.PolyFlags = Case.PolyFlags;
+		Poly.TextureU = Case.TextureU;
+		Poly.TextureV = FVector3f(0.0f, 1.0f, 0.0f);
+		Poly.Base = Poly.Vertices[0];
+		Poly.CalcNormal(true);
+		return Poly;
+	}
+
+	UModel* CreateBrush(const TArray<FPoly>& Polys)
+	{
+		UModel* Model = NewObject<UModel>(GetTransientPackage());
+		Model->Initialize(nullptr, true);
+		Model->Polys->Element = Polys;
+		return Model;
+	}
+
+	/**
+	 * Brush with a poly for every combination of two materials, two sets of flags, two texture axes, plane offsets on both sides
+	 * of the 0.001 distance tolerance, and tilts on both sides of the 0.9999 normal tolerance, in shuffled order
+	 */
+	UModel* CreateLinkCaseBrush()
+	{
+		UMaterialInterface* Materials[] = { nullptr, UMaterial::GetDefaultMaterial(MD_Surface) };
+		const uint32 PolyFlags[] = { 0, PF_TwoSided };
+		const FVector3f TextureUs[] = { FVector3f(1.0f, 0.0f, 0.0f), FVector3f(2.0f, 0.0f, 0.0f) };
+		const float PlaneOffsets[] = { 0.0f, 0.0004f, 0.0009f, 0.0011f, 0.002f, 0.5f, 16.0f };
+		const float Tilts[] = { 0.0f, 0.3f, 1.0f, 45.0f };
+
+		TArray<FPoly> Polys;
+		int32 LocationIndex = 0;
+		for (UMaterialInterface* Material : Materials)
+		for (const uint32 Flags : PolyFlags)
+		for (const FVector3f& TextureU : TextureUs)
+		for (const float PlaneOffset : PlaneOffsets)
+		for (const float Tilt : Tilts)
+		{
+			FLinkCase Case;
+			Case.Material = Material;
+			Case.PolyFlags = Flags;
+			Case.TextureU = TextureU;
+			Case.PlaneOffset = PlaneOffset;
+			Case.TiltDegrees = Tilt;
+			Case.Location = FVector2f((LocationIndex % 16) * 16.0f, (LocationIndex / 16) * 16.0f);
+			Polys.Add(MakeLinkCasePoly(Case));
+			++LocationIndex;
+		}
+
+		FRandomStream Random(Polys.Num());
+		for (int32 Index = Polys.Num() - 1; Index > 0; --Index)
+		{
+			Polys.Swap(Index, Random.RandRange(0, Index));
+		}
+
+		return CreateBrush(Polys);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUSDExtraBrushVertexWeldTest, "USDExtra.Brush.VertexWeld", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FUSDExtraBrushVertexWeldTest::RunTest(const FString& Parameters)
+{
+	using namespace USDExtraBrushTestsImpl;
+
+	// Far from the origin the cell coordinates of the welder no longer fit in 32 bits
+	const FVector3f Offsets[] = { FVector3f::ZeroVector, FVector3f(-250000.0f, 250000.0f, 200000.0f) };
+	for (const FVector3f& Offset : Offsets)
+	{
+		double Seconds = 0.0;
+		const int32 NumVertices = WeldBrush(CreateGridBrush(20, 20, 16.0f, Offset), Seconds);
+		TestEqual(FString::Printf(TEXT("Welded vertices of a brush at %s"), *Offset.ToString()), NumVertices, 21 * 21);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUSDExtraBrushVertexWeldPerfTest, "USDExtra.Brush.VertexWeldPerf", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FUSDExtraBrushVertexWeldPerfTest::RunTest(const FString& Parameters)
+{
+	using namespace USDExtraBrushTestsImpl;
+
+	// Micro-benchmark over 10k to 100k polys, only reported so that machine load never fails the run
+	const int32 GridSizes[] = { 100, 224, 317 };
+	for (const int32 GridSize : GridSizes)
+	{
+		double Seconds = 0.0;
+		const int32 NumVertices = WeldBrush(CreateGridBrush(GridSize, GridSize, 16.0f, FVector3f::ZeroVector), Seconds);
+		TestEqual(FString::Printf(TEXT("Welded vertices of a %d polys brush"), GridSize * GridSize), NumVertices, (GridSize + 1) * (GridSize + 1));
+
+		AddInfo(FString::Printf(TEXT("Welded %d polys in %.3f s, %.3f us per poly"), GridSize * GridSize, Seconds, Seconds * 1.0e6 / (GridSize * GridSize)));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUSDExtraBrushPolyLinkTest, "USDExtra.Brush.PolyLink", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FUSDExtraBrushPolyLinkTest::RunTest(const FString& Parameters)
+{
+	using namespace USDExtraBrushTestsImpl;
+
+	const auto TestPairwiseLinks = [this](const TCHAR* What, UModel* Model)
+	{
+		const TArray<int32> ExpectedLinks = LinkPolysPairwise(Model);
+		const TArray<int32> Links = LinkPolys(Model);
+		TestEqual(FString::Printf(TEXT("Polys of the %s"), What), Links.Num(), ExpectedLinks.Num());
+
+		int32 NumMismatches = 0;
+		for (int32 Index = 0; Index < FMath::Min(Links.Num(), ExpectedLinks.Num()); ++Index)
+		{
+			if (Links[Index] != ExpectedLinks[Index] && NumMismatches++ < 10)
+			{
+				AddError(FString::Printf(TEXT("Poly %d of the %s is linked to %d instead of %d"), Index, What, Links[Index], ExpectedLinks[Index]));
+			}
+		}
+		TestEqual(FString::Printf(TEXT("Polys of the %s linked differently than pairwise"), What), NumMismatches, 0);
+	};
+
+	// About 8k triangles, as many as the pairwise reference links in a reasonable time
+	TestPairwiseLinks(TEXT("triangulated brush"), CreateTriangulatedBrush(64));
+	TestPairwiseLinks(TEXT("link case brush"), CreateLinkCaseBrush());
+
+	// Each field the bucketing groups or quantizes polys by, on its own
+	struct FPairCase
+	{
+		const TCHAR* What;
+		FLinkCase Other;
+		bool bLinked;
+	};
+
+	FLinkCase Other;
+	Other.Location = FVector2f(32.0f, 0.0f);
+	const FLinkCase Base;
+
+	TArray<FPairCase> PairCases;
+	PairCases.Add({ TEXT("Identical coplanar polys"), Other, true });
+	{
+		FLinkCase Case = Other;
+		Case.Material = UMaterial::GetDefaultMaterial(MD_Surface);
+		PairCases.Add({ TEXT("Polys with different materials"), Case, false });
+	}
+	{
+		FLinkCase Case = Other;
+		Case.PolyFlags = PF_TwoSided;
+		PairCases.Add({ TEXT("Polys with different flags"), Case, false });
+	}
+	{
+		FLinkCase Case = Other;
+		Case.TextureU = FVector3f(2.0f, 0.0f, 0.0f);
+		PairCases.Add({ TEXT("Polys with different texture axes"), Case, false });
+	}
+	{
+		FLinkCase Case = Other;
+		Case.PlaneOffset = 0.0005f;
+		PairCases.Add({ TEXT("Polys offset within the plane tolerance"), Case, true });
+	}
+	{
+		FLinkCase Case = Other;
+		Case.PlaneOffset = 0.002f;
+		PairCases.Add({ TEXT("Polys offset past the plane tolerance"), Case, false });
+	}
+	{
+		FLinkCase Case = Other;
+		Case.PlaneOffset = 1.0f;
+		PairCases.Add({ TEXT("Parallel polys"), Case, false });
+	}
+
+	for (const FPairCase& PairCase : PairCases)
+	{
+		const TArray<int32> Links = LinkPolys(CreateBrush({ MakeLinkCasePoly(Base), MakeLinkCasePoly(PairCase.Other) }));
+		TestEqual(PairCase.What, Links[1], PairCase.bLinked ? 0 : 1);
+	}
+
+	return true;
+}
+
+#endif // #if WITH_DEV_AUTOMATION_TESTS
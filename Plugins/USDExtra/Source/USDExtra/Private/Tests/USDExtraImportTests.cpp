@@ -0,0 +1,359 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraUtils.h"
+
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS && USE_USD_SDK
+#include "USDMemory.h"
+#include "USDTypesConversion.h"
+
+#include "USDIncludesStart.h"
+	#include "pxr/usd/sdf/attributeSpec.h"
+	#include "pxr/usd/sdf/layer.h"
+	#include "pxr/usd/sdf/types.h"
+	#include "pxr/usd/usd/attribute.h"
+	#include "pxr/usd/usd/editTarget.h"
+	#include "pxr/usd/usd/stage.h"
+	#include "pxr/usd/usdGeom/scope.h"
+	#include "pxr/usd/usdGeom/xform.h"
+#include "USDIncludesEnd.h"
+
+namespace USDExtraImportTestsImpl
+{
+	/** Op the traversal should compile for a prim, in plan order */
+	struct FExpectedOp
+	{
+		FString PrimPath;
+		FString ParentPath;
+		int32 NumDescendants;
+	};
+
+	void DefineImportPrim(const pxr::UsdStageRefPtr& Stage, const std::string& Path, const pxr::TfToken& PrimUsage, const pxr::TfToken& ConversionMethod = USDExtraTokensType::Modify)
+	{
+		const pxr::UsdPrim UsdPrim = pxr::UsdGeomXform::Define(Stage, pxr::SdfPath(Path)).GetPrim();
+		UsdPrim.CreateAttribute(USDExtraIdentifiers::UnrealPrimUsage, pxr::SdfValueTypeNames->Token).Set(PrimUsage);
+		UsdPrim.CreateAttribute(USDExtraIdentifiers::UnrealConversionMethod, pxr::SdfValueTypeNames->Token).Set(ConversionMethod);
+	}
+
+	/**
+	 * Stage of a folder of actors, an actor at the root, and ignored actors and components whose subtrees are pruned.
+	 * Below /Root/Folder/ActorB is a chain of ChainDepth nested components, deep enough that the scopes of its prims
+	 * are only right if every post visit pops the scope its pre visit pushed.
+	 */
+	TUsdStore<pxr::UsdStageRefPtr> CreateStage(int32 ChainDepth)
+	{
+		FScopedUsdAllocs Allocs;
+
+		const pxr::UsdStageRefPtr Stage = pxr::UsdStage::CreateInMemory();
+		Stage->SetDefaultPrim(pxr::UsdGeomXform::Define(Stage, pxr::SdfPath("/Root")).GetPrim());
+
+		const pxr::UsdPrim Folder = pxr::UsdGeomScope::Define(Stage, pxr::SdfPath("/Root/Folder")).GetPrim();
+		Folder.CreateAttribute(USDExtraIdentifiers::UnrealPrimUsage, pxr::SdfValueTypeNames->Token).Set(USDExtraTokensType::Folder);
+		Folder.CreateAttribute(USDExtraIdentifiers::UnrealActorFolderPath, pxr::SdfValueTypeNames->String).Set(std::string("Folder"));
+
+		DefineImportPrim(Stage, "/Root/Folder/ActorA", USDExtraTokensType::Actor);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/ComponentA", USDExtraTokensType::Component);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/ComponentA/ComponentAA", USDExtraTokensType::Component);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/IgnoredComponent", USDExtraTokensType::Component, USDExtraTokensType::Ignore);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/IgnoredComponent/Component", USDExtraTokensType::Component);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/DataPrim", USDExtraTokensType::Data);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/DataPrim/Component", USDExtraTokensType::Component);
+		DefineImportPrim(Stage, "/Root/Folder/ActorA/ComponentB", USDExtraTokensType::Component);
+
+		DefineImportPrim(Stage, "/Root/Folder/ActorB", USDExtraTokensType::Actor);
+		std::string ChainPath = "/Root/Folder/ActorB";
+		for (int32 Depth = 0; Depth < ChainDepth; ++Depth)
+		{
+			ChainPath += "/Chain";
+			DefineImportPrim(Stage, ChainPath, USDExtraTokensType::Component);
+		}
+
+		DefineImportPrim(Stage, "/Root/ActorC", USDExtraTokensType::Actor);
+		DefineImportPrim(Stage, "/Root/ActorC/Component", USDExtraTokensType::Component);
+
+		DefineImportPrim(Stage, "/Root/IgnoredActor", USDExtraTokensType::Actor, USDExtraTokensType::Ignore);
+		DefineImportPrim(Stage, "/Root/IgnoredActor/Component", USDExtraTokensType::Component);
+
+		return Stage;
+	}
+
+	TArray<FExpectedOp> GetExpectedOps(int32 ChainDepth)
+	{
+		TArray<FExpectedOp> ExpectedOps = {
+			{ TEXT("/Root/Folder"), FString(), 6 + ChainDepth },
+			{ TEXT("/Root/Folder/ActorA"), TEXT("/Root/Folder"), 3 },
+			{ TEXT("/Root/Folder/ActorA/ComponentA"), TEXT("/Root/Folder/ActorA"), 1 },
+			{ TEXT("/Root/Folder/ActorA/ComponentA/ComponentAA"), TEXT("/Root/Folder/ActorA/ComponentA"), 0 },
+			{ TEXT("/Root/Folder/ActorA/ComponentB"), TEXT("/Root/Folder/ActorA"), 0 },
+			{ TEXT("/Root/Folder/ActorB"), TEXT("/Root/Folder"), ChainDepth } };
+
+		FString ChainPath = TEXT("/Root/Folder/ActorB");
+		for (int32 Depth = 0; Depth < ChainDepth; ++Depth)
+		{
+			const FString ParentPath = ChainPath;
+			ChainPath += TEXT("/Chain");
+			ExpectedOps.Add({ ChainPath, ParentPath, ChainDepth - Depth - 1 });
+		}
+
+		ExpectedOps.Add({ TEXT("/Root/ActorC"), FString(), 1 });
+		ExpectedOps.Add({ TEXT("/Root/ActorC/Component"), TEXT("/Root/ActorC"), 0 });
+		return ExpectedOps;
+	}
+
+	void SetInstanceReference(const pxr::UsdStageRefPtr& Stage, const std::string& Path, const std::string& InstanceReference)
+	{
+		Stage->OverridePrim(pxr::SdfPath(Path)).CreateAttribute(USDExtraIdentifiers::UnrealInstanceReference, pxr::SdfValueTypeNames->String).Set(InstanceReference);
+	}
+
+	USDExtraToUnreal::FImportPlan CompileStage(const pxr::UsdStageRefPtr& Stage)
+	{
+		TArray<TUsdStore<pxr::UsdPrim>> RootPrims;
+		{
+			FScopedUsdAllocs Allocs;
+
+			for (const pxr::UsdPrim& UsdPrim : Stage->GetDefaultPrim().GetChildren())
+			{
+				RootPrims.Add(UsdPrim);
+			}
+		}
+
+		USDExtraToUnreal::FReferenceCache ReferenceCache;
+		ReferenceCache.Tables.Read(Stage);
+		return USDExtraToUnreal::CompileImportPlan(Stage, RootPrims, USDExtraToUnreal::FImportScope(), ReferenceCache);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUSDExtraImportTraversalTest, "USDExtra.Import.Traversal", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FUSDExtraImportTraversalTest::RunTest(const FString& Parameters)
+{
+	using namespace USDExtraImportTestsImpl;
+	using FImportPlan = USDExtraToUnreal::FImportPlan;
+
+	constexpr int32 ChainDepth = 256;
+	const TUsdStore<pxr::UsdStageRefPtr> Stage = CreateStage(ChainDepth);
+	const FImportPlan Plan = CompileStage(Stage.Get());
+	const TArray<FExpectedOp> ExpectedOps = GetExpectedOps(ChainDepth);
+
+	// Ops come in prim order, each under the op of its parent prim
+	if (TestEqual(TEXT("Number of ops"), Plan.Ops.Num(), ExpectedOps.Num()))
+	{
+		for (int32 OpIndex = 0; OpIndex < ExpectedOps.Num(); ++OpIndex)
+		{
+			const FImportPlan::FOp& Op = Plan.Ops[OpIndex];
+			const FExpectedOp& ExpectedOp = ExpectedOps[OpIndex];
+			if (!TestEqual(FString::Printf(TEXT("Prim of op %d"), OpIndex), Op.PrimPath, ExpectedOp.PrimPath))
+			{
+				break;
+			}
+
+			const FString ParentPath = Plan.Ops.IsValidIndex(Op.ParentIndex) ? Plan.Ops[Op.ParentIndex].PrimPath : FString();
+			TestEqual(FString::Printf(TEXT("Parent of %s"), *Op.PrimPath), ParentPath, ExpectedOp.ParentPath);
+			TestEqual(FString::Printf(TEXT("Descendants of %s"), *Op.PrimPath), Op.NumDescendants, ExpectedOp.NumDescendants);
+		}
+
+		TestTrue(TEXT("Type of the folder op"), Plan.Ops[0].Type == FImportPlan::EOpType::Folder);
+		TestTrue(TEXT("Type of an actor op in a folder"), Plan.Ops[1].Type == FImportPlan::EOpType::Actor);
+		TestEqual(TEXT("Folder of an actor op in a folder"), Plan.Ops[1].Info.ActorFolderPath.ToString(), FString(TEXT("Folder")));
+		TestTrue(TEXT("Type of a component op"), Plan.Ops[2].Type == FImportPlan::EOpType::Component);
+	}
+
+	// Ignored and data prims are pruned without visiting anything below them
+	TArray<FString> PrunedPrimPaths = Plan.PrunedPrimPaths;
+	PrunedPrimPaths.Sort();
+	const TArray<FString> ExpectedPrunedPrimPaths = { TEXT("/Root/Folder/ActorA/DataPrim"), TEXT("/Root/Folder/ActorA/IgnoredComponent"), TEXT("/Root/IgnoredActor") };
+	TestTrue(FString::Printf(TEXT("Pruned prims %s"), *FString::Join(PrunedPrimPaths, TEXT(", "))), PrunedPrimPaths == ExpectedPrunedPrimPaths);
+	TestEqual(TEXT("Visited prims"), Plan.NumVisitedPrims, ExpectedOps.Num() + ExpectedPrunedPrimPaths.Num());
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUSDExtraImportCompactReferencesTest, "USDExtra.Import.CompactReferences", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FUSDExtraImportCompactReferencesTest::RunTest(const FString& Parameters)
+{
+	using namespace USDExtraImportTestsImpl;
+
+	const std::string Outer = "/Game/Map.Map:PersistentLevel.";
+
+	// Strongest first: an attribute over a compacted prim, a compacted override of an attribute, then the compacted and the plain prims
+	TUsdStore<pxr::UsdStageRefPtr> Stage;
+	TUsdStore<pxr::SdfLayerRefPtr> StrongAttributeLayer;
+	TUsdStore<pxr::SdfLayerRefPtr> StrongCompactLayer;
+	TUsdStore<pxr::SdfLayerRefPtr> CompactLayer;
+	TUsdStore<pxr::SdfLayerRefPtr> AttributeLayer;
+	{
+		FScopedUsdAllocs Allocs;
+
+		StrongAttributeLayer = pxr::SdfLayer::CreateAnonymous("StrongAttributes.usda");
+		StrongCompactLayer = pxr::SdfLayer::CreateAnonymous("StrongCompact.usda");
+		CompactLayer = pxr::SdfLayer::CreateAnonymous("Compact.usda");
+		AttributeLayer = pxr::SdfLayer::CreateAnonymous("Attributes.usda");
+
+		Stage = pxr::UsdStage::CreateInMemory();
+		const pxr::UsdStageRefPtr& UsdStage = Stage.Get();
+		UsdStage->GetRootLayer()->SetSubLayerPaths({
+			StrongAttributeLayer.Get()->GetIdentifier(),
+			StrongCompactLayer.Get()->GetIdentifier(),
+			CompactLayer.Get()->GetIdentifier(),
+			AttributeLayer.Get()->GetIdentifier() });
+		UsdStage->SetDefaultPrim(pxr::UsdGeomXform::Define(UsdStage, pxr::SdfPath("/Root")).GetPrim());
+
+		UsdStage->SetEditTarget(pxr::UsdEditTarget(CompactLayer.Get()));
+		DefineImportPrim(UsdStage, "/Root/CompactOnly", USDExtraTokensType::Actor);
+		SetInstanceReference(UsdStage, "/Root/CompactOnly", Outer + "CompactOnly");
+		DefineImportPrim(UsdStage, "/Root/AttributeOverCompact", USDExtraTokensType::Actor);
+		SetInstanceReference(UsdStage, "/Root/AttributeOverCompact", Outer + "WeakCompact");
+
+		UsdStage->SetEditTarget(pxr::UsdEditTarget(AttributeLayer.Get()));
+		DefineImportPrim(UsdStage, "/Root/AttributesOnly", USDExtraTokensType::Actor);
+		SetInstanceReference(UsdStage, "/Root/AttributesOnly", Outer + "AttributesOnly");
+		DefineImportPrim(UsdStage, "/Root/CompactOverAttribute", USDExtraTokensType::Actor);
+		SetInstanceReference(UsdStage, "/Root/CompactOverAttribute", Outer + "WeakAttribute");
+
+		UsdStage->SetEditTarget(pxr::UsdEditTarget(StrongAttributeLayer.Get()));
+		SetInstanceReference(UsdStage, "/Root/AttributeOverCompact", Outer + "StrongAttribute");
+
+		UsdStage->SetEditTarget(pxr::UsdEditTarget(StrongCompactLayer.Get()));
+		SetInstanceReference(UsdStage, "/Root/CompactOverAttribute", Outer + "StrongCompact");
+	}
+
+	TestEqual(TEXT("Prims compacted in the weak layer"), UnrealToUSDExtra::CompactReferences(CompactLayer.Get(), pxr::SdfPath("/Root")), 2);
+	TestEqual(TEXT("Prims compacted in the strong layer"), UnrealToUSDExtra::CompactReferences(StrongCompactLayer.Get(), pxr::SdfPath("/Root")), 1);
+	{
+		FScopedUsdAllocs Allocs;
+
+		const pxr::SdfPath CompactedAttributePath = pxr::SdfPath("/Root/CompactOnly").AppendProperty(USDExtraIdentifiers::UnrealInstanceReference);
+		TestFalse(TEXT("Compacted attribute left in its layer"), static_cast<bool>(CompactLayer.Get()->GetAttributeAtPath(CompactedAttributePath)));
+	}
+
+	const USDExtraToUnreal::FImportPlan Plan = CompileStage(Stage.Get());
+
+	const TPair<FString, FString> ExpectedReferences[] = {
+		{ TEXT("/Root/CompactOnly"), TEXT("CompactOnly") },
+		{ TEXT("/Root/AttributeOverCompact"), TEXT("StrongAttribute") },
+		{ TEXT("/Root/AttributesOnly"), TEXT("AttributesOnly") },
+		{ TEXT("/Root/CompactOverAttribute"), TEXT("StrongCompact") } };
+	for (const TPair<FString, FString>& ExpectedReference : ExpectedReferences)
+	{
+		const USDExtraToUnreal::FImportPlan::FOp* Op = Plan.Ops.FindByPredicate([&ExpectedReference](const USDExtraToUnreal::FImportPlan::FOp& Candidate)
+		{
+			return Candidate.PrimPath == ExpectedReference.Key;
+		});
+		if (!TestNotNull(FString::Printf(TEXT("Op of %s"), *ExpectedReference.Key), Op))
+		{
+			continue;
+		}
+
+		TestTrue(FString::Printf(TEXT("%s converted as an actor"), *ExpectedReference.Key), Op->Type == USDExtraToUnreal::FImportPlan::EOpType::Actor);
+		TestEqual(FString::Printf(TEXT("Instance reference of %s"), *ExpectedReference.Key), Op->Info.InstanceReference.ToString(), UsdToUnreal::ConvertString(Outer) + ExpectedReference.Value);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUSDExtraImportPlanCacheTest, "USDExtra.Import.PlanCache", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FUSDExtraImportPlanCacheTest::RunTest(const FString& Parameters)
+{
+	using namespace USDExtraImportTestsImpl;
+	using FImportPlan = USDExtraToUnreal::FImportPlan;
+	using FImportPlanCache = USDExtraToUnreal::FImportPlanCache;
+
+	const FString Directory = FPaths::ConvertRelativePathToFull(FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("USDExtraPlanCache")));
+	const FString RootLayerPath = FPaths::Combine(Directory, TEXT("Scene.usda"));
+	const FString SubLayerPath = FPaths::Combine(Directory, TEXT("Actors.usda"));
+	const FString PlanCachePath = FImportPlanCache::GetFilePath(RootLayerPath);
+	IFileManager::Get().DeleteDirectory(*Directory, false, true);
+	IFileManager::Get().MakeDirectory(*Directory, true);
+
+	// A root layer with the default prim, over a sublayer with the actors
+	TUsdStore<pxr::UsdStageRefPtr> Stage;
+	{
+		FScopedUsdAllocs Allocs;
+
+		const pxr::SdfLayerRefPtr SubLayer = pxr::SdfLayer::CreateNew(UnrealToUsd::ConvertString(*SubLayerPath).Get());
+		const pxr::UsdStageRefPtr SubLayerStage = pxr::UsdStage::Open(SubLayer);
+		DefineImportPrim(SubLayerStage, "/Root/Actor", USDExtraTokensType::Actor);
+		DefineImportPrim(SubLayerStage, "/Root/Actor/Component", USDExtraTokensType::Component);
+		SubLayer->Save();
+
+		const pxr::SdfLayerRefPtr RootLayer = pxr::SdfLayer::CreateNew(UnrealToUsd::ConvertString(*RootLayerPath).Get());
+		RootLayer->SetSubLayerPaths({ "./Actors.usda" });
+		const pxr::UsdStageRefPtr RootLayerStage = pxr::UsdStage::Open(RootLayer);
+		RootLayerStage->SetDefaultPrim(pxr::UsdGeomXform::Define(RootLayerStage, pxr::SdfPath("/Root")).GetPrim());
+		RootLayer->Save();
+
+		Stage = pxr::UsdStage::Open(RootLayer);
+	}
+
+	const FImportPlan Plan = CompileStage(Stage.Get());
+	TestEqual(TEXT("Ops compiled from the stage"), Plan.Ops.Num(), 2);
+
+	const auto SavePlan = [this, &Stage, &Plan, &PlanCachePath]()
+	{
+		USDExtraToUnreal::FReferenceCache ReferenceCache;
+		return TestTrue(TEXT("Plan cache saved"), FImportPlanCache::Save(PlanCachePath, Stage.Get(), Plan, ReferenceCache));
+	};
+	const auto LoadPlan = [&PlanCachePath](FImportPlan& OutPlan)
+	{
+		USDExtraToUnreal::FReferenceCache ReferenceCache;
+		return FImportPlanCache::Load(PlanCachePath, false, OutPlan, ReferenceCache);
+	};
+
+	// Replayed while the layers are unchanged
+	if (SavePlan())
+	{
+		FImportPlan CachedPlan;
+		if (TestTrue(TEXT("Plan cache replayed with unchanged layers"), LoadPlan(CachedPlan)) && TestEqual(TEXT("Cached ops"), CachedPlan.Ops.Num(), Plan.Ops.Num()))
+		{
+			for (int32 OpIndex = 0; OpIndex < Plan.Ops.Num(); ++OpIndex)
+			{
+				TestEqual(FString::Printf(TEXT("Prim of cached op %d"), OpIndex), CachedPlan.Ops[OpIndex].PrimPath, Plan.Ops[OpIndex].PrimPath);
+				TestEqual(FString::Printf(TEXT("Parent of cached op %d"), OpIndex), CachedPlan.Ops[OpIndex].ParentIndex, Plan.Ops[OpIndex].ParentIndex);
+			}
+		}
+	}
+
+	// Rejected once a sublayer is edited on disk, without the stage noticing
+	FString SubLayerText;
+	if (TestTrue(TEXT("Sublayer read"), FFileHelper::LoadFileToString(SubLayerText, *SubLayerPath)))
+	{
+		FFileHelper::SaveStringToFile(SubLayerText + TEXT("\n# Edited\n"), *SubLayerPath);
+
+		FImportPlan CachedPlan;
+		TestFalse(TEXT("Plan cache replayed after a sublayer changed"), LoadPlan(CachedPlan));
+	}
+
+	// Rejected when written by another version, which is stored right after the magic number
+	if (SavePlan())
+	{
+		TArray<uint8> Bytes;
+		if (TestTrue(TEXT("Plan cache read"), FFileHelper::LoadFileToArray(Bytes, *PlanCachePath)) && TestTrue(TEXT("Plan cache header"), Bytes.Num() >= 8))
+		{
+			int32 Version = 0;
+			FMemory::Memcpy(&Version, Bytes.GetData() + 4, sizeof(Version));
+			++Version;
+			FMemory::Memcpy(Bytes.GetData() + 4, &Version, sizeof(Version));
+			FFileHelper::SaveArrayToFile(Bytes, *PlanCachePath);
+
+			FImportPlan CachedPlan;
+			TestFalse(TEXT("Plan cache of another version replayed"), LoadPlan(CachedPlan));
+		}
+	}
+
+	{
+		FScopedUsdAllocs Allocs;
+		Stage = pxr::UsdStageRefPtr();
+	}
+	IFileManager::Get().DeleteDirectory(*Directory, false, true);
+
+	return true;
+}
+
+#endif // #if WITH_DEV_AUTOMATION_TESTS && USE_USD_SDK
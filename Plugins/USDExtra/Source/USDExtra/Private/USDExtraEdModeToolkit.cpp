@@ -4,9 +4,11 @@
 #include "USDExtraEdMode.h"
 #include "Engine/Selection.h"
 #include "Widgets/Input/SButton.h"
+#include "Widgets/Input/SCheckBox.h"
 #include "Widgets/Text/STextBlock.h"
 #include "EditorModeManager.h"
 #include "USDExtraUtils.h"
+#include "USDExtraLiveSync.h"
 #include "Widgets\Input\SFilePathPicker.h"
 #include "EditorDirectories.h"
 #include "EditorStyleSet.h"
@@ -73,6 +75,12 @@ void FUSDExtraEdModeToolkit::Init(const TSharedPtr<IToolkitHost>& InitToolkitHos
 				.OnPathPicked(this, &FUSDExtraEdModeToolkit::FilePathPicked)
 			]
 			+ SVerticalBox::Slot()
+			.AutoHeight()
+			.HAlign(HAlign_Fill)
+			[
+				SAssignNew(FolderListBox, SVerticalBox)
+			]
+			+ SVerticalBox::Slot()
 			[
 				SNew(SButton)
 				.OnClicked(this,&FUSDExtraEdModeToolkit::OnImport)
@@ -90,6 +98,15 @@ void FUSDExtraEdModeToolkit::Init(const TSharedPtr<IToolkitHost>& InitToolkitHos
 					.Text(FText::FromString("Export Scene"))
 				]
 			]
+			+ SVerticalBox::Slot()
+			[
+				SNew(SButton)
+				.OnClicked(this,&FUSDExtraEdModeToolkit::OnLiveSync)
+				[
+					SNew(STextBlock)
+					.Text(this, &FUSDExtraEdModeToolkit::GetLiveSyncText)
+				]
+			]
 		];
 		/*+SVerticalBox::Slot()
 		[
@@ -113,6 +130,8 @@ void FUSDExtraEdModeToolkit::Init(const TSharedPtr<IToolkitHost>& InitToolkitHos
 				]
 			]
 		];*/
+
+	RefreshFolders();
 		
 	FModeToolkit::Init(InitToolkitHost);
 }
@@ -135,7 +154,25 @@ FReply FUSDExtraEdModeToolkit::OnImport() const
 	GEditor->GetSelectedActors()->Modify();
 	GEditor->SelectNone(true, true, false);
 
-	UUSDExtraUtils::ImportUSDToLevel(World, FilePath);
+	// Without unchecked folders the stage is opened unmasked, which also imports the prims outside of any folder
+	TArray<FString> PrimPaths;
+	if (FolderItems.ContainsByPredicate([](const TSharedRef<FFolderItem>& Item) { return !Item->bSelected; }))
+	{
+		for (const TSharedRef<FFolderItem>& Item : FolderItems)
+		{
+			if (Item->bSelected)
+			{
+				PrimPaths.Add(Item->PrimPath);
+			}
+		}
+
+		if (PrimPaths.Num() == 0)
+		{
+			return FReply::Handled();
+		}
+	}
+
+	UUSDExtraUtils::ImportUSDToLevel(World, FilePath, FUSDExtraImportRegion(), PrimPaths);
 	
 	UE_LOG(LogTemp, Log, TEXT("USDExtraImport"));
 
@@ -154,6 +191,32 @@ FReply FUSDExtraEdModeToolkit::OnExport() const
 	return FReply::Handled();
 }
 
+FReply FUSDExtraEdModeToolkit::OnLiveSync() const
+{
+	UUSDExtraLiveSyncSubsystem* LiveSync = GEditor->GetEditorSubsystem<UUSDExtraLiveSyncSubsystem>();
+	if (LiveSync->IsLiveSyncing())
+	{
+		LiveSync->StopLiveSync();
+	}
+	else
+	{
+		UWorld* World = GetEditorMode()->GetWorld();
+		check(World)
+
+		GEditor->GetSelectedActors()->Modify();
+		GEditor->SelectNone(true, true, false);
+
+		LiveSync->StartLiveSync(World, FilePath);
+	}
+
+	return FReply::Handled();
+}
+
+FText FUSDExtraEdModeToolkit::GetLiveSyncText() const
+{
+	return FText::FromString(GEditor->GetEditorSubsystem<UUSDExtraLiveSyncSubsystem>()->IsLiveSyncing() ? "Stop Live Sync" : "Start Live Sync");
+}
+
 FString FUSDExtraEdModeToolkit::GetFilePath() const
 {
 	return FilePath;
@@ -162,6 +225,43 @@ FString FUSDExtraEdModeToolkit::GetFilePath() const
 void FUSDExtraEdModeToolkit::FilePathPicked(const FString& PickedPath)
 {
 	FilePath = PickedPath;
+	RefreshFolders();
+}
+
+void FUSDExtraEdModeToolkit::RefreshFolders()
+{
+	FolderItems.Reset();
+	if (!FolderListBox.IsValid())
+	{
+		return;
+	}
+	FolderListBox->ClearChildren();
+
+	if (!FPaths::FileExists(FilePath))
+	{
+		return;
+	}
+
+	for (const FUSDExtraStageFolder& Folder : UUSDExtraUtils::GetStageFolders(FilePath))
+	{
+		TSharedRef<FFolderItem> Item = MakeShared<FFolderItem>();
+		Item->PrimPath = Folder.PrimPath;
+		Item->FolderPath = Folder.FolderPath;
+		FolderItems.Add(Item);
+
+		FolderListBox->AddSlot()
+		.AutoHeight()
+		[
+			SNew(SCheckBox)
+			.IsChecked_Lambda([Item]() { return Item->bSelected ? ECheckBoxState::Checked : ECheckBoxState::Unchecked; })
+			.OnCheckStateChanged_Lambda([Item](ECheckBoxState NewState) { Item->bSelected = NewState == ECheckBoxState::Checked; })
+			.ToolTipText(FText::FromString(Folder.PrimPath))
+			[
+				SNew(STextBlock)
+				.Text(FText::FromString(Folder.FolderPath))
+			]
+		];
+	}
 }
 
 class FEdMode* FUSDExtraEdModeToolkit::GetEditorMode() const
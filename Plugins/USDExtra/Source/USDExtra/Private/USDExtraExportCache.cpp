@@ -0,0 +1,211 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraExportCache.h"
+
+#include "Dom/JsonObject.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/StaticMesh.h"
+#include "Materials/MaterialInterface.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
+#include "Rendering/SkeletalMeshRenderData.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "StaticMeshResources.h"
+#include "USDExtraExportOptions.h"
+#include "USDLog.h"
+
+namespace USDExtraExportCacheImpl
+{
+	const TCHAR* ManifestFileName = TEXT("USDExtraExportCache.json");
+
+	/** Bump whenever the mesh export writes different files from the same inputs, to invalidate every entry */
+	const int32 ManifestVersion = 2;
+
+	void UpdateWithString(FSHA1& Sha, const FString& String)
+	{
+		Sha.UpdateWithString(*String, String.Len());
+		// Separates consecutive strings, so "ab" + "c" doesn't hash like "a" + "bc"
+		const uint8 Separator = 0;
+		Sha.Update(&Separator, sizeof(Separator));
+	}
+
+	FString FinalHash(FSHA1& Sha)
+	{
+		Sha.Final();
+		uint8 Hash[FSHA1::DigestSize];
+		Sha.GetHash(Hash);
+		return BytesToHex(Hash, FSHA1::DigestSize);
+	}
+}
+
+FUSDExtraExportCache::FUSDExtraExportCache(const FString& Directory)
+{
+	using namespace USDExtraExportCacheImpl;
+
+	ManifestPath = FPaths::Combine(Directory, ManifestFileName);
+
+	FString ManifestContent;
+	if (!FFileHelper::LoadFileToString(ManifestContent, *ManifestPath))
+	{
+		return;
+	}
+
+	TSharedPtr<FJsonObject> Manifest;
+	const TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(ManifestContent);
+	if (!FJsonSerializer::Deserialize(Reader, Manifest) || !Manifest.IsValid())
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Ignoring unreadable export cache manifest '%s'"), *ManifestPath);
+		return;
+	}
+
+	int32 Version = 0;
+	const TSharedPtr<FJsonObject>* Assets = nullptr;
+	if (!Manifest->TryGetNumberField(TEXT("Version"), Version) || Version != ManifestVersion || !Manifest->TryGetObjectField(TEXT("Assets"), Assets))
+	{
+		return;
+	}
+
+	for (const TPair<FString, TSharedPtr<FJsonValue>>& Asset : (*Assets)->Values)
+	{
+		const TSharedPtr<FJsonObject>* AssetObject = nullptr;
+		if (!Asset.Value->TryGetObject(AssetObject))
+		{
+			continue;
+		}
+
+		FEntry& Entry = Entries.Add(Asset.Key);
+		(*AssetObject)->TryGetStringField(TEXT("SourceHash"), Entry.SourceHash);
+		(*AssetObject)->TryGetStringField(TEXT("OptionsHash"), Entry.OptionsHash);
+		(*AssetObject)->TryGetStringField(TEXT("File"), Entry.File);
+		(*AssetObject)->TryGetStringField(TEXT("PayloadFile"), Entry.PayloadFile);
+	}
+}
+
+FString FUSDExtraExportCache::HashAssetSource(const UObject* Asset)
+{
+	using namespace USDExtraExportCacheImpl;
+
+	FSHA1 Sha;
+	if (const UStaticMesh* StaticMesh = Cast<UStaticMesh>(Asset))
+	{
+		const FStaticMeshRenderData* RenderData = StaticMesh->GetRenderData();
+		if (!RenderData || RenderData->DerivedDataKey.IsEmpty())
+		{
+			return FString();
+		}
+
+		UpdateWithString(Sha, RenderData->DerivedDataKey);
+		for (const FStaticMaterial& StaticMaterial : StaticMesh->GetStaticMaterials())
+		{
+			UpdateWithString(Sha, StaticMaterial.MaterialSlotName.ToString());
+			UpdateWithString(Sha, StaticMaterial.MaterialInterface ? StaticMaterial.MaterialInterface->GetPathName() : FString());
+		}
+	}
+	else if (const USkeletalMesh* SkeletalMesh = Cast<USkeletalMesh>(Asset))
+	{
+		const FSkeletalMeshRenderData* RenderData = SkeletalMesh->GetResourceForRendering();
+		if (!RenderData || RenderData->DerivedDataKey.IsEmpty())
+		{
+			return FString();
+		}
+
+		UpdateWithString(Sha, RenderData->DerivedDataKey);
+		for (const FSkeletalMaterial& SkeletalMaterial : SkeletalMesh->GetMaterials())
+		{
+			UpdateWithString(Sha, SkeletalMaterial.MaterialSlotName.ToString());
+			UpdateWithString(Sha, SkeletalMaterial.MaterialInterface ? SkeletalMaterial.MaterialInterface->GetPathName() : FString());
+		}
+	}
+	else
+	{
+		return FString();
+	}
+
+	return FinalHash(Sha);
+}
+
+FString FUSDExtraExportCache::HashExportOptions(const UUSDExtraExportOptions& Options, const FString& SceneFileExtension, const FString& PayloadExtension)
+{
+	using namespace USDExtraExportCacheImpl;
+
+	FSHA1 Sha;
+	UpdateWithString(Sha, FString::Printf(TEXT("%d"), ManifestVersion));
+	UpdateWithString(Sha, FString::Printf(TEXT("%d"), static_cast<int32>(Options.StageOptions.UpAxis)));
+	UpdateWithString(Sha, FString::SanitizeFloat(Options.StageOptions.MetersPerUnit));
+	UpdateWithString(Sha, FString::SanitizeFloat(Options.StartTimeCode));
+	UpdateWithString(Sha, FString::SanitizeFloat(Options.EndTimeCode));
+	UpdateWithString(Sha, SceneFileExtension);
+	UpdateWithString(Sha, Options.bUsePayload ? PayloadExtension : FString());
+	return FinalHash(Sha);
+}
+
+bool FUSDExtraExportCache::IsUpToDate(const UObject* Asset, const FString& SourceHash, const FString& OptionsHash, const FString& File) const
+{
+	if (SourceHash.IsEmpty())
+	{
+		return false;
+	}
+
+	const FEntry* Entry = Entries.Find(Asset->GetOutermost()->GetName());
+	return Entry
+		&& Entry->SourceHash == SourceHash
+		&& Entry->OptionsHash == OptionsHash
+		&& Entry->File == File
+		&& FPaths::FileExists(Entry->File)
+		&& (Entry->PayloadFile.IsEmpty() || FPaths::FileExists(Entry->PayloadFile));
+}
+
+void FUSDExtraExportCache::Update(const UObject* Asset, const FString& SourceHash, const FString& OptionsHash, const FString& File, const FString& PayloadFile)
+{
+	const FString PackagePath = Asset->GetOutermost()->GetName();
+	if (SourceHash.IsEmpty())
+	{
+		bDirty |= Entries.Remove(PackagePath) > 0;
+		return;
+	}
+
+	Entries.Add(PackagePath, FEntry{ SourceHash, OptionsHash, File, PayloadFile });
+	bDirty = true;
+}
+
+bool FUSDExtraExportCache::Save()
+{
+	using namespace USDExtraExportCacheImpl;
+
+	if (!bDirty)
+	{
+		return true;
+	}
+
+	TSharedRef<FJsonObject> Assets = MakeShared<FJsonObject>();
+	for (const TPair<FString, FEntry>& Entry : Entries)
+	{
+		TSharedRef<FJsonObject> AssetObject = MakeShared<FJsonObject>();
+		AssetObject->SetStringField(TEXT("SourceHash"), Entry.Value.SourceHash);
+		AssetObject->SetStringField(TEXT("OptionsHash"), Entry.Value.OptionsHash);
+		AssetObject->SetStringField(TEXT("File"), Entry.Value.File);
+		if (!Entry.Value.PayloadFile.IsEmpty())
+		{
+			AssetObject->SetStringField(TEXT("PayloadFile"), Entry.Value.PayloadFile);
+		}
+		Assets->SetObjectField(Entry.Key, AssetObject);
+	}
+
+	TSharedRef<FJsonObject> Manifest = MakeShared<FJsonObject>();
+	Manifest->SetNumberField(TEXT("Version"), ManifestVersion);
+	Manifest->SetObjectField(TEXT("Assets"), Assets);
+
+	FString ManifestContent;
+	const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&ManifestContent);
+	if (!FJsonSerializer::Serialize(Manifest, Writer) || !FFileHelper::SaveStringToFile(ManifestContent, *ManifestPath))
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Failed to write export cache manifest '%s'"), *ManifestPath);
+		return false;
+	}
+
+	bDirty = false;
+	return true;
+}
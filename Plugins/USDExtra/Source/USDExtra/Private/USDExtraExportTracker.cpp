@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraExportTracker.h"
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "Misc/TransactionObjectEvent.h"
+#include "UObject/UObjectGlobals.h"
+
+void UUSDExtraExportTrackerSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	if (GEngine)
+	{
+		GEngine->OnLevelActorAdded().AddUObject(this, &UUSDExtraExportTrackerSubsystem::HandleActorAdded);
+		GEngine->OnLevelActorDeleted().AddUObject(this, &UUSDExtraExportTrackerSubsystem::HandleActorDeleted);
+	}
+	FCoreUObjectDelegates::OnObjectModified.AddUObject(this, &UUSDExtraExportTrackerSubsystem::HandleObjectModified);
+	FCoreUObjectDelegates::OnObjectTransacted.AddUObject(this, &UUSDExtraExportTrackerSubsystem::HandleObjectTransacted);
+	FWorldDelegates::OnWorldCleanup.AddUObject(this, &UUSDExtraExportTrackerSubsystem::HandleWorldCleanup);
+}
+
+void UUSDExtraExportTrackerSubsystem::Deinitialize()
+{
+	if (GEngine)
+	{
+		GEngine->OnLevelActorAdded().RemoveAll(this);
+		GEngine->OnLevelActorDeleted().RemoveAll(this);
+	}
+	FCoreUObjectDelegates::OnObjectModified.RemoveAll(this);
+	FCoreUObjectDelegates::OnObjectTransacted.RemoveAll(this);
+	FWorldDelegates::OnWorldCleanup.RemoveAll(this);
+
+	WorldExports.Empty();
+
+	Super::Deinitialize();
+}
+
+const FUSDExtraExportRecord* UUSDExtraExportTrackerSubsystem::FindRecord(UWorld* World, const FString& RootLayerPath) const
+{
+	const FWorldExport* WorldExport = WorldExports.Find(World);
+	if (WorldExport && WorldExport->RootLayerPath == RootLayerPath)
+	{
+		return &WorldExport->Record;
+	}
+	return nullptr;
+}
+
+void UUSDExtraExportTrackerSubsystem::SetRecord(UWorld* World, const FString& RootLayerPath, FUSDExtraExportRecord&& Record)
+{
+	check(World)
+
+	FWorldExport& WorldExport = WorldExports.FindOrAdd(World);
+	WorldExport.RootLayerPath = RootLayerPath;
+	WorldExport.Record = MoveTemp(Record);
+	WorldExport.DirtyActors.Empty();
+	WorldExport.DeletedActorPaths.Empty();
+}
+
+FUSDExtraExportChanges UUSDExtraExportTrackerSubsystem::GetChanges(UWorld* World) const
+{
+	FUSDExtraExportChanges Changes;
+	if (const FWorldExport* WorldExport = WorldExports.Find(World))
+	{
+		for (const TPair<TWeakObjectPtr<AActor>, FString>& DirtyActor : WorldExport->DirtyActors)
+		{
+			if (AActor* Actor = DirtyActor.Key.Get())
+			{
+				Changes.DirtyActors.Add(Actor, DirtyActor.Value);
+			}
+		}
+		Changes.DeletedActorPaths = WorldExport->DeletedActorPaths;
+	}
+	return Changes;
+}
+
+void UUSDExtraExportTrackerSubsystem::HandleObjectModified(UObject* Object)
+{
+	// Called before every change made through the editor, so return as early as possible
+	if (WorldExports.Num() == 0 || !Object)
+	{
+		return;
+	}
+
+	AActor* Actor = Cast<AActor>(Object);
+	if (!Actor)
+	{
+		Actor = Object->GetTypedOuter<AActor>();
+	}
+	MarkActorDirty(Actor);
+}
+
+void UUSDExtraExportTrackerSubsystem::HandleObjectTransacted(UObject* Object, const FTransactionObjectEvent& Event)
+{
+	// Undo and redo restore objects without calling Modify
+	HandleObjectModified(Object);
+}
+
+void UUSDExtraExportTrackerSubsystem::HandleActorAdded(AActor* Actor)
+{
+	MarkActorDirty(Actor);
+}
+
+void UUSDExtraExportTrackerSubsystem::HandleActorDeleted(AActor* Actor)
+{
+	if (!Actor || WorldExports.Num() == 0)
+	{
+		return;
+	}
+
+	if (FWorldExport* WorldExport = WorldExports.Find(Actor->GetWorld()))
+	{
+		FString ActorPath;
+		if (!WorldExport->DirtyActors.RemoveAndCopyValue(Actor, ActorPath))
+		{
+			ActorPath = Actor->GetPathName();
+		}
+		WorldExport->DeletedActorPaths.Add(ActorPath);
+	}
+}
+
+void UUSDExtraExportTrackerSubsystem::HandleWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources)
+{
+	WorldExports.Remove(World);
+}
+
+void UUSDExtraExportTrackerSubsystem::MarkActorDirty(AActor* Actor)
+{
+	if (!Actor || WorldExports.Num() == 0)
+	{
+		return;
+	}
+
+	FWorldExport* WorldExport = WorldExports.Find(Actor->GetWorld());
+	if (!WorldExport || WorldExport->DirtyActors.Contains(Actor))
+	{
+		return;
+	}
+
+	// Keep the path from before the change, renaming an actor modifies it first
+	const FString ActorPath = Actor->GetPathName();
+	WorldExport->DirtyActors.Add(Actor, ActorPath);
+
+	// Undoing a deletion brings the actor back
+	WorldExport->DeletedActorPaths.Remove(ActorPath);
+}
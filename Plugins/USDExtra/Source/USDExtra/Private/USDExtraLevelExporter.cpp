@@ -0,0 +1,1595 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraLevelExporter.h"
+
+#include "Algo/StableSort.h"
+#include "Async/Async.h"
+#include "Editor.h"
+#include "EditorActorFolders.h"
+#include "Engine/Brush.h"
+#include "Engine/Level.h"
+#include "Engine/LevelStreaming.h"
+#include "Engine/Selection.h"
+#include "Engine/World.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/StaticMesh.h"
+#include "FoliageType.h"
+#include "HAL/FileManager.h"
+#include "InstancedFoliageActor.h"
+#include "LandscapeProxy.h"
+#include "Misc/DateTime.h"
+#include "Misc/Paths.h"
+#include "Misc/QueuedThreadPool.h"
+#include "Misc/ScopedSlowTask.h"
+#include "Components/BrushComponent.h"
+#include "Components/DirectionalLightComponent.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Components/PointLightComponent.h"
+#include "Components/RectLightComponent.h"
+#include "Components/SkinnedMeshComponent.h"
+#include "Components/SkyLightComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "USDConversionUtils.h"
+#include "USDExtraExportCache.h"
+#include "USDExtraExportOptions.h"
+#include "USDExtraExportTracker.h"
+#include "USDExtraSettings.h"
+#include "USDExtraUtils.h"
+#include "USDGeomMeshConversion.h"
+#include "USDLog.h"
+#include "USDMemory.h"
+#include "USDSkeletalDataConversion.h"
+#include "USDTypesConversion.h"
+#include "UsdWrappers/UsdStage.h"
+
+#if USE_USD_SDK
+
+#include "USDIncludesStart.h"
+	#include "pxr/base/tf/stringUtils.h"
+	#include "pxr/usd/sdf/attributeSpec.h"
+	#include "pxr/usd/sdf/changeBlock.h"
+	#include "pxr/usd/sdf/layer.h"
+	#include "pxr/usd/sdf/primSpec.h"
+	#include "pxr/usd/sdf/relationshipSpec.h"
+	#include "pxr/usd/usd/modelAPI.h"
+	#include "pxr/usd/usd/stage.h"
+	#include "pxr/usd/usdGeom/metrics.h"
+	#include "pxr/usd/usdGeom/modelAPI.h"
+	#include "pxr/usd/usdGeom/tokens.h"
+	#include "pxr/usd/usdUtils/flattenLayerStack.h"
+#include "USDIncludesEnd.h"
+
+#define LOCTEXT_NAMESPACE "USDExtraLevelExporter"
+
+namespace USDExtraLevelExporterImpl
+{
+	const TCHAR* RootPrimName = TEXT("Root");
+
+	/** A component whose prim has been authored, waiting for its data to be converted */
+	struct FComponentToConvert
+	{
+		USceneComponent* Component;
+		pxr::SdfLayerRefPtr Layer;
+		pxr::SdfPath PrimPath;
+		/** Child PointInstancer prim receiving the instances of a HISM component */
+		pxr::SdfPath InstancerPath;
+	};
+
+	/** State shared by the traversal of all the actors, mirroring the Python export context */
+	struct FLevelExportContext
+	{
+		const UUSDExtraExportOptions& Options;
+		const TMap<UObject*, FString>& ExportedAssets;
+
+		/** Prim paths already taken by a component, like exported_prim_paths */
+		TSet<FString> ExportedPrimPaths;
+
+		/** Every prim path that has a def on the stage, to know which DefinePrim calls would have been skipped */
+		TSet<FString> DefinedPrimPaths;
+
+		TSet<USceneComponent*> VisitedComponents;
+		TArray<FComponentToConvert> ComponentsToConvert;
+
+		/** What was written for each actor, kept for incremental exports */
+		FUSDExtraExportRecord Record;
+
+		/** Whether the prims are authored into a delta layer, over the opinions of the previous exports */
+		bool bAuthoringDelta = false;
+
+		/** Tokens of the prim names authored by the exporter, prototypes in particular repeat for every instancer of a mesh */
+		FUSDExtraStringCache Strings;
+	};
+
+	FString MakeValidIdentifier(const FString& Name)
+	{
+		return UsdToUnreal::ConvertString(pxr::TfMakeValidIdentifier(UnrealToUsd::ConvertString(*Name).Get()));
+	}
+
+	/** Appends "_0", "_1", ... to Name until it is not in UsedNames anymore, like exporting_utils.get_unique_name */
+	FString GetUniqueName(const TSet<FString>& UsedNames, const FString& Name)
+	{
+		if (!UsedNames.Contains(Name))
+		{
+			return Name;
+		}
+
+		for (int32 Suffix = 0; ; ++Suffix)
+		{
+			FString NewName = FString::Printf(TEXT("%s_%d"), *Name, Suffix);
+			if (!UsedNames.Contains(NewName))
+			{
+				return NewName;
+			}
+		}
+	}
+
+	pxr::SdfPath ToSdfPath(const FString& Path)
+	{
+		return pxr::SdfPath(UnrealToUsd::ConvertString(*Path).Get());
+	}
+
+	FString MakePathRelativeToLayer(const pxr::SdfLayerRefPtr& Layer, const FString& FilePath)
+	{
+		FString RelativePath = FilePath;
+		if (FPaths::MakePathRelativeTo(RelativePath, *UsdToUnreal::ConvertString(Layer->GetRealPath())))
+		{
+			if (!RelativePath.StartsWith(TEXT(".")))
+			{
+				RelativePath = TEXT("./") + RelativePath;
+			}
+			return RelativePath;
+		}
+		return FilePath;
+	}
+
+	/**
+	 * Authors a def for PrimPath with TypeName in Layer, the way UsdStage::DefinePrim would.
+	 * Ancestors that are not defined anywhere yet become typeless defs, the others just get an over.
+	 */
+	pxr::SdfPrimSpecHandle DefinePrimSpec(FLevelExportContext& Context, const pxr::SdfLayerRefPtr& Layer, const pxr::SdfPath& PrimPath, const pxr::TfToken& TypeName)
+	{
+		pxr::SdfPrimSpecHandle PrimSpec = pxr::SdfCreatePrimInLayer(Layer, PrimPath);
+		if (!PrimSpec)
+		{
+			UE_LOG(LogUsd, Error, TEXT("Failed to define prim '%s'"), *UsdToUnreal::ConvertPath(PrimPath));
+			return PrimSpec;
+		}
+
+		for (pxr::SdfPath AncestorPath = PrimPath.GetParentPath(); !AncestorPath.IsAbsoluteRootPath(); AncestorPath = AncestorPath.GetParentPath())
+		{
+			const FString AncestorPathString = UsdToUnreal::ConvertPath(AncestorPath);
+			if (Context.DefinedPrimPaths.Contains(AncestorPathString))
+			{
+				break;
+			}
+
+			if (pxr::SdfPrimSpecHandle AncestorSpec = Layer->GetPrimAtPath(AncestorPath))
+			{
+				AncestorSpec->SetSpecifier(pxr::SdfSpecifierDef);
+			}
+			Context.DefinedPrimPaths.Add(AncestorPathString);
+		}
+
+		PrimSpec->SetSpecifier(pxr::SdfSpecifierDef);
+		PrimSpec->SetTypeName(TypeName);
+		Context.DefinedPrimPaths.Add(UsdToUnreal::ConvertPath(PrimPath));
+
+		return PrimSpec;
+	}
+
+	/**
+	 * References FilePath from PrimSpec. In a delta the reference list is made explicit, so that the reference
+	 * a previous export authored in a weaker layer is replaced rather than composed along with the new one.
+	 */
+	void AddRelativeReference(const FLevelExportContext& Context, const pxr::SdfLayerRefPtr& Layer, const pxr::SdfPrimSpecHandle& PrimSpec, const FString& FilePath)
+	{
+		const FString RelativePath = MakePathRelativeToLayer(Layer, FilePath);
+		const pxr::SdfReference Reference(UnrealToUsd::ConvertString(*RelativePath).Get());
+		if (Context.bAuthoringDelta)
+		{
+			PrimSpec->GetReferenceList().ClearEditsAndMakeExplicit();
+			PrimSpec->GetReferenceList().GetExplicitItems().push_back(Reference);
+		}
+		else
+		{
+			PrimSpec->GetReferenceList().GetPrependedItems().push_back(Reference);
+		}
+	}
+
+	/** Defines a Prototypes scope under the instancer with one Mesh prim referencing each exported mesh, and targets them */
+	void AssignPrototypes(FLevelExportContext& Context, const pxr::SdfLayerRefPtr& Layer, const pxr::SdfPath& InstancerPath, const TArray<UObject*>& Meshes)
+	{
+		pxr::SdfPrimSpecHandle InstancerSpec = Layer->GetPrimAtPath(InstancerPath);
+		if (!InstancerSpec)
+		{
+			return;
+		}
+
+		const pxr::SdfPath PrototypesPath = InstancerPath.AppendChild(pxr::TfToken("Prototypes"));
+		DefinePrimSpec(Context, Layer, PrototypesPath, pxr::TfToken());
+
+		pxr::SdfRelationshipSpecHandle PrototypesRel = pxr::SdfRelationshipSpec::New(InstancerSpec, pxr::UsdGeomTokens->prototypes.GetString(), false);
+		PrototypesRel->GetTargetPathList().ClearEditsAndMakeExplicit();
+
+		TSet<FString> UsedNames;
+		for (UObject* Mesh : Meshes)
+		{
+			const FString PrototypeName = GetUniqueName(UsedNames, MakeValidIdentifier(Mesh ? Mesh->GetName() : TEXT("None")));
+			UsedNames.Add(PrototypeName);
+
+			const pxr::SdfPath PrototypePath = PrototypesPath.AppendChild(Context.Strings.ToToken(PrototypeName));
+			pxr::SdfPrimSpecHandle PrototypeSpec = DefinePrimSpec(Context, Layer, PrototypePath, USDExtraTokensType::USDStaticMesh);
+
+			if (const FString* MeshFile = Mesh ? Context.ExportedAssets.Find(Mesh) : nullptr)
+			{
+				AddRelativeReference(Context, Layer, PrototypeSpec, *MeshFile);
+			}
+			else
+			{
+				UE_LOG(LogUsd, Warning, TEXT("Failed to find produced asset file for mesh '%s'"), Mesh ? *Mesh->GetPathName() : TEXT("None"));
+			}
+
+			PrototypesRel->GetTargetPathList().GetExplicitItems().push_back(PrototypePath);
+		}
+	}
+
+	/** Whether Object is an instance of the class named ClassName, without requiring the module of that class */
+	bool IsA(const UObject* Object, const FName ClassName)
+	{
+		for (const UClass* Class = Object->GetClass(); Class; Class = Class->GetSuperClass())
+		{
+			if (Class->GetFName() == ClassName)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	pxr::TfToken GetSchemaNameForComponent(const USceneComponent* Component)
+	{
+		const AActor* OwnerActor = Component->GetOwner();
+		if (Cast<AInstancedFoliageActor>(OwnerActor))
+		{
+			return USDExtraTokensType::USDInstancedStaticMesh;
+		}
+		else if (Cast<ALandscapeProxy>(OwnerActor))
+		{
+			return USDExtraTokensType::USDStaticMesh;
+		}
+
+		if (Cast<USkinnedMeshComponent>(Component))
+		{
+			return USDExtraTokensType::USDSkeletalMesh;
+		}
+		else if (Cast<UHierarchicalInstancedStaticMeshComponent>(Component))
+		{
+			// The HISM component becomes a regular Xform prim so that its children are handled like anywhere else,
+			// its instances are written onto a child PointInstancer prim instead
+			return USDExtraTokensType::USDScene;
+		}
+		else if (Cast<UStaticMeshComponent>(Component) || Cast<UBrushComponent>(Component))
+		{
+			return USDExtraTokensType::USDStaticMesh;
+		}
+		else if (IsA(Component, TEXT("CineCameraComponent")))
+		{
+			return pxr::TfToken("Camera");
+		}
+		else if (Component->IsA(UDirectionalLightComponent::StaticClass()))
+		{
+			return pxr::TfToken("DistantLight");
+		}
+		else if (Component->IsA(URectLightComponent::StaticClass()))
+		{
+			return pxr::TfToken("RectLight");
+		}
+		else if (Component->IsA(UPointLightComponent::StaticClass()))
+		{
+			return pxr::TfToken("SphereLight");
+		}
+		else if (Component->IsA(USkyLightComponent::StaticClass()))
+		{
+			return pxr::TfToken("DomeLight");
+		}
+		return USDExtraTokensType::USDScene;
+	}
+
+	bool ShouldExportActor(const AActor* Actor)
+	{
+		if (!Actor)
+		{
+			return false;
+		}
+
+		// The editor world's persistent level always has a foliage actor, but it may be empty
+		if (const AInstancedFoliageActor* FoliageActor = Cast<AInstancedFoliageActor>(Actor))
+		{
+			for (const TPair<UFoliageType*, TUniqueObj<FFoliageInfo>>& FoliagePair : FoliageActor->GetFoliageInfos())
+			{
+				if (FoliagePair.Value.Get().Instances.Num() > 0)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// This is a tag added to all actors spawned by the UsdStageActor
+		if (Actor->ActorHasTag(TEXT("SequencerActor")))
+		{
+			return false;
+		}
+
+		// Compared by name so that modules owning some of these classes are not required
+		static const TSet<FName> ActorClassesToIgnore = {
+			TEXT("AbstractNavData"),
+			TEXT("AtmosphericFog"),
+			TEXT("DefaultPhysicsVolume"),
+			TEXT("GameModeBase"),
+			TEXT("GameNetworkManager"),
+			TEXT("GameplayDebuggerCategoryReplicator"),
+			TEXT("GameplayDebuggerPlayerManager"),
+			TEXT("GameSession"),
+			TEXT("GameStateBase"),
+			TEXT("HUD"),
+			TEXT("LevelSequenceActor"),
+			TEXT("ParticleEventManager"),
+			TEXT("PlayerCameraManager"),
+			TEXT("PlayerController"),
+			TEXT("PlayerStart"),
+			TEXT("PlayerState"),
+			TEXT("SphereReflectionCapture"),
+			TEXT("USDLevelInfo"),
+			TEXT("UsdStageActor"),
+			TEXT("WorldSettings")
+		};
+		for (const UClass* Class = Actor->GetClass(); Class; Class = Class->GetSuperClass())
+		{
+			if (ActorClassesToIgnore.Contains(Class->GetFName()))
+			{
+				return false;
+			}
+		}
+
+		if (Actor->GetClass()->GetName() == TEXT("BP_Sky_Sphere_C"))
+		{
+			return false;
+		}
+
+		const FString ActorName = Actor->GetName();
+		if (ActorName == TEXT("Brush_1") || ActorName == TEXT("DefaultPhysicsVolume_0"))
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	/** Finds a valid, full and unique prim path for Component, like get_prim_path_for_component */
+	FString GetPrimPathForComponent(USceneComponent* Component, TSet<FString>& UsedPrimPaths, FString ParentPrimPath, bool bUseFolders)
+	{
+		FString Name = Component->GetName();
+
+		// Use the actor label for root components, and also keep track of the folder path in that case
+		FString FolderPath;
+		if (AActor* Actor = Component->GetOwner())
+		{
+			if (Actor->GetRootComponent() == Component)
+			{
+				Name = Actor->GetActorLabel();
+				if (bUseFolders && !Component->GetAttachParent())
+				{
+					const FName ActorFolderPath = Actor->GetFolderPath();
+					if (!ActorFolderPath.IsNone())
+					{
+						FolderPath = ActorFolderPath.ToString();
+					}
+				}
+			}
+		}
+
+		Name = MakeValidIdentifier(Name);
+
+		// Sanitize each folder name separately so nested folders keep their slashes
+		if (!FolderPath.IsEmpty())
+		{
+			TArray<FString> Segments;
+			FolderPath.ParseIntoArray(Segments, TEXT("/"), false);
+			for (FString& Segment : Segments)
+			{
+				Segment = MakeValidIdentifier(Segment);
+			}
+			Segments.Add(Name);
+			Name = FString::Join(Segments, TEXT("/"));
+		}
+
+		if (ParentPrimPath.IsEmpty())
+		{
+			if (USceneComponent* ParentComponent = Component->GetAttachParent())
+			{
+				ParentPrimPath = GetPrimPathForComponent(ParentComponent, UsedPrimPaths, FString(), bUseFolders);
+			}
+			else
+			{
+				// Root component of a top-level actor
+				ParentPrimPath = FString(TEXT("/")) + RootPrimName;
+			}
+		}
+
+		const FString PrimPath = GetUniqueName(UsedPrimPaths, ParentPrimPath + TEXT("/") + Name);
+		UsedPrimPaths.Add(PrimPath);
+
+		return PrimPath;
+	}
+
+	/** Authors the prims for Component and its children, and records them to be converted once the stage is composed */
+	void AuthorComponentPrims(FLevelExportContext& Context, const pxr::SdfLayerRefPtr& Layer, USceneComponent* Component, const FString& ParentPrimPath = FString())
+	{
+		AActor* Actor = Component->GetOwner();
+		if (!ShouldExportActor(Actor))
+		{
+			return;
+		}
+
+		// We use this as a proxy for bIsVisualizationComponent
+		if (Component->IsEditorOnly())
+		{
+			return;
+		}
+
+		const FString PrimPath = GetPrimPathForComponent(Component, Context.ExportedPrimPaths, ParentPrimPath, Context.Options.bExportActorFolders);
+
+		TArray<FString>& ActorPrimPaths = Context.Record.ActorPrimPaths.FindOrAdd(Actor->GetPathName());
+		ActorPrimPaths.Add(PrimPath);
+		Context.Record.ComponentPrimPaths.Add(Component->GetPathName(), PrimPath);
+
+		UE_LOG(LogUsd, Verbose, TEXT("Exporting component '%s' onto prim '%s'"), *Component->GetName(), *PrimPath);
+
+		const pxr::SdfPath SdfPrimPath = ToSdfPath(PrimPath);
+		pxr::SdfPath SdfInstancerPath;
+
+		pxr::SdfPrimSpecHandle PrimSpec = Layer->GetPrimAtPath(SdfPrimPath);
+		if (!Context.DefinedPrimPaths.Contains(PrimPath))
+		{
+			PrimSpec = DefinePrimSpec(Context, Layer, SdfPrimPath, GetSchemaNameForComponent(Component));
+		}
+		else if (!PrimSpec)
+		{
+			PrimSpec = pxr::SdfCreatePrimInLayer(Layer, SdfPrimPath);
+		}
+
+		if (UHierarchicalInstancedStaticMeshComponent* HISMComponent = Cast<UHierarchicalInstancedStaticMeshComponent>(Component))
+		{
+			// Drawable prims should not live inside PointInstancers, so the instances go onto a separate child prim
+			const FString InstancerPath = GetUniqueName(Context.ExportedPrimPaths, PrimPath + TEXT("/HISMInstance"));
+			Context.ExportedPrimPaths.Add(InstancerPath);
+			ActorPrimPaths.Add(InstancerPath);
+
+			SdfInstancerPath = ToSdfPath(InstancerPath);
+			DefinePrimSpec(Context, Layer, SdfInstancerPath, USDExtraTokensType::USDInstancedStaticMesh);
+
+			if (UStaticMesh* StaticMesh = HISMComponent->GetStaticMesh())
+			{
+				AssignPrototypes(Context, Layer, SdfInstancerPath, { StaticMesh });
+			}
+		}
+
+		Context.ComponentsToConvert.Add({ Component, Layer, SdfPrimPath, SdfInstancerPath });
+
+		UObject* Mesh = nullptr;
+		if (const UStaticMeshComponent* StaticMeshComponent = Cast<UStaticMeshComponent>(Component))
+		{
+			Mesh = StaticMeshComponent->GetStaticMesh();
+		}
+		else if (const USkinnedMeshComponent* SkinnedMeshComponent = Cast<USkinnedMeshComponent>(Component))
+		{
+			Mesh = SkinnedMeshComponent->SkeletalMesh;
+		}
+		if (Mesh && PrimSpec)
+		{
+			if (const FString* MeshFile = Context.ExportedAssets.Find(Mesh))
+			{
+				AddRelativeReference(Context, Layer, PrimSpec, *MeshFile);
+			}
+			else
+			{
+				UE_LOG(LogUsd, Warning, TEXT("Failed to find produced asset file for mesh '%s'"), *Mesh->GetPathName());
+			}
+		}
+		else if (PrimSpec && Context.bAuthoringDelta && (Cast<UStaticMeshComponent>(Component) || Cast<USkinnedMeshComponent>(Component)))
+		{
+			// A mesh cleared since the previous export must not keep the reference of the weaker layers
+			PrimSpec->GetReferenceList().ClearEditsAndMakeExplicit();
+		}
+
+		// The foliage actor is exported in one go, since it has one component per foliage type and we want a single PointInstancer
+		if (const AInstancedFoliageActor* FoliageActor = Cast<AInstancedFoliageActor>(Actor))
+		{
+			TArray<UObject*> FoliageMeshes;
+			for (const TPair<UFoliageType*, TUniqueObj<FFoliageInfo>>& FoliagePair : FoliageActor->GetFoliageInfos())
+			{
+				FoliageMeshes.Add(FoliagePair.Key ? FoliagePair.Key->GetSource() : nullptr);
+			}
+			AssignPrototypes(Context, Layer, SdfPrimPath, FoliageMeshes);
+			return;
+		}
+
+		TArray<USceneComponent*> Children;
+		Component->GetChildrenComponents(false, Children);
+		for (USceneComponent* Child : Children)
+		{
+			if (!Child || Context.VisitedComponents.Contains(Child))
+			{
+				continue;
+			}
+			Context.VisitedComponents.Add(Child);
+
+			AuthorComponentPrims(Context, Layer, Child, PrimPath);
+		}
+	}
+
+	/** Writes the component data onto the prims authored by AuthorComponentPrims, in the same order as convert_component */
+	void ConvertComponent(const pxr::UsdStageRefPtr& Stage, const FComponentToConvert& ComponentToConvert)
+	{
+		USceneComponent* Component = ComponentToConvert.Component;
+
+		Stage->SetEditTarget(pxr::UsdEditTarget(ComponentToConvert.Layer));
+
+		pxr::UsdPrim Prim = Stage->GetPrimAtPath(ComponentToConvert.PrimPath);
+		if (!Prim)
+		{
+			return;
+		}
+
+		if (const UHierarchicalInstancedStaticMeshComponent* HISMComponent = Cast<UHierarchicalInstancedStaticMeshComponent>(Component))
+		{
+			pxr::UsdPrim InstancerPrim = Stage->GetPrimAtPath(ComponentToConvert.InstancerPath);
+			UnrealToUSDExtra::ConvertHierarchicalInstancedStaticMeshComponent(HISMComponent, InstancerPrim);
+		}
+
+		if (const UMeshComponent* MeshComponent = Cast<UMeshComponent>(Component))
+		{
+			if (MeshComponent->IsA<UStaticMeshComponent>() || MeshComponent->IsA<USkinnedMeshComponent>())
+			{
+				UnrealToUSDExtra::ConvertMeshComponent(Stage, MeshComponent, Prim);
+			}
+		}
+
+		if (const UBrushComponent* BrushComponent = Cast<UBrushComponent>(Component))
+		{
+			UnrealToUSDExtra::ConvertBrushComponent(Stage, BrushComponent, Prim);
+		}
+
+		UnrealToUSDExtra::ConvertSceneComponent(Stage, Component, Prim);
+
+		if (const AInstancedFoliageActor* FoliageActor = Cast<AInstancedFoliageActor>(Component->GetOwner()))
+		{
+			UnrealToUSDExtra::ConvertInstancedFoliageActor(*FoliageActor, Prim, UsdUtils::GetDefaultTimeCode());
+		}
+	}
+
+	/** Defines the Scope prim of an actor folder, named after the leaf folder like export_level does */
+	void AuthorFolderPrim(FLevelExportContext& Context, const pxr::SdfLayerRefPtr& Layer, const pxr::SdfPath& RootPrimPath, const FString& FolderName)
+	{
+		const pxr::SdfPath FolderPrimPath = RootPrimPath.AppendChild(Context.Strings.ToToken(MakeValidIdentifier(FolderName)));
+		if (pxr::SdfPrimSpecHandle FolderSpec = DefinePrimSpec(Context, Layer, FolderPrimPath, USDExtraTokensType::USDActorFolder))
+		{
+			pxr::SdfAttributeSpecHandle FolderPathAttr = pxr::SdfAttributeSpec::New(FolderSpec, USDExtraIdentifiers::UnrealActorFolderPath.GetString(), pxr::SdfValueTypeNames->String, pxr::SdfVariabilityVarying, true);
+			FolderPathAttr->SetDefaultValue(pxr::VtValue(UnrealToUsd::ConvertString(*FolderName).Get()));
+
+			pxr::SdfAttributeSpecHandle UsageAttr = pxr::SdfAttributeSpec::New(FolderSpec, USDExtraIdentifiers::UnrealPrimUsage.GetString(), pxr::SdfValueTypeNames->Token, pxr::SdfVariabilityVarying, true);
+			UsageAttr->SetDefaultValue(pxr::VtValue(USDExtraTokensType::Folder));
+		}
+	}
+
+	int32 GetAttachDepth(const AActor* Actor)
+	{
+		int32 Depth = 0;
+		for (const AActor* Parent = Actor->GetAttachParentActor(); Parent; Parent = Parent->GetAttachParentActor())
+		{
+			++Depth;
+		}
+		return Depth;
+	}
+
+	void SetLayerMetadata(const pxr::SdfLayerRefPtr& Layer, const UUSDExtraExportOptions& Options)
+	{
+		const pxr::SdfPrimSpecHandle PseudoRoot = Layer->GetPseudoRoot();
+		PseudoRoot->SetInfo(pxr::UsdGeomTokens->upAxis, pxr::VtValue(Options.StageOptions.UpAxis == EUsdUpAxis::ZAxis ? pxr::UsdGeomTokens->z : pxr::UsdGeomTokens->y));
+		PseudoRoot->SetInfo(pxr::UsdGeomTokens->metersPerUnit, pxr::VtValue(static_cast<double>(Options.StageOptions.MetersPerUnit)));
+		Layer->SetStartTimeCode(Options.StartTimeCode);
+		Layer->SetEndTimeCode(Options.EndTimeCode);
+	}
+
+	void CollectMeshes(const TArray<AActor*>& Actors, TArray<UObject*>& OutStaticMeshes, TArray<UObject*>& OutSkeletalMeshes)
+	{
+		for (const AActor* Actor : Actors)
+		{
+			TInlineComponentArray<UStaticMeshComponent*> StaticMeshComponents(Actor);
+			for (const UStaticMeshComponent* StaticMeshComponent : StaticMeshComponents)
+			{
+				if (UStaticMesh* StaticMesh = StaticMeshComponent->GetStaticMesh())
+				{
+					OutStaticMeshes.AddUnique(StaticMesh);
+				}
+			}
+
+			TInlineComponentArray<USkinnedMeshComponent*> SkinnedMeshComponents(Actor);
+			for (const USkinnedMeshComponent* SkinnedMeshComponent : SkinnedMeshComponents)
+			{
+				if (USkeletalMesh* SkeletalMesh = SkinnedMeshComponent->SkeletalMesh)
+				{
+					OutSkeletalMeshes.AddUnique(SkeletalMesh);
+				}
+			}
+		}
+	}
+
+	/** Incremental exports move the content of "Level.usda" into "Level_base.usda", next to their delta layers */
+	FString GetBaseLayerPath(const FString& RootLayerPath, const FString& Extension)
+	{
+		return FPaths::Combine(FPaths::GetPath(RootLayerPath), FPaths::GetBaseFilename(RootLayerPath) + TEXT("_base") + Extension);
+	}
+
+	bool HasSubLayerPath(const pxr::SdfLayerRefPtr& Layer, const std::string& SubLayerPath)
+	{
+		const std::vector<std::string> SubLayerPaths = Layer->GetSubLayerPaths();
+		return std::find(SubLayerPaths.begin(), SubLayerPaths.end(), SubLayerPath) != SubLayerPaths.end();
+	}
+
+	/**
+	 * Creates a new delta layer and inserts it as the strongest sublayer of RootLayer.
+	 * Opinions authored in the root layer itself are stronger than any of its sublayers, so the first incremental
+	 * export moves the content of the root layer into a base sublayer, leaving only the layer metadata behind.
+	 */
+	pxr::SdfLayerRefPtr CreateDeltaLayer(const pxr::SdfLayerRefPtr& RootLayer, const FString& RootLayerPath, const FString& Extension, const UUSDExtraExportOptions& Options)
+	{
+		const FString BaseLayerPath = GetBaseLayerPath(RootLayerPath, Extension);
+		const std::string BaseLayerRelativePath = UnrealToUsd::ConvertString(*MakePathRelativeToLayer(RootLayer, BaseLayerPath)).Get();
+		if (!HasSubLayerPath(RootLayer, BaseLayerRelativePath))
+		{
+			pxr::SdfLayerRefPtr BaseLayer = pxr::SdfLayer::CreateNew(UnrealToUsd::ConvertString(*BaseLayerPath).Get());
+			if (!BaseLayer)
+			{
+				UE_LOG(LogUsd, Error, TEXT("Failed to create base layer '%s'"), *BaseLayerPath);
+				return nullptr;
+			}
+			BaseLayer->TransferContent(RootLayer);
+			BaseLayer->Save();
+
+			RootLayer->SetRootPrims(pxr::SdfPrimSpecHandleVector());
+			RootLayer->SetSubLayerPaths({ BaseLayerRelativePath });
+		}
+
+		const FString DeltaLayerPrefix = FPaths::Combine(FPaths::GetPath(RootLayerPath), FPaths::GetBaseFilename(RootLayerPath) + TEXT("_delta_") + FDateTime::Now().ToString(TEXT("%Y%m%d_%H%M%S")));
+		FString DeltaLayerPath = DeltaLayerPrefix + Extension;
+		for (int32 Suffix = 0; FPaths::FileExists(DeltaLayerPath); ++Suffix)
+		{
+			DeltaLayerPath = FString::Printf(TEXT("%s_%d%s"), *DeltaLayerPrefix, Suffix, *Extension);
+		}
+
+		pxr::SdfLayerRefPtr DeltaLayer = pxr::SdfLayer::CreateNew(UnrealToUsd::ConvertString(*DeltaLayerPath).Get());
+		if (!DeltaLayer)
+		{
+			UE_LOG(LogUsd, Error, TEXT("Failed to create delta layer '%s'"), *DeltaLayerPath);
+			return nullptr;
+		}
+		SetLayerMetadata(DeltaLayer, Options);
+		RootLayer->InsertSubLayerPath(UnrealToUsd::ConvertString(*MakePathRelativeToLayer(RootLayer, DeltaLayerPath)).Get(), 0);
+
+		return DeltaLayer;
+	}
+
+	/**
+	 * "/Game/Folder/Mesh" is exported to "<root layer folder>/Assets/Game/Folder/Mesh.usda", like level_exporter.get_filename_to_export_to does,
+	 * so that the mesh files of the python and native exporters line up and meshes of different mount points never share a file
+	 */
+	FString GetMeshFilePath(const UObject* Mesh, const FString& RootLayerPath, const FString& Extension)
+	{
+		FString PackagePath = FPaths::GetPath(Mesh->GetOutermost()->GetName());
+		PackagePath.RemoveFromStart(TEXT("/"));
+		return FPaths::Combine(FPaths::GetPath(RootLayerPath), TEXT("Assets"), PackagePath, Mesh->GetName() + Extension);
+	}
+
+	/** Layers of an exported mesh asset, converted in memory and waiting to be written to disk */
+	struct FMeshLayers
+	{
+		FString MeshFile;
+		pxr::SdfLayerRefPtr Layer;
+
+		/** Only used when the mesh data is exported in a separate payload file */
+		FString PayloadFile;
+		pxr::SdfLayerRefPtr PayloadLayer;
+	};
+
+	/** A mesh whose layers are being written by the thread pool */
+	struct FPendingMeshWrite
+	{
+		UObject* Mesh = nullptr;
+		FString MeshFile;
+		FString PayloadFile;
+		FString SourceHash;
+		TFuture<bool> Result;
+	};
+
+	pxr::UsdStageRefPtr CreateMeshStage(const UUSDExtraExportOptions& Options)
+	{
+		// Payloads point to files that are only written later, so they must not be loaded
+		pxr::UsdStageRefPtr Stage = pxr::UsdStage::CreateInMemory(pxr::UsdStage::LoadNone);
+		SetLayerMetadata(Stage->GetRootLayer(), Options);
+		return Stage;
+	}
+
+	/**
+	 * Converts Mesh into anonymous layers, along with the unrealAssetReference and asset name that the Python pipeline
+	 * added by reopening the exported file. Reads the mesh data, so it has to run on the game thread.
+	 */
+	bool ConvertMeshToLayers(UObject* Mesh, bool bSkeletal, const UUSDExtraExportOptions& Options, FMeshLayers& InOutLayers)
+	{
+		FScopedUsdAllocs UsdAllocs;
+
+		const pxr::UsdStageRefPtr Stage = CreateMeshStage(Options);
+		const pxr::UsdStageRefPtr PayloadStage = Options.bUsePayload ? CreateMeshStage(Options) : Stage;
+
+		const pxr::SdfPath AssetPrimPath = pxr::SdfPath::AbsoluteRootPath().AppendChild(UnrealToUsd::ConvertToken(*MakeValidIdentifier(Mesh->GetName())).Get());
+		const pxr::TfToken TypeName = bSkeletal ? pxr::TfToken("SkelRoot") : pxr::TfToken();
+
+		pxr::UsdPrim AssetPrim = Stage->DefinePrim(AssetPrimPath, TypeName);
+		if (!AssetPrim)
+		{
+			return false;
+		}
+		Stage->SetDefaultPrim(AssetPrim);
+
+		pxr::UsdPrim MeshPrim = AssetPrim;
+		if (Options.bUsePayload)
+		{
+			MeshPrim = PayloadStage->DefinePrim(AssetPrimPath, TypeName);
+			PayloadStage->SetDefaultPrim(MeshPrim);
+
+			// Both files end up in the same folder
+			const FString PayloadPath = TEXT("./") + FPaths::GetCleanFilename(InOutLayers.PayloadFile);
+			AssetPrim.GetPayloads().AddPayload(pxr::SdfPayload(UnrealToUsd::ConvertString(*PayloadPath).Get()));
+		}
+
+		// Material assignments stay on the asset layer, like the USD mesh exporters do
+		UE::FUsdStage StageForMaterialAssignments(Stage);
+		const bool bConverted = bSkeletal
+			? UnrealToUsd::ConvertSkeletalMesh(CastChecked<USkeletalMesh>(Mesh), MeshPrim, UsdUtils::GetDefaultTimeCode(), &StageForMaterialAssignments)
+			: UnrealToUsd::ConvertStaticMesh(CastChecked<UStaticMesh>(Mesh), MeshPrim, UsdUtils::GetDefaultTimeCode(), &StageForMaterialAssignments);
+		if (!bConverted)
+		{
+			return false;
+		}
+
+		if (pxr::UsdAttribute UnrealAssetReferenceAttr = AssetPrim.CreateAttribute(USDExtraIdentifiers::UnrealAssetReference, pxr::SdfValueTypeNames->String))
+		{
+			// ReSharper disable once CppExpressionWithoutSideEffects
+			UnrealAssetReferenceAttr.Set(UnrealToUsd::ConvertString(*Mesh->GetPathName()).Get());
+		}
+		pxr::UsdModelAPI(AssetPrim).SetAssetName(UnrealToUsd::ConvertString(*Mesh->GetName()).Get());
+
+		// Lets imports that don't load the payload still tell where the geometry is
+		const FBox Bounds = bSkeletal ? CastChecked<USkeletalMesh>(Mesh)->GetBounds().GetBox() : CastChecked<UStaticMesh>(Mesh)->GetBoundingBox();
+		if (Bounds.IsValid)
+		{
+			const FUsdStageInfo StageInfo(Stage);
+			pxr::GfRange3f Extent;
+			for (int32 Corner = 0; Corner < 8; ++Corner)
+			{
+				const FVector CornerPosition((Corner & 1) ? Bounds.Max.X : Bounds.Min.X, (Corner & 2) ? Bounds.Max.Y : Bounds.Min.Y, (Corner & 4) ? Bounds.Max.Z : Bounds.Min.Z);
+				Extent.UnionWith(UnrealToUsd::ConvertVector(StageInfo, CornerPosition));
+			}
+			pxr::UsdGeomModelAPI(AssetPrim).SetExtentsHint(pxr::VtVec3fArray{ Extent.GetMin(), Extent.GetMax() });
+		}
+
+		InOutLayers.Layer = Stage->GetRootLayer();
+		if (Options.bUsePayload)
+		{
+			InOutLayers.PayloadLayer = PayloadStage->GetRootLayer();
+		}
+
+		return true;
+	}
+
+	/** Serializes the converted layers to their files. Doesn't touch any UObject, so it can run on any thread */
+	bool WriteMeshLayers(FMeshLayers& Layers)
+	{
+		FScopedUsdAllocs UsdAllocs;
+
+		bool bSuccess = !Layers.PayloadLayer || Layers.PayloadLayer->Export(UnrealToUsd::ConvertString(*Layers.PayloadFile).Get());
+		bSuccess = bSuccess && Layers.Layer->Export(UnrealToUsd::ConvertString(*Layers.MeshFile).Get());
+
+		// Release the layers while the USD allocator is active, the task owning them is destroyed on another thread
+		Layers.Layer.Reset();
+		Layers.PayloadLayer.Reset();
+
+		return bSuccess;
+	}
+}
+
+FUSDExtraLevelExporter::FUSDExtraLevelExporter(const UUSDExtraExportOptions& InOptions)
+	: Options(InOptions)
+{
+}
+
+FUSDExtraLevelExporter::~FUSDExtraLevelExporter() = default;
+
+const TArray<AActor*>& FUSDExtraLevelExporter::CollectActors()
+{
+	if (bActorsCollected)
+	{
+		return Actors;
+	}
+	bActorsCollected = true;
+
+	UWorld* World = Options.World;
+	if (!World)
+	{
+		return Actors;
+	}
+
+	TArray<AActor*> CandidateActors;
+	if (Options.bSelectionOnly)
+	{
+		if (GEditor)
+		{
+			for (FSelectionIterator It(GEditor->GetSelectedActorIterator()); It; ++It)
+			{
+				CandidateActors.Add(Cast<AActor>(*It));
+			}
+		}
+	}
+	else
+	{
+		const auto CollectLevelActors = [&CandidateActors](ULevel* Level)
+		{
+			if (Level)
+			{
+				CandidateActors.Append(Level->Actors);
+			}
+		};
+
+		CollectLevelActors(World->PersistentLevel);
+		for (const ULevelStreaming* StreamingLevel : World->GetStreamingLevels())
+		{
+			if (StreamingLevel && StreamingLevel->IsLevelVisible())
+			{
+				CollectLevelActors(StreamingLevel->GetLoadedLevel());
+			}
+		}
+	}
+
+	// Each sublevel has an individual world that carries the sublevel name, the levels themselves are all
+	// named "PersistentLevel", so the filtering goes through the outer world
+	const bool bPersistentLevelAllowed = !Options.LevelsToIgnore.Contains(TEXT("Persistent Level"));
+
+	TSet<AActor*> CollectedActors;
+	for (AActor* Actor : CandidateActors)
+	{
+		if (!Actor || CollectedActors.Contains(Actor))
+		{
+			continue;
+		}
+
+		if (Options.LevelsToIgnore.Num() > 0)
+		{
+			const UObject* ActualWorld = Actor->GetOuter() ? Actor->GetOuter()->GetOuter() : nullptr;
+			const bool bActorInPersistentLevel = ActualWorld == Actor->GetWorld();
+
+			const bool bAllowed = bActorInPersistentLevel
+				? bPersistentLevelAllowed
+				: ActualWorld && !Options.LevelsToIgnore.Contains(ActualWorld->GetName());
+			if (!bAllowed)
+			{
+				continue;
+			}
+		}
+
+		if (USDExtraLevelExporterImpl::ShouldExportActor(Actor))
+		{
+			CollectedActors.Add(Actor);
+			Actors.Add(Actor);
+		}
+	}
+
+	return Actors;
+}
+
+bool FUSDExtraLevelExporter::RequiresPythonExport()
+{
+	if (Options.bBakeMaterials)
+	{
+		return true;
+	}
+
+	for (const AActor* Actor : CollectActors())
+	{
+		if (Cast<ALandscapeProxy>(Actor))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool FUSDExtraLevelExporter::Export()
+{
+	using namespace USDExtraLevelExporterImpl;
+
+	if (!Options.World)
+	{
+		UE_LOG(LogUsd, Error, TEXT("The export options 'World' member must point to a valid UWorld object!"));
+		return false;
+	}
+
+	RootLayerPath = FPaths::ConvertRelativePathToFull(Options.FileName);
+	FPaths::NormalizeFilename(RootLayerPath);
+
+	SceneFileExtension = FPaths::GetExtension(RootLayerPath, true);
+	if (SceneFileExtension.IsEmpty())
+	{
+		SceneFileExtension = TEXT(".usda");
+	}
+	PayloadFormat = Options.PayloadFormat.IsEmpty() ? SceneFileExtension : Options.PayloadFormat;
+	if (!PayloadFormat.StartsWith(TEXT(".")))
+	{
+		PayloadFormat.InsertAt(0, TEXT('.'));
+	}
+
+	const UUSDExtraSettings* Settings = GetDefault<UUSDExtraSettings>();
+	if (Settings->bUseExportCache)
+	{
+		// The manifest lives in the USD repository so every export into it shares the same cache,
+		// exports made elsewhere keep one next to their root layer
+		FString CacheDirectory = Settings->USDRepository.Path.IsEmpty() ? FPaths::GetPath(RootLayerPath) : FPaths::ConvertRelativePathToFull(Settings->USDRepository.Path);
+		ExportCache = MakeUnique<FUSDExtraExportCache>(CacheDirectory);
+		ExportOptionsHash = FUSDExtraExportCache::HashExportOptions(Options, SceneFileExtension, PayloadFormat);
+	}
+
+	if (Options.bIncrementalExport)
+	{
+		UUSDExtraExportTrackerSubsystem* ExportTracker = GEditor ? GEditor->GetEditorSubsystem<UUSDExtraExportTrackerSubsystem>() : nullptr;
+		const FUSDExtraExportRecord* Record = ExportTracker ? ExportTracker->FindRecord(Options.World, RootLayerPath) : nullptr;
+		if (Record && FPaths::FileExists(RootLayerPath))
+		{
+			UE_LOG(LogUsd, Log, TEXT("Exporting changes since the last export to root layer: '%s'"), *RootLayerPath);
+
+			bool bSuccess = ExportDelta(*Record, ExportTracker->GetChanges(Options.World));
+			if (bSuccess && Options.bSquashDeltas)
+			{
+				bSuccess = SquashDeltaLayers();
+			}
+			return bSuccess;
+		}
+
+		UE_LOG(LogUsd, Log, TEXT("The level was not exported to '%s' during this session, exporting all of it"), *RootLayerPath);
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Starting export to root layer: '%s'"), *RootLayerPath);
+
+	FScopedSlowTask SlowTask(4.0f, FText::Format(LOCTEXT("ExportingLevel", "Exporting level to '{0}'"), FText::FromString(RootLayerPath)));
+	SlowTask.MakeDialog(true);
+
+	// Collect items to export
+	SlowTask.EnterProgressFrame(1.0f);
+	TArray<UObject*> StaticMeshes;
+	TArray<UObject*> SkeletalMeshes;
+	CollectMeshes(CollectActors(), StaticMeshes, SkeletalMeshes);
+
+	// Export assets
+	SlowTask.EnterProgressFrame(1.0f);
+	ExportMeshes(StaticMeshes, false);
+
+	SlowTask.EnterProgressFrame(1.0f);
+	ExportMeshes(SkeletalMeshes, true);
+
+	if (ExportCache)
+	{
+		ExportCache->Save();
+	}
+
+	// Export actors
+	SlowTask.EnterProgressFrame(1.0f);
+	return ExportLevel();
+}
+
+void FUSDExtraLevelExporter::ExportMeshes(const TArray<UObject*>& Meshes, bool bSkeletal)
+{
+	using namespace USDExtraLevelExporterImpl;
+
+	const TCHAR* MeshType = bSkeletal ? TEXT("skeletal") : TEXT("static");
+	UE_LOG(LogUsd, Log, TEXT("Exporting %d %s meshes"), Meshes.Num(), MeshType);
+
+	FScopedSlowTask SlowTask(Meshes.Num(), FText::Format(LOCTEXT("ExportingMeshes", "Exporting {0} meshes"), FText::FromString(MeshType)));
+	SlowTask.MakeDialog(true);
+
+	// Mesh data can only be read on the game thread, but once converted the layers don't depend on anything else,
+	// so they are written by the thread pool while the next meshes are converted. Bounding the number of
+	// pending writes keeps the converted layers from piling up in memory when the disk can't keep up
+	const int32 MaxPendingWrites = FMath::Max(2, GThreadPool->GetNumThreads() * 2);
+	TArray<FPendingMeshWrite> PendingWrites;
+
+	auto FinishOldestWrite = [this, &PendingWrites, MeshType]()
+	{
+		FPendingMeshWrite PendingWrite = MoveTemp(PendingWrites[0]);
+		PendingWrites.RemoveAt(0, 1, false);
+
+		if (PendingWrite.Result.Get())
+		{
+			ExportedAssets.Add(PendingWrite.Mesh, PendingWrite.MeshFile);
+			if (ExportCache)
+			{
+				ExportCache->Update(PendingWrite.Mesh, PendingWrite.SourceHash, ExportOptionsHash, PendingWrite.MeshFile, PendingWrite.PayloadFile);
+			}
+		}
+		else
+		{
+			if (PendingWrite.MeshFile.Len() > 220)
+			{
+				UE_LOG(LogUsd, Error, TEXT("USD failed to write a layer with a very long filepath: Try to use a destination folder with a shorter file path"));
+			}
+			UE_LOG(LogUsd, Warning, TEXT("Failed to export %s mesh '%s' to filepath '%s'"), MeshType, *PendingWrite.Mesh->GetName(), *PendingWrite.MeshFile);
+		}
+	};
+
+	for (UObject* Mesh : Meshes)
+	{
+		if (SlowTask.ShouldCancel())
+		{
+			break;
+		}
+		SlowTask.EnterProgressFrame(1.0f);
+
+		if (PendingWrites.Num() >= MaxPendingWrites)
+		{
+			FinishOldestWrite();
+		}
+
+		FMeshLayers MeshLayers;
+		MeshLayers.MeshFile = GetMeshFilePath(Mesh, RootLayerPath, SceneFileExtension);
+		if (Options.bUsePayload)
+		{
+			MeshLayers.PayloadFile = FPaths::Combine(FPaths::GetPath(MeshLayers.MeshFile), Mesh->GetName() + TEXT("_payload") + PayloadFormat);
+		}
+
+		FString SourceHash;
+		if (ExportCache)
+		{
+			SourceHash = FUSDExtraExportCache::HashAssetSource(Mesh);
+			if (ExportCache->IsUpToDate(Mesh, SourceHash, ExportOptionsHash, MeshLayers.MeshFile))
+			{
+				UE_LOG(LogUsd, Log, TEXT("Reusing unchanged %s mesh '%s' from filepath '%s'"), MeshType, *Mesh->GetName(), *MeshLayers.MeshFile);
+				ExportedAssets.Add(Mesh, MeshLayers.MeshFile);
+				continue;
+			}
+		}
+
+		UE_LOG(LogUsd, Log, TEXT("Exporting %s mesh '%s' to filepath '%s'"), MeshType, *Mesh->GetName(), *MeshLayers.MeshFile);
+
+		if (!ConvertMeshToLayers(Mesh, bSkeletal, Options, MeshLayers))
+		{
+			UE_LOG(LogUsd, Warning, TEXT("Failed to export %s mesh '%s' to filepath '%s'"), MeshType, *Mesh->GetName(), *MeshLayers.MeshFile);
+			continue;
+		}
+		IFileManager::Get().MakeDirectory(*FPaths::GetPath(MeshLayers.MeshFile), true);
+
+		FPendingMeshWrite& PendingWrite = PendingWrites.AddDefaulted_GetRef();
+		PendingWrite.Mesh = Mesh;
+		PendingWrite.MeshFile = MeshLayers.MeshFile;
+		PendingWrite.PayloadFile = MeshLayers.PayloadFile;
+		PendingWrite.SourceHash = SourceHash;
+		PendingWrite.Result = Async(EAsyncExecution::ThreadPool, [MeshLayers = MoveTemp(MeshLayers)]() mutable
+		{
+			return WriteMeshLayers(MeshLayers);
+		});
+	}
+
+	while (PendingWrites.Num() > 0)
+	{
+		FinishOldestWrite();
+	}
+}
+
+bool FUSDExtraLevelExporter::ExportLevel()
+{
+	using namespace USDExtraLevelExporterImpl;
+
+	UE_LOG(LogUsd, Log, TEXT("Creating new stage with root layer '%s'"), *RootLayerPath);
+
+	FScopedUsdAllocs UsdAllocs;
+
+	const pxr::UsdStageRefPtr Stage = pxr::UsdStage::CreateNew(UnrealToUsd::ConvertString(*RootLayerPath).Get());
+	if (!Stage)
+	{
+		UE_LOG(LogUsd, Error, TEXT("Failed to create a new stage with root layer '%s'"), *RootLayerPath);
+		return false;
+	}
+
+	const pxr::SdfLayerRefPtr RootLayer = Stage->GetRootLayer();
+	const pxr::SdfPath RootPrimPath = pxr::SdfPath::AbsoluteRootPath().AppendChild(UnrealToUsd::ConvertToken(RootPrimName).Get());
+
+	// Set stage metadata
+	pxr::UsdGeomSetStageUpAxis(Stage, Options.StageOptions.UpAxis == EUsdUpAxis::ZAxis ? pxr::UsdGeomTokens->z : pxr::UsdGeomTokens->y);
+	pxr::UsdGeomSetStageMetersPerUnit(Stage, Options.StageOptions.MetersPerUnit);
+	Stage->SetStartTimeCode(Options.StartTimeCode);
+	Stage->SetEndTimeCode(Options.EndTimeCode);
+
+	FLevelExportContext Context{ Options, ExportedAssets };
+
+	// Component traversal handles parent components before their children, but the actors have to be sorted so
+	// that parent actors come first, otherwise a child could force default Xform prims onto its parents' paths
+	TArray<AActor*> SortedActors = Actors;
+	Algo::StableSortBy(SortedActors, &GetAttachDepth);
+
+	// Author the whole prim hierarchy with the stage composing only once at the end of the block
+	{
+		pxr::SdfChangeBlock ChangeBlock;
+
+		DefinePrimSpec(Context, RootLayer, RootPrimPath, USDExtraTokensType::USDScene);
+		RootLayer->SetDefaultPrim(RootPrimPath.GetNameToken());
+
+		// Prepare a sublayer for each sublevel, the persistent level is authored in the root layer
+		TMap<ULevel*, pxr::SdfLayerRefPtr> LevelToLayer;
+		if (Options.bExportSublayers)
+		{
+			for (AActor* Actor : SortedActors)
+			{
+				ULevel* Level = Actor->GetLevel();
+				if (!Level || LevelToLayer.Contains(Level))
+				{
+					continue;
+				}
+
+				if (Level->IsPersistentLevel())
+				{
+					LevelToLayer.Add(Level, RootLayer);
+					continue;
+				}
+
+				const FString SublayerPath = FPaths::Combine(FPaths::GetPath(RootLayerPath), Level->GetOuter()->GetName() + SceneFileExtension);
+				pxr::SdfLayerRefPtr Sublayer = pxr::SdfLayer::CreateNew(UnrealToUsd::ConvertString(*SublayerPath).Get());
+				if (!Sublayer)
+				{
+					UE_LOG(LogUsd, Warning, TEXT("Failed to create sublayer '%s', its actors will be written to the root layer"), *SublayerPath);
+					LevelToLayer.Add(Level, RootLayer);
+					continue;
+				}
+
+				SetLayerMetadata(Sublayer, Options);
+				RootLayer->InsertSubLayerPath(UnrealToUsd::ConvertString(*MakePathRelativeToLayer(RootLayer, SublayerPath)).Get());
+				LevelToLayer.Add(Level, Sublayer);
+			}
+		}
+
+		if (Options.bExportActorFolders && Options.World)
+		{
+			FActorFolders::Get().ForEachFolder(*Options.World, [&Context, &RootLayer, &RootPrimPath](const FFolder& Folder)
+			{
+				const FString FolderName = Folder.GetLeafName().ToString();
+				if (FolderName.IsEmpty())
+				{
+					return true;
+				}
+
+				UE_LOG(LogUsd, Log, TEXT("Exporting Folder '%s'"), *FolderName);
+
+				AuthorFolderPrim(Context, RootLayer, RootPrimPath, FolderName);
+				return true;
+			});
+		}
+
+		UE_LOG(LogUsd, Log, TEXT("Exporting components from %d actors"), SortedActors.Num());
+
+		for (AActor* Actor : SortedActors)
+		{
+			USceneComponent* RootComponent = Actor->GetRootComponent();
+			if (!RootComponent || Context.VisitedComponents.Contains(RootComponent))
+			{
+				continue;
+			}
+			Context.VisitedComponents.Add(RootComponent);
+
+			// If this actor is in a sublevel, make sure the prims are authored in the matching sublayer
+			const pxr::SdfLayerRefPtr* Layer = LevelToLayer.Find(Actor->GetLevel());
+			AuthorComponentPrims(Context, Layer ? *Layer : RootLayer, RootComponent);
+		}
+	}
+
+	// The converters read back the composed prims, so they run once the hierarchy exists on the stage
+	for (const FComponentToConvert& ComponentToConvert : Context.ComponentsToConvert)
+	{
+		ConvertComponent(Stage, ComponentToConvert);
+	}
+	Stage->SetEditTarget(pxr::UsdEditTarget(RootLayer));
+
+	// The converters author plain attributes, they are compacted once every prim is written
+	if (Options.bCompactReferences)
+	{
+		for (const pxr::SdfLayerHandle& Layer : Stage->GetLayerStack(false))
+		{
+			UnrealToUSDExtra::CompactReferences(Layer, RootPrimPath);
+		}
+	}
+
+	// Write files
+	UE_LOG(LogUsd, Log, TEXT("Saving root layer '%s'"), *RootLayerPath);
+	if (Options.bExportSublayers)
+	{
+		for (const pxr::SdfLayerHandle& Layer : Stage->GetLayerStack(false))
+		{
+			Layer->Save();
+		}
+	}
+	RootLayer->Save();
+
+	if (Options.bIncrementalExport)
+	{
+		if (UUSDExtraExportTrackerSubsystem* ExportTracker = GEditor ? GEditor->GetEditorSubsystem<UUSDExtraExportTrackerSubsystem>() : nullptr)
+		{
+			Context.Record.UsedPrimPaths = MoveTemp(Context.ExportedPrimPaths);
+			ExportTracker->SetRecord(Options.World, RootLayerPath, MoveTemp(Context.Record));
+		}
+	}
+
+	return true;
+}
+
+bool FUSDExtraLevelExporter::ExportDelta(const FUSDExtraExportRecord& PreviousRecord, const FUSDExtraExportChanges& Changes)
+{
+	using namespace USDExtraLevelExporterImpl;
+
+	FScopedSlowTask SlowTask(3.0f, FText::Format(LOCTEXT("ExportingLevelDelta", "Exporting level changes to '{0}'"), FText::FromString(RootLayerPath)));
+	SlowTask.MakeDialog(true);
+
+	// Sort out which exported actors have to be written again, and which went away
+	SlowTask.EnterProgressFrame(1.0f);
+	const TSet<AActor*> ActorsToExport(CollectActors());
+
+	TMap<AActor*, FString> DirtyActors;
+	TArray<FString> RemovedActorPaths = Changes.DeletedActorPaths.Array();
+	for (const TPair<AActor*, FString>& DirtyActor : Changes.DirtyActors)
+	{
+		if (!ActorsToExport.Contains(DirtyActor.Key))
+		{
+			// Not exported anymore, like an actor moved into an ignored level
+			RemovedActorPaths.Add(DirtyActor.Value);
+			continue;
+		}
+
+		DirtyActors.Add(DirtyActor.Key, DirtyActor.Value);
+
+		// The prims of attached actors are nested in the prims of their parent, so they have to follow them
+		TArray<AActor*> AttachedActors;
+		DirtyActor.Key->GetAttachedActors(AttachedActors, true, true);
+		for (AActor* AttachedActor : AttachedActors)
+		{
+			if (ActorsToExport.Contains(AttachedActor) && !Changes.DirtyActors.Contains(AttachedActor))
+			{
+				DirtyActors.Add(AttachedActor, AttachedActor->GetPathName());
+			}
+		}
+	}
+
+	if (DirtyActors.Num() == 0 && RemovedActorPaths.Num() == 0)
+	{
+		UE_LOG(LogUsd, Log, TEXT("Nothing changed since the last export to '%s'"), *RootLayerPath);
+		return true;
+	}
+
+	TArray<AActor*> SortedActors;
+	DirtyActors.GetKeys(SortedActors);
+	Algo::StableSortBy(SortedActors, &GetAttachDepth);
+
+	// Export the assets of the changed actors, unchanged ones are skipped by the export cache
+	SlowTask.EnterProgressFrame(1.0f);
+	TArray<UObject*> StaticMeshes;
+	TArray<UObject*> SkeletalMeshes;
+	CollectMeshes(SortedActors, StaticMeshes, SkeletalMeshes);
+	ExportMeshes(StaticMeshes, false);
+	ExportMeshes(SkeletalMeshes, true);
+	if (ExportCache)
+	{
+		ExportCache->Save();
+	}
+
+	// Write the changes
+	SlowTask.EnterProgressFrame(1.0f);
+
+	UE_LOG(LogUsd, Log, TEXT("Exporting %d changed and %d removed actors"), SortedActors.Num(), RemovedActorPaths.Num());
+
+	FScopedUsdAllocs UsdAllocs;
+
+	const pxr::SdfLayerRefPtr RootLayer = pxr::SdfLayer::FindOrOpen(UnrealToUsd::ConvertString(*RootLayerPath).Get());
+	if (!RootLayer)
+	{
+		UE_LOG(LogUsd, Error, TEXT("Failed to open root layer '%s'"), *RootLayerPath);
+		return false;
+	}
+
+	const pxr::SdfLayerRefPtr DeltaLayer = CreateDeltaLayer(RootLayer, RootLayerPath, SceneFileExtension, Options);
+	if (!DeltaLayer)
+	{
+		return false;
+	}
+
+	// The payloads hold the mesh data of the referenced assets, which nothing written into a delta depends on
+	const pxr::UsdStageRefPtr Stage = pxr::UsdStage::Open(RootLayer, pxr::UsdStage::LoadNone);
+	if (!Stage)
+	{
+		UE_LOG(LogUsd, Error, TEXT("Failed to open a stage with root layer '%s'"), *RootLayerPath);
+		return false;
+	}
+	Stage->SetEditTarget(pxr::UsdEditTarget(DeltaLayer));
+
+	const pxr::SdfPath RootPrimPath = pxr::SdfPath::AbsoluteRootPath().AppendChild(UnrealToUsd::ConvertToken(RootPrimName).Get());
+
+	FLevelExportContext Context{ Options, ExportedAssets };
+	Context.bAuthoringDelta = true;
+	Context.Record = PreviousRecord;
+	Context.ExportedPrimPaths = MoveTemp(Context.Record.UsedPrimPaths);
+
+	// The prims the exporter defines all live in the layer stack, so its specs are walked rather than composing every referenced asset
+	for (const pxr::SdfLayerHandle& Layer : Stage->GetLayerStack(false))
+	{
+		Layer->Traverse(pxr::SdfPath::AbsoluteRootPath(), [&Context, &Layer](const pxr::SdfPath& Path)
+		{
+			if (!Path.IsPrimPath())
+			{
+				return;
+			}
+
+			const pxr::SdfPrimSpecHandle PrimSpec = Layer->GetPrimAtPath(Path);
+			if (PrimSpec && PrimSpec->GetSpecifier() == pxr::SdfSpecifierDef)
+			{
+				Context.DefinedPrimPaths.Add(UsdToUnreal::ConvertPath(Path));
+			}
+		});
+	}
+
+	// Prims of changed actors are written again on their previous paths when they still fit,
+	// whatever isn't written again is deactivated. Removed actors keep their paths reserved, so that
+	// a new actor doesn't end up on a deactivated prim, or on top of what an old actor left there
+	TArray<FString> StalePrimPaths;
+	for (const FString& RemovedActorPath : RemovedActorPaths)
+	{
+		TArray<FString> PrimPaths;
+		if (Context.Record.ActorPrimPaths.RemoveAndCopyValue(RemovedActorPath, PrimPaths))
+		{
+			StalePrimPaths.Append(PrimPaths);
+		}
+	}
+	for (const TPair<AActor*, FString>& DirtyActor : DirtyActors)
+	{
+		TArray<FString> PrimPaths;
+		if (Context.Record.ActorPrimPaths.RemoveAndCopyValue(DirtyActor.Value, PrimPaths))
+		{
+			for (const FString& PrimPath : PrimPaths)
+			{
+				Context.ExportedPrimPaths.Remove(PrimPath);
+			}
+			StalePrimPaths.Append(PrimPaths);
+		}
+	}
+
+	{
+		pxr::SdfChangeBlock ChangeBlock;
+
+		// Folders created since the last export
+		if (Options.bExportActorFolders && Options.World)
+		{
+			FActorFolders::Get().ForEachFolder(*Options.World, [&Context, &DeltaLayer, &RootPrimPath](const FFolder& Folder)
+			{
+				const FString FolderName = Folder.GetLeafName().ToString();
+				const FString FolderPrimPath = UsdToUnreal::ConvertPath(RootPrimPath) + TEXT("/") + MakeValidIdentifier(FolderName);
+				if (!FolderName.IsEmpty() && !Context.DefinedPrimPaths.Contains(FolderPrimPath))
+				{
+					AuthorFolderPrim(Context, DeltaLayer, RootPrimPath, FolderName);
+				}
+				return true;
+			});
+		}
+
+		for (AActor* Actor : SortedActors)
+		{
+			USceneComponent* RootComponent = Actor->GetRootComponent();
+			if (!RootComponent || Context.VisitedComponents.Contains(RootComponent))
+			{
+				continue;
+			}
+			Context.VisitedComponents.Add(RootComponent);
+
+			// Attach actors to the prim their parent was actually written to, which may be in an earlier layer
+			FString ParentPrimPath;
+			if (const USceneComponent* AttachParent = RootComponent->GetAttachParent())
+			{
+				if (const FString* AttachParentPrimPath = Context.Record.ComponentPrimPaths.Find(AttachParent->GetPathName()))
+				{
+					ParentPrimPath = *AttachParentPrimPath;
+				}
+			}
+
+			AuthorComponentPrims(Context, DeltaLayer, RootComponent, ParentPrimPath);
+		}
+
+		TSet<FString> WrittenPrimPaths;
+		for (const FComponentToConvert& ComponentToConvert : Context.ComponentsToConvert)
+		{
+			WrittenPrimPaths.Add(UsdToUnreal::ConvertPath(ComponentToConvert.PrimPath));
+			if (!ComponentToConvert.InstancerPath.IsEmpty())
+			{
+				WrittenPrimPaths.Add(UsdToUnreal::ConvertPath(ComponentToConvert.InstancerPath));
+			}
+		}
+
+		for (const FString& StalePrimPath : StalePrimPaths)
+		{
+			if (WrittenPrimPaths.Contains(StalePrimPath))
+			{
+				continue;
+			}
+			Context.ExportedPrimPaths.Add(StalePrimPath);
+
+			if (pxr::SdfPrimSpecHandle StalePrimSpec = pxr::SdfCreatePrimInLayer(DeltaLayer, ToSdfPath(StalePrimPath)))
+			{
+				StalePrimSpec->SetActive(false);
+			}
+		}
+	}
+
+	for (const FComponentToConvert& ComponentToConvert : Context.ComponentsToConvert)
+	{
+		ConvertComponent(Stage, ComponentToConvert);
+	}
+
+	// Once the stage holds compact references the deltas are compacted too, their attributes would be shadowed by the custom data of the weaker layers otherwise
+	const pxr::UsdPrim RootPrim = Stage->GetPrimAtPath(RootPrimPath);
+	if (Options.bCompactReferences || (RootPrim && !RootPrim.GetCustomDataByKey(USDExtraIdentifiers::UnrealReferenceTables).IsEmpty()))
+	{
+		UnrealToUSDExtra::CompactReferences(DeltaLayer, RootPrimPath);
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Saving delta layer '%s'"), *UsdToUnreal::ConvertString(DeltaLayer->GetRealPath()));
+	DeltaLayer->Save();
+	RootLayer->Save();
+
+	if (UUSDExtraExportTrackerSubsystem* ExportTracker = GEditor ? GEditor->GetEditorSubsystem<UUSDExtraExportTrackerSubsystem>() : nullptr)
+	{
+		Context.Record.UsedPrimPaths = MoveTemp(Context.ExportedPrimPaths);
+		ExportTracker->SetRecord(Options.World, RootLayerPath, MoveTemp(Context.Record));
+	}
+
+	return true;
+}
+
+bool FUSDExtraLevelExporter::SquashDeltaLayers()
+{
+	using namespace USDExtraLevelExporterImpl;
+
+	FScopedUsdAllocs UsdAllocs;
+
+	const pxr::SdfLayerRefPtr RootLayer = pxr::SdfLayer::FindOrOpen(UnrealToUsd::ConvertString(*RootLayerPath).Get());
+	if (!RootLayer)
+	{
+		UE_LOG(LogUsd, Error, TEXT("Failed to open root layer '%s'"), *RootLayerPath);
+		return false;
+	}
+
+	const FString BaseLayerPath = GetBaseLayerPath(RootLayerPath, SceneFileExtension);
+	const std::string BaseLayerRelativePath = UnrealToUsd::ConvertString(*MakePathRelativeToLayer(RootLayer, BaseLayerPath)).Get();
+	if (!HasSubLayerPath(RootLayer, BaseLayerRelativePath))
+	{
+		// Never exported incrementally
+		return true;
+	}
+
+	TArray<FString> DeltaLayerPaths;
+	for (const std::string& SubLayerPath : static_cast<std::vector<std::string>>(RootLayer->GetSubLayerPaths()))
+	{
+		if (SubLayerPath != BaseLayerRelativePath)
+		{
+			DeltaLayerPaths.Add(FPaths::Combine(FPaths::GetPath(RootLayerPath), UsdToUnreal::ConvertString(SubLayerPath)));
+		}
+	}
+	if (DeltaLayerPaths.Num() == 0)
+	{
+		return true;
+	}
+
+	const pxr::SdfLayerRefPtr BaseLayer = pxr::SdfLayer::FindOrOpen(UnrealToUsd::ConvertString(*BaseLayerPath).Get());
+	if (!BaseLayer)
+	{
+		UE_LOG(LogUsd, Error, TEXT("Failed to open base layer '%s'"), *BaseLayerPath);
+		return false;
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Squashing %d delta layers into '%s'"), DeltaLayerPaths.Num(), *BaseLayerPath);
+
+	// Only flatten the deltas onto the base layer, the sublevel layers under it stay separate files
+	const std::vector<std::string> LevelLayerPaths = BaseLayer->GetSubLayerPaths();
+	BaseLayer->SetSubLayerPaths({});
+
+	pxr::SdfLayerRefPtr FlattenedLayer;
+	{
+		const pxr::UsdStageRefPtr Stage = pxr::UsdStage::Open(RootLayer, pxr::UsdStage::LoadNone);
+		if (Stage)
+		{
+			// All the layers are in the same folder, so relative asset paths stay valid as they are
+			FlattenedLayer = pxr::UsdUtilsFlattenLayerStack(Stage, [](const pxr::SdfLayerHandle& SourceLayer, const std::string& AssetPath)
+			{
+				return AssetPath;
+			});
+		}
+	}
+
+	if (!FlattenedLayer)
+	{
+		UE_LOG(LogUsd, Error, TEXT("Failed to flatten the delta layers of '%s'"), *RootLayerPath);
+		BaseLayer->SetSubLayerPaths(LevelLayerPaths);
+		return false;
+	}
+
+	BaseLayer->TransferContent(FlattenedLayer);
+	BaseLayer->SetSubLayerPaths(LevelLayerPaths);
+	BaseLayer->Save();
+
+	RootLayer->SetSubLayerPaths({ BaseLayerRelativePath });
+	RootLayer->Save();
+
+	for (const FString& DeltaLayerPath : DeltaLayerPaths)
+	{
+		IFileManager::Get().Delete(*DeltaLayerPath);
+	}
+
+	return true;
+}
+
+#undef LOCTEXT_NAMESPACE
+
+#else
+
+FUSDExtraLevelExporter::FUSDExtraLevelExporter(const UUSDExtraExportOptions& InOptions)
+	: Options(InOptions)
+{
+}
+
+FUSDExtraLevelExporter::~FUSDExtraLevelExporter() = default;
+
+const TArray<AActor*>& FUSDExtraLevelExporter::CollectActors()
+{
+	return Actors;
+}
+
+bool FUSDExtraLevelExporter::RequiresPythonExport()
+{
+	return true;
+}
+
+bool FUSDExtraLevelExporter::Export()
+{
+	return false;
+}
+
+void FUSDExtraLevelExporter::ExportMeshes(const TArray<UObject*>& Meshes, bool bSkeletal)
+{
+}
+
+bool FUSDExtraLevelExporter::ExportLevel()
+{
+	return false;
+}
+
+bool FUSDExtraLevelExporter::ExportDelta(const FUSDExtraExportRecord& PreviousRecord, const FUSDExtraExportChanges& Changes)
+{
+	return false;
+}
+
+bool FUSDExtraLevelExporter::SquashDeltaLayers()
+{
+	return false;
+}
+
+#endif // USE_USD_SDK
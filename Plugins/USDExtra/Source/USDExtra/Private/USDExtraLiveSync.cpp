@@ -0,0 +1,423 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraLiveSync.h"
+
+#include "Editor.h"
+#include "EditorBuildUtils.h"
+#include "Engine/World.h"
+#include "HAL/FileManager.h"
+#include "UObject/GCObject.h"
+#include "USDExtraSettings.h"
+#include "USDExtraUtils.h"
+#include "USDExtraWorldContentSubsystem.h"
+#include "USDLog.h"
+#include "USDMemory.h"
+#include "USDTypesConversion.h"
+#include "UsdWrappers/UsdStage.h"
+
+#if USE_USD_SDK
+#include "USDIncludesStart.h"
+	#include "pxr/base/tf/notice.h"
+	#include "pxr/base/tf/weakBase.h"
+	#include "pxr/usd/sdf/layer.h"
+	#include "pxr/usd/usd/notice.h"
+	#include "pxr/usd/usd/stage.h"
+#include "USDIncludesEnd.h"
+
+namespace USDExtraLiveSyncImpl
+{
+	/** Collects the prim paths of the ObjectsChanged notices sent by a stage, until they are applied */
+	class FStageListener : public pxr::TfWeakBase
+	{
+	public:
+		explicit FStageListener(const pxr::UsdStageRefPtr& Stage)
+		{
+			Key = pxr::TfNotice::Register(pxr::TfCreateWeakPtr(this), &FStageListener::HandleObjectsChanged, pxr::UsdStageWeakPtr(Stage));
+		}
+
+		~FStageListener()
+		{
+			pxr::TfNotice::Revoke(Key);
+		}
+
+		void HandleObjectsChanged(const pxr::UsdNotice::ObjectsChanged& Notice, const pxr::UsdStageWeakPtr& Sender)
+		{
+			for (const pxr::SdfPath& Path : Notice.GetResyncedPaths())
+			{
+				DirtyPrimPaths.Add(UsdToUnreal::ConvertPath(Path.GetPrimPath()));
+			}
+			for (const pxr::SdfPath& Path : Notice.GetChangedInfoOnlyPaths())
+			{
+				DirtyPrimPaths.Add(UsdToUnreal::ConvertPath(Path.GetPrimPath()));
+			}
+		}
+
+		/** Notices are sent on the thread that edits or reloads the stage, which is always the game thread here */
+		TSet<FString> DirtyPrimPaths;
+
+	private:
+		pxr::TfNotice::Key Key;
+	};
+
+	/**
+	 * Rebuilds the scope the children of UsdPrim were imported into, from the records of the prims above it.
+	 * Returns false when its children were not imported, because an ancestor was ignored or failed to convert.
+	 */
+	bool ResolveImportScope(const pxr::UsdPrim& UsdPrim, const USDExtraToUnreal::FImportFingerprints& Fingerprints, FUSDExtraWorldContentIndex& WorldContent, USDExtraToUnreal::FReferenceCache* ReferenceCache, USDExtraToUnreal::FImportScope& OutScope)
+	{
+		using namespace USDExtraToUnreal;
+
+		// Prims between the default prim and UsdPrim, outermost first
+		const pxr::UsdPrim DefaultPrim = UsdPrim.GetStage()->GetDefaultPrim();
+		TArray<pxr::UsdPrim> Prims;
+		pxr::UsdPrim Prim = UsdPrim;
+		for (; Prim && Prim != DefaultPrim; Prim = Prim.GetParent())
+		{
+			Prims.Insert(Prim, 0);
+		}
+		if (!Prim)
+		{
+			return false;
+		}
+
+		OutScope = FImportScope();
+		for (const pxr::UsdPrim& ScopePrim : Prims)
+		{
+			const FUSDExtraToUnrealInfo PrimInfo = GatherPrimConversionInfo(ScopePrim, ReferenceCache);
+
+			// Same scopes as ConvertPrimTree gives to the prims it visits
+			if (const FImportFingerprints::FPrimRecord* Record = Fingerprints.Previous.Find(UsdToUnreal::ConvertPath(ScopePrim.GetPath())))
+			{
+				USceneComponent* SceneComponent = WorldContent.Find(FName(Record->ObjectPath));
+				if (!SceneComponent || !SceneComponent->GetOwner())
+				{
+					return false;
+				}
+
+				FImportScope Scope;
+				Scope.Kind = FImportScope::EKind::Component;
+				Scope.ActorFolderPath = PrimInfo.PrimUsage == EUnrealPrimUsage::Actor && OutScope.Kind != FImportScope::EKind::Root ? OutScope.ActorFolderPath : PrimInfo.ActorFolderPath;
+				Scope.OwnerActor = SceneComponent->GetOwner();
+				Scope.SceneComponent = SceneComponent;
+				Scope.bSpawned = Record->bSpawned;
+				OutScope = Scope;
+			}
+			else if (PrimInfo.PrimType == EUnrealPrimType::Folder && OutScope.Kind != FImportScope::EKind::Component)
+			{
+				OutScope.ActorFolderPath = OutScope.Kind == FImportScope::EKind::Folder ? FName(OutScope.ActorFolderPath.ToString() + "/" + PrimInfo.ActorFolderPath.ToString()) : PrimInfo.ActorFolderPath;
+				OutScope.Kind = FImportScope::EKind::Folder;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+#endif // #if USE_USD_SDK
+
+/** The stage synced into a world, with what is needed to convert its prims again */
+class FUSDExtraLiveSyncSession : public FGCObject
+{
+public:
+	/** The referenced classes and assets stay cached between ticks, so they must survive garbage collections */
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override
+	{
+#if USE_USD_SDK
+		ReferenceCache.AddReferencedObjects(Collector);
+#endif // #if USE_USD_SDK
+	}
+
+	virtual FString GetReferencerName() const override
+	{
+		return TEXT("FUSDExtraLiveSyncSession");
+	}
+
+	TWeakObjectPtr<UWorld> World;
+	FString FilePath;
+
+#if USE_USD_SDK
+	~FUSDExtraLiveSyncSession()
+	{
+		FScopedUsdAllocs Allocs;
+		Listener.Reset();
+	}
+
+	UE::FUsdStage Stage;
+	USDExtraToUnreal::FReferenceCache ReferenceCache;
+	USDExtraToUnreal::FImportFingerprints Fingerprints;
+
+	/** Allocated and freed with the USD allocator */
+	TUniquePtr<USDExtraLiveSyncImpl::FStageListener> Listener;
+#endif // #if USE_USD_SDK
+
+	/** Modification time of the file of each layer used by the stage, when it was last loaded */
+	TMap<FString, FDateTime> LayerTimestamps;
+	double LastPollTime = 0.0;
+};
+
+UUSDExtraLiveSyncSubsystem::~UUSDExtraLiveSyncSubsystem() = default;
+
+void UUSDExtraLiveSyncSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	FWorldDelegates::OnWorldCleanup.AddUObject(this, &UUSDExtraLiveSyncSubsystem::HandleWorldCleanup);
+}
+
+void UUSDExtraLiveSyncSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldCleanup.RemoveAll(this);
+
+	StopLiveSync();
+
+	Super::Deinitialize();
+}
+
+void UUSDExtraLiveSyncSubsystem::Tick(float DeltaTime)
+{
+	const double Now = FPlatformTime::Seconds();
+	if (Now - Session->LastPollTime >= GetDefault<UUSDExtraSettings>()->LiveSyncPollInterval)
+	{
+		Session->LastPollTime = Now;
+		ReloadChangedLayers();
+	}
+
+	// Everything queued during this tick, by the reload above or by edits made to the stage from elsewhere, goes in one batch
+	ApplyChanges();
+}
+
+bool UUSDExtraLiveSyncSubsystem::IsTickable() const
+{
+	return Session.IsValid();
+}
+
+TStatId UUSDExtraLiveSyncSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUSDExtraLiveSyncSubsystem, STATGROUP_Tickables);
+}
+
+bool UUSDExtraLiveSyncSubsystem::IsLiveSyncing() const
+{
+	return Session.IsValid();
+}
+
+#if USE_USD_SDK
+
+bool UUSDExtraLiveSyncSubsystem::StartLiveSync(UWorld* World, const FString& FilePath)
+{
+	StopLiveSync();
+
+	if (!World)
+	{
+		return false;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	TUniquePtr<FUSDExtraLiveSyncSession> NewSession = MakeUnique<FUSDExtraLiveSyncSession>();
+	NewSession->World = World;
+	NewSession->FilePath = FilePath;
+
+	// Not shared through the stage cache, so that nothing else edits or reloads it behind the session
+	NewSession->Stage = USDExtraToUnreal::OpenImportStage(FilePath, false);
+	if (!NewSession->Stage)
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Failed to open '%s' for live sync"), *FilePath);
+		return false;
+	}
+
+	FUSDExtraWorldContentIndex& WorldContent = GEditor->GetEditorSubsystem<UUSDExtraWorldContentSubsystem>()->GetWorldContent(World);
+
+	{
+		FScopedUsdAllocs Allocs;
+
+		pxr::UsdStageRefPtr StageRef = NewSession->Stage;
+		USDExtraToUnreal::PreloadReferences(StageRef, NewSession->ReferenceCache);
+
+		// Starts from the last import of the file, so that syncing a level that is already up to date converts nothing
+		NewSession->Fingerprints.Load(USDExtraToUnreal::FImportFingerprints::GetFilePath(World, FilePath));
+		const int32 NumVisitedPrims = USDExtraToUnreal::ConvertStage(StageRef, WorldContent, &NewSession->ReferenceCache, World, &NewSession->Fingerprints);
+		NewSession->Fingerprints.RemoveDeletedPrims(StageRef, WorldContent, World);
+		NewSession->Fingerprints.Save(USDExtraToUnreal::FImportFingerprints::GetFilePath(World, FilePath));
+
+		NewSession->Listener = MakeUnique<USDExtraLiveSyncImpl::FStageListener>(StageRef);
+
+		UE_LOG(LogUsd, Log, TEXT("Started live sync of %s, imported %d prims in %.3f seconds"), *FilePath, NumVisitedPrims, FPlatformTime::Seconds() - StartTime);
+	}
+
+	FEditorBuildUtils::EditorBuild(World, FBuildOptions::BuildVisibleGeometry);
+
+	Session = MoveTemp(NewSession);
+	Session->LastPollTime = FPlatformTime::Seconds();
+	ReloadChangedLayers();
+
+	return true;
+}
+
+void UUSDExtraLiveSyncSubsystem::StopLiveSync()
+{
+	if (!Session)
+	{
+		return;
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Stopped live sync of %s"), *Session->FilePath);
+
+	Session.Reset();
+}
+
+void UUSDExtraLiveSyncSubsystem::ReloadChangedLayers()
+{
+	FScopedUsdAllocs Allocs;
+
+	pxr::UsdStageRefPtr StageRef = Session->Stage;
+
+	// Layers seen for the first time are taken as loaded from their current file
+	int32 NumReloadedLayers = 0;
+	for (const pxr::SdfLayerHandle& Layer : StageRef->GetUsedLayers())
+	{
+		const FString LayerFilePath = Layer->IsAnonymous() ? FString() : UsdToUnreal::ConvertString(Layer->GetRealPath());
+		if (LayerFilePath.IsEmpty())
+		{
+			continue;
+		}
+
+		const FDateTime Timestamp = IFileManager::Get().GetTimeStamp(*LayerFilePath);
+		FDateTime& LoadedTimestamp = Session->LayerTimestamps.FindOrAdd(LayerFilePath, Timestamp);
+		if (LoadedTimestamp != Timestamp && Timestamp != FDateTime::MinValue())
+		{
+			// A file still being written fails to reload, and is tried again on the next poll
+			if (Layer->Reload())
+			{
+				LoadedTimestamp = Timestamp;
+				++NumReloadedLayers;
+			}
+		}
+	}
+
+	// Prims that became BSP prims or got children in the scene layers, or were added as such, need their payload
+	if (NumReloadedLayers > 0 && GetDefault<UUSDExtraSettings>()->bDeferImportPayloads)
+	{
+		USDExtraToUnreal::LoadGeometryPayloads(StageRef);
+	}
+
+	if (NumReloadedLayers > 0)
+	{
+		UE_LOG(LogUsd, Log, TEXT("Reloaded %d changed layers of %s"), NumReloadedLayers, *Session->FilePath);
+	}
+}
+
+void UUSDExtraLiveSyncSubsystem::ApplyChanges()
+{
+	UWorld* World = Session->World.Get();
+	if (!World || Session->Listener->DirtyPrimPaths.Num() == 0)
+	{
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	const TSet<FString> DirtyPrimPaths = MoveTemp(Session->Listener->DirtyPrimPaths);
+	Session->Listener->DirtyPrimPaths.Reset();
+
+	FUSDExtraWorldContentIndex& WorldContent = GEditor->GetEditorSubsystem<UUSDExtraWorldContentSubsystem>()->GetWorldContent(World);
+	USDExtraToUnreal::FImportFingerprints& Fingerprints = Session->Fingerprints;
+
+	FScopedUsdAllocs Allocs;
+
+	pxr::UsdStageRefPtr StageRef = Session->Stage;
+	const pxr::UsdPrim DefaultPrim = StageRef->GetDefaultPrim();
+	if (!DefaultPrim)
+	{
+		return;
+	}
+
+	// Every record is carried over by RemoveDeletedPrims, except those of the prims converted again below
+	Fingerprints.Previous = MoveTemp(Fingerprints.Current);
+	Fingerprints.Current.Reset();
+	Fingerprints.NumSkippedPrims = 0;
+
+	pxr::SdfPathVector Paths;
+	Paths.reserve(DirtyPrimPaths.Num());
+	for (const FString& DirtyPrimPath : DirtyPrimPaths)
+	{
+		Paths.push_back(UnrealToUsd::ConvertPath(*DirtyPrimPath).Get());
+	}
+	pxr::SdfPath::RemoveDescendentPaths(&Paths);
+
+	const bool bFullPass = std::any_of(Paths.begin(), Paths.end(), [&DefaultPrim](const pxr::SdfPath& Path)
+	{
+		return DefaultPrim.GetPath().HasPrefix(Path);
+	});
+
+	int32 NumVisitedPrims = 0;
+	if (bFullPass)
+	{
+		// The compact reference tables live on the default prim, so they can only have changed in a full pass
+		Session->ReferenceCache.Tables.Read(StageRef);
+		NumVisitedPrims = USDExtraToUnreal::ConvertStage(StageRef, WorldContent, &Session->ReferenceCache, World, &Fingerprints);
+	}
+	else
+	{
+		for (const pxr::SdfPath& Path : Paths)
+		{
+			// Removed and deactivated prims are handled by RemoveDeletedPrims
+			const pxr::UsdPrim UsdPrim = StageRef->GetPrimAtPath(Path);
+			if (!UsdPrim || !UsdPrim.IsActive() || !Path.HasPrefix(DefaultPrim.GetPath()))
+			{
+				continue;
+			}
+
+			USDExtraToUnreal::FImportScope ParentScope;
+			if (USDExtraLiveSyncImpl::ResolveImportScope(UsdPrim.GetParent(), Fingerprints, WorldContent, &Session->ReferenceCache, ParentScope))
+			{
+				NumVisitedPrims += USDExtraToUnreal::ConvertPrimTree(StageRef, UsdPrim, ParentScope, WorldContent, &Session->ReferenceCache, World, &Fingerprints);
+			}
+		}
+	}
+
+	const int32 NumConvertedPrims = NumVisitedPrims - Fingerprints.NumSkippedPrims;
+	const int32 NumRemovedPrims = Fingerprints.RemoveDeletedPrims(StageRef, WorldContent, World);
+	if (NumConvertedPrims > 0 || NumRemovedPrims > 0)
+	{
+		Fingerprints.Save(USDExtraToUnreal::FImportFingerprints::GetFilePath(World, Session->FilePath));
+		FEditorBuildUtils::EditorBuild(World, FBuildOptions::BuildVisibleGeometry);
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Live sync applied %d changed paths of %s in %.3f seconds: converted %d prims, removed %d"),
+		static_cast<int32>(Paths.size()), *Session->FilePath, FPlatformTime::Seconds() - StartTime, NumConvertedPrims, NumRemovedPrims);
+}
+
+#else
+
+bool UUSDExtraLiveSyncSubsystem::StartLiveSync(UWorld* World, const FString& FilePath)
+{
+	return false;
+}
+
+void UUSDExtraLiveSyncSubsystem::StopLiveSync()
+{
+	Session.Reset();
+}
+
+void UUSDExtraLiveSyncSubsystem::ReloadChangedLayers()
+{
+}
+
+void UUSDExtraLiveSyncSubsystem::ApplyChanges()
+{
+}
+
+#endif // #if USE_USD_SDK
+
+void UUSDExtraLiveSyncSubsystem::HandleWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources)
+{
+	if (Session && Session->World == World)
+	{
+		StopLiveSync();
+	}
+}
@@ -0,0 +1,162 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraStringCache.h"
+
+#if USE_USD_SDK
+#include "USDTypesConversion.h"
+
+namespace USDExtraStringCacheImpl
+{
+	/** Read or write lock of a cache, only taken when the cache is thread safe */
+	class FConditionalScopeLock
+	{
+	public:
+		UE_NONCOPYABLE(FConditionalScopeLock);
+
+		FConditionalScopeLock(FRWLock& InLock, bool bInLocked, bool bInWrite)
+			: Lock(InLock)
+			, bLocked(bInLocked)
+			, bWrite(bInWrite)
+		{
+			if (!bLocked)
+			{
+				return;
+			}
+
+			if (bWrite)
+			{
+				Lock.WriteLock();
+			}
+			else
+			{
+				Lock.ReadLock();
+			}
+		}
+
+		~FConditionalScopeLock()
+		{
+			if (!bLocked)
+			{
+				return;
+			}
+
+			if (bWrite)
+			{
+				Lock.WriteUnlock();
+			}
+			else
+			{
+				Lock.ReadUnlock();
+			}
+		}
+
+	private:
+		FRWLock& Lock;
+		bool bLocked;
+		bool bWrite;
+	};
+}
+
+FUSDExtraStringCache::FUSDExtraStringCache(bool bInThreadSafe)
+	: bThreadSafe(bInThreadSafe)
+{
+}
+
+FName FUSDExtraStringCache::ToName(const std::string& String)
+{
+	using namespace USDExtraStringCacheImpl;
+
+	{
+		FConditionalScopeLock ReadLock(Lock, bThreadSafe, false);
+		const std::unordered_map<std::string, FName>& Names = StringNames.Get();
+		const std::unordered_map<std::string, FName>::const_iterator It = Names.find(String);
+		if (It != Names.end())
+		{
+			NumHits.fetch_add(1, std::memory_order_relaxed);
+			return It->second;
+		}
+	}
+
+	// Converted outside of the lock, threads missing the same string at once just add the same name
+	NumMisses.fetch_add(1, std::memory_order_relaxed);
+	const FName Name(UsdToUnreal::ConvertString(String));
+
+	FConditionalScopeLock WriteLock(Lock, bThreadSafe, true);
+	FScopedUsdAllocs Allocs;
+	StringNames.Get().emplace(String, Name);
+
+	return Name;
+}
+
+FName FUSDExtraStringCache::ToName(const pxr::TfToken& Token)
+{
+	using namespace USDExtraStringCacheImpl;
+
+	{
+		FConditionalScopeLock ReadLock(Lock, bThreadSafe, false);
+		const std::unordered_map<pxr::TfToken, FName, pxr::TfToken::HashFunctor>& Names = TokenNames.Get();
+		const std::unordered_map<pxr::TfToken, FName, pxr::TfToken::HashFunctor>::const_iterator It = Names.find(Token);
+		if (It != Names.end())
+		{
+			NumHits.fetch_add(1, std::memory_order_relaxed);
+			return It->second;
+		}
+	}
+
+	NumMisses.fetch_add(1, std::memory_order_relaxed);
+	const FName Name(UsdToUnreal::ConvertToken(Token));
+
+	FConditionalScopeLock WriteLock(Lock, bThreadSafe, true);
+	FScopedUsdAllocs Allocs;
+	TokenNames.Get().emplace(Token, Name);
+
+	return Name;
+}
+
+pxr::TfToken FUSDExtraStringCache::ToToken(const FString& String)
+{
+	using namespace USDExtraStringCacheImpl;
+
+	{
+		FConditionalScopeLock ReadLock(Lock, bThreadSafe, false);
+		if (const TUsdStore<pxr::TfToken>* Token = StringTokens.Find(String))
+		{
+			NumHits.fetch_add(1, std::memory_order_relaxed);
+			return Token->Get();
+		}
+	}
+
+	NumMisses.fetch_add(1, std::memory_order_relaxed);
+	const TUsdStore<pxr::TfToken> Token = UnrealToUsd::ConvertToken(*String);
+
+	{
+		FConditionalScopeLock WriteLock(Lock, bThreadSafe, true);
+
+		// Callers are often in a USD allocator scope, but the map itself lives in Unreal memory
+		FScopedUnrealAllocs UnrealAllocs;
+		StringTokens.Add(String, Token);
+	}
+
+	return Token.Get();
+}
+
+void FUSDExtraStringCache::Reset()
+{
+	USDExtraStringCacheImpl::FConditionalScopeLock WriteLock(Lock, bThreadSafe, true);
+
+	{
+		FScopedUsdAllocs Allocs;
+		StringNames.Get().clear();
+		TokenNames.Get().clear();
+	}
+
+	{
+		FScopedUnrealAllocs UnrealAllocs;
+		StringTokens.Empty();
+	}
+
+	NumHits.store(0, std::memory_order_relaxed);
+	NumMisses.store(0, std::memory_order_relaxed);
+}
+#endif // #if USE_USD_SDK
@@ -3,16 +3,19 @@
 #include "BSPOps.h"
 #include "EditorActorFolders.h"
 #include "EditorBuildUtils.h"
+#include "Editor.h"
 #include "UnrealUSDWrapper.h"
 #include "USDTypesConversion.h"
 #include "EditorLevelUtils.h"
 #include "EngineUtils.h"
 #include "InstancedFoliageActor.h"
 #include "USDExtraSettings.h"
+#include "USDExtraWorldContentSubsystem.h"
 #include "IPythonScriptPlugin.h"
 #include "MeshDescription.h"
 #include "StaticMeshAttributes.h"
 #include "USDExtraExportOptions.h"
+#include "USDExtraLevelExporter.h"
 #include "USDGeomMeshConversion.h"
 #include "UsdWrappers/UsdPrim.h"
 #include "UsdWrappers/UsdStage.h"
@@ -28,18 +31,522 @@
 #include "FoliageHelper.h"
 #include "LandscapeHeightfieldCollisionComponent.h"
 #include "Components\ModelComponent.h"
+#include "Async/ParallelFor.h"
+#include "Dom/JsonObject.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
+#include "Hash/CityHash.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/GCObject.h"
 
 #if USE_USD_SDK
 #include "USDIncludesStart.h"
+	#include "pxr/base/tf/notice.h"
+	#include "pxr/base/tf/weakBase.h"
+	#include "pxr/base/vt/dictionary.h"
+	#include "pxr/usd/sdf/attributeSpec.h"
+	#include "pxr/usd/sdf/changeBlock.h"
+	#include "pxr/usd/sdf/fileFormat.h"
+	#include "pxr/usd/sdf/layer.h"
+	#include "pxr/usd/sdf/layerUtils.h"
+	#include "pxr/usd/sdf/notice.h"
 	#include "pxr/usd/sdf/path.h"
+	#include "pxr/usd/sdf/primSpec.h"
+	#include "pxr/usd/sdf/schema.h"
 	#include "pxr/usd/usd/attribute.h"
 	#include "pxr/usd/usd/prim.h"
+	#include "pxr/usd/usd/relationship.h"
 	#include "pxr/usd/usdSkel/root.h"
+	#include "pxr/usd/usdGeom/bboxCache.h"
 	#include "pxr/usd/usdGeom/mesh.h"
+	#include "pxr/usd/usdGeom/modelAPI.h"
 	#include "pxr/usd/usdGeom/pointInstancer.h"
+	#include "pxr/usd/usdGeom/primvarsAPI.h"
+	#include "pxr/usd/usdGeom/subset.h"
+	#include "pxr/usd/usdGeom/xformCache.h"
+	#include "pxr/usd/usdShade/tokens.h"
 	#include "pxr/usd/usd/primRange.h"
+	#include "pxr/usd/usd/stage.h"
+	#include "pxr/usd/usd/stagePopulationMask.h"
 #include "USDIncludesEnd.h"
 
+namespace USDExtraUtilsImpl
+{
+	/**
+	 * Traversal predicate of the import. Unlike the default predicate it also visits prims whose payload is not loaded,
+	 * since the import only reads their unreal* attributes and xform, which are authored outside of the payloads.
+	 */
+	pxr::Usd_PrimFlagsPredicate GetImportPrimPredicate()
+	{
+		return pxr::UsdPrimIsActive && pxr::UsdPrimIsDefined && !pxr::UsdPrimIsAbstract;
+	}
+
+	/** Mesh prims under the Prototypes prim of a point instancer, loaded or not */
+	TArray<TUsdStore<pxr::UsdPrim>> GetMeshPrototypes(const pxr::UsdPrim& Prototypes)
+	{
+		TArray<TUsdStore<pxr::UsdPrim>> MeshPrototypes;
+		for (const pxr::UsdPrim& UsdPrim : pxr::UsdPrimRange(Prototypes, GetImportPrimPredicate()))
+		{
+			if (UsdPrim.IsA<pxr::UsdGeomMesh>())
+			{
+				MeshPrototypes.Add(UsdPrim);
+			}
+		}
+		return MeshPrototypes;
+	}
+
+	/** Keys of the "unreal" custom data of prims exported with UnrealToUSDExtra::CompactReferences, and of the tables on their root prim */
+	namespace CompactKeys
+	{
+		const char* const Usage = "usage";
+		const char* const Method = "method";
+		const char* const Class = "class";
+		const char* const Asset = "asset";
+		const char* const Material = "material";
+		const char* const Instance = "instance";
+		const char* const Outer = "outer";
+
+		const char* const Classes = "classes";
+		const char* const Assets = "assets";
+		const char* const Materials = "materials";
+		const char* const Outers = "outers";
+	}
+
+	/** Returns the value of Key in Dictionary, or nullptr if it is missing or doesn't hold a T */
+	template<typename T>
+	const T* FindDictionaryValue(const pxr::VtDictionary& Dictionary, const char* Key)
+	{
+		const pxr::VtDictionary::const_iterator It = Dictionary.find(Key);
+		return It != Dictionary.end() && It->second.IsHolding<T>() ? &It->second.UncheckedGet<T>() : nullptr;
+	}
+
+	/** Compact custom data of UsdPrim, empty for prims exported with plain unreal* attributes */
+	pxr::VtDictionary GetCompactData(const pxr::UsdPrim& UsdPrim)
+	{
+		const pxr::VtValue CompactValue = UsdPrim.GetCustomDataByKey(USDExtraIdentifiers::UnrealCompactReferences);
+		return CompactValue.IsHolding<pxr::VtDictionary>() ? CompactValue.UncheckedGet<pxr::VtDictionary>() : pxr::VtDictionary();
+	}
+
+	/** Compact custom data of a prim, with the prim stack to weigh its fields against attributes authored in other layers */
+	struct FCompactPrimData
+	{
+		pxr::VtDictionary Fields;
+
+		/** Strongest spec first, only fetched once a field is authored both ways */
+		pxr::SdfPrimSpecHandleVector PrimStack;
+		bool bPrimStackRead = false;
+	};
+
+	/**
+	 * Whether the strongest value of Attribute is a stronger opinion than the Key field of the compact custom data,
+	 * like an attribute edited in a DCC session layer over a compacted export. The compact field wins when both are on the same spec.
+	 */
+	bool IsAttributeStronger(const pxr::UsdPrim& UsdPrim, FCompactPrimData& CompactData, const char* Key, const pxr::UsdAttribute& Attribute)
+	{
+		pxr::SdfPropertySpecHandle AttributeSpec;
+		for (const pxr::SdfPropertySpecHandle& PropertySpec : Attribute.GetPropertyStack())
+		{
+			if (PropertySpec->HasDefaultValue())
+			{
+				AttributeSpec = PropertySpec;
+				break;
+			}
+		}
+		if (!AttributeSpec)
+		{
+			return false;
+		}
+
+		if (!CompactData.bPrimStackRead)
+		{
+			CompactData.PrimStack = UsdPrim.GetPrimStack();
+			CompactData.bPrimStackRead = true;
+		}
+
+		const pxr::SdfLayerHandle AttributeLayer = AttributeSpec->GetLayer();
+		const pxr::SdfPath AttributePrimPath = AttributeSpec->GetPath().GetPrimPath();
+		for (const pxr::SdfPrimSpecHandle& PrimSpec : CompactData.PrimStack)
+		{
+			const pxr::SdfLayerHandle Layer = PrimSpec->GetLayer();
+			const pxr::VtValue SpecData = Layer->GetFieldDictValueByKey(PrimSpec->GetPath(), pxr::SdfFieldKeys->CustomData, USDExtraIdentifiers::UnrealCompactReferences);
+			if (SpecData.IsHolding<pxr::VtDictionary>() && SpecData.UncheckedGet<pxr::VtDictionary>().count(Key))
+			{
+				return false;
+			}
+
+			if (Layer == AttributeLayer && PrimSpec->GetPath() == AttributePrimPath)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Reads whichever of the Key field of the compact custom data and the AttributeName attribute is the stronger opinion.
+	 * Returns false if neither is authored, and sets bOutFromCompactData to where the value was read from.
+	 */
+	template<typename T>
+	bool ReadPrimField(const pxr::UsdPrim& UsdPrim, FCompactPrimData& CompactData, const char* Key, const pxr::TfToken& AttributeName, T& OutValue, bool* bOutFromCompactData = nullptr)
+	{
+		const pxr::UsdAttribute Attribute = UsdPrim.GetAttribute(AttributeName);
+
+		const T* Value = FindDictionaryValue<T>(CompactData.Fields, Key);
+		if (Value && !(Attribute && Attribute.HasAuthoredValue() && IsAttributeStronger(UsdPrim, CompactData, Key, Attribute)))
+		{
+			OutValue = *Value;
+			if (bOutFromCompactData)
+			{
+				*bOutFromCompactData = true;
+			}
+			return true;
+		}
+
+		if (Attribute)
+		{
+			Attribute.Get<T>(&OutValue);
+			if (bOutFromCompactData)
+			{
+				*bOutFromCompactData = false;
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	/** Same as ReadPrimField for a reference path, which the compact custom data holds as an id into Table */
+	bool ReadReferencePath(const pxr::UsdPrim& UsdPrim, FCompactPrimData& CompactData, const char* Key, const TMap<int64, FString>& Table, const pxr::TfToken& AttributeName, FString& OutPath)
+	{
+		const pxr::UsdAttribute Attribute = UsdPrim.GetAttribute(AttributeName);
+
+		const int64* Id = FindDictionaryValue<int64>(CompactData.Fields, Key);
+		if (Id && !(Attribute && Attribute.HasAuthoredValue() && IsAttributeStronger(UsdPrim, CompactData, Key, Attribute)))
+		{
+			// An id missing from the table resolves to nothing, like an empty attribute
+			const FString* Path = Table.Find(*Id);
+			OutPath = Path ? *Path : FString();
+			return true;
+		}
+
+		if (Attribute)
+		{
+			std::string Reference;
+			Attribute.Get<std::string>(&Reference);
+			OutPath = UsdToUnreal::ConvertString(Reference);
+			return true;
+		}
+
+		return false;
+	}
+
+	/** FName of a USD string, interned by StringCache when there is one */
+	FName ToName(FUSDExtraStringCache* StringCache, const std::string& String)
+	{
+		return StringCache ? StringCache->ToName(String) : FName(UsdToUnreal::ConvertString(String));
+	}
+
+	/** Id of Path in the compact reference tables. Derived from the path rather than allocated, so the tables of separately exported layers merge without renumbering */
+	int64 GetCompactReferenceId(const std::string& Path)
+	{
+		return static_cast<int64>(CityHash64(Path.data(), Path.size()));
+	}
+
+	/**
+	 * Reads the unreal* attributes of UsdPrim, or their compact custom data, resolving the paths of its class, asset and material through ResolveReference.
+	 * Only reads the stage, so it is safe to call from worker threads as long as ResolveReference and StringCache are.
+	 */
+	FUSDExtraToUnrealInfo ReadPrimConversionInfo(const pxr::UsdPrim& UsdPrim, const USDExtraToUnreal::FCompactReferenceTables& Tables, FUSDExtraStringCache* StringCache, TFunctionRef<UObject*(const FString& Path, UClass* ObjectClass)> ResolveReference)
+	{
+		FUSDExtraToUnrealInfo USDExtraToUnrealInfo;
+
+		FScopedUsdAllocs Allocs;
+
+		// Older exports and DCC edits author the attributes, each field is read from the stronger of the two opinions
+		FCompactPrimData CompactData;
+		CompactData.Fields = GetCompactData(UsdPrim);
+
+		pxr::TfToken PrimUsage;
+		if (ReadPrimField(UsdPrim, CompactData, CompactKeys::Usage, USDExtraIdentifiers::UnrealPrimUsage, PrimUsage))
+		{
+			USDExtraToUnrealInfo.PrimUsage = PrimUsage == USDExtraTokensType::Actor ? EUnrealPrimUsage::Actor : EUnrealPrimUsage::Component;
+		}
+	
+		pxr::TfToken ConversionMethod;
+		if (ReadPrimField(UsdPrim, CompactData, CompactKeys::Method, USDExtraIdentifiers::UnrealConversionMethod, ConversionMethod))
+		{
+			if (ConversionMethod == USDExtraTokensType::Ignore)
+			{
+				USDExtraToUnrealInfo.ConversionMethod = EUnrealConversionMethod::Ignore;
+			}
+			else
+			{
+				USDExtraToUnrealInfo.ConversionMethod = ConversionMethod == USDExtraTokensType::Spawn ? EUnrealConversionMethod::Spawn : EUnrealConversionMethod::Modify;
+			}
+		}
+	
+		std::string InstanceReference;
+		bool bCompactInstanceReference = false;
+		if (ReadPrimField(UsdPrim, CompactData, CompactKeys::Instance, USDExtraIdentifiers::UnrealInstanceReference, InstanceReference, &bCompactInstanceReference))
+		{
+			// Only component names repeat, actor paths are unique and not worth interning
+			const int64* OuterId = bCompactInstanceReference ? FindDictionaryValue<int64>(CompactData.Fields, CompactKeys::Outer) : nullptr;
+			const FString* OuterPath = OuterId ? Tables.Outers.Find(*OuterId) : nullptr;
+			USDExtraToUnrealInfo.InstanceReference = OuterPath ? FName(*OuterPath + UsdToUnreal::ConvertString(InstanceReference)) : ToName(StringCache, InstanceReference);
+		}
+	
+		FString ClassPath;
+		if (ReadReferencePath(UsdPrim, CompactData, CompactKeys::Class, Tables.Classes, USDExtraIdentifiers::UnrealClassReference, ClassPath) && !ClassPath.IsEmpty())
+		{
+			USDExtraToUnrealInfo.ClassReference = Cast<UClass>(ResolveReference(ClassPath, UClass::StaticClass()));
+		}
+	
+		FString AssetPath;
+		if (ReadReferencePath(UsdPrim, CompactData, CompactKeys::Asset, Tables.Assets, USDExtraIdentifiers::UnrealAssetReference, AssetPath) && !AssetPath.IsEmpty() && AssetPath != "None")
+		{
+			USDExtraToUnrealInfo.AssetReference = ResolveReference(AssetPath, UObject::StaticClass());
+		}
+
+		FString MaterialPath;
+		if (ReadReferencePath(UsdPrim, CompactData, CompactKeys::Material, Tables.Materials, USDExtraIdentifiers::UnrealMaterialReference, MaterialPath) && !MaterialPath.IsEmpty() && MaterialPath != "None")
+		{
+			USDExtraToUnrealInfo.MaterialReference = Cast<UMaterialInterface>(ResolveReference(MaterialPath, UMaterialInterface::StaticClass()));
+		}
+	
+		if (const pxr::UsdAttribute ActorFolderPathAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealActorFolderPath))
+		{
+			std::string ActorFolderPath;
+			ActorFolderPathAttr.Get<std::string>(&ActorFolderPath);
+			USDExtraToUnrealInfo.ActorFolderPath = ToName(StringCache, ActorFolderPath);
+		}
+
+		pxr::TfToken PrimTypeName = UsdPrim.GetPrimTypeInfo().GetTypeName();
+		if (PrimTypeName == USDExtraTokensType::USDActorFolder)
+		{
+			if (const pxr::UsdAttribute UnrealPrimUsageAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealPrimUsage))
+			{
+				pxr::TfToken UnrealPrimUsage;
+				UnrealPrimUsageAttr.Get<pxr::TfToken>(&UnrealPrimUsage);
+				if (UnrealPrimUsage == USDExtraTokensType::Folder)
+				{
+					USDExtraToUnrealInfo.PrimType = EUnrealPrimType::Folder;
+				}
+			}
+		}
+		else if (PrimTypeName == USDExtraTokensType::USDScene)
+		{
+			USDExtraToUnrealInfo.PrimType = EUnrealPrimType::Scene;
+
+			if (USDExtraToUnrealInfo.ClassReference == UHierarchicalInstancedStaticMeshComponent::StaticClass())
+			{
+				USDExtraToUnrealInfo.PrimType = EUnrealPrimType::HISM;
+			}
+		}
+		else if (PrimTypeName == USDExtraTokensType::USDStaticMesh)
+		{
+			USDExtraToUnrealInfo.PrimType = EUnrealPrimType::StaticMesh;
+
+			if (const pxr::UsdAttribute UnrealPrimTypeAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealPrimType))
+			{
+				pxr::TfToken UnrealPrimType;
+				UnrealPrimTypeAttr.Get<pxr::TfToken>(&UnrealPrimType);
+				if (UnrealPrimType == USDExtraTokensType::PrimTypeBSP)
+				{
+					USDExtraToUnrealInfo.PrimType = EUnrealPrimType::BSP;
+
+					if (const pxr::UsdAttribute UnrealBSPBrushTypeAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealBSPBrushType))
+					{
+						pxr::TfToken UnrealBSPBrushType;
+						UnrealBSPBrushTypeAttr.Get<pxr::TfToken>(&UnrealBSPBrushType);
+						if (UnrealBSPBrushType == USDExtraTokensType::Add)
+						{
+							USDExtraToUnrealInfo.BSPBrushType = Brush_Add;
+						}
+						else if (UnrealBSPBrushType == USDExtraTokensType::Subtract)
+						{
+							USDExtraToUnrealInfo.BSPBrushType = Brush_Subtract;
+						}
+						else if (UnrealBSPBrushType == USDExtraTokensType::Max)
+						{
+							USDExtraToUnrealInfo.BSPBrushType = Brush_MAX;
+						}
+					}
+				}
+			}
+		}
+		else if (PrimTypeName == USDExtraTokensType::USDSkeletalMesh)
+		{
+			USDExtraToUnrealInfo.PrimType = EUnrealPrimType::SkeletalMesh;
+		}
+		else if (PrimTypeName == USDExtraTokensType::USDInstancedStaticMesh)
+		{
+			if (USDExtraToUnrealInfo.ClassReference == AInstancedFoliageActor::StaticClass())
+			{
+				USDExtraToUnrealInfo.PrimType = EUnrealPrimType::InstancedFoliage;
+			}
+		}
+	
+		return USDExtraToUnrealInfo;
+	}
+}
+
+namespace USDExtraToUnreal
+{
+	/**
+	 * Decides which prims and point instancer instances of a stage intersect a FUSDExtraImportRegion, from their world bounds.
+	 * Bounds come from a UsdGeomBBoxCache, and from extentsHint for prims whose payload is not loaded.
+	 * The caches make it unsafe to share between threads, each import plan compile task has its own.
+	 */
+	class FImportRegionFilter
+	{
+	public:
+		FImportRegionFilter(const pxr::UsdStageRefPtr& Stage, const FUSDExtraImportRegion& InRegion)
+			: Region(InRegion)
+			, StageInfo(Stage)
+			, BBoxCache(pxr::UsdTimeCode::Default(), { pxr::UsdGeomTokens->default_, pxr::UsdGeomTokens->render }, true)
+			, XformCache(pxr::UsdTimeCode::Default())
+		{
+		}
+
+		/** Identifies the region, for the fingerprints of prims whose conversion depends on it */
+		uint64 GetHash() const
+		{
+			const double Values[] = {
+				static_cast<double>(Region.Shape),
+				Region.Box.Min.X, Region.Box.Min.Y, Region.Box.Min.Z,
+				Region.Box.Max.X, Region.Box.Max.Y, Region.Box.Max.Z,
+				Region.Sphere.Center.X, Region.Sphere.Center.Y, Region.Sphere.Center.Z, Region.Sphere.W
+			};
+			return CityHash64(reinterpret_cast<const char*>(Values), sizeof(Values));
+		}
+
+		/** Whether the world bounds of UsdPrim and the geometry below it intersect the region */
+		bool Intersects(const pxr::UsdPrim& UsdPrim)
+		{
+			pxr::GfRange3d Range;
+
+			pxr::UsdPrimRange PrimRange(UsdPrim, USDExtraUtilsImpl::GetImportPrimPredicate());
+			for (pxr::UsdPrimRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt)
+			{
+				if (!PrimRangeIt->IsLoaded())
+				{
+					// The geometry of an unloaded payload is only known through the extentsHint authored next to it
+					pxr::GfRange3d HintRange;
+					if (GetExtentsHint(*PrimRangeIt, HintRange))
+					{
+						Range.UnionWith(pxr::GfBBox3d(HintRange, XformCache.GetLocalToWorldTransform(*PrimRangeIt)).ComputeAlignedRange());
+					}
+					PrimRangeIt.PruneChildren();
+				}
+				else if (PrimRangeIt->IsA<pxr::UsdGeomBoundable>())
+				{
+					Range.UnionWith(BBoxCache.ComputeWorldBound(*PrimRangeIt).ComputeAlignedRange());
+					PrimRangeIt.PruneChildren();
+				}
+			}
+
+			// Prims without any known geometry are placed by their pivot
+			if (Range.IsEmpty())
+			{
+				const pxr::GfVec3d Pivot = XformCache.GetLocalToWorldTransform(UsdPrim).ExtractTranslation();
+				Range = pxr::GfRange3d(Pivot, Pivot);
+			}
+
+			return Region.Intersects(ConvertRange(Range));
+		}
+
+		/**
+		 * Returns whether each instance of PointInstancer intersects the region, from the bounds of its prototype.
+		 * InstanceTransforms are relative to the instancer, as computed by ComputeInstanceTransformsAtTime.
+		 */
+		TArray<bool> FilterInstances(const pxr::UsdGeomPointInstancer& PointInstancer, const pxr::VtMatrix4dArray& InstanceTransforms)
+		{
+			pxr::SdfPathVector PrototypePaths;
+			PointInstancer.GetPrototypesRel().GetTargets(&PrototypePaths);
+
+			TArray<pxr::GfRange3d> PrototypeRanges;
+			PrototypeRanges.Reserve(PrototypePaths.size());
+			for (const pxr::SdfPath& PrototypePath : PrototypePaths)
+			{
+				pxr::GfRange3d PrototypeRange;
+				if (const pxr::UsdPrim Prototype = PointInstancer.GetPrim().GetStage()->GetPrimAtPath(PrototypePath))
+				{
+					if (!Prototype.IsLoaded())
+					{
+						GetExtentsHint(Prototype, PrototypeRange);
+					}
+					else
+					{
+						PrototypeRange = BBoxCache.ComputeUntransformedBound(Prototype).ComputeAlignedRange();
+					}
+				}
+				PrototypeRanges.Add(PrototypeRange);
+			}
+
+			const pxr::VtArray<int> ProtoIndices = UsdUtils::GetUsdValue<pxr::VtArray<int>>(PointInstancer.GetProtoIndicesAttr(), 0.0f);
+			const pxr::GfMatrix4d InstancerToWorld = XformCache.GetLocalToWorldTransform(PointInstancer.GetPrim());
+
+			TArray<bool> InRegion;
+			InRegion.SetNumZeroed(InstanceTransforms.size());
+			ParallelFor(InRegion.Num(), [&](int32 Index)
+			{
+				const pxr::GfMatrix4d InstanceToWorld = InstanceTransforms[Index] * InstancerToWorld;
+				const int32 ProtoIndex = Index < static_cast<int32>(ProtoIndices.size()) ? ProtoIndices[Index] : INDEX_NONE;
+
+				pxr::GfRange3d Range;
+				if (PrototypeRanges.IsValidIndex(ProtoIndex) && !PrototypeRanges[ProtoIndex].IsEmpty())
+				{
+					Range = pxr::GfBBox3d(PrototypeRanges[ProtoIndex], InstanceToWorld).ComputeAlignedRange();
+				}
+				else
+				{
+					const pxr::GfVec3d Pivot = InstanceToWorld.ExtractTranslation();
+					Range = pxr::GfRange3d(Pivot, Pivot);
+				}
+
+				InRegion[Index] = Region.Intersects(ConvertRange(Range));
+			});
+
+			return InRegion;
+		}
+
+	private:
+		static bool GetExtentsHint(const pxr::UsdPrim& UsdPrim, pxr::GfRange3d& OutRange)
+		{
+			pxr::VtVec3fArray ExtentsHint;
+			if (!pxr::UsdGeomModelAPI(UsdPrim).GetExtentsHint(&ExtentsHint) || ExtentsHint.size() < 2)
+			{
+				return false;
+			}
+
+			// The first pair is the extent of the default purpose
+			OutRange = pxr::GfRange3d(pxr::GfVec3d(ExtentsHint[0]), pxr::GfVec3d(ExtentsHint[1]));
+			return !OutRange.IsEmpty();
+		}
+
+		FBox ConvertRange(const pxr::GfRange3d& Range) const
+		{
+			FBox Bounds(ForceInit);
+			for (size_t Corner = 0; Corner < 8; ++Corner)
+			{
+				Bounds += FVector(UsdToUnreal::ConvertVector(StageInfo, pxr::GfVec3f(Range.GetCorner(Corner))));
+			}
+			return Bounds;
+		}
+
+		FUSDExtraImportRegion Region;
+		FUsdStageInfo StageInfo;
+		pxr::UsdGeomBBoxCache BBoxCache;
+		pxr::UsdGeomXformCache XformCache;
+	};
+}
+
 typedef TFunction<bool(const UPrimitiveComponent*)> FFoliageTraceFilterFunc;
 
 struct FFoliagePaintingGeometryFilter
@@ -95,6 +602,8 @@ namespace USDExtraIdentifiers
 	const pxr::TfToken UnrealBSPBrushType = pxr::TfToken("unrealBSPBrushType");
 	const pxr::TfToken UnrealBaseComponentReferences = pxr::TfToken("unrealBaseComponentReferences");
 	const pxr::TfToken UnrealBaseComponentIndices = pxr::TfToken("unrealBaseComponentIndices");
+	const pxr::TfToken UnrealCompactReferences = pxr::TfToken("unreal");
+	const pxr::TfToken UnrealReferenceTables = pxr::TfToken("unrealReferenceTables");
 }
 
 namespace USDExtraTokensType
@@ -121,7 +630,7 @@ namespace USDExtraTokensType
 	const pxr::TfToken Max = pxr::TfToken("max");
 }
 
-inline bool FVerticesEqual(FVector3f& V1, FVector3f& V2)
+inline bool FVerticesEqual(const FVector3f& V1, const FVector3f& V2)
 {
 	if (FMath::Abs(V1.X - V2.X) > THRESH_POINTS_ARE_SAME * 4.0f)
 	{
@@ -141,52 +650,188 @@ inline bool FVerticesEqual(FVector3f& V1, FVector3f& V2)
 	return 1;
 }
 
-inline FTransform ConvertAxes( const bool bZUp, const FTransform Transform )
+/**
+ * Buckets vertices into a grid of cells as wide as the FVerticesEqual tolerance, so that welding a position
+ * only has to compare it against the vertices of its own and neighbouring cells.
+ */
+struct FBrushVertexWelder
 {
-	FVector Translation = Transform.GetTranslation();
-	FQuat Rotation = Transform.GetRotation();
-	FVector Scale = Transform.GetScale3D();
+	static constexpr float CellSize = THRESH_POINTS_ARE_SAME * 4.0f;
 
-	if ( bZUp )
-	{
-		Translation.Y = -Translation.Y;
-		Rotation.X = -Rotation.X;
-		Rotation.Z = -Rotation.Z;
-	}
-	else
+	/** Cells are a few hundred thousandths of a unit wide, so their coordinates overflow int32 a couple of kilometers from the origin */
+	struct FCell
 	{
-		Swap( Translation.Y, Translation.Z );
+		int64 X;
+		int64 Y;
+		int64 Z;
 
-		Rotation = Rotation.Inverse();
-		Swap( Rotation.Y, Rotation.Z );
+		bool operator==(const FCell& Other) const
+		{
+			return X == Other.X && Y == Other.Y && Z == Other.Z;
+		}
 
-		Swap( Scale.Y, Scale.Z );
-	}
+		friend uint32 GetTypeHash(const FCell& Cell)
+		{
+			return HashCombine(HashCombine(GetTypeHash(Cell.X), GetTypeHash(Cell.Y)), GetTypeHash(Cell.Z));
+		}
+	};
 
-	return FTransform( Rotation, Translation, Scale );
-}
+	TMap<FCell, TArray<FVertexID, TInlineAllocator<2>>> Cells;
 
-inline void TexCoordsToVectors(const FVector3f& V0, const FVector2D& InUV0,
-								const FVector3f& V1, const FVector2D& InUV1,
-								const FVector3f& V2, const FVector2D& InUV2,
-								FVector3f* InBaseResult, FVector3f* InUResult, FVector3f* InVResult )
-{
+	static int64 GetCellCoordinate(const float Coordinate)
 	{
-		const FVector2D UVOrigin = FVector2D::ZeroVector;
-		const FVector2D C = UVOrigin - InUV2;
-		const FVector2D A = InUV0 - InUV2;
-		const FVector2D B = InUV1 - InUV2;
+		// Clamped so that non finite positions still land in a cell, far inside the range neighbouring cells are offset in
+		constexpr double MaxCellCoordinate = 1.0e15;
+		return static_cast<int64>(FMath::Clamp(FMath::FloorToDouble(static_cast<double>(Coordinate) / CellSize), -MaxCellCoordinate, MaxCellCoordinate));
+	}
 
-		const float W0 = (C.X * B.Y - C.Y * B.X) / (A.X * B.Y - A.Y * B.X);
-		const float W1 = (C.X * A.Y - C.Y * A.X) / (B.X * A.Y - B.Y * A.X);
-		const float W2 = 1 - W0 - W1;
-		*InBaseResult = V0 * W0 + V1 * W1 + V2 * W2;
+	static FCell GetCell(const FVector3f& Position)
+	{
+		return FCell{ GetCellCoordinate(Position.X), GetCellCoordinate(Position.Y), GetCellCoordinate(Position.Z) };
 	}
 
+	static const FVector3f& GetPosition(const TVertexAttributesRef<FVector3f>& VertexPositions, const FVertexID VertexID)
 	{
-		const FVector2D TextureU = FVector2D(1.0f, 0.0f);
-		const FVector2D C = TextureU - InUV2;
-		const FVector2D A = InUV0 - InUV2;
+		return VertexPositions[VertexID];
+	}
+
+	static const FVector3f& GetPosition(const TArray<FVector3f>& VertexPositions, const FVertexID VertexID)
+	{
+		return VertexPositions[VertexID.GetValue()];
+	}
+
+	/** Returns the matching vertex with the highest ID, the one a linear scan over all vertices would have settled on */
+	template<typename PositionsType>
+	FVertexID Find(const FVector3f& Position, const PositionsType& VertexPositions) const
+	{
+		FVertexID Result = INDEX_NONE;
+		const FCell Cell = GetCell(Position);
+		for (int32 X = -1; X <= 1; ++X)
+		{
+			for (int32 Y = -1; Y <= 1; ++Y)
+			{
+				for (int32 Z = -1; Z <= 1; ++Z)
+				{
+					if (const TArray<FVertexID, TInlineAllocator<2>>* CellVertices = Cells.Find(FCell{ Cell.X + X, Cell.Y + Y, Cell.Z + Z }))
+					{
+						for (const FVertexID VertexID : *CellVertices)
+						{
+							if ((Result == INDEX_NONE || VertexID.GetValue() > Result.GetValue()) && FVerticesEqual(Position, GetPosition(VertexPositions, VertexID)))
+							{
+								Result = VertexID;
+							}
+						}
+					}
+				}
+			}
+		}
+		return Result;
+	}
+
+	void Add(const FVertexID VertexID, const FVector3f& Position)
+	{
+		Cells.FindOrAdd(GetCell(Position)).Add(VertexID);
+	}
+};
+
+/** Fields that BSPValidateBrush requires to be identical for two polys to be linked */
+struct FPolyLinkGroup
+{
+	const UMaterialInterface* Material;
+	FVector3f TextureU;
+	FVector3f TextureV;
+	uint32 PolyFlags;
+
+	explicit FPolyLinkGroup(const FPoly& Poly)
+		: Material(Poly.Material)
+		// Adding zero folds -0 into +0, which compare equal but would not hash equal
+		, TextureU(Poly.TextureU + FVector3f::ZeroVector)
+		, TextureV(Poly.TextureV + FVector3f::ZeroVector)
+		, PolyFlags(Poly.PolyFlags)
+	{
+	}
+
+	bool operator==(const FPolyLinkGroup& Other) const
+	{
+		return Material == Other.Material && TextureU == Other.TextureU && TextureV == Other.TextureV && PolyFlags == Other.PolyFlags;
+	}
+
+	friend uint32 GetTypeHash(const FPolyLinkGroup& Group)
+	{
+		uint32 Hash = GetTypeHash(Group.Material);
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			Hash = HashCombine(Hash, GetTypeHash(Group.TextureU[Axis]));
+			Hash = HashCombine(Hash, GetTypeHash(Group.TextureV[Axis]));
+		}
+		return HashCombine(Hash, GetTypeHash(Group.PolyFlags));
+	}
+};
+
+/** Quantized plane of a poly within its FPolyLinkGroup */
+struct FPolyLinkCell
+{
+	int32 Group = INDEX_NONE;
+	FIntVector Normal = FIntVector::ZeroValue;
+	int32 Distance = 0;
+
+	bool operator==(const FPolyLinkCell& Other) const
+	{
+		return Group == Other.Group && Normal == Other.Normal && Distance == Other.Distance;
+	}
+
+	friend uint32 GetTypeHash(const FPolyLinkCell& Cell)
+	{
+		return HashCombine(HashCombine(GetTypeHash(Cell.Group), GetTypeHash(Cell.Normal)), GetTypeHash(Cell.Distance));
+	}
+};
+
+inline FTransform ConvertAxes( const bool bZUp, const FTransform Transform )
+{
+	FVector Translation = Transform.GetTranslation();
+	FQuat Rotation = Transform.GetRotation();
+	FVector Scale = Transform.GetScale3D();
+
+	if ( bZUp )
+	{
+		Translation.Y = -Translation.Y;
+		Rotation.X = -Rotation.X;
+		Rotation.Z = -Rotation.Z;
+	}
+	else
+	{
+		Swap( Translation.Y, Translation.Z );
+
+		Rotation = Rotation.Inverse();
+		Swap( Rotation.Y, Rotation.Z );
+
+		Swap( Scale.Y, Scale.Z );
+	}
+
+	return FTransform( Rotation, Translation, Scale );
+}
+
+inline void TexCoordsToVectors(const FVector3f& V0, const FVector2D& InUV0,
+								const FVector3f& V1, const FVector2D& InUV1,
+								const FVector3f& V2, const FVector2D& InUV2,
+								FVector3f* InBaseResult, FVector3f* InUResult, FVector3f* InVResult )
+{
+	{
+		const FVector2D UVOrigin = FVector2D::ZeroVector;
+		const FVector2D C = UVOrigin - InUV2;
+		const FVector2D A = InUV0 - InUV2;
+		const FVector2D B = InUV1 - InUV2;
+
+		const float W0 = (C.X * B.Y - C.Y * B.X) / (A.X * B.Y - A.Y * B.X);
+		const float W1 = (C.X * A.Y - C.Y * A.X) / (B.X * A.Y - B.Y * A.X);
+		const float W2 = 1 - W0 - W1;
+		*InBaseResult = V0 * W0 + V1 * W1 + V2 * W2;
+	}
+
+	{
+		const FVector2D TextureU = FVector2D(1.0f, 0.0f);
+		const FVector2D C = TextureU - InUV2;
+		const FVector2D A = InUV0 - InUV2;
 		const FVector2D B = InUV1 - InUV2;
 
 		const float W0 = (C.X * B.Y - C.Y * B.X) / (A.X * B.Y - A.Y * B.X);
@@ -210,64 +855,238 @@ inline void TexCoordsToVectors(const FVector3f& V0, const FVector2D& InUV0,
 	}
 }
 
-void UUSDExtraUtils::ImportUSDToLevel(UWorld* World, FString FilePath)
+/**
+ * Converts NumInstances UE transforms into presized PointInstancer position, orientation and scale buffers in USD space.
+ * Work is split into batches across worker threads, so GetInstanceTransform must be safe to call concurrently.
+ */
+static void ConvertInstanceTransformsToUsd( const FUsdStageInfo& StageInfo, const int32 NumInstances, TFunctionRef<FTransform( int32 )> GetInstanceTransform,
+	pxr::VtArray<pxr::GfVec3f>& Positions, pxr::VtArray<pxr::GfQuath>& Orientations, pxr::VtArray<pxr::GfVec3f>& Scales )
 {
-	TMap<FName, USceneComponent*> WorldContent = CollectWorldContent(World);
-	
-	FScopedUsdAllocs Allocs;
-	
-	UE::FUsdStage USDStage = UnrealUSDWrapper::OpenStage(*FilePath, EUsdInitialLoadSet::LoadAll);
-	check(USDStage)
-	pxr::UsdStageRefPtr& StageRef = USDStage;
-	
-	TArray<pxr::UsdPrim> VisitedPrims;
-	pxr::UsdPrim FoliageActorPrim;
-	FUSDExtraToUnrealInfo FoliageActorPrimInfo;
-	pxr::UsdPrimSiblingRange PrimRange = StageRef->GetDefaultPrim().GetChildren();
-	for ( pxr::UsdPrimSiblingRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt )
+	Positions.resize( NumInstances );
+	Orientations.resize( NumInstances );
+	Scales.resize( NumInstances );
+
+	// Fetch the raw buffers up front, the non-const accessors may detach the arrays and must not run concurrently
+	pxr::GfVec3f* PositionData = Positions.data();
+	pxr::GfQuath* OrientationData = Orientations.data();
+	pxr::GfVec3f* ScaleData = Scales.data();
+
+	const bool bZUp = StageInfo.UpAxis == EUsdUpAxis::ZAxis;
+
+	// Compensate metersPerUnit
+	constexpr float UEMetersPerUnit = 0.01f;
+	const bool bScaleTranslation = !FMath::IsNearlyEqual( UEMetersPerUnit, StageInfo.MetersPerUnit );
+	const float TranslationScale = UEMetersPerUnit / StageInfo.MetersPerUnit;
+
+	constexpr int32 BatchSize = 1024;
+	const int32 NumBatches = FMath::DivideAndRoundUp( NumInstances, BatchSize );
+	ParallelFor( NumBatches, [&]( int32 BatchIndex )
 	{
-		TUsdStore<pxr::UsdPrim> UsdPrim = *PrimRangeIt;
-		
-		if (VisitedPrims.Contains(UsdPrim.Get()))
+		const int32 BatchEnd = FMath::Min( ( BatchIndex + 1 ) * BatchSize, NumInstances );
+		for ( int32 Index = BatchIndex * BatchSize; Index < BatchEnd; ++Index )
 		{
-			continue;
+			// Convert axes
+			const FTransform USDTransform = ConvertAxes( bZUp, GetInstanceTransform( Index ) );
+
+			FVector Translation = USDTransform.GetTranslation();
+			const FQuat Rotation = USDTransform.GetRotation();
+			const FVector Scale = USDTransform.GetScale3D();
+
+			if ( bScaleTranslation )
+			{
+				Translation *= TranslationScale;
+			}
+
+			PositionData[ Index ] = pxr::GfVec3f( Translation.X, Translation.Y, Translation.Z );
+			OrientationData[ Index ] = pxr::GfQuath( Rotation.W, Rotation.X, Rotation.Y, Rotation.Z );
+			ScaleData[ Index ] = pxr::GfVec3f( Scale.X, Scale.Y, Scale.Z );
+		}
+	} );
+}
+
+/** Authors the instance arrays of a PointInstancer prim */
+static void SetPointInstancerAttributes( pxr::UsdGeomPointInstancer& PointInstancer, const pxr::VtArray<int>& ProtoIndices,
+	const pxr::VtArray<pxr::GfVec3f>& Positions, const pxr::VtArray<pxr::GfQuath>& Orientations, const pxr::VtArray<pxr::GfVec3f>& Scales, const pxr::UsdTimeCode UsdTimeCode )
+{
+	if ( pxr::UsdAttribute Attr = PointInstancer.CreateProtoIndicesAttr() )
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set( ProtoIndices, UsdTimeCode );
+	}
+
+	if ( pxr::UsdAttribute Attr = PointInstancer.CreatePositionsAttr() )
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set( Positions, UsdTimeCode );
+	}
+
+	if ( pxr::UsdAttribute Attr = PointInstancer.CreateOrientationsAttr() )
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set( Orientations, UsdTimeCode );
+	}
+
+	if ( pxr::UsdAttribute Attr = PointInstancer.CreateScalesAttr() )
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set( Scales, UsdTimeCode );
+	}
+}
+
+void UUSDExtraUtils::ImportUSDToLevel(UWorld* World, FString FilePath, const FUSDExtraImportRegion& Region, const TArray<FString>& PrimPaths)
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	FUSDExtraWorldContentIndex& WorldContent = GEditor->GetEditorSubsystem<UUSDExtraWorldContentSubsystem>()->GetWorldContent(World);
+
+	// Fingerprints of the previous import of this file, so that only what changed since then is converted again
+	USDExtraToUnreal::FImportFingerprints Fingerprints;
+	USDExtraToUnreal::FImportFingerprints* ImportFingerprints = nullptr;
+	const FString FingerprintsPath = USDExtraToUnreal::FImportFingerprints::GetFilePath(World, FilePath);
+	if (GetDefault<UUSDExtraSettings>()->bIncrementalReimport)
+	{
+		Fingerprints.Load(FingerprintsPath);
+		ImportFingerprints = &Fingerprints;
+	}
+
+	// Region and folder imports only compile part of the stage, only the plans of full imports are cached
+	const bool bUsePlanCache = GetDefault<UUSDExtraSettings>()->bCacheImportPlans && !Region.IsSet() && PrimPaths.Num() == 0;
+	const FString PlanCachePath = USDExtraToUnreal::FImportPlanCache::GetFilePath(FilePath);
+
+	USDExtraToUnreal::FImportPlan Plan;
+	USDExtraToUnreal::FReferenceCache ReferenceCache;
+	UE::FUsdStage USDStage;
+	int32 NumVisitedPrims = 0;
+	int32 NumRemovedPrims = 0;
+	if (bUsePlanCache && USDExtraToUnreal::FImportPlanCache::Load(PlanCachePath, ImportFingerprints != nullptr, Plan, ReferenceCache))
+	{
+		const double ApplyStartTime = FPlatformTime::Seconds();
+		USDExtraToUnreal::ApplyImportPlan(Plan, USDExtraToUnreal::FImportScope(), WorldContent, World, ImportFingerprints);
+		NumVisitedPrims = Plan.NumVisitedPrims;
+
+		if (ImportFingerprints)
+		{
+			NumRemovedPrims = Fingerprints.RemoveDeletedPrims(Plan, WorldContent, World);
 		}
 
-		FUSDExtraToUnrealInfo PrimInfo = USDExtraToUnreal::GatherPrimConversionInfo(UsdPrim.Get());
+		UE_LOG(LogUsd, Log, TEXT("Replayed %d import ops cached in '%s', loaded in %.3f seconds and applied in %.3f seconds"),
+			Plan.Ops.Num(), *PlanCachePath, ApplyStartTime - StartTime, FPlatformTime::Seconds() - ApplyStartTime);
+	}
+	else
+	{
+		FScopedUsdAllocs Allocs;
+
+		USDStage = USDExtraToUnreal::OpenImportStage(FilePath, true, PrimPaths);
+		check(USDStage)
+		pxr::UsdStageRefPtr& StageRef = USDStage;
+
+		USDExtraToUnreal::PreloadReferences(StageRef, ReferenceCache);
+
+		NumVisitedPrims = USDExtraToUnreal::ConvertStage(StageRef, WorldContent, &ReferenceCache, World, ImportFingerprints, Region.IsSet() ? &Region : nullptr, bUsePlanCache ? &Plan : nullptr);
+
+		if (ImportFingerprints)
+		{
+			NumRemovedPrims = Fingerprints.RemoveDeletedPrims(StageRef, WorldContent, World);
+		}
+
+		if (bUsePlanCache)
+		{
+			USDExtraToUnreal::FImportPlanCache::Save(PlanCachePath, StageRef, Plan, ReferenceCache);
+		}
+	}
+
+	if (ImportFingerprints)
+	{
+		Fingerprints.Save(FingerprintsPath);
+
+		UE_LOG(LogUsd, Log, TEXT("Skipped %d unchanged prims and removed %d deleted prims"), Fingerprints.NumSkippedPrims, NumRemovedPrims);
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Imported %d prims from %s in %.3f seconds"), NumVisitedPrims, *FilePath, FPlatformTime::Seconds() - StartTime);
+
+	FEditorBuildUtils::EditorBuild( World, FBuildOptions::BuildVisibleGeometry );
+
+	if (USDStage)
+	{
+		UnrealUSDWrapper::EraseStageFromCache(USDStage);
+	}
+}
+
+TArray<FUSDExtraStageFolder> UUSDExtraUtils::GetStageFolders(const FString& FilePath)
+{
+	TArray<FUSDExtraStageFolder> Folders;
+
+	FScopedUsdAllocs Allocs;
+
+	const pxr::SdfLayerRefPtr RootLayer = pxr::SdfLayer::FindOrOpen(UnrealToUsd::ConvertString(*FilePath).Get());
+	if (!RootLayer || !RootLayer->HasDefaultPrim())
+	{
+		return Folders;
+	}
+	const pxr::SdfPath DefaultPrimPath = pxr::SdfPath::AbsoluteRootPath().AppendChild(RootLayer->GetDefaultPrim());
+
+	// Folders are authored in the layer stack of the root layer, so references and payloads don't need to be followed
+	TSet<FString> VisitedLayers;
+	TSet<FString> FolderPrimPaths;
+	TArray<pxr::SdfLayerRefPtr> LayersToVisit = { RootLayer };
+	while (LayersToVisit.Num() > 0)
+	{
+		const pxr::SdfLayerRefPtr Layer = LayersToVisit.Pop(false);
 
-		if (PrimInfo.PrimType == EUnrealPrimType::Folder)
+		bool bAlreadyVisited = false;
+		VisitedLayers.Add(UsdToUnreal::ConvertString(Layer->GetIdentifier()), &bAlreadyVisited);
+		if (bAlreadyVisited)
 		{
-			USDExtraToUnreal::ConvertFolder(StageRef, UsdPrim.Get(), PrimInfo, VisitedPrims, WorldContent, World);
 			continue;
 		}
 
-		if (PrimInfo.ConversionMethod == EUnrealConversionMethod::Ignore)
+		for (const std::string& SubLayerPath : Layer->GetSubLayerPaths())
+		{
+			if (const pxr::SdfLayerRefPtr SubLayer = pxr::SdfLayer::FindOrOpen(pxr::SdfComputeAssetPathRelativeToLayer(Layer, SubLayerPath)))
+			{
+				LayersToVisit.Add(SubLayer);
+			}
+		}
+
+		const pxr::SdfPrimSpecHandle DefaultPrimSpec = Layer->GetPrimAtPath(DefaultPrimPath);
+		if (!DefaultPrimSpec)
 		{
 			continue;
 		}
-		
-		if (PrimInfo.PrimUsage == EUnrealPrimUsage::Actor)
+
+		for (const pxr::SdfPrimSpecHandle& ChildSpec : DefaultPrimSpec->GetNameChildren())
 		{
-			if (PrimInfo.ClassReference != AInstancedFoliageActor::StaticClass())
+			const pxr::SdfAttributeSpecHandle UsageAttr = Layer->GetAttributeAtPath(ChildSpec->GetPath().AppendProperty(USDExtraIdentifiers::UnrealPrimUsage));
+			if (!UsageAttr || UsageAttr->GetDefaultValue() != pxr::VtValue(USDExtraTokensType::Folder))
 			{
-				USDExtraToUnreal::ConvertActor(StageRef, UsdPrim.Get(), PrimInfo, VisitedPrims, nullptr, WorldContent, World);
+				continue;
 			}
-			else
+
+			const FString PrimPath = UsdToUnreal::ConvertPath(ChildSpec->GetPath());
+			if (FolderPrimPaths.Contains(PrimPath))
+			{
+				continue;
+			}
+			FolderPrimPaths.Add(PrimPath);
+
+			FUSDExtraStageFolder& Folder = Folders.AddDefaulted_GetRef();
+			Folder.PrimPath = PrimPath;
+			Folder.FolderPath = UsdToUnreal::ConvertString(ChildSpec->GetName());
+
+			const pxr::SdfAttributeSpecHandle FolderPathAttr = Layer->GetAttributeAtPath(ChildSpec->GetPath().AppendProperty(USDExtraIdentifiers::UnrealActorFolderPath));
+			if (FolderPathAttr && FolderPathAttr->GetDefaultValue().IsHolding<std::string>())
 			{
-				FoliageActorPrim = UsdPrim.Get();
-				FoliageActorPrimInfo = PrimInfo;
+				Folder.FolderPath = UsdToUnreal::ConvertString(FolderPathAttr->GetDefaultValue().UncheckedGet<std::string>());
 			}
 		}
 	}
 
-	if (FoliageActorPrim)
+	Folders.Sort([](const FUSDExtraStageFolder& A, const FUSDExtraStageFolder& B)
 	{
-		USDExtraToUnreal::ConvertActor(StageRef, FoliageActorPrim, FoliageActorPrimInfo, VisitedPrims, nullptr, WorldContent, World);
-	}
-
-	FEditorBuildUtils::EditorBuild( World, FBuildOptions::BuildVisibleGeometry );
+		return A.FolderPath < B.FolderPath;
+	});
 
-	UnrealUSDWrapper::EraseStageFromCache(USDStage);
+	return Folders;
 }
 
 void UUSDExtraUtils::ExportLevelToUSD(UWorld* World, FString FilePath)
@@ -277,11 +1096,24 @@ void UUSDExtraUtils::ExportLevelToUSD(UWorld* World, FString FilePath)
 	ExportOptions->StageOptions.MetersPerUnit = 1.0f;
 	ExportOptions->World = World;
 	ExportOptions->FileName = FilePath;
+	ExportOptions->bIncrementalExport = GetDefault<UUSDExtraSettings>()->bIncrementalExport;
+	ExportOptions->bSquashDeltas = GetDefault<UUSDExtraSettings>()->bSquashExportDeltas;
+	ExportOptions->bCompactReferences = GetDefault<UUSDExtraSettings>()->bCompactExportReferences;
 
-	if (IPythonScriptPlugin::Get()->IsPythonAvailable())
+	// Material baking and landscapes are only implemented by the Python pipeline
+	FUSDExtraLevelExporter LevelExporter(*ExportOptions);
+	if (!GetDefault<UUSDExtraSettings>()->bUsePythonExporter && !LevelExporter.RequiresPythonExport())
+	{
+		LevelExporter.Export();
+	}
+	else if (IPythonScriptPlugin::Get()->IsPythonAvailable())
 	{
 		IPythonScriptPlugin::Get()->ExecPythonCommand(TEXT("import usd_extra_export_scripts; usd_extra_export_scripts.export_with_cdo_options()"));
 	}
+	else
+	{
+		UE_LOG(LogUsd, Error, TEXT("Exporting '%s' requires the Python export scripts, but Python is not available"), *FilePath);
+	}
 
 	ExportOptions->World = nullptr;
 	ExportOptions->FileName = "";
@@ -356,28 +1188,6 @@ void UUSDExtraUtils::StreamOutLevels(const TArray<ULevel*>& LevelsToStreamOut)
 	EditorLevelUtils::SetLevelsVisibility( LevelsToStreamOut, ShouldBeVisible, bForceLayersVisible, ELevelVisibilityDirtyMode::DontModify );
 }
 
-TMap<FName, USceneComponent*> UUSDExtraUtils::CollectWorldContent(UWorld* World)
-{
-	TMap<FName, USceneComponent*> Result;
-
-	for(FActorIterator It(World); It; ++It)
-	{
-		const AActor* Actor = *It;
-		TInlineComponentArray<USceneComponent*> Components(Actor);
-		for (USceneComponent* Component : Components)
-		{
-			if (Actor->GetRootComponent() == Component)
-			{
-				FName Key = FName(Actor->GetPathName());
-				Result.Add(Key, Component);
-			}
-			FName Key = FName(Component->GetPathName());
-			Result.Add(Key, Component);
-		}
-	}
-	return Result;
-}
-
 UStaticMesh* UUSDExtraUtils::CreateStaticMeshFromBrush(UObject* Outer, FName Name, ABrush* Brush, const UModel* Model)
 {
 	FScopedSlowTask SlowTask(0.0f, NSLOCTEXT("UnrealEd", "CreatingStaticMeshE", "Creating static mesh..."));
@@ -423,13 +1233,9 @@ UStaticMesh* UUSDExtraUtils::CreateStaticMeshFromBrush(UObject* Outer, FName Nam
 
 }
 
-void UUSDExtraUtils::CreateModelFromStaticMesh(UBrushComponent* BrushComponent, const UStaticMesh* StaticMesh)
+/** Returns the brush model of BrushComponent, creating an empty one on the owning brush actor if needed */
+static UModel* GetOrCreateBrushModel(UBrushComponent* BrushComponent)
 {
-	FScopedUnrealAllocs UnrealAllocs;
-
-	check(BrushComponent)
-	check(StaticMesh)
-
 	UModel* Model = BrushComponent->Brush;
 	if (!Model)
 	{
@@ -443,6 +1249,18 @@ void UUSDExtraUtils::CreateModelFromStaticMesh(UBrushComponent* BrushComponent,
 		BrushComponent->Brush = Model;
 	}
 	check(Model)
+
+	return Model;
+}
+
+void UUSDExtraUtils::CreateModelFromStaticMesh(UBrushComponent* BrushComponent, const UStaticMesh* StaticMesh)
+{
+	FScopedUnrealAllocs UnrealAllocs;
+
+	check(BrushComponent)
+	check(StaticMesh)
+
+	UModel* Model = GetOrCreateBrushModel(BrushComponent);
 	
 	FMeshDescription* MeshDescription = StaticMesh->GetMeshDescription(0);
 	FStaticMeshAttributes StaticMeshAttributes( *MeshDescription );
@@ -472,261 +1290,1978 @@ void UUSDExtraUtils::CreateModelFromStaticMesh(UBrushComponent* BrushComponent,
 		Polygon->PolyFlags = PF_DefaultFlags;
 		//Polygon->SmoothingMask = Triangle.SmoothingMask;
 
-		//new(Polygon->Vertices) FVector(ActorToWorld.TransformPosition(Triangle.Vertices[2]));
-		//new(Polygon->Vertices) FVector(ActorToWorld.TransformPosition(Triangle.Vertices[1]));
-		//new(Polygon->Vertices) FVector(ActorToWorld.TransformPosition(Triangle.Vertices[0]));
+		//new(Polygon->Vertices) FVector(ActorToWorld.TransformPosition(Triangle.Vertices[2]));
+		//new(Polygon->Vertices) FVector(ActorToWorld.TransformPosition(Triangle.Vertices[1]));
+		//new(Polygon->Vertices) FVector(ActorToWorld.TransformPosition(Triangle.Vertices[0]));
+
+		new(Polygon->Vertices) FVector(MeshDescriptionVertexPositions[V2]);
+		new(Polygon->Vertices) FVector(MeshDescriptionVertexPositions[V1]);
+		new(Polygon->Vertices) FVector(MeshDescriptionVertexPositions[V0]);
+
+		TexCoordsToVectors(Polygon->Vertices[2], FVector2D(VertexInstanceUVs.Get(VI0, 0).X * UModel::GetGlobalBSPTexelScale(), VertexInstanceUVs.Get(VI0, 0).Y * UModel::GetGlobalBSPTexelScale()),
+			Polygon->Vertices[1], FVector2D(VertexInstanceUVs.Get(VI1, 0).X * UModel::GetGlobalBSPTexelScale(), VertexInstanceUVs.Get(VI1, 0).Y * UModel::GetGlobalBSPTexelScale()),
+			Polygon->Vertices[0], FVector2D(VertexInstanceUVs.Get(VI2, 0).X * UModel::GetGlobalBSPTexelScale(), VertexInstanceUVs.Get(VI2, 0).Y * UModel::GetGlobalBSPTexelScale()),
+			&Polygon->Base, &Polygon->TextureU, &Polygon->TextureV);
+
+		Polygon->Finalize(nullptr, 0);
+	}
+
+	Model->Linked = true;
+	BSPValidateBrush(Model,false,true);
+}
+
+void UUSDExtraUtils::GetMeshDescriptionFromBrush(ABrush* Brush, const ::UModel* Model, FMeshDescription& MeshDescription, TArray<FStaticMaterial>& OutMaterials)
+{
+	FStaticMeshAttributes Attributes(MeshDescription);
+	TVertexAttributesRef<FVector3f> VertexPositions = Attributes.GetVertexPositions();
+	TVertexInstanceAttributesRef<FVector3f> VertexInstanceNormals = Attributes.GetVertexInstanceNormals();
+	TVertexInstanceAttributesRef<FVector3f> VertexInstanceTangents = Attributes.GetVertexInstanceTangents();
+	TVertexInstanceAttributesRef<float> VertexInstanceBinormalSigns = Attributes.GetVertexInstanceBinormalSigns();
+	TVertexInstanceAttributesRef<FVector4f> VertexInstanceColors = Attributes.GetVertexInstanceColors();
+	TVertexInstanceAttributesRef<FVector2f> VertexInstanceUVs = Attributes.GetVertexInstanceUVs();
+	TEdgeAttributesRef<bool> EdgeHardnesses = Attributes.GetEdgeHardnesses();
+	TPolygonGroupAttributesRef<FName> PolygonGroupImportedMaterialSlotNames = Attributes.GetPolygonGroupMaterialSlotNames();
+
+	//Make sure we have one UVChannel
+	VertexInstanceUVs.SetNumChannels(1);
+
+	// Calculate the local to world transform for the source brush.
+	FMatrix	ActorToWorld = Brush ? Brush->ActorToWorld().ToMatrixWithScale() : FMatrix::Identity;
+	bool	ReverseVertices = 0;
+	FVector4	PostSub = Brush ? FVector4(Brush->GetActorLocation()) : FVector4(0, 0, 0, 0);
+
+	TMap<uint32, FEdgeID> RemapEdgeID;
+	FBrushVertexWelder VertexWelder;
+	int32 NumPolys = Model->Polys->Element.Num();
+	//Create Fill the vertex position
+	for (int32 PolygonIndex = 0; PolygonIndex < NumPolys; ++PolygonIndex)
+	{
+		FPoly& Polygon = Model->Polys->Element[PolygonIndex];
+
+		// Find a material index for this polygon.
+		UMaterialInterface*	Material = Polygon.Material;
+		if (Material == nullptr)
+		{
+			Material = UMaterial::GetDefaultMaterial(MD_Surface);
+		}
+
+		int32 MaterialIndex = OutMaterials.AddUnique(FStaticMaterial(Material, Material->GetFName(), Material->GetFName()));
+		FPolygonGroupID CurrentPolygonGroupID = INDEX_NONE;
+		for (const FPolygonGroupID PolygonGroupID : MeshDescription.PolygonGroups().GetElementIDs())
+		{
+			if (Material->GetFName() == PolygonGroupImportedMaterialSlotNames[PolygonGroupID])
+			{
+				CurrentPolygonGroupID = PolygonGroupID;
+				break;
+			}
+		}
+		if (CurrentPolygonGroupID == INDEX_NONE)
+		{
+			CurrentPolygonGroupID = MeshDescription.CreatePolygonGroup();
+			PolygonGroupImportedMaterialSlotNames[CurrentPolygonGroupID] = Material->GetFName();
+		}
+
+		// Cache the texture coordinate system for this polygon.
+		FVector3f	TextureBase = Polygon.Base - (Brush ? (FVector3f)Brush->GetPivotOffset() : FVector3f::ZeroVector),
+			TextureX = Polygon.TextureU / UModel::GetGlobalBSPTexelScale(),
+			TextureY = Polygon.TextureV / UModel::GetGlobalBSPTexelScale();
+		// For each vertex after the first two vertices...
+		for (int32 VertexIndex = 2; VertexIndex < Polygon.Vertices.Num(); VertexIndex++)
+		{
+			FVector3f Positions[3];
+			Positions[ReverseVertices ? 0 : 2] = FVector4f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[0]) - PostSub);
+			Positions[1] = FVector4f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[VertexIndex - 1]) - PostSub);
+			Positions[ReverseVertices ? 2 : 0] = FVector4f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[VertexIndex]) - PostSub);
+			FVertexID VertexID[3] = {
+				VertexWelder.Find(Positions[0], VertexPositions),
+				VertexWelder.Find(Positions[1], VertexPositions),
+				VertexWelder.Find(Positions[2], VertexPositions) };
+
+			//Create the vertex instances
+			TArray<FVertexInstanceID> VertexInstanceIDs;
+			VertexInstanceIDs.SetNum(3);
+
+			for (int32 CornerIndex = 0; CornerIndex < 3; ++CornerIndex)
+			{
+				if (VertexID[CornerIndex] == INDEX_NONE)
+				{
+					VertexID[CornerIndex] = MeshDescription.CreateVertex();
+					VertexPositions[VertexID[CornerIndex]] = Positions[CornerIndex];
+					VertexWelder.Add(VertexID[CornerIndex], Positions[CornerIndex]);
+				}
+				VertexInstanceIDs[CornerIndex] = MeshDescription.CreateVertexInstance(VertexID[CornerIndex]);
+				VertexInstanceUVs.Set(VertexInstanceIDs[CornerIndex], 0, FVector2f(
+					(Positions[CornerIndex] - TextureBase) | TextureX,
+					(Positions[CornerIndex] - TextureBase) | TextureY));
+			}
+
+			// Create a polygon with the 3 vertex instances
+
+			TArray<FEdgeID> NewEdgeIDs;
+			const FPolygonID NewPolygonID = MeshDescription.CreatePolygon(CurrentPolygonGroupID, VertexInstanceIDs, &NewEdgeIDs);
+			for (const FEdgeID& NewEdgeID : NewEdgeIDs)
+			{
+				//All edge are hard for BSP
+				EdgeHardnesses[NewEdgeID] = true;
+			}
+		}
+	}
+}
+
+void UUSDExtraUtils::BSPValidateBrush(UModel* Brush, bool ForceValidate, bool DoStatusUpdate)
+{
+	check(Brush != nullptr);
+	Brush->Modify();
+	if( ForceValidate || !Brush->Linked )
+	{
+		Brush->Linked = true;
+		const int32 NumPolys = Brush->Polys->Element.Num();
+		for( int32 i=0; i<NumPolys; i++ )
+		{
+			Brush->Polys->Element[i].iLink = i;
+		}
+
+		// Two polys can only link if they are in the same group and in neighbouring cells, so each poly is only
+		// tested against the few candidates that could pass the full test below, in the same order as before.
+		FBox3f PlaneOrigins(ForceInit);
+		for( int32 i=0; i<NumPolys; i++ )
+		{
+			PlaneOrigins += Brush->Polys->Element[i].Vertices[0];
+		}
+		const FVector3f Center = PlaneOrigins.IsValid ? PlaneOrigins.GetCenter() : FVector3f::ZeroVector;
+		const float Radius = PlaneOrigins.IsValid ? PlaneOrigins.GetExtent().Size() : 0.0f;
+
+		// Normals passing the dot product test are closer than this to each other, which in turn bounds how far
+		// apart the plane offsets of two linkable polys can be
+		constexpr float NormalCellSize = 0.0142f;
+		const float DistanceCellSize = 0.001f + Radius * NormalCellSize;
+
+		TMap<FPolyLinkGroup, int32> Groups;
+		TMap<FPolyLinkCell, TArray<int32, TInlineAllocator<4>>> Cells;
+		TArray<FPolyLinkCell> PolyCells;
+		PolyCells.SetNum(NumPolys);
+		for( int32 i=0; i<NumPolys; i++ )
+		{
+			const FPoly& Poly = Brush->Polys->Element[i];
+
+			FPolyLinkCell& Cell = PolyCells[i];
+			Cell.Group = Groups.FindOrAdd(FPolyLinkGroup(Poly), Groups.Num());
+			Cell.Normal = FIntVector(
+				FMath::FloorToInt(Poly.Normal.X / NormalCellSize),
+				FMath::FloorToInt(Poly.Normal.Y / NormalCellSize),
+				FMath::FloorToInt(Poly.Normal.Z / NormalCellSize));
+			Cell.Distance = FMath::FloorToInt(((Poly.Vertices[0] - Center) | Poly.Normal) / DistanceCellSize);
+
+			Cells.FindOrAdd(Cell).Add(i);
+		}
+
+		int32 n=0;
+		for( int32 i=0; i<NumPolys; i++ )
+		{
+			FPoly* EdPoly = &Brush->Polys->Element[i];
+			if( EdPoly->iLink==i )
+			{
+				for( int32 X=-1; X<=1; X++ )
+				for( int32 Y=-1; Y<=1; Y++ )
+				for( int32 Z=-1; Z<=1; Z++ )
+				for( int32 D=-1; D<=1; D++ )
+				{
+					FPolyLinkCell NeighbourCell = PolyCells[i];
+					NeighbourCell.Normal += FIntVector(X, Y, Z);
+					NeighbourCell.Distance += D;
+
+					const TArray<int32, TInlineAllocator<4>>* CellPolys = Cells.Find(NeighbourCell);
+					if( !CellPolys )
+					{
+						continue;
+					}
+
+					for( const int32 j : *CellPolys )
+					{
+						if( j<=i )
+						{
+							continue;
+						}
+
+						FPoly* OtherPoly = &Brush->Polys->Element[j];
+						if
+						(	OtherPoly->iLink == j
+						&&	OtherPoly->Material == EdPoly->Material
+						&&	OtherPoly->TextureU == EdPoly->TextureU
+						&&	OtherPoly->TextureV == EdPoly->TextureV
+						&&	OtherPoly->PolyFlags == EdPoly->PolyFlags
+						&&	(OtherPoly->Normal | EdPoly->Normal)>0.9999 )
+						{
+							const float Dist = FVector::PointPlaneDist( FVector3d(OtherPoly->Vertices[0]), 
+								FVector3d(EdPoly->Vertices[0]), FVector3d(EdPoly->Normal) );
+							if( Dist>-0.001 && Dist<0.001 )
+							{
+								OtherPoly->iLink = i;
+								n++;
+							}
+						}
+					}
+				}
+			}
+		}
+		// 		UE_LOG(LogBSPOps, Log,  TEXT("BspValidateBrush linked %i of %i polys"), n, Brush->Polys->Element.Num() );
+	}
+
+	// Build bounds.
+	Brush->BuildBound();
+}
+
+void UUSDExtraUtils::PrintBrushPolyInfo(AActor* InActor)
+{
+	ABrush* BrushActor = Cast<ABrush>(InActor);
+
+	if (!BrushActor)
+	{
+		UE_LOG(LogUsd, Warning, TEXT("No Valid Brush"));
+		return;
+	}
+
+	const UModel* Model = BrushActor->GetBrushComponent()->Brush;
+	
+	for( int32 i=0; i<Model->Polys->Element.Num(); i++ )
+	{
+		const FPoly* Poly = &Model->Polys->Element[i];
+
+		FVector3f PolyBase = Poly->Base;
+		FVector3f PolyTextureU = Poly->TextureU;
+		FVector3f PolyTextureV = Poly->TextureV;
+
+		UE_LOG(LogUsd, Log, TEXT("Poly Base: %s ; TextureU: %s ; TextureV: %s"), *PolyBase.ToString(), *PolyTextureU.ToString(), *PolyTextureV.ToString());
+	}
+}
+
+UObject* USDExtraToUnreal::FReferenceCache::FindOrLoad(const FString& Path, UClass* ObjectClass)
+{
+	if (UObject** FoundObject = Objects.Find(Path))
+	{
+		return *FoundObject;
+	}
+
+	UObject* Object = ObjectClass == UClass::StaticClass()
+		? StaticLoadClass(UObject::StaticClass(), nullptr, *Path)
+		: StaticLoadObject(ObjectClass, nullptr, *Path);
+	Objects.Add(Path, Object);
+	return Object;
+}
+
+void USDExtraToUnreal::FReferenceCache::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	// Objects destroyed explicitly, like deleted assets, are nulled out and then resolve to nothing
+	for (TPair<FString, UObject*>& Object : Objects)
+	{
+		Collector.AddReferencedObject(Object.Value);
+	}
+}
+
+namespace USDExtraUtilsImpl
+{
+	FString GetFullLayerPath(const FString& FilePath)
+	{
+		FString FullFilePath = FPaths::ConvertRelativePathToFull(FilePath);
+		FPaths::NormalizeFilename(FullFilePath);
+		return FullFilePath;
+	}
+
+	/**
+	 * Layers read from their crate copy, which are dirty from the moment their content is transferred, so their dirty state says nothing
+	 * about whether they differ from their file. A layer only counts as unchanged until it is edited in memory or released.
+	 */
+	class FCrateCachedLayers : public pxr::TfWeakBase
+	{
+	public:
+		~FCrateCachedLayers()
+		{
+			if (Key.IsValid())
+			{
+				pxr::TfNotice::Revoke(Key);
+			}
+		}
+
+		/** Called once the content of Layer has been transferred from the crate copy of FilePath */
+		void Add(const FString& FilePath, const pxr::SdfLayerRefPtr& Layer)
+		{
+			FScopeLock Lock(&CriticalSection);
+
+			if (!Key.IsValid())
+			{
+				Key = pxr::TfNotice::Register(pxr::TfCreateWeakPtr(this), &FCrateCachedLayers::HandleLayersDidChange);
+			}
+
+			RemoveReleasedLayers();
+			Layers.Add(GetFullLayerPath(FilePath), pxr::SdfLayerHandle(Layer));
+		}
+
+		/** Whether Layer, opened from FilePath, still holds what was read from the crate copy of its file */
+		bool IsUnchanged(const FString& FilePath, const pxr::SdfLayerHandle& Layer)
+		{
+			FScopeLock Lock(&CriticalSection);
+
+			RemoveReleasedLayers();
+			const TUsdStore<pxr::SdfLayerHandle>* CachedLayer = Layers.Find(GetFullLayerPath(FilePath));
+			return CachedLayer && CachedLayer->Get() == Layer;
+		}
+
+	private:
+		void HandleLayersDidChange(const pxr::SdfNotice::LayersDidChange& Notice)
+		{
+			FScopeLock Lock(&CriticalSection);
+
+			for (const pxr::SdfLayerHandle& ChangedLayer : Notice.GetLayers())
+			{
+				for (TMap<FString, TUsdStore<pxr::SdfLayerHandle>>::TIterator It = Layers.CreateIterator(); It; ++It)
+				{
+					if (It->Value.Get() == ChangedLayer)
+					{
+						It.RemoveCurrent();
+					}
+				}
+			}
+		}
+
+		void RemoveReleasedLayers()
+		{
+			for (TMap<FString, TUsdStore<pxr::SdfLayerHandle>>::TIterator It = Layers.CreateIterator(); It; ++It)
+			{
+				if (!It->Value.Get())
+				{
+					It.RemoveCurrent();
+				}
+			}
+		}
+
+		TMap<FString, TUsdStore<pxr::SdfLayerHandle>> Layers;
+		pxr::TfNotice::Key Key;
+		FCriticalSection CriticalSection;
+	};
+
+	FCrateCachedLayers& GetCrateCachedLayers()
+	{
+		static FCrateCachedLayers CrateCachedLayers;
+		return CrateCachedLayers;
+	}
+
+	struct FCrateCacheStats
+	{
+		/** Text layers read from their crate copy */
+		int32 NumCachedLayers = 0;
+
+		/** Text layers parsed and written to the cache, for lack of an up to date copy */
+		int32 NumConvertedLayers = 0;
+	};
+
+	/** Whether FilePath holds a text layer, whatever its extension */
+	bool IsTextLayerFile(const FString& FilePath)
+	{
+		const TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*FilePath, FILEREAD_Silent));
+
+		ANSICHAR Header[5] = {};
+		if (!Reader || Reader->TotalSize() < static_cast<int64>(sizeof(Header)))
+		{
+			return false;
+		}
+		Reader->Serialize(Header, sizeof(Header));
+		return FCStringAnsi::Strncmp(Header, "#usda", sizeof(Header)) == 0;
+	}
+
+	/** Prefix of the crate copies of FilePath, every version of the file is cached under the same one */
+	FString GetCrateCachePrefix(const FString& FilePath)
+	{
+		const FString FullFilePath = GetFullLayerPath(FilePath);
+		const FString FileName = FString::Printf(TEXT("%s_%08x_"), *FPaths::GetBaseFilename(FullFilePath), GetTypeHash(FullFilePath.ToLower()));
+		return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("USDExtra"), TEXT("CrateCache"), FileName);
+	}
+
+	/** Where the crate copy of the current version of FilePath is cached, keyed by its path, modification time and size. Empty if there is no such file */
+	FString GetCrateCachePath(const FString& FilePath)
+	{
+		const FFileStatData StatData = IFileManager::Get().GetStatData(*FilePath);
+		if (!StatData.bIsValid || StatData.bIsDirectory)
+		{
+			return FString();
+		}
+
+		const uint64 VersionHash = CityHash128to64(Uint128_64(StatData.ModificationTime.GetTicks(), StatData.FileSize));
+		return GetCrateCachePrefix(FilePath) + FString::Printf(TEXT("%016llx.usdc"), VersionHash);
+	}
+
+	/** Opens the layer Identifier, from its crate copy when it is a text layer. Text layers without an up to date copy are parsed, then cached */
+	pxr::SdfLayerRefPtr OpenLayerThroughCrateCache(const std::string& Identifier, FCrateCacheStats& Stats)
+	{
+		const FString FilePath = UsdToUnreal::ConvertString(Identifier);
+		const FString CachePath = IsTextLayerFile(FilePath) ? GetCrateCachePath(FilePath) : FString();
+		if (CachePath.IsEmpty())
+		{
+			return pxr::SdfLayer::FindOrOpen(Identifier);
+		}
+
+		if (FPaths::FileExists(CachePath))
+		{
+			// The content goes into a new layer under the original identifier, so that composition finds it
+			// and the relative asset paths it holds still resolve next to the text file
+			if (const pxr::SdfLayerRefPtr CrateLayer = pxr::SdfLayer::OpenAsAnonymous(UnrealToUsd::ConvertString(*CachePath).Get()))
+			{
+				if (const pxr::SdfLayerRefPtr Layer = pxr::SdfLayer::New(pxr::SdfFileFormat::FindByExtension(Identifier), Identifier))
+				{
+					Layer->TransferContent(CrateLayer);
+					GetCrateCachedLayers().Add(FilePath, Layer);
+					++Stats.NumCachedLayers;
+					return Layer;
+				}
+			}
+		}
+
+		const pxr::SdfLayerRefPtr Layer = pxr::SdfLayer::FindOrOpen(Identifier);
+		if (Layer)
+		{
+			// Copies of the previous versions of the file are stale
+			const FString CachePrefix = GetCrateCachePrefix(FilePath);
+			TArray<FString> StaleFileNames;
+			IFileManager::Get().FindFiles(StaleFileNames, *(CachePrefix + TEXT("*.usdc")), true, false);
+			for (const FString& StaleFileName : StaleFileNames)
+			{
+				IFileManager::Get().Delete(*FPaths::Combine(FPaths::GetPath(CachePrefix), StaleFileName), false, false, true);
+			}
+
+			IFileManager::Get().MakeDirectory(*FPaths::GetPath(CachePath), true);
+			if (Layer->Export(UnrealToUsd::ConvertString(*CachePath).Get()))
+			{
+				++Stats.NumConvertedLayers;
+			}
+		}
+		return Layer;
+	}
+
+	/** Adds the asset paths of the payloads authored on PrimSpec and its descendants to OutPayloadPaths */
+	void CollectPayloadPaths(const pxr::SdfPrimSpecHandle& PrimSpec, std::set<std::string>& OutPayloadPaths)
+	{
+		if (PrimSpec->HasPayloads())
+		{
+			pxr::SdfPayloadVector Payloads;
+			PrimSpec->GetPayloadList().ApplyEditsToList(&Payloads);
+			for (const pxr::SdfPayload& Payload : Payloads)
+			{
+				OutPayloadPaths.insert(Payload.GetAssetPath());
+			}
+		}
+
+		for (const pxr::SdfPrimSpecHandle& ChildSpec : PrimSpec->GetNameChildren())
+		{
+			CollectPayloadPaths(ChildSpec, OutPayloadPaths);
+		}
+	}
+
+	/**
+	 * Opens the layers the stage of RootFilePath is composed from through the crate cache, following sublayers, references and,
+	 * with bIncludePayloads, payloads. Layers that are already open are used as they are.
+	 * The layers are held in OutLayers, a stage opened from RootFilePath while they are alive uses them rather than opening the files.
+	 */
+	FCrateCacheStats OpenLayersThroughCrateCache(const FString& RootFilePath, bool bIncludePayloads, std::vector<pxr::SdfLayerRefPtr>& OutLayers)
+	{
+		FScopedUsdAllocs Allocs;
+
+		FCrateCacheStats Stats;
+		std::set<std::string> VisitedIdentifiers;
+		std::vector<std::string> IdentifiersToVisit = { UnrealToUsd::ConvertString(*RootFilePath).Get() };
+		while (!IdentifiersToVisit.empty())
+		{
+			const std::string Identifier = IdentifiersToVisit.back();
+			IdentifiersToVisit.pop_back();
+			if (!VisitedIdentifiers.insert(Identifier).second)
+			{
+				continue;
+			}
+
+			pxr::SdfLayerRefPtr Layer = pxr::SdfLayer::Find(Identifier);
+			if (!Layer)
+			{
+				Layer = OpenLayerThroughCrateCache(Identifier, Stats);
+			}
+			if (!Layer)
+			{
+				continue;
+			}
+			OutLayers.push_back(Layer);
+
+			std::set<std::string> PayloadPaths;
+			if (!bIncludePayloads)
+			{
+				CollectPayloadPaths(Layer->GetPseudoRoot(), PayloadPaths);
+			}
+
+			for (const std::string& AssetPath : Layer->GetCompositionAssetDependencies())
+			{
+				if (!AssetPath.empty() && PayloadPaths.count(AssetPath) == 0)
+				{
+					IdentifiersToVisit.push_back(pxr::SdfComputeAssetPathRelativeToLayer(Layer, AssetPath));
+				}
+			}
+		}
+
+		return Stats;
+	}
+}
+
+UE::FUsdStage USDExtraToUnreal::OpenImportStage(const FString& FilePath, bool bUseStageCache, const TArray<FString>& PrimPaths)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	const bool bDeferPayloads = GetDefault<UUSDExtraSettings>()->bDeferImportPayloads;
+
+	// Held until the stage is open, which then uses these layers rather than parsing the text files again
+	TUsdStore<std::vector<pxr::SdfLayerRefPtr>> CrateCachedLayers;
+	if (GetDefault<UUSDExtraSettings>()->bUseCrateCache)
+	{
+		const USDExtraUtilsImpl::FCrateCacheStats Stats = USDExtraUtilsImpl::OpenLayersThroughCrateCache(FilePath, !bDeferPayloads, CrateCachedLayers.Get());
+
+		UE_LOG(LogUsd, Log, TEXT("Opened the layers of %s in %.3f seconds, read %d text layers from their cached crate copy and parsed %d uncached ones"),
+			*FilePath, FPlatformTime::Seconds() - StartTime, Stats.NumCachedLayers, Stats.NumConvertedLayers);
+	}
+
+	UE::FUsdStage Stage;
+	if (PrimPaths.Num() > 0)
+	{
+		FScopedUsdAllocs Allocs;
+
+		// Prims outside of the mask are never composed, their ancestors only as far as needed to reach the masked prims
+		pxr::UsdStagePopulationMask Mask;
+		for (const FString& PrimPath : PrimPaths)
+		{
+			Mask.Add(UnrealToUsd::ConvertPath(*PrimPath).Get());
+		}
+
+		if (const pxr::SdfLayerRefPtr RootLayer = pxr::SdfLayer::FindOrOpen(UnrealToUsd::ConvertString(*FilePath).Get()))
+		{
+			Stage = UE::FUsdStage(pxr::UsdStage::OpenMasked(RootLayer, Mask, bDeferPayloads ? pxr::UsdStage::LoadNone : pxr::UsdStage::LoadAll));
+		}
+	}
+	else
+	{
+		Stage = UnrealUSDWrapper::OpenStage(*FilePath, bDeferPayloads ? EUsdInitialLoadSet::LoadNone : EUsdInitialLoadSet::LoadAll, bUseStageCache);
+	}
+
+	if (Stage && bDeferPayloads)
+	{
+		FScopedUsdAllocs Allocs;
+
+		pxr::UsdStageRefPtr StageRef = Stage;
+		const int32 NumLoadedPrims = LoadGeometryPayloads(StageRef);
+
+		UE_LOG(LogUsd, Log, TEXT("Opened %s without payloads in %.3f seconds, loaded the payloads of %d prims that need geometry or children"), *FilePath, FPlatformTime::Seconds() - StartTime, NumLoadedPrims);
+	}
+	else if (Stage)
+	{
+		UE_LOG(LogUsd, Log, TEXT("Opened %s in %.3f seconds"), *FilePath, FPlatformTime::Seconds() - StartTime);
+	}
+
+	return Stage;
+}
+
+int32 USDExtraToUnreal::LoadGeometryPayloads(const pxr::UsdStageRefPtr& Stage)
+{
+	FScopedUsdAllocs Allocs;
+
+	// Children authored in the scene layers, like the HISMInstance prim or attached components under a mesh prim,
+	// are only composed once the payload of their parent is loaded
+	std::set<pxr::SdfLayerHandle> SceneLayers;
+	for (const pxr::SdfLayerHandle& Layer : Stage->GetLayerStack())
+	{
+		SceneLayers.insert(Layer);
+	}
+
+	auto HasSceneChildren = [&SceneLayers](const pxr::UsdPrim& UsdPrim)
+	{
+		for (const pxr::SdfPrimSpecHandle& PrimSpec : UsdPrim.GetPrimStack())
+		{
+			if (SceneLayers.count(PrimSpec->GetLayer()) > 0 && !PrimSpec->GetNameChildren().empty())
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// BSP prims are the only ones converted from their mesh data, everything else points to assets through its attributes.
+	// Loading a prim reveals its children, whose own payloads may be needed too, so this goes on until nothing else has to be loaded
+	int32 NumLoadedPrims = 0;
+	for (;;)
+	{
+		pxr::SdfPathSet LoadSet;
+		for (const pxr::UsdPrim& UsdPrim : Stage->Traverse(USDExtraUtilsImpl::GetImportPrimPredicate()))
+		{
+			if (UsdPrim.IsLoaded() || !UsdPrim.HasAuthoredPayloads())
+			{
+				continue;
+			}
+
+			pxr::TfToken PrimType;
+			const pxr::UsdAttribute PrimTypeAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealPrimType);
+			const bool bBSP = PrimTypeAttr && PrimTypeAttr.Get<pxr::TfToken>(&PrimType) && PrimType == USDExtraTokensType::PrimTypeBSP;
+
+			if (bBSP || UsdPrim.IsA<pxr::UsdGeomPointInstancer>() || HasSceneChildren(UsdPrim))
+			{
+				LoadSet.insert(UsdPrim.GetPath());
+			}
+		}
+
+		if (LoadSet.empty())
+		{
+			break;
+		}
+
+		Stage->LoadAndUnload(LoadSet, pxr::SdfPathSet(), pxr::UsdLoadWithoutDescendants);
+		NumLoadedPrims += static_cast<int32>(LoadSet.size());
+	}
+
+	return NumLoadedPrims;
+}
+
+namespace USDExtraUtilsImpl
+{
+	/** Loads ReferencePaths in one asynchronous batch into OutCache, leaving out the ones that don't resolve */
+	void PreloadReferencePaths(const TArray<FString>& ReferencePaths, USDExtraToUnreal::FReferenceCache& OutCache)
+	{
+		if (ReferencePaths.Num() == 0)
+		{
+			return;
+		}
+
+		TArray<FSoftObjectPath> ObjectPaths;
+		ObjectPaths.Reserve(ReferencePaths.Num());
+		for (const FString& ReferencePath : ReferencePaths)
+		{
+			ObjectPaths.Emplace(ReferencePath);
+		}
+
+		OutCache.PreloadHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(ObjectPaths, FStreamableDelegate(), FStreamableManager::AsyncLoadHighPriority, false, false, TEXT("USDExtraPreloadReferences"));
+		if (OutCache.PreloadHandle.IsValid())
+		{
+			OutCache.PreloadHandle->WaitUntilComplete();
+		}
+
+		// Paths that did not resolve stay out of the table, GatherPrimConversionInfo and the import retry them synchronously
+		for (int32 PathIndex = 0; PathIndex < ObjectPaths.Num(); ++PathIndex)
+		{
+			if (UObject* Object = ObjectPaths[PathIndex].ResolveObject())
+			{
+				OutCache.Objects.Add(ReferencePaths[PathIndex], Object);
+			}
+		}
+
+		UE_LOG(LogUsd, Log, TEXT("Preloaded %d of %d referenced classes and assets"), OutCache.Objects.Num(), ObjectPaths.Num());
+	}
+}
+
+void USDExtraToUnreal::FCompactReferenceTables::Read(const pxr::UsdStageRefPtr& Stage)
+{
+	using namespace USDExtraUtilsImpl;
+
+	Classes.Reset();
+	Assets.Reset();
+	Materials.Reset();
+	Outers.Reset();
+
+	FScopedUsdAllocs Allocs;
+
+	const pxr::UsdPrim DefaultPrim = Stage ? Stage->GetDefaultPrim() : pxr::UsdPrim();
+	if (!DefaultPrim)
+	{
+		return;
+	}
+
+	// The tables of every layer of the stage are merged by the composition of the custom data dictionaries
+	const pxr::VtValue TablesValue = DefaultPrim.GetCustomDataByKey(USDExtraIdentifiers::UnrealReferenceTables);
+	if (!TablesValue.IsHolding<pxr::VtDictionary>())
+	{
+		return;
+	}
+
+	const pxr::VtDictionary& TablesData = TablesValue.UncheckedGet<pxr::VtDictionary>();
+	auto ReadTable = [&TablesData](const char* Key, TMap<int64, FString>& OutTable)
+	{
+		if (const pxr::VtDictionary* Table = FindDictionaryValue<pxr::VtDictionary>(TablesData, Key))
+		{
+			for (const std::pair<const std::string, pxr::VtValue>& Entry : *Table)
+			{
+				if (Entry.second.IsHolding<std::string>())
+				{
+					OutTable.Add(FCString::Atoi64(*UsdToUnreal::ConvertString(Entry.first)), UsdToUnreal::ConvertString(Entry.second.UncheckedGet<std::string>()));
+				}
+			}
+		}
+	};
+
+	ReadTable(CompactKeys::Classes, Classes);
+	ReadTable(CompactKeys::Assets, Assets);
+	ReadTable(CompactKeys::Materials, Materials);
+	ReadTable(CompactKeys::Outers, Outers);
+}
+
+void USDExtraToUnreal::PreloadReferences(const pxr::UsdStageRefPtr& Stage, FReferenceCache& OutCache)
+{
+	TSet<FString> ReferencePaths;
+
+	OutCache.Tables.Read(Stage);
+	for (const TMap<int64, FString>* Table : { &OutCache.Tables.Classes, &OutCache.Tables.Assets, &OutCache.Tables.Materials })
+	{
+		for (const TPair<int64, FString>& Entry : *Table)
+		{
+			ReferencePaths.Add(Entry.Value);
+		}
+	}
+
+	{
+		FScopedUsdAllocs Allocs;
+
+		const pxr::TfToken ReferenceAttributes[] = { USDExtraIdentifiers::UnrealClassReference, USDExtraIdentifiers::UnrealAssetReference, USDExtraIdentifiers::UnrealMaterialReference };
+		for (const pxr::UsdPrim& UsdPrim : Stage->Traverse(USDExtraUtilsImpl::GetImportPrimPredicate()))
+		{
+			for (const pxr::TfToken& ReferenceAttribute : ReferenceAttributes)
+			{
+				if (const pxr::UsdAttribute ReferenceAttr = UsdPrim.GetAttribute(ReferenceAttribute))
+				{
+					std::string Reference;
+					ReferenceAttr.Get<std::string>(&Reference);
+					if (!Reference.empty() && Reference != "None")
+					{
+						ReferencePaths.Add(UsdToUnreal::ConvertString(Reference));
+					}
+				}
+			}
+		}
+	}
+
+	USDExtraUtilsImpl::PreloadReferencePaths(ReferencePaths.Array(), OutCache);
+}
+
+FString USDExtraToUnreal::FImportFingerprints::GetFilePath(const UWorld* World, const FString& StageFilePath)
+{
+	FString FullStageFilePath = FPaths::ConvertRelativePathToFull(StageFilePath);
+	FPaths::NormalizeFilename(FullStageFilePath);
+
+	// "/Game/Maps/Level" and "D:/Scatter/HTest.usda" become "_Game_Maps_Level_HTest_<hash of the full path>.json"
+	const FString FileName = FString::Printf(TEXT("%s_%s_%08x.json"), *World->GetOutermost()->GetName().Replace(TEXT("/"), TEXT("_")), *FPaths::GetBaseFilename(FullStageFilePath), GetTypeHash(FullStageFilePath.ToLower()));
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("USDExtra"), TEXT("ImportFingerprints"), FileName);
+}
+
+bool USDExtraToUnreal::FImportFingerprints::Load(const FString& FilePath)
+{
+	FScopedUnrealAllocs UnrealAllocs;
+
+	Previous.Reset();
+
+	FString Content;
+	if (!FFileHelper::LoadFileToString(Content, *FilePath))
+	{
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> Root;
+	const TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Content);
+	const TSharedPtr<FJsonObject>* Prims = nullptr;
+	if (!FJsonSerializer::Deserialize(Reader, Root) || !Root.IsValid() || !Root->TryGetObjectField(TEXT("Prims"), Prims))
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Ignoring unreadable import fingerprints '%s'"), *FilePath);
+		return false;
+	}
+
+	Previous.Reserve((*Prims)->Values.Num());
+	for (const TPair<FString, TSharedPtr<FJsonValue>>& Prim : (*Prims)->Values)
+	{
+		const TSharedPtr<FJsonObject>* PrimObject = nullptr;
+		FString Hash;
+		if (!Prim.Value->TryGetObject(PrimObject) || !(*PrimObject)->TryGetStringField(TEXT("Hash"), Hash))
+		{
+			continue;
+		}
+
+		FPrimRecord& Record = Previous.Add(Prim.Key);
+		Record.Hash = FParse::HexNumber64(*Hash);
+		(*PrimObject)->TryGetStringField(TEXT("Object"), Record.ObjectPath);
+		(*PrimObject)->TryGetBoolField(TEXT("Actor"), Record.bActor);
+		(*PrimObject)->TryGetBoolField(TEXT("Spawned"), Record.bSpawned);
+	}
+
+	return true;
+}
+
+bool USDExtraToUnreal::FImportFingerprints::Save(const FString& FilePath) const
+{
+	FScopedUnrealAllocs UnrealAllocs;
+
+	TSharedRef<FJsonObject> Prims = MakeShared<FJsonObject>();
+	for (const TPair<FString, FPrimRecord>& Prim : Current)
+	{
+		TSharedRef<FJsonObject> PrimObject = MakeShared<FJsonObject>();
+		PrimObject->SetStringField(TEXT("Hash"), FString::Printf(TEXT("%016llx"), Prim.Value.Hash));
+		PrimObject->SetStringField(TEXT("Object"), Prim.Value.ObjectPath);
+		PrimObject->SetBoolField(TEXT("Actor"), Prim.Value.bActor);
+		PrimObject->SetBoolField(TEXT("Spawned"), Prim.Value.bSpawned);
+		Prims->SetObjectField(Prim.Key, PrimObject);
+	}
+
+	TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+	Root->SetObjectField(TEXT("Prims"), Prims);
+
+	FString Content;
+	const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Content);
+	if (!FJsonSerializer::Serialize(Root, Writer) || !FFileHelper::SaveStringToFile(Content, *FilePath))
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Failed to write import fingerprints '%s'"), *FilePath);
+		return false;
+	}
+	return true;
+}
+
+int32 USDExtraToUnreal::FImportFingerprints::RemoveDeletedPrims(const pxr::UsdStageRefPtr& Stage, FUSDExtraWorldContentIndex& WorldContent, UWorld* World)
+{
+	return RemoveDeletedPrims([&Stage](const FString& PrimPathString)
+	{
+		FScopedUsdAllocs UsdAllocs;
+
+		const pxr::SdfPath PrimPath = UnrealToUsd::ConvertPath(*PrimPathString).Get();
+		const pxr::UsdPrim UsdPrim = Stage->GetPrimAtPath(PrimPath);
+		return (UsdPrim && UsdPrim.IsActive()) || !Stage->GetPopulationMask().IncludesSubtree(PrimPath);
+	}, WorldContent, World);
+}
+
+int32 USDExtraToUnreal::FImportFingerprints::RemoveDeletedPrims(const FImportPlan& Plan, FUSDExtraWorldContentIndex& WorldContent, UWorld* World)
+{
+	TSet<FString> OpPrimPaths;
+	OpPrimPaths.Reserve(Plan.Ops.Num());
+	for (const FImportPlan::FOp& Op : Plan.Ops)
+	{
+		OpPrimPaths.Add(Op.PrimPath);
+	}
+	const TSet<FString> PrunedPrimPaths(Plan.PrunedPrimPaths);
+
+	return RemoveDeletedPrims([&OpPrimPaths, &PrunedPrimPaths](const FString& PrimPath)
+	{
+		if (OpPrimPaths.Contains(PrimPath))
+		{
+			return true;
+		}
+
+		// Descendants of pruned prims were never visited, but are still on the stage
+		FString AncestorPath = PrimPath;
+		int32 SeparatorIndex = INDEX_NONE;
+		while (!PrunedPrimPaths.Contains(AncestorPath))
+		{
+			if (!AncestorPath.FindLastChar(TEXT('/'), SeparatorIndex) || SeparatorIndex == 0)
+			{
+				return false;
+			}
+			AncestorPath.LeftInline(SeparatorIndex, false);
+		}
+		return true;
+	}, WorldContent, World);
+}
+
+int32 USDExtraToUnreal::FImportFingerprints::RemoveDeletedPrims(TFunctionRef<bool(const FString& PrimPath)> IsPrimKept, FUSDExtraWorldContentIndex& WorldContent, UWorld* World)
+{
+	int32 NumRemovedPrims = 0;
+
+	for (const TPair<FString, FPrimRecord>& Prim : Previous)
+	{
+		if (Current.Contains(Prim.Key))
+		{
+			continue;
+		}
+
+		if (IsPrimKept(Prim.Key))
+		{
+			Current.Add(Prim.Key, Prim.Value);
+			continue;
+		}
+
+		++NumRemovedPrims;
+
+		// Objects that existed before the import are left alone, only their prim is gone
+		USceneComponent* Component = Prim.Value.bSpawned ? WorldContent.Find(FName(Prim.Value.ObjectPath)) : nullptr;
+		AActor* Owner = Component ? Component->GetOwner() : nullptr;
+		if (!Owner)
+		{
+			continue;
+		}
+
+		UE_LOG(LogUsd, Log, TEXT("Removing '%s' of deleted prim '%s'"), *Prim.Value.ObjectPath, *Prim.Key);
+
+		if (Prim.Value.bActor)
+		{
+			World->EditorDestroyActor(Owner, true);
+		}
+		else
+		{
+			Owner->RemoveInstanceComponent(Component);
+			Component->DestroyComponent();
+		}
+	}
+
+	return NumRemovedPrims;
+}
+
+uint64 USDExtraToUnreal::HashPrim(const pxr::UsdPrim& UsdPrim, bool bIncludeDescendants)
+{
+	FScopedUsdAllocs Allocs;
+
+	uint64 Hash = 0;
+	auto Combine = [&Hash](uint64 Value)
+	{
+		Hash = CityHash128to64(Uint128_64(Hash, Value));
+	};
+
+	pxr::UsdPrimRange PrimRange(UsdPrim, USDExtraUtilsImpl::GetImportPrimPredicate());
+	for (pxr::UsdPrimRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt)
+	{
+		const pxr::UsdPrim& Prim = *PrimRangeIt;
+		if (!bIncludeDescendants)
+		{
+			PrimRangeIt.PruneChildren();
+		}
+		else if (Prim != UsdPrim)
+		{
+			Combine(Prim.GetPath().GetHash());
+		}
+
+		Combine(Prim.GetTypeName().Hash());
+		Combine(Prim.IsActive());
+
+		// Prims exported with compact references hold them in custom data rather than in properties
+		for (const std::pair<const std::string, pxr::VtValue>& Field : USDExtraUtilsImpl::GetCompactData(Prim))
+		{
+			Combine(std::hash<std::string>()(Field.first));
+			Combine(Field.second.GetHash());
+		}
+
+		for (const pxr::UsdProperty& Property : Prim.GetAuthoredProperties())
+		{
+			Combine(Property.GetName().Hash());
+
+			if (Property.Is<pxr::UsdAttribute>())
+			{
+				const pxr::UsdAttribute Attribute = Property.As<pxr::UsdAttribute>();
+
+				pxr::VtValue Value;
+				if (Attribute.Get(&Value, pxr::UsdTimeCode::Default()))
+				{
+					Combine(Value.GetHash());
+				}
+
+				std::vector<double> TimeSamples;
+				Attribute.GetTimeSamples(&TimeSamples);
+				for (const double TimeSample : TimeSamples)
+				{
+					Combine(std::hash<double>()(TimeSample));
+					if (Attribute.Get(&Value, TimeSample))
+					{
+						Combine(Value.GetHash());
+					}
+				}
+			}
+			else if (Property.Is<pxr::UsdRelationship>())
+			{
+				pxr::SdfPathVector Targets;
+				Property.As<pxr::UsdRelationship>().GetTargets(&Targets);
+				for (const pxr::SdfPath& Target : Targets)
+				{
+					Combine(Target.GetHash());
+				}
+			}
+		}
+	}
+
+	return Hash;
+}
+
+namespace USDExtraUtilsImpl
+{
+	using namespace USDExtraToUnreal;
+
+	/** Scope of the prims being compiled, mirrors the FImportScope they get when the plan is applied */
+	struct FCompileScope
+	{
+		FImportScope::EKind Kind = FImportScope::EKind::Root;
+		FName ActorFolderPath = NAME_None;
+		int32 OpIndex = INDEX_NONE;
+	};
+
+	/** Subtree of the stage compiled by one worker, merged into the plan in the order the tasks were added */
+	struct FCompileTask
+	{
+		TUsdStore<pxr::UsdPrim> Prim;
+		FCompileScope Scope;
+
+		/** Task whose first op is the parent of the top ops of this one */
+		int32 ParentTaskIndex = INDEX_NONE;
+
+		bool bDeferFoliage = true;
+		bool bCompiled = false;
+
+		FImportPlan Plan;
+		TArray<TUsdStore<pxr::UsdPrim>> DeferredFoliagePrims;
+	};
+
+	/** Looks references up in a preloaded cache without ever loading, so that compiling can run on any thread. Misses are added to OutUnresolvedReferences */
+	UObject* FindPreloadedReference(const FReferenceCache& ReferenceCache, const FString& Path, UClass* ObjectClass, TMap<FString, UClass*>& OutUnresolvedReferences)
+	{
+		if (UObject* const* Object = ReferenceCache.Objects.Find(Path))
+		{
+			return *Object;
+		}
+
+		OutUnresolvedReferences.Add(Path, ObjectClass);
+		return nullptr;
+	}
+
+	/**
+	 * Decides what Op does for a prim imported into Scope, adjusting the actor folder of its info.
+	 * Returns false when the prim is pruned with its descendants, or deferred to OutDeferFoliage.
+	 */
+	bool DecidePrimOp(const FCompileScope& Scope, bool bDeferFoliage, FImportPlan::FOp& Op, bool& bOutDeferFoliage)
+	{
+		FUSDExtraToUnrealInfo& Info = Op.Info;
+		bOutDeferFoliage = false;
+
+		if (Scope.Kind == FImportScope::EKind::Component)
+		{
+			if (Info.ConversionMethod == EUnrealConversionMethod::Ignore)
+			{
+				return false;
+			}
+			else if (Info.PrimUsage == EUnrealPrimUsage::Actor)
+			{
+				Info.ActorFolderPath = Scope.ActorFolderPath;
+				Op.Type = FImportPlan::EOpType::Actor;
+				return true;
+			}
+			else if (Info.PrimUsage == EUnrealPrimUsage::Component)
+			{
+				Op.Type = FImportPlan::EOpType::Component;
+				return true;
+			}
+		}
+		else if (Info.PrimType == EUnrealPrimType::Folder)
+		{
+			if (Scope.Kind == FImportScope::EKind::Folder)
+			{
+				Info.ActorFolderPath = FName(Scope.ActorFolderPath.ToString() + "/" + Info.ActorFolderPath.ToString());
+			}
+			Op.Type = FImportPlan::EOpType::Folder;
+			return true;
+		}
+		else if (Info.ConversionMethod != EUnrealConversionMethod::Ignore && Info.PrimUsage == EUnrealPrimUsage::Actor)
+		{
+			// Foliage goes last so that its base component traces can hit everything imported before it
+			if (Scope.Kind == FImportScope::EKind::Root && bDeferFoliage && Info.ClassReference == AInstancedFoliageActor::StaticClass())
+			{
+				bOutDeferFoliage = true;
+				return false;
+			}
+
+			if (Scope.Kind == FImportScope::EKind::Folder)
+			{
+				Info.ActorFolderPath = Scope.ActorFolderPath;
+			}
+			Op.Type = FImportPlan::EOpType::Actor;
+			return true;
+		}
+
+		return false;
+	}
+
+	/** Reads the prototypes and instances of the point instancer of a HISM or foliage prim, keeping the instances inside the region */
+	bool CompilePointInstancerPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, EUnrealPrimType PrimType, const FReferenceCache& ReferenceCache, FImportRegionFilter* RegionFilter, FImportPlan::FInstancer& OutInstancer, TMap<FString, UClass*>& OutUnresolvedReferences)
+	{
+		FScopedUsdAllocs UsdAllocs;
+
+		// HISM prims hold their point instancer in a child prim, foliage prims are the point instancer
+		const pxr::UsdPrim InstancerPrim = PrimType == EUnrealPrimType::HISM ? UsdPrim.GetChild(pxr::TfToken("HISMInstance")) : UsdPrim;
+		if (!InstancerPrim)
+		{
+			return false;
+		}
+
+		const pxr::UsdGeomPointInstancer PointInstancer(InstancerPrim);
+		if (!PointInstancer)
+		{
+			return false;
+		}
+
+		const pxr::UsdPrim Prototypes = InstancerPrim.GetChild(pxr::TfToken("Prototypes"));
+		if (!Prototypes)
+		{
+			return false;
+		}
+
+		const auto ResolveReference = [&ReferenceCache, &OutUnresolvedReferences](const FString& Path, UClass* ObjectClass)
+		{
+			return FindPreloadedReference(ReferenceCache, Path, ObjectClass, OutUnresolvedReferences);
+		};
+
+		for (const TUsdStore<pxr::UsdPrim>& MeshPrototype : GetMeshPrototypes(Prototypes))
+		{
+			const FUSDExtraToUnrealInfo MeshInfo = ReadPrimConversionInfo(MeshPrototype.Get(), ReferenceCache.Tables, &ReferenceCache.Strings, ResolveReference);
+			OutInstancer.PrototypeMeshes.Add(Cast<UStaticMesh>(MeshInfo.AssetReference));
+			OutInstancer.PrototypeMaterials.Add(MeshInfo.MaterialReference);
+		}
+
+		// A HISM component only has a single mesh, without it there is nothing to instance
+		if (PrimType == EUnrealPrimType::HISM && !(OutInstancer.PrototypeMeshes.IsValidIndex(0) && OutInstancer.PrototypeMeshes[0]))
+		{
+			return false;
+		}
+
+		pxr::VtMatrix4dArray UsdInstanceTransforms;
+		if (!PointInstancer.ComputeInstanceTransformsAtTime(&UsdInstanceTransforms, 0.0f, 0.0f))
+		{
+			return false;
+		}
+
+		const TArray<bool> InRegion = RegionFilter ? RegionFilter->FilterInstances(PointInstancer, UsdInstanceTransforms) : TArray<bool>();
+
+		const bool bFoliage = PrimType == EUnrealPrimType::InstancedFoliage;
+		const pxr::VtArray<int> ProtoIndices = bFoliage ? UsdUtils::GetUsdValue<pxr::VtArray<int>>(PointInstancer.GetProtoIndicesAttr(), 0.0f) : pxr::VtArray<int>();
+		const pxr::VtArray<int> BaseComponentIndices = bFoliage ? UsdUtils::GetUsdValue<pxr::VtArray<int>>(UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealBaseComponentIndices), UsdUtils::GetDefaultTimeCode()) : pxr::VtArray<int>();
+		if (bFoliage)
+		{
+			pxr::VtArray<std::string> BaseComponentReferences;
+			UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealBaseComponentReferences).Get<pxr::VtArray<std::string>>(&BaseComponentReferences);
+			for (const std::string& BaseComponentReference : BaseComponentReferences)
+			{
+				OutInstancer.BaseComponentReferences.Add(ReferenceCache.Strings.ToName(BaseComponentReference));
+			}
+		}
+
+		const FUsdStageInfo StageInfo(Stage);
+
+		FScopedUnrealAllocs UnrealAllocs;
+
+		const int32 NumInstances = bFoliage ? FMath::Min<int32>(UsdInstanceTransforms.size(), ProtoIndices.size()) : UsdInstanceTransforms.size();
+		TArray<int32> InstancesToAdd;
+		InstancesToAdd.Reserve(NumInstances);
+		for (int32 Index = 0; Index < NumInstances; ++Index)
+		{
+			if (InRegion.Num() == 0 || InRegion[Index])
+			{
+				InstancesToAdd.Add(Index);
+			}
+		}
+
+		const pxr::VtMatrix4dArray& ConstUsdInstanceTransforms = UsdInstanceTransforms;
+		OutInstancer.Transforms.SetNum(InstancesToAdd.Num());
+		ParallelFor(InstancesToAdd.Num(), [&OutInstancer, &InstancesToAdd, &ConstUsdInstanceTransforms, &StageInfo](int32 InstanceIndex)
+		{
+			OutInstancer.Transforms[InstanceIndex] = UsdToUnreal::ConvertMatrix(StageInfo, ConstUsdInstanceTransforms[InstancesToAdd[InstanceIndex]]);
+		});
+
+		if (bFoliage)
+		{
+			OutInstancer.PrototypeIndices.Reserve(InstancesToAdd.Num());
+			OutInstancer.BaseComponentIndices.Reserve(InstancesToAdd.Num());
+			for (const int32 Index : InstancesToAdd)
+			{
+				OutInstancer.PrototypeIndices.Add(ProtoIndices[Index]);
+				OutInstancer.BaseComponentIndices.Add(Index < static_cast<int32>(BaseComponentIndices.size()) ? BaseComponentIndices[Index] : INDEX_NONE);
+			}
+		}
+
+		return true;
+	}
+
+	/** Compiles UsdPrim and its descendants into OutPlan, foliage actors found directly under a Root scope are deferred to OutDeferredFoliagePrims */
+	void CompilePrimTree(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, const FCompileScope& ParentScope, const FReferenceCache& ReferenceCache, bool bHashPrims, const FUSDExtraImportRegion* Region, bool bDeferFoliage, FImportPlan& OutPlan, TArray<TUsdStore<pxr::UsdPrim>>& OutDeferredFoliagePrims)
+	{
+		FScopedUsdAllocs Allocs;
+
+		// Each worker has its own caches, they are not safe to share
+		TOptional<FImportRegionFilter> RegionFilter;
+		if (Region)
+		{
+			RegionFilter.Emplace(Stage, *Region);
+		}
+
+		const auto ResolveReference = [&ReferenceCache, &OutPlan](const FString& Path, UClass* ObjectClass)
+		{
+			return FindPreloadedReference(ReferenceCache, Path, ObjectClass, OutPlan.UnresolvedReferences);
+		};
+
+		// Scopes of the prims on the current traversal path, the last one is the parent of the prim being visited
+		TArray<FCompileScope> ScopeStack;
+		ScopeStack.Push(ParentScope);
+
+		pxr::UsdPrimRange PrimRange = pxr::UsdPrimRange::PreAndPostVisit(UsdPrim, GetImportPrimPredicate());
+		for (pxr::UsdPrimRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt)
+		{
+			if (PrimRangeIt.IsPostVisit())
+			{
+				ScopeStack.Pop(false);
+				continue;
+			}
+
+			++OutPlan.NumVisitedPrims;
+
+			const pxr::UsdPrim& ChildUsdPrim = *PrimRangeIt;
+			const FCompileScope Scope = ScopeStack.Last();
+			FCompileScope ChildScope;
+
+			FImportPlan::FOp Op;
+			Op.Info = ReadPrimConversionInfo(ChildUsdPrim, ReferenceCache.Tables, &ReferenceCache.Strings, ResolveReference);
+
+			// Actors outside of the region are pruned before any other read, along with everything below them
+			const bool bOutsideRegion = RegionFilter && Op.Info.PrimUsage == EUnrealPrimUsage::Actor && Op.Info.PrimType != EUnrealPrimType::Folder
+				&& Op.Info.ConversionMethod != EUnrealConversionMethod::Ignore && !RegionFilter->Intersects(ChildUsdPrim);
+
+			bool bDeferred = false;
+			if (bOutsideRegion || !DecidePrimOp(Scope, bDeferFoliage, Op, bDeferred))
+			{
+				if (bDeferred)
+				{
+					OutDeferredFoliagePrims.Add(ChildUsdPrim);
+				}
+				else
+				{
+					OutPlan.PrunedPrimPaths.Add(UsdToUnreal::ConvertPath(ChildUsdPrim.GetPath()));
+				}
+
+				// Pushed even when pruned, so that the post visit of this prim pops it
+				PrimRangeIt.PruneChildren();
+				ScopeStack.Push(ChildScope);
+				continue;
+			}
+
+			Op.PrimPath = UsdToUnreal::ConvertPath(ChildUsdPrim.GetPath());
+			Op.PrimName = UsdToUnreal::ConvertString(ChildUsdPrim.GetName().GetString());
+			Op.ParentIndex = Scope.OpIndex;
+
+			if (Op.Type != FImportPlan::EOpType::Folder)
+			{
+				if (const pxr::UsdGeomXformable Xformable = pxr::UsdGeomXformable(ChildUsdPrim))
+				{
+					Op.bHasTransform = UsdToUnreal::ConvertXformable(Stage, Xformable, Op.Transform, 0.0, &Op.bResetTransformStack);
+					Op.bHidden = Xformable.ComputeVisibility(0.0) == pxr::UsdGeomTokens->invisible;
+				}
+
+				// Instancer prims are converted from their child prims, and only keep the instances inside the region
+				const bool bInstancer = Op.Info.PrimType == EUnrealPrimType::HISM || Op.Info.PrimType == EUnrealPrimType::InstancedFoliage;
+				if (bHashPrims)
+				{
+					Op.Hash = HashPrim(ChildUsdPrim, bInstancer);
+					if (bInstancer && RegionFilter)
+					{
+						Op.Hash = CityHash128to64(Uint128_64(Op.Hash, RegionFilter->GetHash()));
+					}
+				}
+
+				if (bInstancer)
+				{
+					FImportPlan::FInstancer Instancer;
+					if (CompilePointInstancerPrim(Stage, ChildUsdPrim, Op.Info.PrimType, ReferenceCache, RegionFilter.GetPtrOrNull(), Instancer, OutPlan.UnresolvedReferences))
+					{
+						Op.InstancerIndex = OutPlan.Instancers.Add(MoveTemp(Instancer));
+					}
+				}
+				else if (Op.Info.PrimType == EUnrealPrimType::BSP)
+				{
+					TArray<FPoly> Polys;
+					if (ConvertGeomMeshToPolys(ChildUsdPrim, Polys))
+					{
+						Op.BrushIndex = OutPlan.Brushes.Add(MoveTemp(Polys));
+					}
+				}
+			}
+
+			ChildScope.Kind = Op.Type == FImportPlan::EOpType::Folder ? FImportScope::EKind::Folder : FImportScope::EKind::Component;
+			ChildScope.ActorFolderPath = Op.Info.ActorFolderPath;
+			ChildScope.OpIndex = OutPlan.Ops.Add(MoveTemp(Op));
+			ScopeStack.Push(ChildScope);
+		}
+	}
+
+	/**
+	 * Adds the task compiling UsdPrim. Folders are compiled right away and their children get tasks of their own,
+	 * so that the actors under the folders, the bulk of a stage, are spread over the workers.
+	 */
+	void AddCompileTasks(const pxr::UsdPrim& UsdPrim, const FCompileScope& Scope, int32 ParentTaskIndex, const FReferenceCache& ReferenceCache, TArray<FCompileTask>& OutTasks)
+	{
+		FScopedUsdAllocs Allocs;
+
+		const int32 TaskIndex = OutTasks.AddDefaulted();
+		OutTasks[TaskIndex].Prim = UsdPrim;
+		OutTasks[TaskIndex].Scope = Scope;
+		OutTasks[TaskIndex].ParentTaskIndex = ParentTaskIndex;
+
+		FImportPlan::FOp Op;
+		Op.Info = ReadPrimConversionInfo(UsdPrim, ReferenceCache.Tables, &ReferenceCache.Strings, [&ReferenceCache, &OutTasks, TaskIndex](const FString& Path, UClass* ObjectClass)
+		{
+			return FindPreloadedReference(ReferenceCache, Path, ObjectClass, OutTasks[TaskIndex].Plan.UnresolvedReferences);
+		});
+
+		bool bDeferred = false;
+		if (!DecidePrimOp(Scope, true, Op, bDeferred) || Op.Type != FImportPlan::EOpType::Folder)
+		{
+			return;
+		}
+
+		Op.PrimPath = UsdToUnreal::ConvertPath(UsdPrim.GetPath());
+		Op.PrimName = UsdToUnreal::ConvertString(UsdPrim.GetName().GetString());
+
+		FCompileScope ChildScope;
+		ChildScope.Kind = FImportScope::EKind::Folder;
+		ChildScope.ActorFolderPath = Op.Info.ActorFolderPath;
+
+		FCompileTask& Task = OutTasks[TaskIndex];
+		Task.Plan.Ops.Add(MoveTemp(Op));
+		Task.Plan.NumVisitedPrims = 1;
+		Task.bCompiled = true;
+
+		for (const pxr::UsdPrim& ChildPrim : UsdPrim.GetFilteredChildren(GetImportPrimPredicate()))
+		{
+			AddCompileTasks(ChildPrim, ChildScope, TaskIndex, ReferenceCache, OutTasks);
+		}
+	}
+
+	void CompileTasks(const pxr::UsdStageRefPtr& Stage, const FReferenceCache& ReferenceCache, bool bHashPrims, const FUSDExtraImportRegion* Region, TArrayView<FCompileTask> Tasks)
+	{
+		ParallelFor(Tasks.Num(), [&](int32 TaskIndex)
+		{
+			FCompileTask& Task = Tasks[TaskIndex];
+			if (!Task.bCompiled)
+			{
+				CompilePrimTree(Stage, Task.Prim.Get(), Task.Scope, ReferenceCache, bHashPrims, Region, Task.bDeferFoliage, Task.Plan, Task.DeferredFoliagePrims);
+				Task.bCompiled = true;
+			}
+		});
+	}
+}
+
+FString USDExtraToUnreal::FImportPlan::ToString() const
+{
+	TArray<int32> Depths;
+	Depths.SetNumZeroed(Ops.Num());
+
+	FString Result;
+	for (int32 OpIndex = 0; OpIndex < Ops.Num(); ++OpIndex)
+	{
+		const FOp& Op = Ops[OpIndex];
+		Depths[OpIndex] = Op.ParentIndex == INDEX_NONE ? 0 : Depths[Op.ParentIndex] + 1;
+
+		Result += FString::ChrN(Depths[OpIndex] * 2, TEXT(' '));
+		if (Op.Type == EOpType::Folder)
+		{
+			Result += FString::Printf(TEXT("[%d] Folder %s -> %s"), OpIndex, *Op.PrimPath, *Op.Info.ActorFolderPath.ToString());
+		}
+		else
+		{
+			Result += FString::Printf(TEXT("[%d] %s %s %s -> %s (%s)"), OpIndex,
+				Op.Type == EOpType::Actor ? TEXT("Actor") : TEXT("Component"),
+				*StaticEnum<EUnrealConversionMethod>()->GetValueAsString(Op.Info.ConversionMethod),
+				*Op.PrimPath, *Op.Info.InstanceReference.ToString(), *GetNameSafe(Op.Info.ClassReference));
+
+			if (Op.Info.AssetReference)
+			{
+				Result += FString::Printf(TEXT(" asset=%s"), *Op.Info.AssetReference->GetPathName());
+			}
+			if (Instancers.IsValidIndex(Op.InstancerIndex))
+			{
+				Result += FString::Printf(TEXT(" instances=%d"), Instancers[Op.InstancerIndex].Transforms.Num());
+			}
+			if (Brushes.IsValidIndex(Op.BrushIndex))
+			{
+				Result += FString::Printf(TEXT(" polys=%d"), Brushes[Op.BrushIndex].Num());
+			}
+			if (bHasHashes)
+			{
+				Result += FString::Printf(TEXT(" hash=%016llx"), Op.Hash);
+			}
+		}
+		Result += LINE_TERMINATOR;
+	}
+
+	return Result;
+}
+
+USDExtraToUnreal::FImportPlan USDExtraToUnreal::CompileImportPlan(const pxr::UsdStageRefPtr& Stage, const TArray<TUsdStore<pxr::UsdPrim>>& RootPrims, const FImportScope& ParentScope, const FReferenceCache& ReferenceCache, bool bHashPrims, const FUSDExtraImportRegion* Region)
+{
+	using namespace USDExtraUtilsImpl;
+
+	FCompileScope RootScope;
+	RootScope.Kind = ParentScope.Kind;
+	RootScope.ActorFolderPath = ParentScope.ActorFolderPath;
+
+	TArray<FCompileTask> Tasks;
+	for (const TUsdStore<pxr::UsdPrim>& RootPrim : RootPrims)
+	{
+		AddCompileTasks(RootPrim.Get(), RootScope, INDEX_NONE, ReferenceCache, Tasks);
+	}
+	CompileTasks(Stage, ReferenceCache, bHashPrims, Region, Tasks);
+
+	// Deferred foliage actors get tasks of their own, after every other task
+	TArray<TUsdStore<pxr::UsdPrim>> FoliagePrims;
+	for (const FCompileTask& Task : Tasks)
+	{
+		FoliagePrims.Append(Task.DeferredFoliagePrims);
+	}
+
+	const int32 NumTasks = Tasks.Num();
+	for (const TUsdStore<pxr::UsdPrim>& FoliagePrim : FoliagePrims)
+	{
+		FCompileTask& FoliageTask = Tasks.AddDefaulted_GetRef();
+		FoliageTask.Prim = FoliagePrim;
+		FoliageTask.Scope = RootScope;
+		FoliageTask.bDeferFoliage = false;
+	}
+	CompileTasks(Stage, ReferenceCache, bHashPrims, Region, MakeArrayView(Tasks).Slice(NumTasks, Tasks.Num() - NumTasks));
+
+	// Merge the tasks in order, which keeps the ops in depth first order
+	FImportPlan Plan;
+	Plan.bHasHashes = bHashPrims;
+
+	TArray<int32> TaskOpOffsets;
+	TaskOpOffsets.SetNumUninitialized(Tasks.Num());
+	for (int32 TaskIndex = 0; TaskIndex < Tasks.Num(); ++TaskIndex)
+	{
+		FCompileTask& Task = Tasks[TaskIndex];
+
+		const int32 OpOffset = Plan.Ops.Num();
+		const int32 InstancerOffset = Plan.Instancers.Num();
+		const int32 BrushOffset = Plan.Brushes.Num();
+		TaskOpOffsets[TaskIndex] = OpOffset;
+
+		const int32 TaskParentIndex = Task.ParentTaskIndex != INDEX_NONE ? TaskOpOffsets[Task.ParentTaskIndex] : INDEX_NONE;
+		for (FImportPlan::FOp& Op : Task.Plan.Ops)
+		{
+			Op.ParentIndex = Op.ParentIndex == INDEX_NONE ? TaskParentIndex : Op.ParentIndex + OpOffset;
+			Op.InstancerIndex = Op.InstancerIndex == INDEX_NONE ? INDEX_NONE : Op.InstancerIndex + InstancerOffset;
+			Op.BrushIndex = Op.BrushIndex == INDEX_NONE ? INDEX_NONE : Op.BrushIndex + BrushOffset;
+			Plan.Ops.Add(MoveTemp(Op));
+		}
+		for (FImportPlan::FInstancer& Instancer : Task.Plan.Instancers)
+		{
+			Plan.Instancers.Add(MoveTemp(Instancer));
+		}
+		for (TArray<FPoly>& Brush : Task.Plan.Brushes)
+		{
+			Plan.Brushes.Add(MoveTemp(Brush));
+		}
+		Plan.PrunedPrimPaths.Append(MoveTemp(Task.Plan.PrunedPrimPaths));
+		Plan.UnresolvedReferences.Append(Task.Plan.UnresolvedReferences);
+		Plan.NumVisitedPrims += Task.Plan.NumVisitedPrims;
+	}
+
+	// An op's descendants are the ops after it until one whose parent is not among them
+	TArray<int32> OpenOps;
+	for (int32 OpIndex = 0; OpIndex <= Plan.Ops.Num(); ++OpIndex)
+	{
+		const int32 ParentIndex = OpIndex < Plan.Ops.Num() ? Plan.Ops[OpIndex].ParentIndex : INDEX_NONE;
+		while (OpenOps.Num() > 0 && OpenOps.Last() != ParentIndex)
+		{
+			const int32 ClosedIndex = OpenOps.Pop(false);
+			Plan.Ops[ClosedIndex].NumDescendants = OpIndex - ClosedIndex - 1;
+		}
+		if (OpIndex < Plan.Ops.Num())
+		{
+			OpenOps.Push(OpIndex);
+		}
+	}
+
+	return Plan;
+}
+
+void USDExtraToUnreal::ApplyImportPlan(const FImportPlan& Plan, const FImportScope& ParentScope, FUSDExtraWorldContentIndex& WorldContent, UWorld* World, FImportFingerprints* Fingerprints)
+{
+	FScopedUnrealAllocs UnrealAllocs;
+
+	// Without hashes every op would look unchanged
+	if (!Plan.bHasHashes)
+	{
+		Fingerprints = nullptr;
+	}
+
+	// Scope each op imports its children into, ops whose parent failed are skipped so never read an unset scope
+	TArray<FImportScope> Scopes;
+	Scopes.SetNum(Plan.Ops.Num());
+
+	for (int32 OpIndex = 0; OpIndex < Plan.Ops.Num(); ++OpIndex)
+	{
+		const FImportPlan::FOp& Op = Plan.Ops[OpIndex];
+		const FImportScope& Scope = Op.ParentIndex == INDEX_NONE ? ParentScope : Scopes[Op.ParentIndex];
+		FImportScope& ChildScope = Scopes[OpIndex];
+		bool bConverted = false;
+
+		// Actors and components of prims that didn't change since the previous import are only looked up, to import their children into
+		const FImportFingerprints::FPrimRecord* PreviousRecord = Fingerprints && Op.Type != FImportPlan::EOpType::Folder ? Fingerprints->Previous.Find(Op.PrimPath) : nullptr;
+		USceneComponent* UnchangedComponent = PreviousRecord && PreviousRecord->Hash == Op.Hash ? WorldContent.Find(FName(PreviousRecord->ObjectPath)) : nullptr;
+		if (UnchangedComponent && UnchangedComponent->GetOwner())
+		{
+			ChildScope.Kind = FImportScope::EKind::Component;
+			ChildScope.ActorFolderPath = Op.Type == FImportPlan::EOpType::Actor && Scope.Kind != FImportScope::EKind::Root ? Scope.ActorFolderPath : Op.Info.ActorFolderPath;
+			ChildScope.OwnerActor = UnchangedComponent->GetOwner();
+			ChildScope.SceneComponent = UnchangedComponent;
+			ChildScope.bSpawned = PreviousRecord->bSpawned;
+			bConverted = true;
+			++Fingerprints->NumSkippedPrims;
+		}
+		else if (Op.Type == FImportPlan::EOpType::Folder)
+		{
+			bConverted = ConvertFolder(Op, ChildScope);
+		}
+		else if (Op.Type == FImportPlan::EOpType::Actor)
+		{
+			bConverted = ConvertActor(Plan, Op, Scope.Kind == FImportScope::EKind::Component ? Scope.SceneComponent : nullptr, WorldContent, World, ChildScope);
+		}
+		else
+		{
+			bConverted = ConvertComponent(Plan, Op, Op.Info, Scope.OwnerActor, Scope.SceneComponent, WorldContent, World, ChildScope);
+		}
+
+		if (!bConverted)
+		{
+			OpIndex += Op.NumDescendants;
+		}
+		else if (Fingerprints && Op.Type != FImportPlan::EOpType::Folder && ChildScope.SceneComponent)
+		{
+			FImportFingerprints::FPrimRecord& Record = Fingerprints->Current.Add(Op.PrimPath);
+			Record.Hash = Op.Hash;
+			Record.bActor = Op.Type == FImportPlan::EOpType::Actor;
+			Record.ObjectPath = Record.bActor ? ChildScope.OwnerActor->GetPathName() : ChildScope.SceneComponent->GetPathName();
+			// Converting again finds what an earlier import spawned, which still belongs to the import
+			Record.bSpawned = ChildScope.bSpawned || (PreviousRecord && PreviousRecord->bSpawned && PreviousRecord->ObjectPath == Record.ObjectPath);
+		}
+	}
+}
+
+namespace USDExtraUtilsImpl
+{
+	/** Bump whenever FImportPlan or what is compiled into it changes, to invalidate every cached plan */
+	const int32 ImportPlanCacheVersion = 1;
+	/** "UPLN" */
+	const uint32 ImportPlanCacheMagic = 0x4e4c5055;
+
+	/** A layer the cached plan was compiled from, with the content hash it had then */
+	struct FCachedLayer
+	{
+		FString FilePath;
+		uint64 Hash = 0;
+
+		friend FArchive& operator<<(FArchive& Ar, FCachedLayer& Layer)
+		{
+			return Ar << Layer.FilePath << Layer.Hash;
+		}
+	};
+
+	/** The classes and assets a cached plan points to, saved once as paths and referenced by index from the ops */
+	struct FCachedReferences
+	{
+		TArray<FString> Paths;
+		TArray<bool> IsClass;
+
+		TArray<UObject*> Objects;
+		TMap<UObject*, int32> Indices;
 
-		new(Polygon->Vertices) FVector(MeshDescriptionVertexPositions[V2]);
-		new(Polygon->Vertices) FVector(MeshDescriptionVertexPositions[V1]);
-		new(Polygon->Vertices) FVector(MeshDescriptionVertexPositions[V0]);
+		void Add(UObject* Object)
+		{
+			if (Object && !Indices.Contains(Object))
+			{
+				Indices.Add(Object, Objects.Add(Object));
+				Paths.Add(Object->GetPathName());
+				IsClass.Add(Object->IsA<UClass>());
+			}
+		}
 
-		TexCoordsToVectors(Polygon->Vertices[2], FVector2D(VertexInstanceUVs.Get(VI0, 0).X * UModel::GetGlobalBSPTexelScale(), VertexInstanceUVs.Get(VI0, 0).Y * UModel::GetGlobalBSPTexelScale()),
-			Polygon->Vertices[1], FVector2D(VertexInstanceUVs.Get(VI1, 0).X * UModel::GetGlobalBSPTexelScale(), VertexInstanceUVs.Get(VI1, 0).Y * UModel::GetGlobalBSPTexelScale()),
-			Polygon->Vertices[0], FVector2D(VertexInstanceUVs.Get(VI2, 0).X * UModel::GetGlobalBSPTexelScale(), VertexInstanceUVs.Get(VI2, 0).Y * UModel::GetGlobalBSPTexelScale()),
-			&Polygon->Base, &Polygon->TextureU, &Polygon->TextureV);
+		template<typename ObjectType>
+		void Serialize(FArchive& Ar, ObjectType*& Object)
+		{
+			int32 Index = Ar.IsSaving() && Object ? Indices.FindChecked(Object) : INDEX_NONE;
+			Ar << Index;
+			if (Ar.IsLoading())
+			{
+				Object = Objects.IsValidIndex(Index) ? Cast<ObjectType>(Objects[Index]) : nullptr;
+			}
+		}
+	};
 
-		Polygon->Finalize(nullptr, 0);
+	template<typename EnumType>
+	void SerializeEnum(FArchive& Ar, EnumType& Value)
+	{
+		uint8 Byte = static_cast<uint8>(Value);
+		Ar << Byte;
+		Value = static_cast<EnumType>(Byte);
 	}
 
-	Model->Linked = true;
-	BSPValidateBrush(Model,false,true);
-}
+	/** Hashes the content of a file, reading it in chunks. Returns 0 if it can't be read */
+	uint64 HashFile(const FString& FilePath)
+	{
+		const TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*FilePath, FILEREAD_Silent));
+		if (!Reader)
+		{
+			return 0;
+		}
 
-void UUSDExtraUtils::GetMeshDescriptionFromBrush(ABrush* Brush, const ::UModel* Model, FMeshDescription& MeshDescription, TArray<FStaticMaterial>& OutMaterials)
-{
-	FStaticMeshAttributes Attributes(MeshDescription);
-	TVertexAttributesRef<FVector3f> VertexPositions = Attributes.GetVertexPositions();
-	TVertexInstanceAttributesRef<FVector3f> VertexInstanceNormals = Attributes.GetVertexInstanceNormals();
-	TVertexInstanceAttributesRef<FVector3f> VertexInstanceTangents = Attributes.GetVertexInstanceTangents();
-	TVertexInstanceAttributesRef<float> VertexInstanceBinormalSigns = Attributes.GetVertexInstanceBinormalSigns();
-	TVertexInstanceAttributesRef<FVector4f> VertexInstanceColors = Attributes.GetVertexInstanceColors();
-	TVertexInstanceAttributesRef<FVector2f> VertexInstanceUVs = Attributes.GetVertexInstanceUVs();
-	TEdgeAttributesRef<bool> EdgeHardnesses = Attributes.GetEdgeHardnesses();
-	TPolygonGroupAttributesRef<FName> PolygonGroupImportedMaterialSlotNames = Attributes.GetPolygonGroupMaterialSlotNames();
+		const int64 Size = Reader->TotalSize();
+		uint64 Hash = CityHash64(reinterpret_cast<const char*>(&Size), sizeof(Size));
 
-	//Make sure we have one UVChannel
-	VertexInstanceUVs.SetNumChannels(1);
+		TArray<uint8> Buffer;
+		Buffer.SetNumUninitialized(FMath::Min<int64>(Size, 16 * 1024 * 1024));
+		for (int64 Offset = 0; Offset < Size; Offset += Buffer.Num())
+		{
+			const int32 ChunkSize = static_cast<int32>(FMath::Min<int64>(Size - Offset, Buffer.Num()));
+			Reader->Serialize(Buffer.GetData(), ChunkSize);
+			Hash = CityHash64WithSeed(reinterpret_cast<const char*>(Buffer.GetData()), ChunkSize, Hash);
+		}
 
-	// Calculate the local to world transform for the source brush.
-	FMatrix	ActorToWorld = Brush ? Brush->ActorToWorld().ToMatrixWithScale() : FMatrix::Identity;
-	bool	ReverseVertices = 0;
-	FVector4	PostSub = Brush ? FVector4(Brush->GetActorLocation()) : FVector4(0, 0, 0, 0);
+		return Reader->Close() ? Hash : 0;
+	}
 
-	TMap<uint32, FEdgeID> RemapEdgeID;
-	int32 NumPolys = Model->Polys->Element.Num();
-	//Create Fill the vertex position
-	for (int32 PolygonIndex = 0; PolygonIndex < NumPolys; ++PolygonIndex)
+	/** Only the FPoly members compiled from a mesh, the rest keep the values of FPoly::Init */
+	void SerializePoly(FArchive& Ar, FPoly& Poly)
 	{
-		FPoly& Polygon = Model->Polys->Element[PolygonIndex];
+		if (Ar.IsLoading())
+		{
+			Poly.Init();
+		}
+		Ar << Poly.Vertices << Poly.Base << Poly.Normal << Poly.TextureU << Poly.TextureV << Poly.PolyFlags;
+	}
 
-		// Find a material index for this polygon.
-		UMaterialInterface*	Material = Polygon.Material;
-		if (Material == nullptr)
+	void SerializeImportPlan(FArchive& Ar, FImportPlan& Plan, FCachedReferences& References)
+	{
+		int32 NumOps = Plan.Ops.Num();
+		Ar << NumOps;
+		if (Ar.IsLoading())
 		{
-			Material = UMaterial::GetDefaultMaterial(MD_Surface);
+			Plan.Ops.SetNum(FMath::Max(NumOps, 0));
 		}
 
-		int32 MaterialIndex = OutMaterials.AddUnique(FStaticMaterial(Material, Material->GetFName(), Material->GetFName()));
-		FPolygonGroupID CurrentPolygonGroupID = INDEX_NONE;
-		for (const FPolygonGroupID PolygonGroupID : MeshDescription.PolygonGroups().GetElementIDs())
+		for (FImportPlan::FOp& Op : Plan.Ops)
 		{
-			if (Material->GetFName() == PolygonGroupImportedMaterialSlotNames[PolygonGroupID])
-			{
-				CurrentPolygonGroupID = PolygonGroupID;
-				break;
-			}
+			SerializeEnum(Ar, Op.Type);
+			Ar << Op.PrimPath << Op.PrimName << Op.ParentIndex << Op.NumDescendants;
+
+			FUSDExtraToUnrealInfo& Info = Op.Info;
+			SerializeEnum(Ar, Info.PrimType);
+			SerializeEnum(Ar, Info.PrimUsage);
+			SerializeEnum(Ar, Info.ConversionMethod);
+			Ar << Info.InstanceReference << Info.ActorFolderPath << Info.BSPBrushType;
+			References.Serialize(Ar, Info.ClassReference);
+			References.Serialize(Ar, Info.AssetReference);
+			References.Serialize(Ar, Info.MaterialReference);
+
+			Ar << Op.Transform << Op.bHasTransform << Op.bResetTransformStack << Op.bHidden << Op.Hash << Op.InstancerIndex << Op.BrushIndex;
 		}
-		if (CurrentPolygonGroupID == INDEX_NONE)
+
+		int32 NumInstancers = Plan.Instancers.Num();
+		Ar << NumInstancers;
+		if (Ar.IsLoading())
 		{
-			CurrentPolygonGroupID = MeshDescription.CreatePolygonGroup();
-			PolygonGroupImportedMaterialSlotNames[CurrentPolygonGroupID] = Material->GetFName();
+			Plan.Instancers.SetNum(FMath::Max(NumInstancers, 0));
 		}
 
-		// Cache the texture coordinate system for this polygon.
-		FVector3f	TextureBase = Polygon.Base - (Brush ? (FVector3f)Brush->GetPivotOffset() : FVector3f::ZeroVector),
-			TextureX = Polygon.TextureU / UModel::GetGlobalBSPTexelScale(),
-			TextureY = Polygon.TextureV / UModel::GetGlobalBSPTexelScale();
-		// For each vertex after the first two vertices...
-		for (int32 VertexIndex = 2; VertexIndex < Polygon.Vertices.Num(); VertexIndex++)
+		for (FImportPlan::FInstancer& Instancer : Plan.Instancers)
 		{
-			FVector3f Positions[3];
-			Positions[ReverseVertices ? 0 : 2] = FVector4f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[0]) - PostSub);
-			Positions[1] = FVector4f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[VertexIndex - 1]) - PostSub);
-			Positions[ReverseVertices ? 2 : 0] = FVector4f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[VertexIndex]) - PostSub);
-			FVertexID VertexID[3] = { INDEX_NONE, INDEX_NONE, INDEX_NONE };
-			for (FVertexID IterVertexID : MeshDescription.Vertices().GetElementIDs())
+			int32 NumPrototypes = Instancer.PrototypeMeshes.Num();
+			Ar << NumPrototypes;
+			if (Ar.IsLoading())
 			{
-				if (FVerticesEqual(Positions[0], VertexPositions[IterVertexID]))
-				{
-					VertexID[0] = IterVertexID;
-				}
-				if (FVerticesEqual(Positions[1], VertexPositions[IterVertexID]))
-				{
-					VertexID[1] = IterVertexID;
-				}
-				if (FVerticesEqual(Positions[2], VertexPositions[IterVertexID]))
-				{
-					VertexID[2] = IterVertexID;
-				}
+				Instancer.PrototypeMeshes.SetNum(FMath::Max(NumPrototypes, 0));
+				Instancer.PrototypeMaterials.SetNum(FMath::Max(NumPrototypes, 0));
 			}
-
-			//Create the vertex instances
-			TArray<FVertexInstanceID> VertexInstanceIDs;
-			VertexInstanceIDs.SetNum(3);
-
-			for (int32 CornerIndex = 0; CornerIndex < 3; ++CornerIndex)
+			for (int32 PrototypeIndex = 0; PrototypeIndex < Instancer.PrototypeMeshes.Num(); ++PrototypeIndex)
 			{
-				if (VertexID[CornerIndex] == INDEX_NONE)
-				{
-					VertexID[CornerIndex] = MeshDescription.CreateVertex();
-					VertexPositions[VertexID[CornerIndex]] = Positions[CornerIndex];
-				}
-				VertexInstanceIDs[CornerIndex] = MeshDescription.CreateVertexInstance(VertexID[CornerIndex]);
-				VertexInstanceUVs.Set(VertexInstanceIDs[CornerIndex], 0, FVector2f(
-					(Positions[CornerIndex] - TextureBase) | TextureX,
-					(Positions[CornerIndex] - TextureBase) | TextureY));
+				References.Serialize(Ar, Instancer.PrototypeMeshes[PrototypeIndex]);
+				References.Serialize(Ar, Instancer.PrototypeMaterials[PrototypeIndex]);
 			}
 
-			// Create a polygon with the 3 vertex instances
+			Ar << Instancer.Transforms << Instancer.PrototypeIndices << Instancer.BaseComponentReferences << Instancer.BaseComponentIndices;
+		}
 
-			TArray<FEdgeID> NewEdgeIDs;
-			const FPolygonID NewPolygonID = MeshDescription.CreatePolygon(CurrentPolygonGroupID, VertexInstanceIDs, &NewEdgeIDs);
-			for (const FEdgeID& NewEdgeID : NewEdgeIDs)
+		int32 NumBrushes = Plan.Brushes.Num();
+		Ar << NumBrushes;
+		if (Ar.IsLoading())
+		{
+			Plan.Brushes.SetNum(FMath::Max(NumBrushes, 0));
+		}
+
+		for (TArray<FPoly>& Brush : Plan.Brushes)
+		{
+			int32 NumPolys = Brush.Num();
+			Ar << NumPolys;
+			if (Ar.IsLoading())
 			{
-				//All edge are hard for BSP
-				EdgeHardnesses[NewEdgeID] = true;
+				Brush.SetNum(FMath::Max(NumPolys, 0));
+			}
+			for (FPoly& Poly : Brush)
+			{
+				SerializePoly(Ar, Poly);
 			}
 		}
+
+		Ar << Plan.NumVisitedPrims << Plan.PrunedPrimPaths;
 	}
 }
 
-void UUSDExtraUtils::BSPValidateBrush(UModel* Brush, bool ForceValidate, bool DoStatusUpdate)
+FString USDExtraToUnreal::FImportPlanCache::GetFilePath(const FString& StageFilePath)
 {
-	check(Brush != nullptr);
-	Brush->Modify();
-	if( ForceValidate || !Brush->Linked )
+	return FPaths::ConvertRelativePathToFull(StageFilePath) + TEXT(".uplan");
+}
+
+bool USDExtraToUnreal::FImportPlanCache::Load(const FString& FilePath, bool bNeedHashes, FImportPlan& OutPlan, FReferenceCache& OutReferenceCache)
+{
+	using namespace USDExtraUtilsImpl;
+
+	FScopedUnrealAllocs UnrealAllocs;
+
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *FilePath, FILEREAD_Silent))
 	{
-		Brush->Linked = true;
-		for( int32 i=0; i<Brush->Polys->Element.Num(); i++ )
+		return false;
+	}
+	FMemoryReader Reader(Bytes);
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+	Reader << Magic << Version;
+	if (Magic != ImportPlanCacheMagic || Version != ImportPlanCacheVersion)
+	{
+		UE_LOG(LogUsd, Log, TEXT("Ignoring import plan cache '%s' written by another version"), *FilePath);
+		return false;
+	}
+
+	// Deferring payloads changes which layers are composed, and only prims reimported with fingerprints need hashes
+	bool bDeferPayloads = false;
+	bool bHasHashes = false;
+	Reader << bDeferPayloads << bHasHashes;
+	if (bDeferPayloads != GetDefault<UUSDExtraSettings>()->bDeferImportPayloads || (bNeedHashes && !bHasHashes))
+	{
+		return false;
+	}
+
+	TArray<FCachedLayer> Layers;
+	Reader << Layers;
+	if (Reader.IsError())
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Ignoring unreadable import plan cache '%s'"), *FilePath);
+		return false;
+	}
+
+	for (const FCachedLayer& Layer : Layers)
+	{
+		if (HashFile(Layer.FilePath) != Layer.Hash)
 		{
-			Brush->Polys->Element[i].iLink = i;
+			UE_LOG(LogUsd, Log, TEXT("Import plan cache '%s' is out of date, '%s' changed"), *FilePath, *Layer.FilePath);
+			return false;
 		}
-		int32 n=0;
-		for( int32 i=0; i<Brush->Polys->Element.Num(); i++ )
+	}
+
+	FCachedReferences References;
+	Reader << References.Paths << References.IsClass;
+	if (Reader.IsError() || References.Paths.Num() != References.IsClass.Num())
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Ignoring unreadable import plan cache '%s'"), *FilePath);
+		return false;
+	}
+
+	PreloadReferencePaths(References.Paths, OutReferenceCache);
+	for (int32 ReferenceIndex = 0; ReferenceIndex < References.Paths.Num(); ++ReferenceIndex)
+	{
+		// An asset deleted since would leave holes the stage itself can't explain, the stage is imported again instead
+		UObject* Object = OutReferenceCache.FindOrLoad(References.Paths[ReferenceIndex], References.IsClass[ReferenceIndex] ? UClass::StaticClass() : UObject::StaticClass());
+		if (!Object)
 		{
-			FPoly* EdPoly = &Brush->Polys->Element[i];
-			if( EdPoly->iLink==i )
-			{
-				for( int32 j=i+1; j<Brush->Polys->Element.Num(); j++ )
-				{
-					FPoly* OtherPoly = &Brush->Polys->Element[j];
-					if
-					(	OtherPoly->iLink == j
-					&&	OtherPoly->Material == EdPoly->Material
-					&&	OtherPoly->TextureU == EdPoly->TextureU
-					&&	OtherPoly->TextureV == EdPoly->TextureV
-					&&	OtherPoly->PolyFlags == EdPoly->PolyFlags
-					&&	(OtherPoly->Normal | EdPoly->Normal)>0.9999 )
-					{
-						const float Dist = FVector::PointPlaneDist( FVector3d(OtherPoly->Vertices[0]), 
-							FVector3d(EdPoly->Vertices[0]), FVector3d(EdPoly->Normal) );
-						if( Dist>-0.001 && Dist<0.001 )
-						{
-							OtherPoly->iLink = i;
-							n++;
-						}
-					}
-				}
-			}
+			UE_LOG(LogUsd, Log, TEXT("Import plan cache '%s' is out of date, '%s' does not load anymore"), *FilePath, *References.Paths[ReferenceIndex]);
+			return false;
 		}
-		// 		UE_LOG(LogBSPOps, Log,  TEXT("BspValidateBrush linked %i of %i polys"), n, Brush->Polys->Element.Num() );
+		References.Objects.Add(Object);
 	}
 
-	// Build bounds.
-	Brush->BuildBound();
+	FImportPlan Plan;
+	Plan.bHasHashes = bHasHashes;
+	SerializeImportPlan(Reader, Plan, References);
+	if (Reader.IsError())
+	{
+		UE_LOG(LogUsd, Warning, TEXT("Ignoring unreadable import plan cache '%s'"), *FilePath);
+		return false;
+	}
+
+	OutPlan = MoveTemp(Plan);
+	return true;
 }
 
-void UUSDExtraUtils::PrintBrushPolyInfo(AActor* InActor)
+bool USDExtraToUnreal::FImportPlanCache::Save(const FString& FilePath, const pxr::UsdStageRefPtr& Stage, const FImportPlan& Plan, const FReferenceCache& ReferenceCache)
 {
-	ABrush* BrushActor = Cast<ABrush>(InActor);
+	using namespace USDExtraUtilsImpl;
 
-	if (!BrushActor)
+	TArray<FCachedLayer> Layers;
 	{
-		UE_LOG(LogUsd, Warning, TEXT("No Valid Brush"));
-		return;
+		FScopedUsdAllocs UsdAllocs;
+
+		for (const pxr::SdfLayerHandle& Layer : Stage->GetUsedLayers())
+		{
+			// The session layer is anonymous and left empty by imports
+			if (Layer->IsAnonymous() && Layer->IsEmpty())
+			{
+				continue;
+			}
+
+			const FString LayerFilePath = Layer->IsAnonymous() ? FString() : UsdToUnreal::ConvertString(Layer->GetRealPath());
+			if (LayerFilePath.IsEmpty() || (Layer->IsDirty() && !USDExtraUtilsImpl::GetCrateCachedLayers().IsUnchanged(LayerFilePath, Layer)))
+			{
+				UE_LOG(LogUsd, Log, TEXT("Not caching the import plan of %s, layer '%s' is not saved to a file"), *FilePath, *UsdToUnreal::ConvertString(Layer->GetIdentifier()));
+				return false;
+			}
+
+			FScopedUnrealAllocs UnrealAllocs;
+			Layers.AddDefaulted_GetRef().FilePath = LayerFilePath;
+		}
 	}
 
-	const UModel* Model = BrushActor->GetBrushComponent()->Brush;
-	
-	for( int32 i=0; i<Model->Polys->Element.Num(); i++ )
+	FScopedUnrealAllocs UnrealAllocs;
+
+	for (const TPair<FString, UObject*>& Reference : ReferenceCache.Objects)
 	{
-		const FPoly* Poly = &Model->Polys->Element[i];
+		if (!Reference.Value)
+		{
+			UE_LOG(LogUsd, Log, TEXT("Not caching the import plan of %s, '%s' failed to load"), *FilePath, *Reference.Key);
+			return false;
+		}
+	}
 
-		FVector3f PolyBase = Poly->Base;
-		FVector3f PolyTextureU = Poly->TextureU;
-		FVector3f PolyTextureV = Poly->TextureV;
+	for (FCachedLayer& Layer : Layers)
+	{
+		Layer.Hash = HashFile(Layer.FilePath);
+	}
 
-		UE_LOG(LogUsd, Log, TEXT("Poly Base: %s ; TextureU: %s ; TextureV: %s"), *PolyBase.ToString(), *PolyTextureU.ToString(), *PolyTextureV.ToString());
+	FCachedReferences References;
+	for (const FImportPlan::FOp& Op : Plan.Ops)
+	{
+		References.Add(Op.Info.ClassReference);
+		References.Add(Op.Info.AssetReference);
+		References.Add(Op.Info.MaterialReference);
+	}
+	for (const FImportPlan::FInstancer& Instancer : Plan.Instancers)
+	{
+		for (int32 PrototypeIndex = 0; PrototypeIndex < Instancer.PrototypeMeshes.Num(); ++PrototypeIndex)
+		{
+			References.Add(Instancer.PrototypeMeshes[PrototypeIndex]);
+			References.Add(Instancer.PrototypeMaterials[PrototypeIndex]);
+		}
 	}
-}
 
-bool USDExtraToUnreal::ConvertFolder(const pxr::UsdStageRefPtr& Stage, pxr::UsdPrim& UsdPrim, FUSDExtraToUnrealInfo PrimInfo, TArray<pxr::UsdPrim> &VisitedPrims, TMap<FName, USceneComponent*> &WorldContent, UWorld* World)
-{
-	FScopedUsdAllocs Allocs;
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
 
-	// Deal with target prim as Folder.
-	UE_LOG(LogUsd, Log, TEXT("Convert Folder: %s"), *PrimInfo.ActorFolderPath.ToString());
-	VisitedPrims.Add(UsdPrim);
+	uint32 Magic = ImportPlanCacheMagic;
+	int32 Version = ImportPlanCacheVersion;
+	bool bDeferPayloads = GetDefault<UUSDExtraSettings>()->bDeferImportPayloads;
+	bool bHasHashes = Plan.bHasHashes;
+	Writer << Magic << Version << bDeferPayloads << bHasHashes << Layers << References.Paths << References.IsClass;
 
-	// Traverse children prims.
-	pxr::UsdPrimSiblingRange PrimRange = UsdPrim.GetChildren();
-	for ( pxr::UsdPrimSiblingRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt )
+	// Serializing only reads the plan when saving
+	SerializeImportPlan(Writer, const_cast<FImportPlan&>(Plan), References);
+
+	if (!FFileHelper::SaveArrayToFile(Bytes, *FilePath))
 	{
-		TUsdStore<pxr::UsdPrim> ChildUsdPrim = *PrimRangeIt;
+		UE_LOG(LogUsd, Warning, TEXT("Failed to write import plan cache '%s'"), *FilePath);
+		return false;
+	}
+	return true;
+}
 
-		if (VisitedPrims.Contains(ChildUsdPrim.Get()))
+namespace USDExtraUtilsImpl
+{
+	int32 ConvertPrims(const pxr::UsdStageRefPtr& Stage, const TArray<TUsdStore<pxr::UsdPrim>>& RootPrims, const FImportScope& ParentScope, FUSDExtraWorldContentIndex& WorldContent, FReferenceCache* ReferenceCache, UWorld* World, FImportFingerprints* Fingerprints, const FUSDExtraImportRegion* Region, FImportPlan* OutPlan)
+	{
+		// Compiling only looks references up, so they are loaded beforehand
+		FReferenceCache LocalReferenceCache;
+		if (!ReferenceCache)
 		{
-			continue;
+			PreloadReferences(Stage, LocalReferenceCache);
+			ReferenceCache = &LocalReferenceCache;
 		}
 
-		FUSDExtraToUnrealInfo ChildPrimInfo = USDExtraToUnreal::GatherPrimConversionInfo(ChildUsdPrim.Get());
-		
-		if (ChildPrimInfo.PrimType == EUnrealPrimType::Folder)
+		const double StartTime = FPlatformTime::Seconds();
+		FImportPlan Plan = CompileImportPlan(Stage, RootPrims, ParentScope, *ReferenceCache, Fingerprints != nullptr, Region);
+
+		// References added since the cache was filled, or that failed to preload, are loaded here and the plan compiled again with them
+		if (Plan.UnresolvedReferences.Num() > 0)
 		{
-			ChildPrimInfo.ActorFolderPath = FName(PrimInfo.ActorFolderPath.ToString() + "/" + ChildPrimInfo.ActorFolderPath.ToString());
-			ConvertFolder(Stage, ChildUsdPrim.Get(), ChildPrimInfo, VisitedPrims, WorldContent, World);
-			continue;
+			for (const TPair<FString, UClass*>& Reference : Plan.UnresolvedReferences)
+			{
+				ReferenceCache->FindOrLoad(Reference.Key, Reference.Value);
+			}
+			Plan = CompileImportPlan(Stage, RootPrims, ParentScope, *ReferenceCache, Fingerprints != nullptr, Region);
 		}
+		const double CompileTime = FPlatformTime::Seconds();
 
-		if (ChildPrimInfo.ConversionMethod == EUnrealConversionMethod::Ignore)
+		if (UE_LOG_ACTIVE(LogUsd, Verbose))
 		{
-			VisitedPrims.Add(ChildUsdPrim.Get());
-			continue;
+			UE_LOG(LogUsd, Verbose, TEXT("Import plan:%s%s"), LINE_TERMINATOR, *Plan.ToString());
+		}
+
+		ApplyImportPlan(Plan, ParentScope, WorldContent, World, Fingerprints);
+
+		UE_LOG(LogUsd, Log, TEXT("Compiled %d import ops from %d prims in %.3f seconds, applied them in %.3f seconds"),
+			Plan.Ops.Num(), Plan.NumVisitedPrims, CompileTime - StartTime, FPlatformTime::Seconds() - CompileTime);
+		UE_LOG(LogUsd, Log, TEXT("Interned names: %lld conversions answered from the cache, %lld converted"),
+			ReferenceCache->Strings.GetNumHits(), ReferenceCache->Strings.GetNumMisses());
+
+		const int32 NumVisitedPrims = Plan.NumVisitedPrims;
+		if (OutPlan)
+		{
+			*OutPlan = MoveTemp(Plan);
 		}
+		return NumVisitedPrims;
+	}
+}
+
+int32 USDExtraToUnreal::ConvertStage(const pxr::UsdStageRefPtr& Stage, FUSDExtraWorldContentIndex& WorldContent, FReferenceCache* ReferenceCache, UWorld* World, FImportFingerprints* Fingerprints, const FUSDExtraImportRegion* Region, FImportPlan* OutPlan)
+{
+	TArray<TUsdStore<pxr::UsdPrim>> RootPrims;
+	{
+		FScopedUsdAllocs Allocs;
 
-		if (ChildPrimInfo.PrimUsage == EUnrealPrimUsage::Actor)
+		for (const pxr::UsdPrim& UsdPrim : Stage->GetDefaultPrim().GetFilteredChildren(USDExtraUtilsImpl::GetImportPrimPredicate()))
 		{
-			ChildPrimInfo.ActorFolderPath = PrimInfo.ActorFolderPath;
-			ConvertActor(Stage, ChildUsdPrim.Get(), ChildPrimInfo, VisitedPrims, nullptr, WorldContent, World);
+			RootPrims.Add(UsdPrim);
 		}
 	}
 
+	return USDExtraUtilsImpl::ConvertPrims(Stage, RootPrims, FImportScope(), WorldContent, ReferenceCache, World, Fingerprints, Region, OutPlan);
+}
+
+int32 USDExtraToUnreal::ConvertPrimTree(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, const FImportScope& ParentScope, FUSDExtraWorldContentIndex& WorldContent, FReferenceCache* ReferenceCache, UWorld* World, FImportFingerprints* Fingerprints)
+{
+	TArray<TUsdStore<pxr::UsdPrim>> RootPrims;
+	RootPrims.Add(UsdPrim);
+
+	return USDExtraUtilsImpl::ConvertPrims(Stage, RootPrims, ParentScope, WorldContent, ReferenceCache, World, Fingerprints, nullptr, nullptr);
+}
+
+bool USDExtraToUnreal::ConvertFolder(const FImportPlan::FOp& Op, FImportScope& OutScope)
+{
+	// Deal with target prim as Folder.
+	UE_LOG(LogUsd, Log, TEXT("Convert Folder: %s"), *Op.Info.ActorFolderPath.ToString());
+
+	OutScope.Kind = FImportScope::EKind::Folder;
+	OutScope.ActorFolderPath = Op.Info.ActorFolderPath;
+
 	return true;
 }
 
-bool USDExtraToUnreal::ConvertActor(const pxr::UsdStageRefPtr& Stage, pxr::UsdPrim& UsdPrim, FUSDExtraToUnrealInfo PrimInfo, TArray<pxr::UsdPrim> &VisitedPrims, USceneComponent* ParentComponent, TMap<FName, USceneComponent*> &WorldContent, UWorld* World)
+bool USDExtraToUnreal::ConvertActor(const FImportPlan& Plan, const FImportPlan::FOp& Op, USceneComponent* ParentComponent, FUSDExtraWorldContentIndex& WorldContent, UWorld* World, FImportScope& OutScope)
 {
 	AActor* Actor = nullptr;
 	USceneComponent* RootComponent = nullptr;
-
-	FScopedUsdAllocs Allocs;
+	bool bSpawnedActor = false;
+	FUSDExtraToUnrealInfo PrimInfo = Op.Info;
 
 	// Deal with target prim as Actor.
 	UE_LOG(LogUsd, Log, TEXT("%s Actor: %s"), *StaticEnum<EUnrealConversionMethod>()->GetValueAsString(PrimInfo.ConversionMethod), *PrimInfo.InstanceReference.ToString());
 
 	if (PrimInfo.InstanceReference.IsEqual(""))
 	{
-		FString primName(UsdPrim.GetName().GetString().c_str());
+		FString primName = Op.PrimName;
 		primName = World->GetActiveLevelCollection()->GetPersistentLevel()->GetFullName()+ '.'+ primName;
 		primName.RemoveFromStart("Level ");
 
@@ -734,7 +3269,7 @@ bool USDExtraToUnreal::ConvertActor(const pxr::UsdStageRefPtr& Stage, pxr::UsdPr
 	}
 
 	if (!WorldContent.Find(PrimInfo.InstanceReference))
-	{	
+	{
 		if (PrimInfo.ClassReference)
 		{
 			if (PrimInfo.ClassReference == AInstancedFoliageActor::StaticClass())
@@ -744,6 +3279,7 @@ bool USDExtraToUnreal::ConvertActor(const pxr::UsdStageRefPtr& Stage, pxr::UsdPr
 			else
 			{
 				Actor = World->SpawnActor(PrimInfo.ClassReference);
+				bSpawnedActor = Actor != nullptr;
 			}
 			FString ActorPath;
 			FString ActorLabel;
@@ -765,7 +3301,7 @@ bool USDExtraToUnreal::ConvertActor(const pxr::UsdStageRefPtr& Stage, pxr::UsdPr
 	{
 		if (WorldContent.Find(PrimInfo.InstanceReference))
 		{
-			RootComponent = *WorldContent.Find(PrimInfo.InstanceReference);
+			RootComponent = WorldContent.Find(PrimInfo.InstanceReference);
 			if (RootComponent)
 			{
 				Actor = RootComponent->GetOwner();
@@ -778,45 +3314,29 @@ bool USDExtraToUnreal::ConvertActor(const pxr::UsdStageRefPtr& Stage, pxr::UsdPr
 			WorldContent.Add(PrimInfo.InstanceReference, RootComponent);
 		}
 	}
-			
-	if (Actor && RootComponent)
-	{
-		Actor->SetFolderPath(PrimInfo.ActorFolderPath);
-		ConvertComponent(Stage, UsdPrim, PrimInfo, VisitedPrims, Actor, ParentComponent, WorldContent, World);
-	}
-	else
+
+	if (Actor && RootComponent)
 	{
-		const pxr::UsdPrimRange PrimRange(UsdPrim);
-		for ( pxr::UsdPrimRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt )
-		{
-			TUsdStore<pxr::UsdPrim> ChildUsdPrim = *PrimRangeIt;
-			VisitedPrims.Add(ChildUsdPrim.Get());
-		}
-		
-		UE_LOG(LogUsd, Warning, TEXT("Failed to convert Actor: %s"), *PrimInfo.InstanceReference.ToString());
-		return false;
+		Actor->SetFolderPath(PrimInfo.ActorFolderPath);
+		const bool bConverted = ConvertComponent(Plan, Op, PrimInfo, Actor, ParentComponent, WorldContent, World, OutScope);
+		OutScope.bSpawned = bSpawnedActor;
+		return bConverted;
 	}
-	return true;
+
+	UE_LOG(LogUsd, Warning, TEXT("Failed to convert Actor: %s"), *PrimInfo.InstanceReference.ToString());
+	return false;
 }
 
-bool USDExtraToUnreal::ConvertComponent(const pxr::UsdStageRefPtr& Stage, pxr::UsdPrim& UsdPrim, FUSDExtraToUnrealInfo PrimInfo, TArray<pxr::UsdPrim> &VisitedPrims, AActor* OwnerActor, USceneComponent* ParentComponent, TMap<FName, USceneComponent*> &WorldContent, UWorld* World)
+bool USDExtraToUnreal::ConvertComponent(const FImportPlan& Plan, const FImportPlan::FOp& Op, const FUSDExtraToUnrealInfo& PrimInfo, AActor* OwnerActor, USceneComponent* ParentComponent, FUSDExtraWorldContentIndex& WorldContent, UWorld* World, FImportScope& OutScope)
 {
 	USceneComponent* SceneComponent = nullptr;
-	
-	FScopedUsdAllocs Allocs;
+	bool bSpawnedComponent = false;
 
 	// Deal with target prim conversion as Component.
 	UE_LOG(LogUsd, Log, TEXT("%s Component: %s"), *StaticEnum<EUnrealConversionMethod>()->GetValueAsString(PrimInfo.ConversionMethod), *PrimInfo.InstanceReference.ToString());
 
 	if (!OwnerActor)
 	{
-		const pxr::UsdPrimRange PrimRange(UsdPrim);
-		for ( pxr::UsdPrimRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt )
-		{
-			TUsdStore<pxr::UsdPrim> ChildUsdPrim = *PrimRangeIt;
-			VisitedPrims.Add(ChildUsdPrim.Get());
-		}
-		
 		UE_LOG(LogUsd, Warning, TEXT("Need Valid Owner Actor for Component: %s"), *PrimInfo.InstanceReference.ToString());
 		return false;
 	}
@@ -833,35 +3353,27 @@ bool USDExtraToUnreal::ConvertComponent(const pxr::UsdStageRefPtr& Stage, pxr::U
 				OwnerActor->AddInstanceComponent(SceneComponent);
 				SceneComponent->RegisterComponent();
 				WorldContent.Add(FName(SceneComponent->GetPathName()), SceneComponent);
+				bSpawnedComponent = true;
 			}
 		}
 	}
 	else
 	{
-		if (WorldContent.Find(ComponentPath))
-		{
-			SceneComponent = *WorldContent.Find(ComponentPath);
-		}
+		SceneComponent = WorldContent.Find(ComponentPath);
 	}
 
 	if (!SceneComponent)
 	{
-		const pxr::UsdPrimRange PrimRange(UsdPrim);
-		for ( pxr::UsdPrimRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt )
-		{
-			TUsdStore<pxr::UsdPrim> ChildUsdPrim = *PrimRangeIt;
-			VisitedPrims.Add(ChildUsdPrim.Get());
-		}
-		
 		UE_LOG(LogUsd, Warning, TEXT("Failed to convert Component: %s"), *PrimInfo.InstanceReference.ToString());
 		return false;
 	}
-	
+
 	if (ParentComponent)
 	{
 		SceneComponent->AttachToComponent(ParentComponent, FAttachmentTransformRules::SnapToTargetIncludingScale);
 	}
 
+	const FImportPlan::FInstancer* Instancer = Plan.Instancers.IsValidIndex(Op.InstancerIndex) ? &Plan.Instancers[Op.InstancerIndex] : nullptr;
 	switch (PrimInfo.PrimType)
 	{
 	case EUnrealPrimType::StaticMesh:
@@ -869,57 +3381,33 @@ bool USDExtraToUnreal::ConvertComponent(const pxr::UsdStageRefPtr& Stage, pxr::U
 		ConvertMeshPrim(PrimInfo, Cast<UMeshComponent>(SceneComponent));
 		break;
 	case EUnrealPrimType::HISM:
-		ConvertPointInstancerPrim(Stage, UsdPrim, Cast<UHierarchicalInstancedStaticMeshComponent>(SceneComponent));
+		ConvertPointInstancerPrim(Instancer, Cast<UHierarchicalInstancedStaticMeshComponent>(SceneComponent));
 		break;
 	case EUnrealPrimType::InstancedFoliage:
-		ConvertPointInstancerPrim(Stage, UsdPrim, Cast<AInstancedFoliageActor>(OwnerActor), WorldContent);
+		ConvertPointInstancerPrim(Instancer, Cast<AInstancedFoliageActor>(OwnerActor), WorldContent);
 		break;
 	case EUnrealPrimType::BSP:
-		ConvertBSPPrim(PrimInfo, UsdPrim, Cast<UBrushComponent>(SceneComponent));
+		if (Plan.Brushes.IsValidIndex(Op.BrushIndex))
+		{
+			ConvertBSPPrim(PrimInfo, Plan.Brushes[Op.BrushIndex], Cast<UBrushComponent>(SceneComponent));
+		}
 		break;
 	default:
 		break;
 	}
 
-	ConvertXformPrim(Stage,UsdPrim,*SceneComponent,World);
-
-	VisitedPrims.Add(UsdPrim);
-
-	// Traverse children prims
-	pxr::UsdPrimSiblingRange PrimRange = UsdPrim.GetChildren();
-	for ( pxr::UsdPrimSiblingRange::iterator PrimRangeIt = PrimRange.begin(); PrimRangeIt != PrimRange.end(); ++PrimRangeIt )
-	{
-		TUsdStore<pxr::UsdPrim> ChildUsdPrim = *PrimRangeIt;
-
-		if (VisitedPrims.Contains(ChildUsdPrim.Get()))
-		{
-			continue;
-		}
-
-		FUSDExtraToUnrealInfo ChildPrimInfo = GatherPrimConversionInfo(ChildUsdPrim.Get());
-		if (ChildPrimInfo.ConversionMethod == EUnrealConversionMethod::Ignore)
-		{
-			VisitedPrims.Add(ChildUsdPrim.Get());
-			continue;
-		}
+	ConvertXformPrim(Op, *SceneComponent);
 
-		if (ChildPrimInfo.PrimUsage == EUnrealPrimUsage::Actor)
-		{
-			ChildPrimInfo.ActorFolderPath = PrimInfo.ActorFolderPath;
-			ConvertActor(Stage, ChildUsdPrim.Get(), ChildPrimInfo, VisitedPrims, SceneComponent,WorldContent,World);
-			continue;
-		}
+	OutScope.Kind = FImportScope::EKind::Component;
+	OutScope.ActorFolderPath = PrimInfo.ActorFolderPath;
+	OutScope.OwnerActor = OwnerActor;
+	OutScope.SceneComponent = SceneComponent;
+	OutScope.bSpawned = bSpawnedComponent;
 
-		if (ChildPrimInfo.PrimUsage == EUnrealPrimUsage::Component)
-		{
-			ConvertComponent(Stage, ChildUsdPrim.Get(), ChildPrimInfo, VisitedPrims, OwnerActor, SceneComponent, WorldContent, World);
-		}
-	}
-	
 	return true;
 }
 
-bool USDExtraToUnreal::ConvertMeshPrim(FUSDExtraToUnrealInfo PrimInfo, UMeshComponent* MeshComponent)
+bool USDExtraToUnreal::ConvertMeshPrim(const FUSDExtraToUnrealInfo& PrimInfo, UMeshComponent* MeshComponent)
 {
 	if (PrimInfo.AssetReference)
 	{
@@ -927,7 +3415,7 @@ bool USDExtraToUnreal::ConvertMeshPrim(FUSDExtraToUnrealInfo PrimInfo, UMeshComp
 		{
 			UStaticMeshComponent* StaticMeshComponent = Cast<UStaticMeshComponent>(MeshComponent);
 			UStaticMesh* StaticMeshAsset = Cast<UStaticMesh>(PrimInfo.AssetReference);
-			
+
 			if (StaticMeshComponent && StaticMeshAsset)
 			{
 				StaticMeshComponent->SetStaticMesh(StaticMeshAsset);
@@ -941,7 +3429,7 @@ bool USDExtraToUnreal::ConvertMeshPrim(FUSDExtraToUnrealInfo PrimInfo, UMeshComp
 		{
 			USkeletalMeshComponent* SkeletalMeshComponent = Cast<USkeletalMeshComponent>(MeshComponent);
 			USkeletalMesh* SkeletalMeshAsset = Cast<USkeletalMesh>(PrimInfo.AssetReference);
-			
+
 			if (SkeletalMeshComponent && SkeletalMeshAsset)
 			{
 				SkeletalMeshComponent->SetSkeletalMesh(SkeletalMeshAsset);
@@ -952,416 +3440,399 @@ bool USDExtraToUnreal::ConvertMeshPrim(FUSDExtraToUnrealInfo PrimInfo, UMeshComp
 			}
 		}
 	}
-	
+
 	return true;
 }
 
-bool USDExtraToUnreal::ConvertBSPPrim(FUSDExtraToUnrealInfo PrimInfo, const pxr::UsdPrim& UsdPrim, UBrushComponent* BrushComponent)
+bool USDExtraToUnreal::ConvertBSPPrim(const FUSDExtraToUnrealInfo& PrimInfo, const TArray<FPoly>& Polys, UBrushComponent* BrushComponent)
 {
-	UStaticMesh* StaticMesh = NewObject<UStaticMesh>(GetTransientPackage());
-
-	if (!StaticMesh->IsSourceModelValid(0))
+	if (!BrushComponent)
 	{
-		// Add one LOD
-		StaticMesh->AddSourceModel();
+		return false;
 	}
-	
-	FMeshDescription* MeshDescription = StaticMesh->CreateMeshDescription(0);
-
-	UsdUtils::FUsdPrimMaterialAssignmentInfo MaterialInfo;
-	UsdToUnreal::ConvertGeomMesh( UE::FUsdTyped( UsdPrim ), *MeshDescription, MaterialInfo );
-	
-	StaticMesh->CommitMeshDescription(0);
 
-	//Set the Imported version before calling the build
-	StaticMesh->ImportVersion = EImportStaticMeshVersion::LastVersion;
+	UModel* Model = GetOrCreateBrushModel(BrushComponent);
+	Model->Polys->Element.Empty(Polys.Num());
+	for (const FPoly& Poly : Polys)
+	{
+		FPoly* Polygon = new(Model->Polys->Element) FPoly(Poly);
+		Polygon->iLink = Polygon - Model->Polys->Element.GetData();
+	}
 
-	StaticMesh->Build();
-	// ReSharper disable once CppExpressionWithoutSideEffects
-	StaticMesh->MarkPackageDirty();
-	
-	// Test if the mesh info generated successfully
-	//AStaticMeshActor* MeshActor = Cast<AStaticMeshActor>(BrushComponent->GetWorld()->SpawnActor(AStaticMeshActor::StaticClass()));
-	//MeshActor->GetStaticMeshComponent()->SetStaticMesh(StaticMesh);
-	//MeshActor->SetActorTransform(BrushComponent->GetComponentToWorld());
-	
-	UUSDExtraUtils::CreateModelFromStaticMesh(BrushComponent, StaticMesh);
-	//MeshActor->Destroy();
+	Model->Linked = true;
+	UUSDExtraUtils::BSPValidateBrush(Model,false,true);
 
 	ABrush* BrushActor = Cast<ABrush>(BrushComponent->GetOwner());
 	BrushActor->BrushType = PrimInfo.BSPBrushType;
-	
-	return true;
-}
-
-bool USDExtraToUnreal::ConvertXformPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, USceneComponent& SceneComponent, UWorld* World)
-{
-	if (UsdToUnreal::ConvertXformable(Stage,pxr::UsdGeomXformable(UsdPrim),SceneComponent,0.0f))
-	{
-		SceneComponent.Modify();
 
-		UE_LOG(LogUsd, Log, TEXT("Convert XformPrim for %s"), *SceneComponent.GetName());
-
-		return true;
-	}
-	return false;
+	return true;
 }
 
-bool USDExtraToUnreal::ConvertPointInstancerPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, UHierarchicalInstancedStaticMeshComponent* HISMComponent)
+bool USDExtraToUnreal::ConvertGeomMeshToPolys(const pxr::UsdPrim& UsdPrim, TArray<FPoly>& OutPolys)
 {
-	if (!HISMComponent || !UsdPrim)
-	{
-		return false;
-	}
-	
-	HISMComponent->Modify();
-	HISMComponent->ClearInstances();
-	
 	FScopedUsdAllocs UsdAllocs;
-	
-	pxr::UsdPrim HISMInstance = UsdPrim.GetChild(pxr::TfToken("HISMInstance"));
-	if (!HISMInstance)
-	{
-		return false;
-	}
-	
-	pxr::UsdGeomPointInstancer PointInstancer(HISMInstance);
-	if (!PointInstancer)
+
+	const pxr::UsdGeomMesh UsdMesh(UsdPrim);
+	if (!UsdMesh)
 	{
 		return false;
 	}
-	
-	const pxr::UsdPrim Prototypes = HISMInstance.GetChild(pxr::TfToken("Prototypes"));
-	if (!Prototypes)
+
+	// Same time code UsdToUnreal::ConvertGeomMesh samples by default
+	const pxr::UsdTimeCode TimeCode = pxr::UsdTimeCode::EarliestTime();
+
+	const FUsdStageInfo StageInfo(UsdMesh.GetPrim().GetStage());
+
+	pxr::VtArray<pxr::GfVec3f> Points;
+	pxr::VtArray<int> FaceVertexCounts;
+	pxr::VtArray<int> FaceVertexIndices;
+	UsdMesh.GetPointsAttr().Get(&Points, TimeCode);
+	UsdMesh.GetFaceVertexCountsAttr().Get(&FaceVertexCounts, TimeCode);
+	UsdMesh.GetFaceVertexIndicesAttr().Get(&FaceVertexIndices, TimeCode);
+
+	// UsdToUnreal::ConvertGeomMesh keeps the USD corner order for right handed meshes and CreateModelFromStaticMesh
+	// then reversed every triangle, so the corners of right handed faces are reversed here to produce the same polys
+	pxr::TfToken Orientation;
+	const bool bReverseCorners = !(UsdMesh.GetOrientationAttr().Get(&Orientation) && Orientation == pxr::UsdGeomTokens->leftHanded);
+
+	pxr::VtArray<pxr::GfVec2f> UVs;
+	pxr::TfToken UVInterpolation;
+	const pxr::UsdGeomPrimvar UVPrimvar = pxr::UsdGeomPrimvarsAPI(UsdMesh.GetPrim()).GetPrimvar(UnrealToUsd::ConvertToken(TEXT("st")).Get());
+	if (UVPrimvar && UVPrimvar.ComputeFlattened(&UVs, TimeCode))
 	{
-		return false;
+		UVInterpolation = UVPrimvar.GetInterpolation();
 	}
 
-	TArray<TUsdStore<pxr::UsdPrim>> MeshPrototypes = UsdUtils::GetAllPrimsOfType(Prototypes, pxr::TfType::Find< pxr::UsdGeomMesh >());
+	const int32 NumPoints = Points.size();
+	const int32 NumCornersTotal = FaceVertexIndices.size();
+	const int32 NumUVs = UVs.size();
+
+	FScopedUnrealAllocs UnrealAllocs;
+
+	OutPolys.Reset(FaceVertexCounts.size());
 
-	if (MeshPrototypes.IsValidIndex(0))
+	int32 CornerOffset = 0;
+	for (int32 FaceIndex = 0; FaceIndex < static_cast<int32>(FaceVertexCounts.size()); ++FaceIndex)
 	{
-		pxr::UsdPrim Mesh = MeshPrototypes[0].Get();
-		const FUSDExtraToUnrealInfo MeshInfo = GatherPrimConversionInfo(Mesh);
+		const int32 NumCorners = FaceVertexCounts[FaceIndex];
+		const int32 FaceCornerOffset = CornerOffset;
+		CornerOffset += FMath::Max(NumCorners, 0);
+
+		if (NumCorners < 3 || CornerOffset > NumCornersTotal)
+		{
+			continue;
+		}
+
+		const auto GetCornerIndex = [&](int32 CornerIndex)
+		{
+			return FaceCornerOffset + (bReverseCorners ? NumCorners - 1 - CornerIndex : CornerIndex);
+		};
 
-		if (MeshInfo.AssetReference)
+		const auto GetCornerUV = [&](int32 CornerIndex) -> FVector2D
 		{
-			UStaticMesh* MeshAsset = Cast<UStaticMesh>(MeshInfo.AssetReference);
-			if (MeshAsset)
+			const int32 FaceCornerIndex = GetCornerIndex(CornerIndex);
+			int32 UVIndex = INDEX_NONE;
+			if (UVInterpolation == pxr::UsdGeomTokens->faceVarying)
 			{
-				HISMComponent->SetStaticMesh(MeshAsset);
-				if (MeshInfo.MaterialReference)
-				{
-					HISMComponent->SetMaterial(0, MeshInfo.MaterialReference);
-				}
-				pxr::VtMatrix4dArray UsdInstanceTransforms;
+				UVIndex = FaceCornerIndex;
+			}
+			else if (UVInterpolation == pxr::UsdGeomTokens->vertex || UVInterpolation == pxr::UsdGeomTokens->varying)
+			{
+				UVIndex = FaceVertexIndices[FaceCornerIndex];
+			}
+			else if (UVInterpolation == pxr::UsdGeomTokens->uniform)
+			{
+				UVIndex = FaceIndex;
+			}
+			else if (UVInterpolation == pxr::UsdGeomTokens->constant)
+			{
+				UVIndex = 0;
+			}
 
-				if ( !PointInstancer.ComputeInstanceTransformsAtTime(
-						&UsdInstanceTransforms,
-						0.0f,
-						0.0f ) )
-				{
-					return false;
-				}
+			if (!UVs.empty() && UVIndex >= 0 && UVIndex < NumUVs)
+			{
+				const pxr::GfVec2f& UV = UVs[UVIndex];
+				// Flip V like UsdToUnreal::ConvertGeomMesh does
+				return FVector2D(UV[0] * UModel::GetGlobalBSPTexelScale(), (1.f - UV[1]) * UModel::GetGlobalBSPTexelScale());
+			}
+			return FVector2D::ZeroVector;
+		};
 
-				FUsdStageInfo StageInfo( Stage );
+		bool bValidFace = true;
+		for (int32 CornerIndex = 0; CornerIndex < NumCorners; ++CornerIndex)
+		{
+			const int32 PointIndex = FaceVertexIndices[FaceCornerOffset + CornerIndex];
+			bValidFace &= PointIndex >= 0 && PointIndex < NumPoints;
+		}
+		if (!bValidFace)
+		{
+			continue;
+		}
 
-				FScopedUnrealAllocs UnrealAllocs;
-				
-				for ( pxr::GfMatrix4d& UsdMatrix : UsdInstanceTransforms )
-				{
-					FTransform InstanceTransform = UsdToUnreal::ConvertMatrix( StageInfo, UsdMatrix );
-					HISMComponent->AddInstance( InstanceTransform );
-				}
+		// Adds the poly made of these corners of the face, and drops it again if it is degenerate
+		const auto AddPoly = [&](TArrayView<const int32> PolyCorners)
+		{
+			// iLink is set once the poly is in the brush model
+			FPoly& Polygon = OutPolys.AddDefaulted_GetRef();
 
-				HISMComponent->BuildTreeIfOutdated(true, true);
+			Polygon.Init();
+			Polygon.PolyFlags = PF_DefaultFlags;
 
-				return true;
+			for (const int32 CornerIndex : PolyCorners)
+			{
+				new(Polygon.Vertices) FVector3f(UsdToUnreal::ConvertVector(StageInfo, Points[FaceVertexIndices[GetCornerIndex(CornerIndex)]]));
+			}
+
+			TexCoordsToVectors(Polygon.Vertices[0], GetCornerUV(PolyCorners[0]),
+				Polygon.Vertices[1], GetCornerUV(PolyCorners[1]),
+				Polygon.Vertices[2], GetCornerUV(PolyCorners[2]),
+				&Polygon.Base, &Polygon.TextureU, &Polygon.TextureV);
+
+			// Finalize fixes up the vertices, and fails when fewer than 3 distinct ones are left
+			if (Polygon.Finalize(nullptr, 0) != 0)
+			{
+				OutPolys.Pop(false);
+				return false;
+			}
+			return true;
+		};
+
+		// N-gons are kept whole when BSP operations can take them as they are, otherwise they are fanned into triangles
+		if (NumCorners <= FPoly::MAX_VERTICES)
+		{
+			TArray<int32, TInlineAllocator<FPoly::MAX_VERTICES>> FaceCorners;
+			for (int32 CornerIndex = 0; CornerIndex < NumCorners; ++CornerIndex)
+			{
+				FaceCorners.Add(CornerIndex);
+			}
+
+			if (AddPoly(FaceCorners))
+			{
+				if (NumCorners == 3 || (OutPolys.Last().IsCoplanar() && OutPolys.Last().IsConvex()))
+				{
+					continue;
+				}
+				OutPolys.Pop(false);
 			}
 		}
+
+		// Triangles that are still degenerate are dropped, they would corrupt the CSG operations
+		for (int32 FanCorner = 1; FanCorner < NumCorners - 1; ++FanCorner)
+		{
+			const int32 TriangleCorners[3] = { 0, FanCorner, FanCorner + 1 };
+			AddPoly(TriangleCorners);
+		}
 	}
-	
-	return false;
+
+	return true;
 }
 
-bool USDExtraToUnreal::ConvertPointInstancerPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, AInstancedFoliageActor* FoliageActor, TMap<FName, USceneComponent*> WorldContent)
+bool USDExtraToUnreal::ConvertXformPrim(const FImportPlan::FOp& Op, USceneComponent& SceneComponent)
 {
-	if (!FoliageActor || !UsdPrim)
+	if (!Op.bHasTransform)
 	{
 		return false;
 	}
 
-	FoliageActor->Modify();
-	TMap<UFoliageType*, FFoliageInfo*>  InstancesFoliageType = FoliageActor->GetAllInstancesFoliageType();
-	TArray<UFoliageType*> FoliageTypes;
-	InstancesFoliageType.GetKeys(FoliageTypes);
-	FoliageActor->RemoveFoliageType(FoliageTypes.GetData(), FoliageTypes.Num());	
-	
-	FScopedUsdAllocs UsdAllocs;
-	
-	pxr::UsdGeomPointInstancer PointInstancer( UsdPrim );
-	if ( !PointInstancer )
+	// Like UsdToUnreal::ConvertXformable, a prim resetting the transform stack keeps its transform in world space
+	if (Op.bResetTransformStack && SceneComponent.GetAttachParent())
 	{
-		return false;
+		SceneComponent.SetWorldTransform(Op.Transform);
 	}
-	
-	const pxr::UsdPrim Prototypes = UsdPrim.GetChild(pxr::TfToken("Prototypes"));
-	if (!Prototypes)
+	else
 	{
-		return false;
+		SceneComponent.SetRelativeTransform(Op.Transform);
 	}
+	SceneComponent.SetHiddenInGame(Op.bHidden);
+	SceneComponent.Modify();
 
-	TArray<TUsdStore<pxr::UsdPrim>> MeshPrototypes = UsdUtils::GetAllPrimsOfType(Prototypes, pxr::TfType::Find< pxr::UsdGeomMesh >());
+	UE_LOG(LogUsd, Log, TEXT("Convert XformPrim for %s"), *SceneComponent.GetName());
 
+	return true;
+}
 
-	for (int32 ProtoIndex = 0; ProtoIndex < MeshPrototypes.Num(); ++ProtoIndex)
+bool USDExtraToUnreal::ConvertPointInstancerPrim(const FImportPlan::FInstancer* Instancer, UHierarchicalInstancedStaticMeshComponent* HISMComponent)
+{
+	if (!HISMComponent)
 	{
-		pxr::UsdPrim MeshPrim = MeshPrototypes[ProtoIndex].Get();
-		
-		const FUSDExtraToUnrealInfo MeshInfo = GatherPrimConversionInfo(MeshPrim);
-		if (MeshInfo.AssetReference)
-		{
-			UStaticMesh* MeshAsset = Cast<UStaticMesh>(MeshInfo.AssetReference);
-			if (MeshAsset)
-			{
-				UFoliageType_InstancedStaticMesh* MeshSetting = nullptr;
-				if (MeshInfo.MaterialReference)
-				{
-					MeshSetting = NewObject<UFoliageType_InstancedStaticMesh>(GetTransientPackage());
-					MeshSetting->Mesh = MeshAsset;
-					MeshSetting->OverrideMaterials.Add(MeshInfo.MaterialReference);
-				}
-				
-				UFoliageType* NewFoliageType;
-				FFoliageInfo* NewFoliageInfo = FoliageActor->AddMesh(MeshAsset, &NewFoliageType, MeshSetting);
-				
-				pxr::VtArray< int > ProtoIndices = UsdUtils::GetUsdValue< pxr::VtArray< int > >( PointInstancer.GetProtoIndicesAttr(), 0.0f );
-				pxr::VtMatrix4dArray UsdInstanceTransforms;
-				if ( !PointInstancer.ComputeInstanceTransformsAtTime(
-					&UsdInstanceTransforms,
-					0.0f,
-					0.0f ))
-				{
-					continue;
-				}
-
-				// Deal with base components
-				pxr::VtArray<int> BaseComponentIndices = UsdUtils::GetUsdValue<pxr::VtArray<int>>(UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealBaseComponentIndices),UsdUtils::GetDefaultTimeCode());
-				pxr::UsdAttribute BaseComponentReferencesAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealBaseComponentReferences);
-				pxr::VtArray<std::string> BaseComponentReferences;
-				BaseComponentReferencesAttr.Get<pxr::VtArray<std::string>>(&BaseComponentReferences);
-				
-				TArray<UActorComponent*> BaseComponents;
-				for (std::string& BaseComponentReference : BaseComponentReferences)
-				{
-					FName ComponentPathName = FName(UsdToUnreal::ConvertString(BaseComponentReference));
-					UE_LOG(LogUsd, Error, TEXT("Base Component Path Name: %s"), *ComponentPathName.ToString());
-					
-					if (WorldContent.Find(ComponentPathName))
-					{
-						USceneComponent* SceneComponent = *WorldContent.Find(ComponentPathName);
-						BaseComponents.Add(SceneComponent);
-					}
-					else
-					{
-						BaseComponents.Add(FoliageActor->GetRootComponent());
-					}
-				}
-				
-				FUsdStageInfo StageInfo( Stage );
-
-				int32 Index = 0;
+		return false;
+	}
 
-				FScopedUnrealAllocs UnrealAllocs;
-				
-				for ( pxr::GfMatrix4d& UsdMatrix : UsdInstanceTransforms )
-				{
-					if ( ProtoIndices[ Index ] == ProtoIndex )
-					{
-						FTransform InstanceTransform = UsdToUnreal::ConvertMatrix( StageInfo, UsdMatrix );
-						FFoliageInstance FoliageInstance;
-						FoliageInstance.Location = InstanceTransform.GetLocation();
-						FoliageInstance.Rotation = InstanceTransform.GetRotation().Rotator();
-						FoliageInstance.PreAlignRotation = InstanceTransform.GetRotation().Rotator();
-						FoliageInstance.DrawScale3D = FVector3f(InstanceTransform.GetScale3D());
-
-						FVector start = FoliageInstance.Location + FVector(0, 0, 500);
-						FVector end = FoliageInstance.Location + FVector(0, 0, -500);
-
-						//FDesiredFoliageInstance* DesiredInstance = FDesiredFoliageInstance(start, end);
-						FFoliagePaintingGeometryFilter OverrideGeometryFilter;
-
-						FHitResult Hit;
-						static FName NAME_AddFoliageInstances = FName(TEXT("AddFoliageInstances"));
-						if (AInstancedFoliageActor::FoliageTrace(GWorld, Hit, FDesiredFoliageInstance(start, end, nullptr),
-							NAME_AddFoliageInstances, true, OverrideGeometryFilter))
-						{
-							float HitWeight = 1.f;
+	HISMComponent->Modify();
+	HISMComponent->ClearInstances();
 
-							UPrimitiveComponent* InstanceBase = Hit.GetComponent();
+	if (!Instancer || !Instancer->PrototypeMeshes.IsValidIndex(0) || !Instancer->PrototypeMeshes[0])
+	{
+		return false;
+	}
 
-							if (InstanceBase)
-							{
-								FoliageInstance.BaseComponent = InstanceBase;
-							}
-						}
-						else
-						{
-							FoliageInstance.BaseComponent = BaseComponents[BaseComponentIndices[Index]];
-						}
+	HISMComponent->SetStaticMesh(Instancer->PrototypeMeshes[0]);
+	if (Instancer->PrototypeMaterials[0])
+	{
+		HISMComponent->SetMaterial(0, Instancer->PrototypeMaterials[0]);
+	}
 
-						NewFoliageInfo->AddInstance(NewFoliageType, FoliageInstance);
-					}
+	HISMComponent->AddInstances(Instancer->Transforms, false);
 
-					++Index;
-				}
+	// The instances above already flagged the tree as outdated, so build it in the background instead of forcing it
+	HISMComponent->BuildTreeIfOutdated(true, false);
 
-				NewFoliageInfo->Refresh(true, false);
-			}
-		}
-	}
-	
 	return true;
 }
 
-FUSDExtraToUnrealInfo USDExtraToUnreal::GatherPrimConversionInfo(pxr::UsdPrim& UsdPrim)
+bool USDExtraToUnreal::ConvertPointInstancerPrim(const FImportPlan::FInstancer* Instancer, AInstancedFoliageActor* FoliageActor, FUSDExtraWorldContentIndex& WorldContent)
 {
-	FUSDExtraToUnrealInfo USDExtraToUnrealInfo;
+	if (!FoliageActor)
+	{
+		return false;
+	}
 
-	FScopedUsdAllocs Allocs;
+	FoliageActor->Modify();
+	TMap<UFoliageType*, FFoliageInfo*>  InstancesFoliageType = FoliageActor->GetAllInstancesFoliageType();
+	TArray<UFoliageType*> FoliageTypes;
+	InstancesFoliageType.GetKeys(FoliageTypes);
+	FoliageActor->RemoveFoliageType(FoliageTypes.GetData(), FoliageTypes.Num());
 
-	if (const pxr::UsdAttribute PrimUsageAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealPrimUsage))
+	if (!Instancer)
 	{
-		pxr::TfToken PrimUsage;
-		PrimUsageAttr.Get<pxr::TfToken>(&PrimUsage);
-		USDExtraToUnrealInfo.PrimUsage = PrimUsage == USDExtraTokensType::Actor ? EUnrealPrimUsage::Actor : EUnrealPrimUsage::Component;
+		return false;
 	}
-	
-	if (const pxr::UsdAttribute ConversionMethodAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealConversionMethod))
+
+	// Deal with base components
+	TArray<UActorComponent*> BaseComponents;
+	for (const FName& ComponentPathName : Instancer->BaseComponentReferences)
 	{
-		pxr::TfToken ConversionMethod;
-		ConversionMethodAttr.Get<pxr::TfToken>(&ConversionMethod);
-		if (ConversionMethod == USDExtraTokensType::Ignore)
+		UE_LOG(LogUsd, Error, TEXT("Base Component Path Name: %s"), *ComponentPathName.ToString());
+
+		if (USceneComponent* SceneComponent = WorldContent.Find(ComponentPathName))
 		{
-			USDExtraToUnrealInfo.ConversionMethod = EUnrealConversionMethod::Ignore;
+			BaseComponents.Add(SceneComponent);
 		}
 		else
 		{
-			USDExtraToUnrealInfo.ConversionMethod = ConversionMethod == USDExtraTokensType::Spawn ? EUnrealConversionMethod::Spawn : EUnrealConversionMethod::Modify;
+			BaseComponents.Add(FoliageActor->GetRootComponent());
 		}
 	}
-	
-	if (const pxr::UsdAttribute InstanceReferenceAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealInstanceReference))
-	{
-		std::string InstanceReference;
-		InstanceReferenceAttr.Get<std::string>(&InstanceReference);
-		USDExtraToUnrealInfo.InstanceReference = FName(UsdToUnreal::ConvertString(InstanceReference));
-	}
-	
-	if (const pxr::UsdAttribute ClassReferenceAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealClassReference))
-	{
-		std::string ClassReference;
-		ClassReferenceAttr.Get<std::string>(&ClassReference);
-		FString ClassPath = UsdToUnreal::ConvertString(ClassReference);
-		USDExtraToUnrealInfo.ClassReference = StaticLoadClass(UObject::StaticClass(),nullptr, *ClassPath);
-	}
-	
-	if (const pxr::UsdAttribute AssetReferenceAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealAssetReference))
+
+	// Partition the instances by prototype in a single pass
+	const int32 NumPrototypes = Instancer->PrototypeMeshes.Num();
+	TArray<TArray<int32>> PrototypeInstances;
+	PrototypeInstances.SetNum(NumPrototypes);
+	for (int32 Index = 0; Index < Instancer->Transforms.Num(); ++Index)
 	{
-		std::string AssetReference;
-		AssetReferenceAttr.Get<std::string>(&AssetReference);
-		FString AssetPath = UsdToUnreal::ConvertString(AssetReference);
-		if (AssetPath != "None")
+		if (PrototypeInstances.IsValidIndex(Instancer->PrototypeIndices[Index]))
 		{
-			USDExtraToUnrealInfo.AssetReference = StaticLoadObject(UObject::StaticClass(), nullptr, *AssetPath);
+			PrototypeInstances[Instancer->PrototypeIndices[Index]].Add(Index);
 		}
 	}
 
-	if (const pxr::UsdAttribute MaterialReferenceAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealMaterialReference))
+	// Create a foliage type for every prototype with a valid mesh, and lay out its instances contiguously
+	TArray<UFoliageType*> PrototypeFoliageTypes;
+	TArray<FFoliageInfo*> PrototypeFoliageInfos;
+	TArray<int32> PrototypeFirstInstance;
+	PrototypeFoliageTypes.SetNumZeroed(NumPrototypes);
+	PrototypeFoliageInfos.SetNumZeroed(NumPrototypes);
+	PrototypeFirstInstance.SetNumZeroed(NumPrototypes);
+
+	TArray<int32> InstancesToAdd;
+	for (int32 ProtoIndex = 0; ProtoIndex < NumPrototypes; ++ProtoIndex)
 	{
-		std::string MaterialReference;
-		MaterialReferenceAttr.Get<std::string>(&MaterialReference);
-		FString MaterialPath = UsdToUnreal::ConvertString(MaterialReference);
-		if (MaterialPath != "None")
+		UStaticMesh* MeshAsset = Instancer->PrototypeMeshes[ProtoIndex];
+		if (!MeshAsset)
 		{
-			USDExtraToUnrealInfo.MaterialReference = Cast<UMaterialInterface>(StaticLoadObject(UMaterialInterface::StaticClass(), nullptr, *MaterialPath));
+			continue;
 		}
-	}
-	
-	if (const pxr::UsdAttribute ActorFolderPathAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealActorFolderPath))
-	{
-		std::string ActorFolderPath;
-		ActorFolderPathAttr.Get<std::string>(&ActorFolderPath);
-		USDExtraToUnrealInfo.ActorFolderPath = FName(UsdToUnreal::ConvertString(ActorFolderPath));
+
+		UFoliageType_InstancedStaticMesh* MeshSetting = nullptr;
+		if (UMaterialInterface* Material = Instancer->PrototypeMaterials[ProtoIndex])
+		{
+			MeshSetting = NewObject<UFoliageType_InstancedStaticMesh>(GetTransientPackage());
+			MeshSetting->Mesh = MeshAsset;
+			MeshSetting->OverrideMaterials.Add(Material);
+		}
+
+		PrototypeFoliageInfos[ProtoIndex] = FoliageActor->AddMesh(MeshAsset, &PrototypeFoliageTypes[ProtoIndex], MeshSetting);
+		PrototypeFirstInstance[ProtoIndex] = InstancesToAdd.Num();
+		InstancesToAdd.Append(PrototypeInstances[ProtoIndex]);
 	}
 
-	pxr::TfToken PrimTypeName = UsdPrim.GetPrimTypeInfo().GetTypeName();
-	if (PrimTypeName == USDExtraTokensType::USDActorFolder)
+	// Trace the base components of the instances in parallel. The traces only read the world,
+	// and the results are only applied to the foliage actor afterwards.
+	TArray<FFoliageInstance> FoliageInstances;
+	FoliageInstances.SetNum(InstancesToAdd.Num());
+	UWorld* TraceWorld = GWorld;
+	const FFoliageTraceFilterFunc TraceFilter = FFoliagePaintingGeometryFilter();
+	ParallelFor(InstancesToAdd.Num(), [&](int32 InstanceIndex)
 	{
-		if (const pxr::UsdAttribute UnrealPrimUsageAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealPrimUsage))
+		const int32 Index = InstancesToAdd[InstanceIndex];
+
+		const FTransform& InstanceTransform = Instancer->Transforms[Index];
+		FFoliageInstance& FoliageInstance = FoliageInstances[InstanceIndex];
+		FoliageInstance.Location = InstanceTransform.GetLocation();
+		FoliageInstance.Rotation = InstanceTransform.GetRotation().Rotator();
+		FoliageInstance.PreAlignRotation = InstanceTransform.GetRotation().Rotator();
+		FoliageInstance.DrawScale3D = FVector3f(InstanceTransform.GetScale3D());
+
+		const FVector Start = FoliageInstance.Location + FVector(0, 0, 500);
+		const FVector End = FoliageInstance.Location + FVector(0, 0, -500);
+
+		FHitResult Hit;
+		static const FName NAME_AddFoliageInstances = FName(TEXT("AddFoliageInstances"));
+		if (AInstancedFoliageActor::FoliageTrace(TraceWorld, Hit, FDesiredFoliageInstance(Start, End, nullptr),
+			NAME_AddFoliageInstances, true, TraceFilter))
 		{
-			pxr::TfToken UnrealPrimUsage;
-			UnrealPrimUsageAttr.Get<pxr::TfToken>(&UnrealPrimUsage);
-			if (UnrealPrimUsage == USDExtraTokensType::Folder)
+			if (UPrimitiveComponent* InstanceBase = Hit.GetComponent())
 			{
-				USDExtraToUnrealInfo.PrimType = EUnrealPrimType::Folder;
+				FoliageInstance.BaseComponent = InstanceBase;
 			}
 		}
-	}
-	else if (PrimTypeName == USDExtraTokensType::USDScene)
-	{
-		USDExtraToUnrealInfo.PrimType = EUnrealPrimType::Scene;
-
-		if (USDExtraToUnrealInfo.ClassReference == UHierarchicalInstancedStaticMeshComponent::StaticClass())
+		else if (BaseComponents.IsValidIndex(Instancer->BaseComponentIndices[Index]))
 		{
-			USDExtraToUnrealInfo.PrimType = EUnrealPrimType::HISM;
+			FoliageInstance.BaseComponent = BaseComponents[Instancer->BaseComponentIndices[Index]];
 		}
-	}
-	else if (PrimTypeName == USDExtraTokensType::USDStaticMesh)
-	{
-		USDExtraToUnrealInfo.PrimType = EUnrealPrimType::StaticMesh;
+	});
 
-		if (const pxr::UsdAttribute UnrealPrimTypeAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealPrimType))
+	// Add each foliage type's instances in bulk
+	for (int32 ProtoIndex = 0; ProtoIndex < NumPrototypes; ++ProtoIndex)
+	{
+		FFoliageInfo* FoliageInfo = PrototypeFoliageInfos[ProtoIndex];
+		if (!FoliageInfo)
 		{
-			pxr::TfToken UnrealPrimType;
-			UnrealPrimTypeAttr.Get<pxr::TfToken>(&UnrealPrimType);
-			if (UnrealPrimType == USDExtraTokensType::PrimTypeBSP)
-			{
-				USDExtraToUnrealInfo.PrimType = EUnrealPrimType::BSP;
-
-				if (const pxr::UsdAttribute UnrealBSPBrushTypeAttr = UsdPrim.GetAttribute(USDExtraIdentifiers::UnrealBSPBrushType))
-				{
-					pxr::TfToken UnrealBSPBrushType;
-					UnrealBSPBrushTypeAttr.Get<pxr::TfToken>(&UnrealBSPBrushType);
-					if (UnrealBSPBrushType == USDExtraTokensType::Add)
-					{
-						USDExtraToUnrealInfo.BSPBrushType = Brush_Add;
-					}
-					else if (UnrealBSPBrushType == USDExtraTokensType::Subtract)
-					{
-						USDExtraToUnrealInfo.BSPBrushType = Brush_Subtract;
-					}
-					else if (UnrealBSPBrushType == USDExtraTokensType::Max)
-					{
-						USDExtraToUnrealInfo.BSPBrushType = Brush_MAX;
-					}
-				}
-			}
+			continue;
+		}
+
+		TArray<const FFoliageInstance*> NewInstances;
+		NewInstances.Reserve(PrototypeInstances[ProtoIndex].Num());
+		for (int32 InstanceIndex = 0; InstanceIndex < PrototypeInstances[ProtoIndex].Num(); ++InstanceIndex)
+		{
+			NewInstances.Add(&FoliageInstances[PrototypeFirstInstance[ProtoIndex] + InstanceIndex]);
 		}
+
+		FoliageInfo->AddInstances(PrototypeFoliageTypes[ProtoIndex], NewInstances);
 	}
-	else if (PrimTypeName == USDExtraTokensType::USDSkeletalMesh)
+
+	return true;
+}
+
+FUSDExtraToUnrealInfo USDExtraToUnreal::GatherPrimConversionInfo(const pxr::UsdPrim& UsdPrim, FReferenceCache* ReferenceCache)
+{
+	// Without a cache, the tables of the stage are only read for prims exported with compact references
+	FCompactReferenceTables StageTables;
+	if (!ReferenceCache && !USDExtraUtilsImpl::GetCompactData(UsdPrim).empty())
 	{
-		USDExtraToUnrealInfo.PrimType = EUnrealPrimType::SkeletalMesh;
+		StageTables.Read(UsdPrim.GetStage());
 	}
-	else if (PrimTypeName == USDExtraTokensType::USDInstancedStaticMesh)
+
+	return USDExtraUtilsImpl::ReadPrimConversionInfo(UsdPrim, ReferenceCache ? ReferenceCache->Tables : StageTables, ReferenceCache ? &ReferenceCache->Strings : nullptr, [ReferenceCache](const FString& Path, UClass* ObjectClass) -> UObject*
 	{
-		if (USDExtraToUnrealInfo.ClassReference == AInstancedFoliageActor::StaticClass())
+		if (ReferenceCache)
 		{
-			USDExtraToUnrealInfo.PrimType = EUnrealPrimType::InstancedFoliage;
+			return ReferenceCache->FindOrLoad(Path, ObjectClass);
 		}
-	}
-	
-	return USDExtraToUnrealInfo;
+		return ObjectClass == UClass::StaticClass()
+			? StaticLoadClass(UObject::StaticClass(), nullptr, *Path)
+			: StaticLoadObject(ObjectClass, nullptr, *Path);
+	});
 }
 
 bool UnrealToUSDExtra::ConvertSceneComponent(const pxr::UsdStageRefPtr& Stage, const USceneComponent* SceneComponent, pxr::UsdPrim& UsdPrim)
@@ -1391,17 +3862,9 @@ bool UnrealToUSDExtra::ConvertBrushComponent(const pxr::UsdStageRefPtr& Stage, c
 		return false;
 	}
 	
-	const FName MeshName = FName(BrushComponent->GetName() + "_StaticMesh");
-	UStaticMesh* StaticMesh = UUSDExtraUtils::CreateStaticMeshFromBrush(GetTransientPackage(), MeshName,BrushActor,BrushComponent->Brush);
-	if (StaticMesh)
+	if (BrushComponent->Brush && !ConvertBrushModel(BrushActor, BrushComponent->Brush, UsdPrim))
 	{
-		if (!UnrealToUsd::ConvertStaticMesh(StaticMesh, UsdPrim))
-		{
-			return false;
-		}
-		// Test if the mesh info generated successfully
-		// const AStaticMeshActor* MeshActor = Cast<AStaticMeshActor>(BrushComponent->GetWorld()->SpawnActor(AStaticMeshActor::StaticClass()));
-		// MeshActor->GetStaticMeshComponent()->SetStaticMesh(StaticMesh);
+		return false;
 	}
 
 	if (const pxr::UsdAttribute UnrealPrimUsageAttr = UsdPrim.CreateAttribute(USDExtraIdentifiers::UnrealPrimType, pxr::SdfValueTypeNames->Token))
@@ -1438,13 +3901,263 @@ bool UnrealToUSDExtra::ConvertBrushComponent(const pxr::UsdStageRefPtr& Stage, c
 	return true;
 }
 
+bool UnrealToUSDExtra::ConvertBrushModel(const ABrush* Brush, const UModel* Model, pxr::UsdPrim& UsdPrim)
+{
+	if (!Model || !Model->Polys)
+	{
+		return false;
+	}
+
+	{
+		FScopedUsdAllocs UsdAllocs;
+		if (!pxr::UsdGeomMesh(UsdPrim))
+		{
+			return false;
+		}
+	}
+
+	// Same space GetMeshDescriptionFromBrush puts the brush in: transformed by the actor but not translated
+	const FMatrix ActorToWorld = Brush ? Brush->ActorToWorld().ToMatrixWithScale() : FMatrix::Identity;
+	const FMatrix NormalToWorld = ActorToWorld.Inverse().GetTransposed();
+	const FVector PostSub = Brush ? Brush->GetActorLocation() : FVector::ZeroVector;
+	const FVector3f PivotOffset = Brush ? (FVector3f)Brush->GetPivotOffset() : FVector3f::ZeroVector;
+
+	const TArray<FPoly>& Polys = Model->Polys->Element;
+	const int32 NumPolys = Polys.Num();
+
+	int32 NumCorners = 0;
+	TArray<int32> PolyCornerOffsets;
+	PolyCornerOffsets.SetNumUninitialized(NumPolys);
+	for (int32 PolyIndex = 0; PolyIndex < NumPolys; ++PolyIndex)
+	{
+		PolyCornerOffsets[PolyIndex] = NumCorners;
+		NumCorners += Polys[PolyIndex].Vertices.Num() >= 3 ? Polys[PolyIndex].Vertices.Num() : 0;
+	}
+
+	// Transform every corner and evaluate its texture coordinates in parallel, the corners are stored in
+	// reverse order to match the winding of the triangles GetMeshDescriptionFromBrush produces
+	TArray<FVector3f> CornerPositions;
+	TArray<FVector2f> CornerUVs;
+	TArray<FVector3f> PolyNormals;
+	CornerPositions.SetNumUninitialized(NumCorners);
+	CornerUVs.SetNumUninitialized(NumCorners);
+	PolyNormals.SetNumUninitialized(NumPolys);
+
+	constexpr int32 MinPolysForParallelConversion = 256;
+	ParallelFor(NumPolys, [&](int32 PolyIndex)
+	{
+		const FPoly& Polygon = Polys[PolyIndex];
+		const int32 NumPolyCorners = Polygon.Vertices.Num();
+		if (NumPolyCorners < 3)
+		{
+			return;
+		}
+
+		const FVector3f TextureBase = Polygon.Base - PivotOffset;
+		const FVector3f TextureX = Polygon.TextureU / UModel::GetGlobalBSPTexelScale();
+		const FVector3f TextureY = Polygon.TextureV / UModel::GetGlobalBSPTexelScale();
+
+		for (int32 CornerIndex = 0; CornerIndex < NumPolyCorners; ++CornerIndex)
+		{
+			const FVector3f Position = FVector3f(ActorToWorld.TransformPosition((FVector)Polygon.Vertices[NumPolyCorners - 1 - CornerIndex]) - PostSub);
+			CornerPositions[PolyCornerOffsets[PolyIndex] + CornerIndex] = Position;
+			CornerUVs[PolyCornerOffsets[PolyIndex] + CornerIndex] = FVector2f((Position - TextureBase) | TextureX, (Position - TextureBase) | TextureY);
+		}
+
+		PolyNormals[PolyIndex] = FVector3f(NormalToWorld.TransformVector((FVector)Polygon.Normal).GetSafeNormal());
+	}, NumPolys < MinPolysForParallelConversion);
+
+	// Weld the corners and group the faces by material sequentially so the output stays deterministic
+	TArray<FVector3f> WeldedPositions;
+	TArray<int32> CornerPointIndices;
+	CornerPointIndices.SetNumUninitialized(NumCorners);
+	FBrushVertexWelder VertexWelder;
+
+	TArray<UMaterialInterface*> Materials;
+	TArray<TArray<int32>> MaterialFaceIndices;
+	int32 NumFaces = 0;
+
+	for (int32 PolyIndex = 0; PolyIndex < NumPolys; ++PolyIndex)
+	{
+		const FPoly& Polygon = Polys[PolyIndex];
+		const int32 NumPolyCorners = Polygon.Vertices.Num();
+		if (NumPolyCorners < 3)
+		{
+			continue;
+		}
+
+		UMaterialInterface* Material = Polygon.Material;
+		if (Material == nullptr)
+		{
+			Material = UMaterial::GetDefaultMaterial(MD_Surface);
+		}
+
+		int32 MaterialIndex = Materials.Find(Material);
+		if (MaterialIndex == INDEX_NONE)
+		{
+			MaterialIndex = Materials.Add(Material);
+			MaterialFaceIndices.AddDefaulted();
+		}
+		MaterialFaceIndices[MaterialIndex].Add(NumFaces++);
+
+		for (int32 CornerIndex = PolyCornerOffsets[PolyIndex]; CornerIndex < PolyCornerOffsets[PolyIndex] + NumPolyCorners; ++CornerIndex)
+		{
+			const FVector3f& Position = CornerPositions[CornerIndex];
+			FVertexID VertexID = VertexWelder.Find(Position, WeldedPositions);
+			if (VertexID == INDEX_NONE)
+			{
+				VertexID = FVertexID(WeldedPositions.Add(Position));
+				VertexWelder.Add(VertexID, Position);
+			}
+			CornerPointIndices[CornerIndex] = VertexID.GetValue();
+		}
+	}
+
+	using namespace pxr;
+
+	FScopedUsdAllocs UsdAllocs;
+
+	UsdGeomMesh UsdMesh{ UsdPrim };
+	const FUsdStageInfo StageInfo(UsdPrim.GetStage());
+
+	VtArray<GfVec3f> Points;
+	Points.reserve(WeldedPositions.Num());
+	for (const FVector3f& Position : WeldedPositions)
+	{
+		Points.push_back(UnrealToUsd::ConvertVector(StageInfo, FVector(Position)));
+	}
+
+	VtArray<int> FaceVertexCounts;
+	VtArray<int> FaceVertexIndices;
+	VtArray<GfVec3f> Normals;
+	VtArray<GfVec2f> UVs;
+	FaceVertexCounts.reserve(NumFaces);
+	FaceVertexIndices.reserve(NumCorners);
+	Normals.reserve(NumFaces);
+	UVs.reserve(NumCorners);
+
+	for (int32 PolyIndex = 0; PolyIndex < NumPolys; ++PolyIndex)
+	{
+		const int32 NumPolyCorners = Polys[PolyIndex].Vertices.Num();
+		if (NumPolyCorners < 3)
+		{
+			continue;
+		}
+
+		FaceVertexCounts.push_back(NumPolyCorners);
+		for (int32 CornerIndex = PolyCornerOffsets[PolyIndex]; CornerIndex < PolyCornerOffsets[PolyIndex] + NumPolyCorners; ++CornerIndex)
+		{
+			FaceVertexIndices.push_back(CornerPointIndices[CornerIndex]);
+
+			// Flip V like UnrealToUsd::ConvertStaticMesh does
+			UVs.push_back(GfVec2f(CornerUVs[CornerIndex].X, 1.f - CornerUVs[CornerIndex].Y));
+		}
+
+		Normals.push_back(UnrealToUsd::ConvertVector(StageInfo, FVector(PolyNormals[PolyIndex])).GetNormalized());
+	}
+
+	if (UsdAttribute Attr = UsdMesh.CreatePointsAttr())
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set(Points);
+	}
+
+	if (UsdAttribute Attr = UsdMesh.CreateExtentAttr())
+	{
+		VtArray<GfVec3f> Extent;
+		if (UsdGeomPointBased::ComputeExtent(Points, &Extent))
+		{
+			// ReSharper disable once CppExpressionWithoutSideEffects
+			Attr.Set(Extent);
+		}
+	}
+
+	if (UsdAttribute Attr = UsdMesh.CreateFaceVertexCountsAttr())
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set(FaceVertexCounts);
+	}
+
+	if (UsdAttribute Attr = UsdMesh.CreateFaceVertexIndicesAttr())
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set(FaceVertexIndices);
+	}
+
+	// BSP faces are always flat shaded
+	if (UsdAttribute Attr = UsdMesh.CreateNormalsAttr())
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		Attr.Set(Normals);
+		UsdMesh.SetNormalsInterpolation(UsdGeomTokens->uniform);
+	}
+
+	if (const UsdGeomPrimvar UVPrimvar = UsdGeomPrimvarsAPI(UsdPrim).CreatePrimvar(UnrealToUsd::ConvertToken(TEXT("st")).Get(), SdfValueTypeNames->TexCoord2fArray, UsdGeomTokens->faceVarying))
+	{
+		// ReSharper disable once CppExpressionWithoutSideEffects
+		UVPrimvar.Set(UVs);
+	}
+
+	// A single material is assigned on the mesh itself, several get one GeomSubset each like static mesh sections
+	if (Materials.Num() == 1)
+	{
+		if (UsdAttribute Attr = UsdPrim.CreateAttribute(USDExtraIdentifiers::UnrealMaterialReference, SdfValueTypeNames->String))
+		{
+			// ReSharper disable once CppExpressionWithoutSideEffects
+			Attr.Set(UnrealToUsd::ConvertString(*Materials[0]->GetPathName()).Get());
+		}
+	}
+	else if (Materials.Num() > 1)
+	{
+		for (int32 MaterialIndex = 0; MaterialIndex < Materials.Num(); ++MaterialIndex)
+		{
+			const VtArray<int> FaceIndices(MaterialFaceIndices[MaterialIndex].GetData(), MaterialFaceIndices[MaterialIndex].GetData() + MaterialFaceIndices[MaterialIndex].Num());
+			const TfToken SubsetName = UnrealToUsd::ConvertToken(*FString::Printf(TEXT("Section%d"), MaterialIndex)).Get();
+
+			UsdGeomSubset Subset = UsdGeomSubset::CreateGeomSubset(UsdMesh, SubsetName, UsdGeomTokens->face, FaceIndices, UsdShadeTokens->materialBind);
+			if (UsdAttribute Attr = Subset.GetPrim().CreateAttribute(USDExtraIdentifiers::UnrealMaterialReference, SdfValueTypeNames->String))
+			{
+				// ReSharper disable once CppExpressionWithoutSideEffects
+				Attr.Set(UnrealToUsd::ConvertString(*Materials[MaterialIndex]->GetPathName()).Get());
+			}
+		}
+
+		UsdGeomSubset::SetFamilyType(UsdMesh, UsdShadeTokens->materialBind, UsdGeomTokens->nonOverlapping);
+	}
+
+	return true;
+}
+
 bool UnrealToUSDExtra::ConvertHierarchicalInstancedStaticMeshComponent(const UHierarchicalInstancedStaticMeshComponent* HISMComponent, pxr::UsdPrim& UsdPrim, double TimeCode)
 {
-	if (UnrealToUsd::ConvertHierarchicalInstancedStaticMeshComponent(HISMComponent, UsdPrim, TimeCode))
+	using namespace pxr;
+
+	FScopedUsdAllocs Allocs;
+
+	UsdGeomPointInstancer PointInstancer{ UsdPrim };
+	if ( !PointInstancer || !HISMComponent )
 	{
-		return AddUSDExtraAttributesForHISMComponent(HISMComponent, UsdPrim);
+		return false;
 	}
-	return false;
+
+	FUsdStageInfo StageInfo{ UsdPrim.GetStage() };
+
+	const TArray<FInstancedStaticMeshInstanceData>& PerInstanceSMData = HISMComponent->PerInstanceSMData;
+
+	// ISM components only ever hold one mesh, so every instance uses the single prototype
+	VtArray<int> ProtoIndices( PerInstanceSMData.Num(), 0 );
+	VtArray<GfVec3f> Positions;
+	VtArray<GfQuath> Orientations;
+	VtArray<GfVec3f> Scales;
+
+	ConvertInstanceTransformsToUsd( StageInfo, PerInstanceSMData.Num(), [&PerInstanceSMData]( int32 Index )
+	{
+		return FTransform{ PerInstanceSMData[ Index ].Transform };
+	}, Positions, Orientations, Scales );
+
+	SetPointInstancerAttributes( PointInstancer, ProtoIndices, Positions, Orientations, Scales, UsdTimeCode( TimeCode ) );
+
+	return AddUSDExtraAttributesForHISMComponent(HISMComponent, UsdPrim);
 }
 
 bool UnrealToUSDExtra::ConvertInstancedFoliageActor(const AInstancedFoliageActor& Actor, pxr::UsdPrim& UsdPrim, double TimeCode)
@@ -1474,63 +4187,54 @@ bool UnrealToUSDExtra::ConvertInstancedFoliageActor(const AInstancedFoliageActor
 	VtArray<GfVec3f> Scales;
 
 	TArray<UActorComponent*> BaseComponents;
+	TMap<UActorComponent*, int32> BaseComponentToIndex;
 	BaseComponents.Add(nullptr);
+	BaseComponentToIndex.Add(nullptr, 0);
+
+	int32 NumInstances = 0;
+	for ( const TPair<UFoliageType*, TUniqueObj<FFoliageInfo>>& FoliagePair : Actor.GetFoliageInfos() )
+	{
+		for ( const TPair<FFoliageInstanceBaseId, TSet<int32>>& Pair : FoliagePair.Value.Get().ComponentHash )
+		{
+			NumInstances += Pair.Value.Num();
+		}
+	}
+
+	// Gather the instances and their prototype and base indices, the transforms are converted in parallel below
+	TArray<const FFoliageInstancePlacementInfo*> Instances;
+	Instances.Reserve( NumInstances );
+	ProtoIndices.reserve( NumInstances );
+	UnrealBaseComponentIndices.reserve( NumInstances );
 	
 	int PrototypeIndex = 0;
 	for ( const TPair<UFoliageType*, TUniqueObj<FFoliageInfo>>& FoliagePair : Actor.GetFoliageInfos() )
 	{
 		const FFoliageInfo& Info = FoliagePair.Value.Get();
 
-		//for (const TPair<FFoliageInstanceBaseId, FFoliageInstanceBaseInfo>& FoliageInstancePair : Actor.InstanceBaseCache.InstanceBaseMap)
-		
 		for ( const TPair<FFoliageInstanceBaseId, TSet<int32>>& Pair : Info.ComponentHash )
 		{
 			const FFoliageInstanceBaseId BaseId = Pair.Key;
 			const TSet<int32>& InstanceSet = Pair.Value;
-			
-			const int32 NumInstances = InstanceSet.Num();
-			ProtoIndices.reserve( ProtoIndices.size() + NumInstances );
-			Positions.reserve( Positions.size() + NumInstances );
-			Orientations.reserve( Orientations.size() + NumInstances );
-			Scales.reserve( Scales.size() + NumInstances );
-			UnrealBaseComponentIndices.reserve(UnrealBaseComponentIndices.size() + NumInstances);
 
 			int UnrealBaseComponentIndex = 0;
 			if (auto BaseInfo = Actor.InstanceBaseCache.InstanceBaseMap.Find(BaseId))
 			{
-				if (BaseComponents.Contains(BaseInfo->BasePtr.Get()))
+				UActorComponent* BaseComponent = BaseInfo->BasePtr.Get();
+				if (const int32* ExistingIndex = BaseComponentToIndex.Find(BaseComponent))
 				{
-					UnrealBaseComponentIndex = BaseComponents.IndexOfByKey(BaseInfo->BasePtr.Get());
+					UnrealBaseComponentIndex = *ExistingIndex;
 				}
 				else
 				{
-					UnrealBaseComponentIndex = BaseComponents.Add(BaseInfo->BasePtr.Get());
+					UnrealBaseComponentIndex = BaseComponents.Add(BaseComponent);
+					BaseComponentToIndex.Add(BaseComponent, UnrealBaseComponentIndex);
 				}
 			}
 			
 			for ( int32 InstanceIndex : InstanceSet )
 			{
-				const FFoliageInstancePlacementInfo* Instance = &Info.Instances[ InstanceIndex ];
-
-				// Convert axes
-				FTransform UETransform{ Instance->Rotation, FVector(Instance->Location), FVector(Instance->DrawScale3D) };
-				FTransform USDTransform = ConvertAxes( StageInfo.UpAxis == EUsdUpAxis::ZAxis, UETransform );
-
-				FVector Translation = USDTransform.GetTranslation();
-				FQuat Rotation = USDTransform.GetRotation();
-				FVector Scale = USDTransform.GetScale3D();
-
-				// Compensate metersPerUnit
-				constexpr float UEMetersPerUnit = 0.01f;
-				if ( !FMath::IsNearlyEqual( UEMetersPerUnit, StageInfo.MetersPerUnit ) )
-				{
-					Translation *= ( UEMetersPerUnit / StageInfo.MetersPerUnit );
-				}
-
+				Instances.Add( &Info.Instances[ InstanceIndex ] );
 				ProtoIndices.push_back( PrototypeIndex );
-				Positions.push_back( GfVec3f( Translation.X, Translation.Y, Translation.Z ) );
-				Orientations.push_back( GfQuath( Rotation.W, Rotation.X, Rotation.Y, Rotation.Z ) );
-				Scales.push_back( GfVec3f( Scale.X, Scale.Y, Scale.Z ) );
 				UnrealBaseComponentIndices.push_back(UnrealBaseComponentIndex);
 			}
 		}
@@ -1538,31 +4242,15 @@ bool UnrealToUSDExtra::ConvertInstancedFoliageActor(const AInstancedFoliageActor
 		++PrototypeIndex;
 	}
 
-	const pxr::UsdTimeCode UsdTimeCode( TimeCode );
-
-	if ( UsdAttribute Attr = PointInstancer.CreateProtoIndicesAttr() )
-	{
-		// ReSharper disable once CppExpressionWithoutSideEffects
-		Attr.Set( ProtoIndices, UsdTimeCode );
-	}
-
-	if ( UsdAttribute Attr = PointInstancer.CreatePositionsAttr() )
+	ConvertInstanceTransformsToUsd( StageInfo, Instances.Num(), [&Instances]( int32 Index )
 	{
-		// ReSharper disable once CppExpressionWithoutSideEffects
-		Attr.Set( Positions, UsdTimeCode );
-	}
+		const FFoliageInstancePlacementInfo* Instance = Instances[ Index ];
+		return FTransform{ Instance->Rotation, FVector(Instance->Location), FVector(Instance->DrawScale3D) };
+	}, Positions, Orientations, Scales );
 
-	if ( UsdAttribute Attr = PointInstancer.CreateOrientationsAttr() )
-	{
-		// ReSharper disable once CppExpressionWithoutSideEffects
-		Attr.Set( Orientations, UsdTimeCode );
-	}
+	const pxr::UsdTimeCode UsdTimeCode( TimeCode );
 
-	if ( UsdAttribute Attr = PointInstancer.CreateScalesAttr() )
-	{
-		// ReSharper disable once CppExpressionWithoutSideEffects
-		Attr.Set( Scales, UsdTimeCode );
-	}
+	SetPointInstancerAttributes( PointInstancer, ProtoIndices, Positions, Orientations, Scales, UsdTimeCode );
 
 	if (UsdAttribute Attr = UsdPrim.CreateAttribute(USDExtraIdentifiers::UnrealBaseComponentReferences, SdfValueTypeNames->StringArray))
 	{
@@ -1783,5 +4471,195 @@ bool UnrealToUSDExtra::AddUSDExtraAttributesForFoliageComponent(const AInstanced
 	return true;
 }
 
+int32 UnrealToUSDExtra::CompactReferences(const pxr::SdfLayerRefPtr& Layer, const pxr::SdfPath& RootPrimPath)
+{
+	using namespace USDExtraUtilsImpl;
+
+	FScopedUsdAllocs Allocs;
+
+	if (!Layer || !Layer->GetPrimAtPath(RootPrimPath))
+	{
+		return 0;
+	}
+
+	// Starts from the tables of a previous compaction of the layer, so that the ids already in it stay valid
+	pxr::VtDictionary Tables;
+	const pxr::VtValue TablesValue = Layer->GetFieldDictValueByKey(RootPrimPath, pxr::SdfFieldKeys->CustomData, USDExtraIdentifiers::UnrealReferenceTables);
+	if (TablesValue.IsHolding<pxr::VtDictionary>())
+	{
+		Tables = TablesValue.UncheckedGet<pxr::VtDictionary>();
+	}
+
+	auto GetTable = [&Tables](const char* Key)
+	{
+		const pxr::VtDictionary* Table = FindDictionaryValue<pxr::VtDictionary>(Tables, Key);
+		return Table ? *Table : pxr::VtDictionary();
+	};
+	pxr::VtDictionary ClassTable = GetTable(CompactKeys::Classes);
+	pxr::VtDictionary AssetTable = GetTable(CompactKeys::Assets);
+	pxr::VtDictionary MaterialTable = GetTable(CompactKeys::Materials);
+	pxr::VtDictionary OuterTable = GetTable(CompactKeys::Outers);
+
+	// Returns false when another path of Table already has the id of Path, which then stays in its attribute
+	auto AddToTable = [](pxr::VtDictionary& Table, const std::string& Path, int64& OutId)
+	{
+		OutId = GetCompactReferenceId(Path);
+		const std::string Key = std::to_string(OutId);
+		const pxr::VtDictionary::const_iterator It = Table.find(Key);
+		if (It == Table.end())
+		{
+			Table[Key] = pxr::VtValue(Path);
+			return true;
+		}
+		return It->second.IsHolding<std::string>() && It->second.UncheckedGet<std::string>() == Path;
+	};
+
+	// Only attributes with a single default value can be compacted, time samples would be lost
+	auto FindAttributeValue = [&Layer](const pxr::SdfPath& PrimPath, const pxr::TfToken& Name, pxr::VtValue& OutValue)
+	{
+		const pxr::SdfAttributeSpecHandle AttributeSpec = Layer->GetAttributeAtPath(PrimPath.AppendProperty(Name));
+		if (!AttributeSpec || !AttributeSpec->HasDefaultValue() || Layer->GetNumTimeSamplesForPath(AttributeSpec->GetPath()) > 0)
+		{
+			return pxr::SdfAttributeSpecHandle();
+		}
+		OutValue = AttributeSpec->GetDefaultValue();
+		return AttributeSpec;
+	};
+
+	std::vector<pxr::SdfPath> PrimPaths;
+	Layer->Traverse(RootPrimPath, [&PrimPaths](const pxr::SdfPath& Path)
+	{
+		if (Path.IsPrimPath())
+		{
+			PrimPaths.push_back(Path);
+		}
+	});
+
+	struct FReferenceField
+	{
+		const char* Key;
+		const pxr::TfToken& AttributeName;
+		pxr::VtDictionary& Table;
+	};
+	const FReferenceField ReferenceFields[] =
+	{
+		{ CompactKeys::Class, USDExtraIdentifiers::UnrealClassReference, ClassTable },
+		{ CompactKeys::Asset, USDExtraIdentifiers::UnrealAssetReference, AssetTable },
+		{ CompactKeys::Material, USDExtraIdentifiers::UnrealMaterialReference, MaterialTable },
+	};
+
+	int32 NumCompactedPrims = 0;
+
+	pxr::SdfChangeBlock ChangeBlock;
+
+	for (const pxr::SdfPath& PrimPath : PrimPaths)
+	{
+		const pxr::SdfPrimSpecHandle PrimSpec = Layer->GetPrimAtPath(PrimPath);
+		if (!PrimSpec)
+		{
+			continue;
+		}
+
+		pxr::VtDictionary CompactData;
+		const pxr::VtValue CompactValue = Layer->GetFieldDictValueByKey(PrimPath, pxr::SdfFieldKeys->CustomData, USDExtraIdentifiers::UnrealCompactReferences);
+		if (CompactValue.IsHolding<pxr::VtDictionary>())
+		{
+			CompactData = CompactValue.UncheckedGet<pxr::VtDictionary>();
+		}
+		std::vector<pxr::SdfAttributeSpecHandle> CompactedAttributes;
+
+		pxr::VtValue Value;
+		if (const pxr::SdfAttributeSpecHandle AttributeSpec = FindAttributeValue(PrimPath, USDExtraIdentifiers::UnrealPrimUsage, Value))
+		{
+			// Folders are listed from their attribute specs by GetStageFolders, so they keep them
+			if (!Value.IsHolding<pxr::TfToken>() || Value.UncheckedGet<pxr::TfToken>() == USDExtraTokensType::Folder)
+			{
+				continue;
+			}
+			CompactData[CompactKeys::Usage] = Value;
+			CompactedAttributes.push_back(AttributeSpec);
+		}
+
+		if (const pxr::SdfAttributeSpecHandle AttributeSpec = FindAttributeValue(PrimPath, USDExtraIdentifiers::UnrealConversionMethod, Value))
+		{
+			if (Value.IsHolding<pxr::TfToken>())
+			{
+				CompactData[CompactKeys::Method] = Value;
+				CompactedAttributes.push_back(AttributeSpec);
+			}
+		}
+
+		// Actor instance references are object paths, whose outer is shared by every actor of the level
+		if (const pxr::SdfAttributeSpecHandle AttributeSpec = FindAttributeValue(PrimPath, USDExtraIdentifiers::UnrealInstanceReference, Value))
+		{
+			if (Value.IsHolding<std::string>())
+			{
+				const std::string& InstanceReference = Value.UncheckedGet<std::string>();
+				const std::string::size_type OuterEnd = InstanceReference.find_last_of(".:");
+				int64 OuterId = 0;
+				if (OuterEnd != std::string::npos && AddToTable(OuterTable, InstanceReference.substr(0, OuterEnd + 1), OuterId))
+				{
+					CompactData[CompactKeys::Outer] = pxr::VtValue(OuterId);
+					CompactData[CompactKeys::Instance] = pxr::VtValue(InstanceReference.substr(OuterEnd + 1));
+				}
+				else
+				{
+					CompactData.erase(CompactKeys::Outer);
+					CompactData[CompactKeys::Instance] = Value;
+				}
+				CompactedAttributes.push_back(AttributeSpec);
+			}
+		}
+
+		for (const FReferenceField& ReferenceField : ReferenceFields)
+		{
+			const pxr::SdfAttributeSpecHandle AttributeSpec = FindAttributeValue(PrimPath, ReferenceField.AttributeName, Value);
+			if (!AttributeSpec || !Value.IsHolding<std::string>())
+			{
+				continue;
+			}
+
+			// Empty references resolve to nothing either way, they are dropped without an id
+			const std::string& Reference = Value.UncheckedGet<std::string>();
+			int64 Id = 0;
+			if (Reference.empty() || Reference == "None")
+			{
+				CompactData.erase(ReferenceField.Key);
+				CompactedAttributes.push_back(AttributeSpec);
+			}
+			else if (AddToTable(ReferenceField.Table, Reference, Id))
+			{
+				CompactData[ReferenceField.Key] = pxr::VtValue(Id);
+				CompactedAttributes.push_back(AttributeSpec);
+			}
+		}
+
+		if (CompactedAttributes.empty())
+		{
+			continue;
+		}
+
+		for (const pxr::SdfAttributeSpecHandle& AttributeSpec : CompactedAttributes)
+		{
+			PrimSpec->RemoveProperty(AttributeSpec);
+		}
+		Layer->SetFieldDictValueByKey(PrimPath, pxr::SdfFieldKeys->CustomData, USDExtraIdentifiers::UnrealCompactReferences, pxr::VtValue(CompactData));
+		++NumCompactedPrims;
+	}
+
+	if (NumCompactedPrims > 0)
+	{
+		Tables[CompactKeys::Classes] = pxr::VtValue(ClassTable);
+		Tables[CompactKeys::Assets] = pxr::VtValue(AssetTable);
+		Tables[CompactKeys::Materials] = pxr::VtValue(MaterialTable);
+		Tables[CompactKeys::Outers] = pxr::VtValue(OuterTable);
+		Layer->SetFieldDictValueByKey(RootPrimPath, pxr::SdfFieldKeys->CustomData, USDExtraIdentifiers::UnrealReferenceTables, pxr::VtValue(Tables));
+	}
+
+	UE_LOG(LogUsd, Log, TEXT("Compacted the references of %d prims in '%s'"), NumCompactedPrims, *UsdToUnreal::ConvertString(Layer->GetIdentifier()));
+
+	return NumCompactedPrims;
+}
+
 #endif
 
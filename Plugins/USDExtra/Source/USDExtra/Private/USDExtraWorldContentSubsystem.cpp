@@ -0,0 +1,284 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "USDExtraWorldContentSubsystem.h"
+
+#include "Engine/Engine.h"
+#include "Engine/Level.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "Misc/CoreDelegates.h"
+#include "UObject/UObjectGlobals.h"
+
+USceneComponent* FUSDExtraWorldContentIndex::Find(FName Path)
+{
+	if (const TWeakObjectPtr<USceneComponent>* Component = Components.Find(Path))
+	{
+		if (USceneComponent* SceneComponent = Component->Get())
+		{
+			return SceneComponent;
+		}
+	}
+
+	// Components recreated by construction scripts or reinstancing, added after their owner was indexed, or renamed
+	// without an event leave a stale key or none at all, so index the owner of whatever object lives at Path again
+	AActor* Owner = nullptr;
+	if (UObject* Object = StaticFindObject(UObject::StaticClass(), nullptr, *Path.ToString()))
+	{
+		if (AActor* Actor = Cast<AActor>(Object))
+		{
+			Owner = Actor;
+		}
+		else if (USceneComponent* SceneComponent = Cast<USceneComponent>(Object))
+		{
+			Owner = SceneComponent->GetOwner();
+		}
+	}
+
+	if (!IsValid(Owner) || !IsLevelIndexed(Owner->GetLevel()))
+	{
+		Components.Remove(Path);
+		return nullptr;
+	}
+
+	ReindexActor(Owner);
+
+	const TWeakObjectPtr<USceneComponent>* Component = Components.Find(Path);
+	return Component ? Component->Get() : nullptr;
+}
+
+void FUSDExtraWorldContentIndex::Add(FName Path, USceneComponent* Component)
+{
+	if (!Component)
+	{
+		return;
+	}
+
+	Components.Add(Path, Component);
+
+	if (AActor* Owner = Component->GetOwner())
+	{
+		ActorKeys.FindOrAdd(Owner).AddUnique(Path);
+	}
+}
+
+void FUSDExtraWorldContentIndex::AddActor(AActor* Actor)
+{
+	if (!Actor)
+	{
+		return;
+	}
+
+	TArray<FName>& Keys = ActorKeys.FindOrAdd(Actor);
+
+	TInlineComponentArray<USceneComponent*> SceneComponents(Actor);
+	for (USceneComponent* SceneComponent : SceneComponents)
+	{
+		if (Actor->GetRootComponent() == SceneComponent)
+		{
+			const FName Key = FName(Actor->GetPathName());
+			Components.Add(Key, SceneComponent);
+			Keys.AddUnique(Key);
+		}
+		const FName Key = FName(SceneComponent->GetPathName());
+		Components.Add(Key, SceneComponent);
+		Keys.AddUnique(Key);
+	}
+}
+
+void FUSDExtraWorldContentIndex::RemoveActor(AActor* Actor)
+{
+	TArray<FName> Keys;
+	if (ActorKeys.RemoveAndCopyValue(Actor, Keys))
+	{
+		for (const FName Key : Keys)
+		{
+			Components.Remove(Key);
+		}
+	}
+}
+
+void FUSDExtraWorldContentIndex::ReindexActor(AActor* Actor)
+{
+	RemoveActor(Actor);
+	AddActor(Actor);
+}
+
+void FUSDExtraWorldContentIndex::IndexLevel(ULevel* Level)
+{
+	if (!Level || IsLevelIndexed(Level))
+	{
+		return;
+	}
+
+	IndexedLevels.Add(Level);
+	for (AActor* Actor : Level->Actors)
+	{
+		AddActor(Actor);
+	}
+}
+
+void FUSDExtraWorldContentIndex::RemoveLevel(ULevel* Level)
+{
+	if (!Level || !IsLevelIndexed(Level))
+	{
+		return;
+	}
+
+	IndexedLevels.Remove(Level);
+	for (AActor* Actor : Level->Actors)
+	{
+		RemoveActor(Actor);
+	}
+}
+
+bool FUSDExtraWorldContentIndex::IsLevelIndexed(ULevel* Level) const
+{
+	return IndexedLevels.Contains(Level);
+}
+
+void UUSDExtraWorldContentSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	if (GEngine)
+	{
+		GEngine->OnLevelActorAdded().AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleActorAdded);
+		GEngine->OnLevelActorDeleted().AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleActorDeleted);
+		GEngine->OnLevelActorOuterChanged().AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleActorOuterChanged);
+	}
+	FCoreDelegates::OnActorLabelChanged.AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleActorChanged);
+	FCoreUObjectDelegates::OnObjectsReplaced.AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleObjectsReplaced);
+	FWorldDelegates::LevelRemovedFromWorld.AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleLevelRemovedFromWorld);
+	FWorldDelegates::OnWorldCleanup.AddUObject(this, &UUSDExtraWorldContentSubsystem::HandleWorldCleanup);
+}
+
+void UUSDExtraWorldContentSubsystem::Deinitialize()
+{
+	if (GEngine)
+	{
+		GEngine->OnLevelActorAdded().RemoveAll(this);
+		GEngine->OnLevelActorDeleted().RemoveAll(this);
+		GEngine->OnLevelActorOuterChanged().RemoveAll(this);
+	}
+	FCoreDelegates::OnActorLabelChanged.RemoveAll(this);
+	FCoreUObjectDelegates::OnObjectsReplaced.RemoveAll(this);
+	FWorldDelegates::LevelRemovedFromWorld.RemoveAll(this);
+	FWorldDelegates::OnWorldCleanup.RemoveAll(this);
+
+	WorldIndices.Empty();
+
+	Super::Deinitialize();
+}
+
+FUSDExtraWorldContentIndex& UUSDExtraWorldContentSubsystem::GetWorldContent(UWorld* World)
+{
+	check(World)
+
+	FUSDExtraWorldContentIndex& Index = WorldIndices.FindOrAdd(World);
+	for (ULevel* Level : World->GetLevels())
+	{
+		Index.IndexLevel(Level);
+	}
+	return Index;
+}
+
+void UUSDExtraWorldContentSubsystem::HandleActorAdded(AActor* Actor)
+{
+	if (FUSDExtraWorldContentIndex* Index = FindIndexForActor(Actor))
+	{
+		Index->AddActor(Actor);
+	}
+}
+
+void UUSDExtraWorldContentSubsystem::HandleActorDeleted(AActor* Actor)
+{
+	if (FUSDExtraWorldContentIndex* Index = FindIndexForActor(Actor))
+	{
+		Index->RemoveActor(Actor);
+	}
+}
+
+void UUSDExtraWorldContentSubsystem::HandleActorChanged(AActor* Actor)
+{
+	// Relabeling may rename the actor object, which changes every path it was indexed with
+	if (FUSDExtraWorldContentIndex* Index = FindIndexForActor(Actor))
+	{
+		Index->ReindexActor(Actor);
+	}
+}
+
+void UUSDExtraWorldContentSubsystem::HandleObjectsReplaced(const TMap<UObject*, UObject*>& ReplacementMap)
+{
+	// Blueprint recompiles and reinstancing swap actors and components for new objects with the same paths
+	TSet<AActor*> Owners;
+	for (const TPair<UObject*, UObject*>& Replacement : ReplacementMap)
+	{
+		if (AActor* Actor = Cast<AActor>(Replacement.Value))
+		{
+			Owners.Add(Actor);
+		}
+		else if (USceneComponent* SceneComponent = Cast<USceneComponent>(Replacement.Value))
+		{
+			Owners.Add(SceneComponent->GetOwner());
+		}
+	}
+
+	for (AActor* Owner : Owners)
+	{
+		if (IsValid(Owner))
+		{
+			HandleActorChanged(Owner);
+		}
+	}
+}
+
+void UUSDExtraWorldContentSubsystem::HandleActorOuterChanged(AActor* Actor, UObject* OldOuter)
+{
+	if (!Actor)
+	{
+		return;
+	}
+
+	for (TPair<TWeakObjectPtr<UWorld>, FUSDExtraWorldContentIndex>& WorldIndex : WorldIndices)
+	{
+		WorldIndex.Value.RemoveActor(Actor);
+	}
+
+	HandleActorAdded(Actor);
+}
+
+void UUSDExtraWorldContentSubsystem::HandleLevelRemovedFromWorld(ULevel* Level, UWorld* World)
+{
+	if (FUSDExtraWorldContentIndex* Index = WorldIndices.Find(World))
+	{
+		if (Level)
+		{
+			Index->RemoveLevel(Level);
+		}
+		else
+		{
+			WorldIndices.Remove(World);
+		}
+	}
+}
+
+void UUSDExtraWorldContentSubsystem::HandleWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources)
+{
+	WorldIndices.Remove(World);
+}
+
+FUSDExtraWorldContentIndex* UUSDExtraWorldContentSubsystem::FindIndexForActor(const AActor* Actor)
+{
+	if (!Actor)
+	{
+		return nullptr;
+	}
+
+	FUSDExtraWorldContentIndex* Index = WorldIndices.Find(Actor->GetWorld());
+	if (Index && Index->IsLevelIndexed(Actor->GetLevel()))
+	{
+		return Index;
+	}
+	return nullptr;
+}
@@ -27,13 +27,29 @@ private:
 	
 	FReply OnExport() const;
 
+	FReply OnLiveSync() const;
+	FText GetLiveSyncText() const;
+
 	FString GetFilePath() const;
 	void FilePathPicked(const FString& PickedPath);
 
+	/** Lists the actor folders of FilePath, so that only the checked ones get imported */
+	void RefreshFolders();
+
 private:
+	struct FFolderItem
+	{
+		FString PrimPath;
+		FString FolderPath;
+		bool bSelected = true;
+	};
+
 	FString FilePath;
 	FString FolderPath;
 
+	TArray<TSharedRef<FFolderItem>> FolderItems;
+	TSharedPtr<class SVerticalBox> FolderListBox;
+
 
 	TSharedPtr<SWidget> ToolkitWidget;
 	TSharedPtr<class IDetailsView> DetailsWidget;
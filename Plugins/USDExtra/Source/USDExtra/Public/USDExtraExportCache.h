@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UUSDExtraExportOptions;
+
+/**
+ * Manifest of the mesh assets written by previous exports, keyed by package path.
+ * Remembers the source data and export options each file was written from, so unchanged assets can reuse their file.
+ */
+class USDEXTRA_API FUSDExtraExportCache
+{
+public:
+	/** Loads the manifest stored in Directory, if there is one */
+	explicit FUSDExtraExportCache(const FString& Directory);
+
+	/** Hashes the derived data key and material slots of a static or skeletal mesh, empty if the mesh has no built data */
+	static FString HashAssetSource(const UObject* Asset);
+
+	/** Hashes every option that changes the content of exported mesh files */
+	static FString HashExportOptions(const UUSDExtraExportOptions& Options, const FString& SceneFileExtension, const FString& PayloadExtension);
+
+	/** Whether Asset was exported to File from the same source and options, and the files it wrote still exist */
+	bool IsUpToDate(const UObject* Asset, const FString& SourceHash, const FString& OptionsHash, const FString& File) const;
+
+	/** Records that Asset was exported to File, along with its payload file if it has one */
+	void Update(const UObject* Asset, const FString& SourceHash, const FString& OptionsHash, const FString& File, const FString& PayloadFile);
+
+	/** Writes the manifest back if any entry changed */
+	bool Save();
+
+private:
+	struct FEntry
+	{
+		FString SourceHash;
+		FString OptionsHash;
+		FString File;
+		FString PayloadFile;
+	};
+
+	FString ManifestPath;
+	TMap<FString, FEntry> Entries;
+	bool bDirty = false;
+};
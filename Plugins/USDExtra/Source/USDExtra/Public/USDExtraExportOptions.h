@@ -71,4 +71,16 @@ public:
 	/** Names of levels that should be ignored when collecting actors to export (e.g. "Persistent Level", "Level1", "MySubLevel", etc.) */
 	UPROPERTY(BlueprintReadWrite)
 	TSet<FString> LevelsToIgnore;
+
+	/** If the level was already exported to this file during this session, only write the actors changed since then, into a new delta sublayer */
+	UPROPERTY(BlueprintReadWrite)
+	bool bIncrementalExport = false;
+
+	/** Whether to merge the delta sublayers back into the base layer after an incremental export */
+	UPROPERTY(BlueprintReadWrite)
+	bool bSquashDeltas = false;
+
+	/** Whether to store the class, asset and material references of the exported prims as ids into tables on the root prim, instead of one path attribute each */
+	UPROPERTY(BlueprintReadWrite)
+	bool bCompactReferences = false;
 };
@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "EditorSubsystem.h"
+#include "USDExtraExportTracker.generated.h"
+
+/** Prim paths written by the last export of a level, so that later exports can update it incrementally */
+struct FUSDExtraExportRecord
+{
+	/** Every prim path taken by the export, including the deactivated prims of deleted actors */
+	TSet<FString> UsedPrimPaths;
+
+	/** Prim paths written for each actor, keyed by actor path name, with the root component first */
+	TMap<FString, TArray<FString>> ActorPrimPaths;
+
+	/** Prim path of each component, keyed by component path name */
+	TMap<FString, FString> ComponentPrimPaths;
+};
+
+/** Actors changed in a world since its last export */
+struct FUSDExtraExportChanges
+{
+	/** Added or modified actors, mapped to the path name they had before being changed */
+	TMap<AActor*, FString> DirtyActors;
+
+	/** Path names of deleted actors */
+	TSet<FString> DeletedActorPaths;
+};
+
+/**
+ * Remembers the last export of each editor world, and which of its actors were added, modified or deleted since.
+ * Worlds are only tracked once they have a record, so this costs nothing until incremental export is used.
+ */
+UCLASS()
+class USDEXTRA_API UUSDExtraExportTrackerSubsystem : public UEditorSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// USubsystem interface
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// End of USubsystem interface
+
+	/** Returns the record of the last export of World, if it was exported to RootLayerPath during this session */
+	const FUSDExtraExportRecord* FindRecord(UWorld* World, const FString& RootLayerPath) const;
+
+	/** Stores the record of an export of World and starts tracking its changes from there */
+	void SetRecord(UWorld* World, const FString& RootLayerPath, FUSDExtraExportRecord&& Record);
+
+	FUSDExtraExportChanges GetChanges(UWorld* World) const;
+
+private:
+	void HandleObjectModified(UObject* Object);
+	void HandleObjectTransacted(UObject* Object, const class FTransactionObjectEvent& Event);
+	void HandleActorAdded(AActor* Actor);
+	void HandleActorDeleted(AActor* Actor);
+	void HandleWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources);
+
+	void MarkActorDirty(AActor* Actor);
+
+private:
+	struct FWorldExport
+	{
+		FString RootLayerPath;
+		FUSDExtraExportRecord Record;
+
+		/** Path name each actor had when it was first changed, to find what the export wrote for it */
+		TMap<TWeakObjectPtr<AActor>, FString> DirtyActors;
+		TSet<FString> DeletedActorPaths;
+	};
+
+	TMap<TWeakObjectPtr<UWorld>, FWorldExport> WorldExports;
+};
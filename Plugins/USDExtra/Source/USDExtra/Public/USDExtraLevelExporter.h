@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class AActor;
+class FUSDExtraExportCache;
+struct FUSDExtraExportChanges;
+struct FUSDExtraExportRecord;
+class UUSDExtraExportOptions;
+
+/**
+ * Native version of the level export implemented by usd_extra_export_scripts.py.
+ * Collects the actors, exports the mesh assets they use and writes the component hierarchy of the level,
+ * producing the same layers as the Python pipeline without crossing into Python for every component.
+ */
+class USDEXTRA_API FUSDExtraLevelExporter
+{
+public:
+	explicit FUSDExtraLevelExporter(const UUSDExtraExportOptions& InOptions);
+	~FUSDExtraLevelExporter();
+
+	/** Collects the actors to export, following the same rules as collect_actors in the Python script */
+	const TArray<AActor*>& CollectActors();
+
+	/** Whether the export uses a feature only the Python pipeline implements, like material baking or landscapes */
+	bool RequiresPythonExport();
+
+	/**
+	 * Exports the mesh assets used by the collected actors, then the level itself.
+	 * With bIncrementalExport, a level exported before during this session only gets the changes since then, in a new delta sublayer.
+	 */
+	bool Export();
+
+private:
+	void ExportMeshes(const TArray<UObject*>& Meshes, bool bSkeletal);
+	bool ExportLevel();
+	bool ExportDelta(const FUSDExtraExportRecord& PreviousRecord, const FUSDExtraExportChanges& Changes);
+
+	/** Merges the delta sublayers written by incremental exports back into the base layer, and deletes them */
+	bool SquashDeltaLayers();
+
+	const UUSDExtraExportOptions& Options;
+
+	FString RootLayerPath;
+	FString SceneFileExtension;
+	FString PayloadFormat;
+
+	TArray<AActor*> Actors;
+	bool bActorsCollected = false;
+
+	/** Maps exported mesh assets to the file they were written to */
+	TMap<UObject*, FString> ExportedAssets;
+
+	/** Files of previous exports that unchanged mesh assets can reuse, null when the cache is disabled */
+	TUniquePtr<FUSDExtraExportCache> ExportCache;
+	FString ExportOptionsHash;
+};
@@ -0,0 +1,58 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "EditorSubsystem.h"
+#include "Tickable.h"
+#include "USDExtraLiveSync.generated.h"
+
+class FUSDExtraLiveSyncSession;
+
+/**
+ * Keeps a USD stage open on a level and applies the changes made to its layers while it is open.
+ * Layer files rewritten on disk are reloaded, and the prims named by the resulting UsdNotice::ObjectsChanged notices
+ * are converted again in one batch per editor tick, leaving the rest of the level untouched.
+ */
+UCLASS()
+class USDEXTRA_API UUSDExtraLiveSyncSubsystem : public UEditorSubsystem, public FTickableEditorObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual ~UUSDExtraLiveSyncSubsystem();
+
+	// USubsystem interface
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// End of USubsystem interface
+
+	// FTickableEditorObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual ETickableTickType GetTickableTickType() const override { return ETickableTickType::Conditional; }
+	virtual TStatId GetStatId() const override;
+	// End of FTickableEditorObject interface
+
+	/** Imports FilePath into World like UUSDExtraUtils::ImportUSDToLevel, then keeps applying its changes until StopLiveSync */
+	UFUNCTION(BlueprintCallable, Category = "USDExtra")
+	bool StartLiveSync(UWorld* World, const FString& FilePath);
+
+	UFUNCTION(BlueprintCallable, Category = "USDExtra")
+	void StopLiveSync();
+
+	UFUNCTION(BlueprintCallable, Category = "USDExtra")
+	bool IsLiveSyncing() const;
+
+private:
+	/** Reloads the layers whose file changed on disk, which queues their changes through the notice listener */
+	void ReloadChangedLayers();
+
+	/** Converts the prims changed since the last batch again, and removes what was spawned for removed prims */
+	void ApplyChanges();
+
+	void HandleWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources);
+
+private:
+	TUniquePtr<FUSDExtraLiveSyncSession> Session;
+};
@@ -32,4 +32,47 @@ public:
 
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, config)
 	TEnumAsByte<EUSDFormat> USDFormat = EUSDFormat::USDA;
+
+	/** Export levels through usd_extra_export_scripts.py instead of the native exporter */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bUsePythonExporter = false;
+
+	/** Skip exporting mesh assets whose source and export options match the cache manifest stored in the USD repository */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bUseExportCache = true;
+
+	/** Only write the actors changed since the last export of the level into a delta sublayer, when it was exported during this session */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bIncrementalExport = false;
+
+	/** Merge the delta sublayers back into the base layer after each incremental export */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay, meta = (EditCondition = "bIncrementalExport"))
+	bool bSquashExportDeltas = false;
+
+	/** Export the class, asset and material references of the prims as compact per-stage tables, which older versions of the importer can't read */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bCompactExportReferences = false;
+
+	/**
+	 * On reimport, only convert the prims that changed since the last import of the same file, and remove what was spawned for deleted prims.
+	 * Whether a prim changed is only decided from the stage, so actors moved or edited in the level since the last import are not reverted.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bIncrementalReimport = false;
+
+	/** Cache the plan compiled by full imports next to the imported file, and replay it without opening the stage while none of its layers changed */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bCacheImportPlans = true;
+
+	/** Open stages to import without loading their payloads, only the payloads of BSP prims are loaded since the other prims get their geometry from unrealAssetReference */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bDeferImportPayloads = true;
+
+	/** Read the text layers of imported stages from binary .usdc copies cached under the project's Saved folder, made the first time each version of a file is imported */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay)
+	bool bUseCrateCache = true;
+
+	/** Seconds between two checks of the layer files of a live synced stage for changes */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, config, AdvancedDisplay, meta = (ClampMin = "0.0", Units = "s"))
+	float LiveSyncPollInterval = 0.5f;
 };
@@ -0,0 +1,67 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if USE_USD_SDK
+#include "USDMemory.h"
+
+#include "USDIncludesStart.h"
+	#include "pxr/base/tf/token.h"
+#include "USDIncludesEnd.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Interns the conversions between USD strings and tokens and Unreal names, for the strings an import or export converts
+ * over and over, like component instance references, folder paths and base component references.
+ * A thread safe cache takes a read lock for lookups and a write lock for insertions, so the workers compiling an import plan can share it.
+ */
+class USDEXTRA_API FUSDExtraStringCache
+{
+public:
+	UE_NONCOPYABLE(FUSDExtraStringCache);
+
+	FUSDExtraStringCache() = default;
+	explicit FUSDExtraStringCache(bool bInThreadSafe);
+
+	/** Same as FName(UsdToUnreal::ConvertString(String)) */
+	FName ToName(const std::string& String);
+
+	/** Same as FName(UsdToUnreal::ConvertToken(Token)) */
+	FName ToName(const pxr::TfToken& Token);
+
+	/** Same as UnrealToUsd::ConvertToken(*String).Get(), case sensitive unlike FString comparisons */
+	pxr::TfToken ToToken(const FString& String);
+
+	/** Conversions answered from the cache, and the ones that had to be converted, since the cache was created or reset */
+	int64 GetNumHits() const { return NumHits.load(std::memory_order_relaxed); }
+	int64 GetNumMisses() const { return NumMisses.load(std::memory_order_relaxed); }
+
+	/** Forgets every interned string and resets the counters */
+	void Reset();
+
+private:
+	struct FCaseSensitiveKeyFuncs : BaseKeyFuncs<TPair<FString, TUsdStore<pxr::TfToken>>, FString, false>
+	{
+		static const FString& GetSetKey(const TPair<FString, TUsdStore<pxr::TfToken>>& Element) { return Element.Key; }
+		static bool Matches(const FString& A, const FString& B) { return A.Equals(B, ESearchCase::CaseSensitive); }
+		static uint32 GetKeyHash(const FString& Key) { return FCrc::StrCrc32(*Key); }
+	};
+
+	/** Allocated and freed with the USD allocator */
+	TUsdStore<std::unordered_map<std::string, FName>> StringNames;
+	TUsdStore<std::unordered_map<pxr::TfToken, FName, pxr::TfToken::HashFunctor>> TokenNames;
+
+	TMap<FString, TUsdStore<pxr::TfToken>, FDefaultSetAllocator, FCaseSensitiveKeyFuncs> StringTokens;
+
+	FRWLock Lock;
+	bool bThreadSafe = false;
+
+	std::atomic<int64> NumHits{ 0 };
+	std::atomic<int64> NumMisses{ 0 };
+};
+#endif // #if USE_USD_SDK
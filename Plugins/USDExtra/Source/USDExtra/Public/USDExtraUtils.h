@@ -2,10 +2,20 @@
 
 #include "CoreMinimal.h"
 #include "USDPrimConversion.h"
+#include "Engine/Polys.h"
+#include "USDExtraStringCache.h"
 //#include "USDPrimResolver.h"
 //#include "USDImporter.h"
 #include "USDExtraUtils.generated.h"
 
+struct FStreamableHandle;
+class FReferenceCollector;
+class FUSDExtraWorldContentIndex;
+namespace UE
+{
+	class FUsdStage;
+}
+
 
 UENUM(BlueprintType)
 enum class EUnrealPrimType : uint8
@@ -82,13 +92,76 @@ public:
 	TMap<FName, UMyActorFolder*> ChildrenFolders;
 };
 
+/** World space volume an import can be restricted to, only the actors and instances intersecting it are imported */
+struct FUSDExtraImportRegion
+{
+	enum class EShape : uint8
+	{
+		None,
+		Box,
+		Sphere
+	};
+
+	EShape Shape = EShape::None;
+	FBox Box = FBox(ForceInit);
+	FSphere Sphere = FSphere(ForceInit);
+
+	static FUSDExtraImportRegion MakeBox(const FBox& InBox)
+	{
+		FUSDExtraImportRegion Region;
+		Region.Shape = EShape::Box;
+		Region.Box = InBox;
+		return Region;
+	}
+
+	static FUSDExtraImportRegion MakeSphere(const FSphere& InSphere)
+	{
+		FUSDExtraImportRegion Region;
+		Region.Shape = EShape::Sphere;
+		Region.Sphere = InSphere;
+		return Region;
+	}
+
+	bool IsSet() const
+	{
+		return Shape != EShape::None;
+	}
+
+	bool Intersects(const FBox& Bounds) const
+	{
+		switch (Shape)
+		{
+		case EShape::Box:
+			return Box.Intersect(Bounds);
+		case EShape::Sphere:
+			return FMath::SphereAABBIntersection(Sphere, Bounds);
+		default:
+			return true;
+		}
+	}
+};
+
+/** Actor folder prim authored directly under the default prim of a USD file */
+struct FUSDExtraStageFolder
+{
+	FString PrimPath;
+	FString FolderPath;
+};
+
 UCLASS(Blueprintable)
 class USDEXTRA_API UUSDExtraUtils : public UObject
 {
 	GENERATED_BODY()
 	
 public:
-	static void ImportUSDToLevel(UWorld* World, FString FilePath);
+	/**
+	 * Imports FilePath into World, restricted to the actors and point instancer instances intersecting Region when it is set.
+	 * When PrimPaths is not empty, the stage is opened with a population mask of these prims, and nothing else is composed or imported.
+	 */
+	static void ImportUSDToLevel(UWorld* World, FString FilePath, const FUSDExtraImportRegion& Region = FUSDExtraImportRegion(), const TArray<FString>& PrimPaths = TArray<FString>());
+
+	/** Lists the actor folder prims of FilePath by reading the prim specs of its layer stack, without composing a stage */
+	static TArray<FUSDExtraStageFolder> GetStageFolders(const FString& FilePath);
 	static void ExportLevelToUSD(UWorld* World, FString FilePath);
 	static bool Test();
 
@@ -103,17 +176,22 @@ public:
 private:
 	static TArray<ULevel*> StreamInRequiredLevels( UWorld* World, const TSet<FString>& LevelsToIgnore );
 	static void StreamOutLevels( const TArray<ULevel*>& LevelsToStreamOut );
-
-	static TMap<FName, USceneComponent*> CollectWorldContent(UWorld* World);
-
 };
 
 #if USE_USD_SDK
+PXR_NAMESPACE_OPEN_SCOPE
+	class SdfLayer;
+	class SdfPath;
+	typedef TfRefPtr<SdfLayer> SdfLayerRefPtr;
+PXR_NAMESPACE_CLOSE_SCOPE
+
 namespace UnrealToUSDExtra
 {
 	bool ConvertSceneComponent(const pxr::UsdStageRefPtr& Stage, const USceneComponent* SceneComponent, pxr::UsdPrim& UsdPrim);
 	bool ConvertMeshComponent(const pxr::UsdStageRefPtr& Stage, const UMeshComponent* MeshComponent, pxr::UsdPrim& UsdPrim);
 	bool ConvertBrushComponent(const pxr::UsdStageRefPtr& Stage, const UBrushComponent* BrushComponent, pxr::UsdPrim& UsdPrim);
+	/** Writes the polys of a brush model onto a UsdGeomMesh prim, keeping n-gons whole */
+	bool ConvertBrushModel(const ABrush* Brush, const UModel* Model, pxr::UsdPrim& UsdPrim);
 	bool ConvertHierarchicalInstancedStaticMeshComponent( const UHierarchicalInstancedStaticMeshComponent* HISMComponent, pxr::UsdPrim& UsdPrim, double TimeCode = UsdUtils::GetDefaultTimeCode() );
 	bool ConvertInstancedFoliageActor( const AInstancedFoliageActor& Actor, pxr::UsdPrim& UsdPrim, double TimeCode );
 
@@ -121,21 +199,297 @@ namespace UnrealToUSDExtra
 	bool AddUSDExtraAttributesForMeshComponent(const pxr::UsdStageRefPtr& Stage, const UMeshComponent* MeshComponent, const pxr::UsdPrim& UsdPrim);
 	bool AddUSDExtraAttributesForHISMComponent(const UHierarchicalInstancedStaticMeshComponent* HISMComponent, const pxr::UsdPrim& UsdPrim);
 	bool AddUSDExtraAttributesForFoliageComponent(const AInstancedFoliageActor& FoliageActor, pxr::UsdPrim& UsdPrim);
+
+	/**
+	 * Moves the reference attributes of the prims authored in Layer into an "unreal" custom data dictionary, where class, asset
+	 * and material paths and instance outers are ids into tables stored once on the RootPrimPath prim of the layer.
+	 * Folder prims and attributes with time samples are left as they are. Returns the number of prims compacted.
+	 */
+	int32 CompactReferences(const pxr::SdfLayerRefPtr& Layer, const pxr::SdfPath& RootPrimPath);
 }
 
 namespace USDExtraToUnreal
 {
-	bool ConvertFolder(const pxr::UsdStageRefPtr& Stage, pxr::UsdPrim& UsdPrim, FUSDExtraToUnrealInfo PrimInfo, TArray<pxr::UsdPrim> &VisitedPrims, TMap<FName, USceneComponent*> &WorldContent, UWorld* World);
-	bool ConvertActor(const pxr::UsdStageRefPtr& Stage, pxr::UsdPrim& UsdPrim, FUSDExtraToUnrealInfo PrimInfo, TArray<pxr::UsdPrim> &VisitedPrims, USceneComponent* ParentComponent, TMap<FName, USceneComponent*> &WorldContent, UWorld* World);
-	bool ConvertComponent(const pxr::UsdStageRefPtr& Stage, pxr::UsdPrim& UsdPrim, FUSDExtraToUnrealInfo PrimInfo, TArray<pxr::UsdPrim> &VisitedPrims, AActor* OwnerActor, USceneComponent* ParentComponent, TMap<FName, USceneComponent*> &WorldContent, UWorld* World);
+	/**
+	 * Class, asset and material paths and instance outers of a stage exported with UnrealToUSDExtra::CompactReferences,
+	 * keyed by the ids its prims hold in their "unreal" custom data. Empty for stages exported with plain unreal* attributes.
+	 */
+	struct FCompactReferenceTables
+	{
+		TMap<int64, FString> Classes;
+		TMap<int64, FString> Assets;
+		TMap<int64, FString> Materials;
+		TMap<int64, FString> Outers;
+
+		/** Replaces the tables with the ones composed on the default prim of Stage */
+		void Read(const pxr::UsdStageRefPtr& Stage);
+	};
+
+	/** Class, asset and material references of a stage, resolved once per path and shared by every prim that uses them */
+	struct FReferenceCache
+	{
+		/** Keeps the preloaded objects alive for as long as the cache is */
+		TSharedPtr<FStreamableHandle> PreloadHandle;
+
+		TMap<FString, UObject*> Objects;
+
+		/** Compact reference tables of the stage, read by PreloadReferences */
+		FCompactReferenceTables Tables;
+
+		/** Names converted from the strings of the stage, shared by the workers compiling an import plan */
+		mutable FUSDExtraStringCache Strings{ true };
+
+		/** Returns the object loaded for Path, loading it synchronously if it was not preloaded. Pass UClass::StaticClass() to load a class */
+		UObject* FindOrLoad(const FString& Path, UClass* ObjectClass);
+
+		/** Keeps every cached object alive, for caches that outlive the import that filled them */
+		void AddReferencedObjects(FReferenceCollector& Collector);
+	};
+
+	/**
+	 * Opens FilePath for importing. With bDeferImportPayloads the stage is opened with EUsdInitialLoadSet::LoadNone,
+	 * and only the payloads picked by LoadGeometryPayloads are loaded.
+	 * A non empty PrimPaths masks the stage population to these prims and their descendants, such a stage is never cached.
+	 * With bUseCrateCache, text layers are read from binary copies cached the first time each version of a file is opened.
+	 */
+	UE::FUsdStage OpenImportStage(const FString& FilePath, bool bUseStageCache = true, const TArray<FString>& PrimPaths = TArray<FString>());
+
+	/**
+	 * Loads the payloads of the prims of Stage that the import can't do without: BSP prims, point instancers, and prims
+	 * with children authored in the layer stack of the stage, which are not composed while the payload is unloaded.
+	 * Returns the number of prims loaded.
+	 */
+	int32 LoadGeometryPayloads(const pxr::UsdStageRefPtr& Stage);
+
+	/**
+	 * Collects every distinct unrealClassReference, unrealAssetReference and unrealMaterial path on the stage, along with
+	 * the paths of its compact reference tables, and loads them in one asynchronous batch, so conversion only has to read them from OutCache.
+	 */
+	void PreloadReferences(const pxr::UsdStageRefPtr& Stage, FReferenceCache& OutCache);
+
+	/** What the children of a converted prim are imported into during the import traversal */
+	struct FImportScope
+	{
+		enum class EKind : uint8
+		{
+			Root,
+			Folder,
+			Component
+		};
+
+		EKind Kind = EKind::Root;
+		FName ActorFolderPath = NAME_None;
+		AActor* OwnerActor = nullptr;
+		USceneComponent* SceneComponent = nullptr;
+
+		/** Whether the import spawned the actor or component of this scope, rather than modifying an existing one */
+		bool bSpawned = false;
+	};
+
+	struct FImportPlan;
+
+	/**
+	 * Content hashes of the prims converted by the last import of a stage into a world, with the objects they became.
+	 * Reimports skip the prims whose hash didn't change, and delete what was spawned for prims that are gone.
+	 */
+	struct FImportFingerprints
+	{
+		struct FPrimRecord
+		{
+			uint64 Hash = 0;
+
+			/** Path name of the actor or component the prim was converted to */
+			FString ObjectPath;
+			bool bActor = false;
+			bool bSpawned = false;
+		};
+
+		/** Records of the last import */
+		TMap<FString, FPrimRecord> Previous;
+
+		/** Records of the import in progress */
+		TMap<FString, FPrimRecord> Current;
+
+		int32 NumSkippedPrims = 0;
+
+		/** Where the fingerprints of importing StageFilePath into World are saved, under the project's Saved folder */
+		static FString GetFilePath(const UWorld* World, const FString& StageFilePath);
+
+		/** Reads Previous from FilePath, returns false if there is no valid file */
+		bool Load(const FString& FilePath);
+
+		/** Writes Current to FilePath */
+		bool Save(const FString& FilePath) const;
+
+		/**
+		 * Deletes the actors and components spawned for prims of the last import that are not on the stage anymore.
+		 * Prims still on the stage that were not visited, like descendants of prims that failed to convert, keep their records,
+		 * and so do prims left out of the population mask of Stage.
+		 * Returns the number of removed prims.
+		 */
+		int32 RemoveDeletedPrims(const pxr::UsdStageRefPtr& Stage, FUSDExtraWorldContentIndex& WorldContent, UWorld* World);
+
+		/**
+		 * Same for an import replayed from an FImportPlanCache, without a stage to look the prims up on.
+		 * Prims with an op in Plan, or at or below one of its PrunedPrimPaths, are still on the stage.
+		 */
+		int32 RemoveDeletedPrims(const FImportPlan& Plan, FUSDExtraWorldContentIndex& WorldContent, UWorld* World);
+
+		/** Shared by both, IsPrimKept tells whether the record of a prim missing from Current is kept rather than deleted */
+		int32 RemoveDeletedPrims(TFunctionRef<bool(const FString& PrimPath)> IsPrimKept, FUSDExtraWorldContentIndex& WorldContent, UWorld* World);
+	};
+
+	/**
+	 * Hashes the type, activation and authored property values of UsdPrim as composed from every layer of its stage.
+	 * With bIncludeDescendants, the prims below it are hashed as well, for prims whose conversion reads their children.
+	 */
+	uint64 HashPrim(const pxr::UsdPrim& UsdPrim, bool bIncludeDescendants = false);
+
+	/**
+	 * What importing a stage does to the world, compiled from the stage by CompileImportPlan and applied by ApplyImportPlan.
+	 * Compiling reads every unreal* attribute, transform, instancer and brush of the stage and touches nothing else,
+	 * so that applying only mutates the world from the plan without reading the stage again.
+	 */
+	struct FImportPlan
+	{
+		enum class EOpType : uint8
+		{
+			/** Opens an actor folder for the ops below it */
+			Folder,
+			/** Spawns or modifies an actor, then converts its root component */
+			Actor,
+			/** Spawns or modifies a component of the actor above it */
+			Component
+		};
+
+		/** Instances of a point instancer prim, already converted and filtered to the import region */
+		struct FInstancer
+		{
+			/** Mesh and material of each prototype, in prototype order. A HISM component only uses the first one */
+			TArray<UStaticMesh*> PrototypeMeshes;
+			TArray<UMaterialInterface*> PrototypeMaterials;
+
+			TArray<FTransform> Transforms;
+			TArray<int32> PrototypeIndices;
+
+			/** Foliage only, the components instances fall back to when their trace hits nothing */
+			TArray<FName> BaseComponentReferences;
+			TArray<int32> BaseComponentIndices;
+		};
+
+		struct FOp
+		{
+			EOpType Type = EOpType::Folder;
+			FString PrimPath;
+			FString PrimName;
+
+			/** Op of the parent prim, INDEX_NONE when the prim is imported into the parent scope of the plan */
+			int32 ParentIndex = INDEX_NONE;
+
+			/** Number of ops below this one, which are skipped with it when it fails to apply */
+			int32 NumDescendants = 0;
+
+			/** References resolved from the FReferenceCache the plan was compiled with, ActorFolderPath is the one of the resulting scope */
+			FUSDExtraToUnrealInfo Info;
+
+			/** Relative transform, or world transform when the prim resets the transform stack. Only set for xformable prims */
+			FTransform Transform;
+			bool bHasTransform = false;
+			bool bResetTransformStack = false;
+			bool bHidden = false;
+
+			/** HashPrim of the prim, only computed for plans compiled for a reimport */
+			uint64 Hash = 0;
+
+			int32 InstancerIndex = INDEX_NONE;
+			int32 BrushIndex = INDEX_NONE;
+		};
+
+		/** In depth first order, every op comes after the op of its parent prim. Foliage actors come last */
+		TArray<FOp> Ops;
+		TArray<FInstancer> Instancers;
+		TArray<TArray<FPoly>> Brushes;
+
+		int32 NumVisitedPrims = 0;
+
+		/** Visited prims that got no op, and were left out along with their descendants */
+		TArray<FString> PrunedPrimPaths;
+
+		/** Whether the ops have their Hash, fingerprints are ignored when applying a plan without them */
+		bool bHasHashes = false;
+
+		/** References missing from the FReferenceCache the plan was compiled with, with the class to load them as. They are left unset in the ops */
+		TMap<FString, UClass*> UnresolvedReferences;
+
+		/** Lists the ops one per line, indented by depth, for debugging */
+		FString ToString() const;
+	};
+
+	/**
+	 * Compiles the plan of importing RootPrims and their descendants into a scope like ParentScope, only reading from the stage.
+	 * The subtrees of the actors are compiled in parallel, below the folders holding them.
+	 * References are only looked up in ReferenceCache, as filled by PreloadReferences, the ones missing from it end up in UnresolvedReferences.
+	 * With bHashPrims, each op gets the HashPrim its fingerprint is compared against. When Region is set, actors outside of it are left out.
+	 */
+	FImportPlan CompileImportPlan(const pxr::UsdStageRefPtr& Stage, const TArray<TUsdStore<pxr::UsdPrim>>& RootPrims, const FImportScope& ParentScope, const FReferenceCache& ReferenceCache, bool bHashPrims = false, const FUSDExtraImportRegion* Region = nullptr);
+
+	/**
+	 * Applies Plan to World on the game thread, importing the ops without a parent op into ParentScope.
+	 * When Fingerprints is provided, actor and component ops that didn't change since the previous import only resolve their existing objects.
+	 */
+	void ApplyImportPlan(const FImportPlan& Plan, const FImportScope& ParentScope, FUSDExtraWorldContentIndex& WorldContent, UWorld* World, FImportFingerprints* Fingerprints = nullptr);
+
+	/**
+	 * Binary sidecar of the plan compiled by the last full import of a file, with its references saved as paths.
+	 * It is keyed by the content hash of every layer the stage used, so that reimporting unchanged files replays it without opening the stage.
+	 */
+	struct FImportPlanCache
+	{
+		/** Where the plan of StageFilePath is cached, next to it: "Scene.usda" is cached in "Scene.usda.uplan" */
+		static FString GetFilePath(const FString& StageFilePath);
+
+		/**
+		 * Reads the plan cached in FilePath if none of the layers it was compiled from changed, and loads its references into OutReferenceCache.
+		 * With bNeedHashes, plans compiled without prim hashes are rejected. Returns false when there is no up to date plan.
+		 */
+		static bool Load(const FString& FilePath, bool bNeedHashes, FImportPlan& OutPlan, FReferenceCache& OutReferenceCache);
+
+		/**
+		 * Writes Plan, compiled from every prim of Stage with the references of ReferenceCache, to FilePath.
+		 * Nothing is written while a layer of Stage has unsaved changes or a reference failed to load, since the files would not reproduce the plan.
+		 */
+		static bool Save(const FString& FilePath, const pxr::UsdStageRefPtr& Stage, const FImportPlan& Plan, const FReferenceCache& ReferenceCache);
+	};
+
+	/**
+	 * Compiles and applies the plan of every prim under the default prim of Stage into World.
+	 * When OutPlan is set, the applied plan is moved into it. Returns the number of prims visited.
+	 */
+	int32 ConvertStage(const pxr::UsdStageRefPtr& Stage, FUSDExtraWorldContentIndex& WorldContent, FReferenceCache* ReferenceCache, UWorld* World, FImportFingerprints* Fingerprints = nullptr, const FUSDExtraImportRegion* Region = nullptr, FImportPlan* OutPlan = nullptr);
+
+	/**
+	 * Compiles and applies the plan of UsdPrim and its descendants as children of ParentScope.
+	 * The children of every prim that is ignored or fails to convert are pruned.
+	 * Returns the number of prims visited.
+	 */
+	int32 ConvertPrimTree(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, const FImportScope& ParentScope, FUSDExtraWorldContentIndex& WorldContent, FReferenceCache* ReferenceCache, UWorld* World, FImportFingerprints* Fingerprints = nullptr);
+
+	bool ConvertFolder(const FImportPlan::FOp& Op, FImportScope& OutScope);
+	bool ConvertActor(const FImportPlan& Plan, const FImportPlan::FOp& Op, USceneComponent* ParentComponent, FUSDExtraWorldContentIndex& WorldContent, UWorld* World, FImportScope& OutScope);
+	bool ConvertComponent(const FImportPlan& Plan, const FImportPlan::FOp& Op, const FUSDExtraToUnrealInfo& PrimInfo, AActor* OwnerActor, USceneComponent* ParentComponent, FUSDExtraWorldContentIndex& WorldContent, UWorld* World, FImportScope& OutScope);
 	
-	bool ConvertMeshPrim(FUSDExtraToUnrealInfo PrimInfo, UMeshComponent* MeshComponent);
-	bool ConvertBSPPrim(FUSDExtraToUnrealInfo PrimInfo, const pxr::UsdPrim& UsdPrim, UBrushComponent* BrushComponent);
-	bool ConvertXformPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, USceneComponent& SceneComponent, UWorld* World);
-	bool ConvertPointInstancerPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, UHierarchicalInstancedStaticMeshComponent* HISMComponent);
-	bool ConvertPointInstancerPrim(const pxr::UsdStageRefPtr& Stage, const pxr::UsdPrim& UsdPrim, AInstancedFoliageActor* FoliageActor, TMap<FName, USceneComponent*> WorldContent);
+	bool ConvertMeshPrim(const FUSDExtraToUnrealInfo& PrimInfo, UMeshComponent* MeshComponent);
+	bool ConvertBSPPrim(const FUSDExtraToUnrealInfo& PrimInfo, const TArray<FPoly>& Polys, UBrushComponent* BrushComponent);
+	/**
+	 * Reads the faces of a UsdGeomMesh prim as FPolys for a brush model. Planar convex n-gons are kept whole, other faces
+	 * are fanned into triangles, and degenerate polys are dropped. Only reads the stage
+	 */
+	bool ConvertGeomMeshToPolys(const pxr::UsdPrim& UsdPrim, TArray<FPoly>& OutPolys);
+	bool ConvertXformPrim(const FImportPlan::FOp& Op, USceneComponent& SceneComponent);
+	bool ConvertPointInstancerPrim(const FImportPlan::FInstancer* Instancer, UHierarchicalInstancedStaticMeshComponent* HISMComponent);
+	bool ConvertPointInstancerPrim(const FImportPlan::FInstancer* Instancer, AInstancedFoliageActor* FoliageActor, FUSDExtraWorldContentIndex& WorldContent);
 	
-	FUSDExtraToUnrealInfo GatherPrimConversionInfo(pxr::UsdPrim& UsdPrim);
+	FUSDExtraToUnrealInfo GatherPrimConversionInfo(const pxr::UsdPrim& UsdPrim, FReferenceCache* ReferenceCache = nullptr);
 }
 
 namespace USDExtraIdentifiers
@@ -151,6 +505,8 @@ namespace USDExtraIdentifiers
 	extern const pxr::TfToken UnrealBSPBrushType;
 	extern const pxr::TfToken UnrealBaseComponentReferences;
 	extern const pxr::TfToken UnrealBaseComponentIndices;
+	extern const pxr::TfToken UnrealCompactReferences;
+	extern const pxr::TfToken UnrealReferenceTables;
 }
 
 namespace USDExtraTokensType
@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "EditorSubsystem.h"
+#include "USDExtraWorldContentSubsystem.generated.h"
+
+/**
+ * Maps object paths of actors and scene components to the scene components they refer to.
+ * Actors are keyed by their path name and resolve to their root component, components by their own path name.
+ * Levels are indexed on first use and kept up to date afterwards, so lookups never walk the world.
+ */
+class USDEXTRA_API FUSDExtraWorldContentIndex
+{
+public:
+	/**
+	 * Returns the component indexed with Path. When the key is missing or its component has been destroyed,
+	 * the actor owning the object found at Path is indexed again, which picks up recreated, added and renamed components.
+	 */
+	USceneComponent* Find(FName Path);
+
+	/** Adds an extra key for Component, dropped together with the keys of its owner actor */
+	void Add(FName Path, USceneComponent* Component);
+
+	void AddActor(AActor* Actor);
+	void RemoveActor(AActor* Actor);
+
+	/** Drops the keys of Actor and adds it again under its current paths */
+	void ReindexActor(AActor* Actor);
+
+	/** Indexes every actor of Level, unless it has been indexed already */
+	void IndexLevel(ULevel* Level);
+	void RemoveLevel(ULevel* Level);
+	bool IsLevelIndexed(ULevel* Level) const;
+
+private:
+	TMap<FName, TWeakObjectPtr<USceneComponent>> Components;
+
+	/** Keys added for each actor, so they can be removed when the actor is deleted, renamed or moved */
+	TMap<TWeakObjectPtr<AActor>, TArray<FName>> ActorKeys;
+
+	TSet<TWeakObjectPtr<ULevel>> IndexedLevels;
+};
+
+/**
+ * Keeps a FUSDExtraWorldContentIndex for each editor world, updated from actor added, deleted, renamed, moved and replaced events.
+ */
+UCLASS()
+class USDEXTRA_API UUSDExtraWorldContentSubsystem : public UEditorSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// USubsystem interface
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// End of USubsystem interface
+
+	/** Returns the index of World with all of its loaded levels indexed */
+	FUSDExtraWorldContentIndex& GetWorldContent(UWorld* World);
+
+private:
+	void HandleActorAdded(AActor* Actor);
+	void HandleActorDeleted(AActor* Actor);
+	void HandleActorChanged(AActor* Actor);
+	void HandleActorOuterChanged(AActor* Actor, UObject* OldOuter);
+	void HandleObjectsReplaced(const TMap<UObject*, UObject*>& ReplacementMap);
+	void HandleLevelRemovedFromWorld(ULevel* Level, UWorld* World);
+	void HandleWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources);
+
+	FUSDExtraWorldContentIndex* FindIndexForActor(const AActor* Actor);
+
+private:
+	TMap<TWeakObjectPtr<UWorld>, FUSDExtraWorldContentIndex> WorldIndices;
+};
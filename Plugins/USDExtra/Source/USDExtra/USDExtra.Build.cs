@@ -44,6 +44,7 @@ public class USDExtra : ModuleRules
 				"Slate",
 				"SlateCore",
 				"InputCore",
+				"Json",
 				"UnrealEd",
 				"USDExporter",
 				"LevelEditor",				
@@ -58,6 +59,7 @@ public class USDExtra : ModuleRules
 				"Landscape",
 				"BSPUtils",
 				"EditorFramework",
+				"EditorSubsystem",
 				// ... add private dependencies that you statically link with here ...	
 			}
 			);